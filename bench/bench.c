@@ -0,0 +1,136 @@
+/*
+ * bench.c
+ *
+ * Helpers shared by the benchmark and test tools: generated workloads,
+ * loading of programs with superinstructions and closed forms, runs on SIMD
+ * lanes and JSON output.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stdlib.h>
+
+#include "affine.h"
+#include "bench.h"
+#include "fuse.h"
+#include "hash.h"
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Write a program nesting outer LOOPs over x2 around inner LOOPs over x1
+ * around an increment of x0 and a decrement of x3.
+ * ARGS     stream - destination of the program text
+ *          outer  - number of LOOPs over x2
+ *          inner  - number of LOOPs over x1
+ */
+void writeDeepNesting(FILE *stream, long outer, long inner)
+{
+    for (long i = 0; i < outer; ++i)
+        fprintf(stream, "LOOP x2 DO\n");
+    for (long i = 0; i < inner; ++i)
+        fprintf(stream, "LOOP x1 DO\n");
+    fprintf(stream, "x0 := x0 + 1;\nx3 := x3 - 1\n");
+    for (long i = 0; i < outer + inner; ++i)
+        fprintf(stream, "END\n");
+}
+
+/*
+ * Write n pseudo random assignments over the 16 variables x2 ... x17, each
+ * but the first preceded by a semicolon.
+ * ARGS     stream - destination of the program text
+ *          n      - number of statements
+ * RETURN   x2 after running the statements once on zero registers
+ */
+Value writeStraightLine(FILE *stream, long n)
+{
+    Value regs[16] = { 0 };
+    uint32_t seed = 1;
+    for (long i = 0; i < n; ++i) {
+        seed = seed * 1103515245 + 12345;
+        unsigned lvalue = (seed >> 8) % 16, rvalue = (seed >> 12) % 16, nat = (seed >> 16) % 8;
+        bool addition = (seed >> 20) % 4 != 0;
+        fprintf(stream, "%sx%u := x%u %c %u\n", i > 0 ? ";" : "", lvalue + 2, rvalue + 2,
+                addition ? '+' : '-', nat);
+        if (addition)
+            regs[lvalue] = regs[rvalue] + nat;
+        else
+            regs[lvalue] = regs[rvalue] > nat ? regs[rvalue] - nat : 0;
+    }
+    return regs[0];
+}
+
+/*
+ * Create a temporary file for a generated program, terminate on failure.
+ * RETURN   stream opened for reading and writing
+ */
+FILE *createTempFile(void)
+{
+    FILE *stream = tmpfile();
+    if (stream == NULL) {
+        perror("ERROR: failed to create temporary file");
+        exit(EXIT_FAILURE);
+    }
+    return stream;
+}
+
+/*
+ * Parse a program and attach superinstructions and closed forms to its
+ * LOOPs. The stream is closed afterwards.
+ * ARGS     stream - program text positioned at the beginning
+ *          vars   - variable table to parse with
+ *          hash   - destination of the hash of the program text
+ * RETURN   parsed program
+ */
+Program *loadProgram(FILE *stream, VariableTable *vars, uint64_t *hash)
+{
+    *hash = hashStream(HASH_SEED, stream);
+    internVariable(vars, 0);
+    Program *prog = parse(stream, vars);
+    fclose(stream);
+    analyseFusedLoops(prog, NULL);
+    analyseAffineLoops(prog);
+    return prog;
+}
+
+/*
+ * Run a program on all lanes with equal inputs.
+ * ARGS     prog   - program to be executed
+ *          inputs - values of x1, x2, ...
+ *          count  - number of inputs
+ *          vars   - variable table of the program
+ *          lanes  - lane register file
+ * RETURN   false if a value exceeded the machine word range
+ */
+bool runLanes(Program *prog, const Value *inputs, long count, const VariableTable *vars,
+        LaneFile *lanes)
+{
+    clearLaneFile(lanes);
+    for (long i = 0; i < count; ++i) {
+        long slot = lookupVariable(vars, i + 1);
+        for (long l = 0; l < lanes->width && slot >= 0; ++l)
+            lanes->regs[slot * SIMD_LANES + l] = inputs[i];
+    }
+    return executeLanes(prog, lanes);
+}
+
+/*
+ * Print a number as JSON, which has no representation of infinity.
+ * ARGS     stream - output stream
+ *          x      - number to be printed, negative for null
+ */
+void printNumber(FILE *stream, double x)
+{
+    if (x >= 0 && x < 1e300)
+        fprintf(stream, "%.6g", x);
+    else
+        fprintf(stream, "null");
+}
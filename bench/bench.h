@@ -0,0 +1,82 @@
+/*
+ * bench.h
+ *
+ * Helpers shared by the benchmark and test tools: generated workloads,
+ * loading of programs with superinstructions and closed forms, runs on SIMD
+ * lanes and JSON output.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "parser.h"
+#include "simd.h"
+#include "value.h"
+#include "var.h"
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Write a program nesting outer LOOPs over x2 around inner LOOPs over x1
+ * around an increment of x0 and a decrement of x3.
+ * ARGS     stream - destination of the program text
+ *          outer  - number of LOOPs over x2
+ *          inner  - number of LOOPs over x1
+ */
+void writeDeepNesting(FILE *stream, long outer, long inner);
+
+/*
+ * Write n pseudo random assignments over the 16 variables x2 ... x17, each
+ * but the first preceded by a semicolon. The same n always gives the same
+ * statements.
+ * ARGS     stream - destination of the program text
+ *          n      - number of statements
+ * RETURN   x2 after running the statements once on zero registers
+ */
+Value writeStraightLine(FILE *stream, long n);
+
+/*
+ * Create a temporary file for a generated program, terminate on failure.
+ * RETURN   stream opened for reading and writing
+ */
+FILE *createTempFile(void);
+
+/*
+ * Parse a program and attach superinstructions and closed forms to its
+ * LOOPs. The stream is closed afterwards.
+ * ARGS     stream - program text positioned at the beginning
+ *          vars   - variable table to parse with
+ *          hash   - destination of the hash of the program text
+ * RETURN   parsed program
+ */
+Program *loadProgram(FILE *stream, VariableTable *vars, uint64_t *hash);
+
+/*
+ * Run a program on all lanes with equal inputs.
+ * ARGS     prog   - program to be executed
+ *          inputs - values of x1, x2, ...
+ *          count  - number of inputs
+ *          vars   - variable table of the program
+ *          lanes  - lane register file
+ * RETURN   false if a value exceeded the machine word range
+ */
+bool runLanes(Program *prog, const Value *inputs, long count, const VariableTable *vars,
+        LaneFile *lanes);
+
+/*
+ * Print a number as JSON, which has no representation of infinity.
+ * ARGS     stream - output stream
+ *          x      - number to be printed, negative for null
+ */
+void printNumber(FILE *stream, double x);
+
+#endif /* BENCH_H */
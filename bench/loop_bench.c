@@ -0,0 +1,445 @@
+/*
+ * loop_bench.c
+ *
+ * Benchmark suite running a fixed corpus of LOOP programs through every
+ * execution engine. The corpus consists of the sample programs and generated
+ * workloads stressing deep nesting, long straight-line code and large
+ * register files. For every workload and engine the parse, compile and
+ * execution time, the executed statements per second and the peak resident
+ * set size are reported as JSON, so results of different builds can be
+ * compared by scripts.
+ *
+ * Statements are counted by a reference run of the tree engine iterating
+ * every LOOP, so engines applying closed forms are credited with the
+ * statements they saved. Every measurement runs in a child process of its
+ * own to attribute peak memory to it.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "engine.h"
+#include "exec.h"
+#include "parser.h"
+#include "profile.h"
+#include "simd.h"
+#include "value.h"
+#include "var.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define BENCH_FORK
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#ifndef LOOP_SAMPLES_DIR
+#define LOOP_SAMPLES_DIR "samples"
+#endif
+
+#define BENCH_REPEAT 3      // default number of timed executions
+#define MAX_INPUTS 4        // inputs per workload
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Program of the corpus together with its inputs.
+ */
+typedef struct {
+    const char *name;               // name in the report
+    const char *sample;             // file name within the samples directory
+    void (*generate)(FILE *);       // writer of generated programs
+    long inputCount;                // number of inputs
+    Value inputs[MAX_INPUTS];       // values of x1, x2, ...
+} Workload;
+
+/*
+ * Result of running one workload with one engine.
+ */
+typedef struct {
+    Engine ran;             // engine executing after fallbacks
+    double parseSeconds;    // parsing and analysis
+    double compileSeconds;  // preparing the executable
+    double execSeconds;     // fastest of all repetitions
+    bool correct;           // x0 matched the reference run
+    long peakKb;            // peak resident set size or -1 if unknown
+} Measurement;
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Write a program nesting 1000 LOOPs over x2 around 10 LOOPs over x1.
+ * ARGS     stream - destination of the program text
+ */
+static void generateDeepNesting(FILE *stream)
+{
+    writeDeepNesting(stream, 1000, 10);
+}
+
+/*
+ * Write a program repeating 200000 pseudo random assignments over 16
+ * variables x1 times.
+ * ARGS     stream - destination of the program text
+ */
+static void generateStraightLine(FILE *stream)
+{
+    fprintf(stream, "LOOP x1 DO\n");
+    writeStraightLine(stream, 200000);
+    fprintf(stream, "END;\nx0 := x2 + 0\n");
+}
+
+/*
+ * Write a program passing a value through a chain of 50000 variables x1
+ * times.
+ * ARGS     stream - destination of the program text
+ */
+static void generateManyVariables(FILE *stream)
+{
+    fprintf(stream, "LOOP x1 DO\nx3 := x0 + 1");
+    for (int i = 3; i < 50002; ++i)
+        fprintf(stream, ";\nx%d := x%d + 1", i + 1, i);
+    fprintf(stream, ";\nx0 := x50002 - 50000\nEND\n");
+}
+
+/*
+ * Fixed corpus of the benchmark, keep names stable to compare reports.
+ */
+static const Workload corpus[] = {
+    { "sample/add", "add.loop", NULL, 2, { 1000000, 1000000 } },
+    { "sample/mul", "mul.loop", NULL, 2, { 2000, 2000 } },
+    { "sample/exponentiation", "exponentiation.loop", NULL, 2, { 3, 13 } },
+    { "generated/deep_nesting", NULL, generateDeepNesting, 3, { 4, 1, 0 } },
+    { "generated/straight_line", NULL, generateStraightLine, 1, { 20 } },
+    { "generated/many_variables", NULL, generateManyVariables, 1, { 40 } },
+};
+
+/*
+ * Parse a workload and attach closed forms to its LOOPs.
+ * ARGS     work    - workload to be loaded
+ *          samples - directory of the sample programs
+ *          vars    - variable table to parse with
+ *          hash    - destination of the hash of the program text
+ * RETURN   parsed program or NULL if the sample cannot be opened
+ */
+static Program *loadWorkload(const Workload *work, const char *samples, VariableTable *vars,
+        uint64_t *hash)
+{
+    FILE *stream;
+    if (work->sample != NULL) {
+        char *path = malloc(strlen(samples) + strlen(work->sample) + 2);
+        if (path == NULL) {
+            fprintf(stderr, "ERROR: unable to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        sprintf(path, "%s/%s", samples, work->sample);
+        stream = fopen(path, "r");
+        free(path);
+        if (stream == NULL)
+            return NULL;
+    } else {
+        stream = createTempFile();
+        work->generate(stream);
+        rewind(stream);
+    }
+    return loadProgram(stream, vars, hash);
+}
+
+/*
+ * Reset the register file and store the inputs of the workload.
+ * ARGS     work - workload to take the inputs from
+ *          vars - variable table of the program
+ *          regs - register file to be initialized
+ */
+static void loadInputs(const Workload *work, const VariableTable *vars, Value *regs)
+{
+    Value inputs[MAX_INPUTS];
+    for (long i = 0; i < work->inputCount; ++i)
+        inputs[i] = work->inputs[i];
+    clearRegisters(vars, regs);
+    storeInputs(vars, regs, inputs, work->inputCount);
+}
+
+/*
+ * Run a workload once with the tree engine iterating every LOOP.
+ * ARGS     work     - workload to be run
+ *          samples  - directory of the sample programs
+ *          expected - destination of x0
+ * RETURN   number of executed statements or -1 if the workload is missing
+ */
+static long long countStatements(const Workload *work, const char *samples, Value *expected)
+{
+    uint64_t hash;
+    VariableTable *vars = createVariableTable();
+    Program *prog = loadWorkload(work, samples, vars, &hash);
+    if (prog == NULL) {
+        freeVariableTable(vars);
+        return -1;
+    }
+    
+    Profile *profile = createProfile(prog, false);
+    Value *regs = createRegisters(vars);
+    loadInputs(work, vars, regs);
+    executeProfiled(prog, regs, profile);
+    long long total = 0;
+    for (NodeIndex i = 0; i < prog->count; ++i)
+        total += (long long)profile->counts[i];
+    
+    *expected = regs[0];
+    regs[0] = 0;
+    clearRegisters(vars, regs);
+    free(regs);
+    freeProfile(profile);
+    freeProgram(prog);
+    freeVariableTable(vars);
+    return total;
+}
+
+/*
+ * Measure one workload with one engine in the current process.
+ * ARGS     work     - workload to be run
+ *          samples  - directory of the sample programs
+ *          engine   - requested engine
+ *          repeat   - number of timed executions
+ *          expected - x0 of the reference run
+ *          res      - destination of the measurement
+ */
+static void measure(const Workload *work, const char *samples, Engine engine, long repeat,
+        Value expected, Measurement *res)
+{
+    uint64_t hash;
+    VariableTable *vars = createVariableTable();
+    uint64_t start = profileClock();
+    Program *prog = loadWorkload(work, samples, vars, &hash);
+    res->parseSeconds = (profileClock() - start) / 1e9;
+    
+    Executable exe;
+    start = profileClock();
+    prepareExecutable(&exe, engine, prog, vars, hash);
+    LaneFile *lanes = exe.engine == ENGINE_SIMD ? createLaneFile(vars) : NULL;
+    res->compileSeconds = (profileClock() - start) / 1e9;
+    res->ran = exe.engine;
+    
+    // lanes exceeding a machine word are left to the tree engine, just like
+    // in batch mode
+    Value *regs = createRegisters(vars);
+    res->execSeconds = -1;
+    res->correct = true;
+    for (long r = 0; r < repeat; ++r) {
+        bool done = false;
+        Value result;
+        if (lanes != NULL) {
+            start = profileClock();
+            done = runLanes(prog, work->inputs, work->inputCount, vars, lanes);
+            result = lanes->regs[0];
+            if (!done)
+                res->ran = ENGINE_TREE;
+        }
+        if (!done) {
+            loadInputs(work, vars, regs);
+            start = profileClock();
+            runExecutable(&exe, regs);
+            result = regs[0];
+        }
+        double seconds = (profileClock() - start) / 1e9;
+        if (res->execSeconds < 0 || seconds < res->execSeconds)
+            res->execSeconds = seconds;
+        if (valueCompare(result, expected) != 0)
+            res->correct = false;
+    }
+    
+    clearRegisters(vars, regs);
+    free(regs);
+    freeLaneFile(lanes);
+    releaseExecutable(&exe);
+    freeProgram(prog);
+    freeVariableTable(vars);
+}
+
+/*
+ * Measure one workload with one engine in a child process, so the peak
+ * memory of the process belongs to this measurement alone.
+ * ARGS     work     - workload to be run
+ *          samples  - directory of the sample programs
+ *          engine   - requested engine
+ *          repeat   - number of timed executions
+ *          expected - x0 of the reference run
+ *          res      - destination of the measurement
+ * RETURN   false if the measurement crashed
+ */
+static bool measureIsolated(const Workload *work, const char *samples, Engine engine, long repeat,
+        Value expected, Measurement *res)
+{
+#ifndef BENCH_FORK
+    measure(work, samples, engine, repeat, expected, res);
+    res->peakKb = -1;
+    return true;
+#else
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("ERROR: failed to create pipe");
+        exit(EXIT_FAILURE);
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("ERROR: failed to fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        measure(work, samples, engine, repeat, expected, res);
+        bool written = write(fds[1], res, sizeof(Measurement)) == (ssize_t)sizeof(Measurement);
+        _exit(written ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    
+    close(fds[1]);
+    ssize_t n = read(fds[0], res, sizeof(Measurement));
+    close(fds[0]);
+    int status;
+    struct rusage usage;
+    while (wait4(pid, &status, 0, &usage) < 0) {
+        if (errno != EINTR) {
+            perror("ERROR: failed to wait for measurement");
+            exit(EXIT_FAILURE);
+        }
+    }
+#if defined(__APPLE__)
+    res->peakKb = usage.ru_maxrss / 1024;   // reported in bytes
+#else
+    res->peakKb = usage.ru_maxrss;          // reported in kilobytes
+#endif
+    return n == (ssize_t)sizeof(Measurement) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+}
+
+/*
+ * Main function of the benchmark suite.
+ * ARGS     argc - number of command line parameters
+ *          argv - vector of command line parameters
+ */
+int main(int argc, char *argv[])
+{
+    const char *samples = LOOP_SAMPLES_DIR;
+    const char *output = NULL;
+    long repeat = BENCH_REPEAT;
+    bool enabled[ENGINE_COUNT];
+    for (int e = 0; e < ENGINE_COUNT; ++e)
+        enabled[e] = true;
+    
+    for (int arg = 1; arg < argc; ++arg) {
+        if (strncmp(argv[arg], "--samples=", 10) == 0) {
+            samples = argv[arg] + 10;
+        } else if (strncmp(argv[arg], "--output=", 9) == 0) {
+            output = argv[arg] + 9;
+        } else if (strncmp(argv[arg], "--repeat=", 9) == 0) {
+            char *end;
+            errno = 0;
+            repeat = strtol(argv[arg] + 9, &end, 10);
+            if (errno != 0 || *end != '\0' || repeat < 1) {
+                fprintf(stderr, "ERROR: invalid number of repetitions %s\n", argv[arg] + 9);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strncmp(argv[arg], "--engines=", 10) == 0) {
+            // comma separated list of engine names
+            char *list = malloc(strlen(argv[arg] + 10) + 1);
+            if (list == NULL) {
+                fprintf(stderr, "ERROR: unable to allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+            strcpy(list, argv[arg] + 10);
+            for (int e = 0; e < ENGINE_COUNT; ++e)
+                enabled[e] = false;
+            for (char *name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+                Engine engine;
+                if (!parseEngine(name, &engine)) {
+                    fprintf(stderr, "ERROR: unknown engine %s\n", name);
+                    exit(EXIT_FAILURE);
+                }
+                enabled[engine] = true;
+            }
+            free(list);
+        } else {
+            fprintf(stderr, "Usage: loop_bench [--samples=<dir>] [--engines=<e1>,<e2>,...] "
+                    "[--repeat=<n>] [--output=<file>]\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    FILE *out = output != NULL ? fopen(output, "w") : stdout;
+    if (out == NULL) {
+        perror("ERROR: failed to open output file");
+        exit(EXIT_FAILURE);
+    }
+    
+    fprintf(out, "{\n  \"repeat\": %ld,\n  \"results\": [", repeat);
+    bool first = true;
+    for (size_t w = 0; w < sizeof(corpus) / sizeof(corpus[0]); ++w) {
+        const Workload *work = &corpus[w];
+        Value expected;
+        long long statements = countStatements(work, samples, &expected);
+        if (statements < 0) {
+            fprintf(stderr, "WARNING: skipping %s, sample not found in %s\n", work->name, samples);
+            continue;
+        }
+        
+        for (int e = 0; e < ENGINE_COUNT; ++e) {
+            if (!enabled[e])
+                continue;
+            Measurement res;
+            bool ok = measureIsolated(work, samples, (Engine)e, repeat, expected, &res);
+            fprintf(stderr, "%-26s %-5s %s\n", work->name, engineName((Engine)e), ok ? "done" : "FAILED");
+            
+            fprintf(out, "%s\n    {\"workload\": \"%s\", \"engine\": \"%s\", ", first ? "" : ",",
+                    work->name, engineName((Engine)e));
+            first = false;
+            if (!ok) {
+                fprintf(out, "\"error\": \"measurement failed\"}");
+                continue;
+            }
+            fprintf(out, "\"ran\": \"%s\", \"statements\": %lld, \"parse_seconds\": ",
+                    engineName(res.ran), statements);
+            printNumber(out, res.parseSeconds);
+            fprintf(out, ", \"compile_seconds\": ");
+            printNumber(out, res.compileSeconds);
+            fprintf(out, ", \"exec_seconds\": ");
+            printNumber(out, res.execSeconds);
+            fprintf(out, ", \"statements_per_second\": ");
+            printNumber(out, res.execSeconds > 0 ? statements / res.execSeconds : -1);
+            fprintf(out, ", \"peak_rss_kb\": ");
+            if (res.peakKb >= 0)
+                fprintf(out, "%ld", res.peakKb);
+            else
+                fprintf(out, "null");
+            fprintf(out, ", \"correct\": %s}", res.correct ? "true" : "false");
+        }
+        valueRelease(expected);
+    }
+    fprintf(out, "\n  ]\n}\n");
+    
+    if (out != stdout)
+        fclose(out);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,372 @@
+/*
+ * loop_diff.c
+ *
+ * Differential test of the execution engines on random programs of the
+ * generator (generate.h). Every program is run by the reference engine,
+ * executeProgram iterating every LOOP, and then by every enabled engine
+ * with superinstructions and closed forms, optionally after optimising.
+ * Results differing from the reference are reported with the seed that
+ * reproduces the program (loopgen --seed=<n> with the same options). The
+ * time of every engine relative to the reference is reported as JSON.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "affine.h"
+#include "bench.h"
+#include "engine.h"
+#include "exec.h"
+#include "fuse.h"
+#include "generate.h"
+#include "hash.h"
+#include "optimise.h"
+#include "parser.h"
+#include "profile.h"
+#include "simd.h"
+#include "symbolic.h"
+#include "value.h"
+#include "var.h"
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define DIFF_PROGRAMS 100   // default number of programs
+#define DIFF_REPEAT 3       // default number of timed executions
+#define DIFF_REPORTED 8     // mismatches printed with their program
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Results of one engine over all programs.
+ */
+typedef struct {
+    bool enabled;           // engine selected on the command line
+    long fallbacks;         // programs run by the tree engine instead
+    long mismatches;        // programs with a result differing from the reference
+    double seconds;         // total of the fastest executions
+    double *speedups;       // reference time over engine time of every program
+    long count;             // number of programs measured
+} EngineResult;
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Parse a generated program.
+ * ARGS     gen  - generated program
+ *          vars - variable table to parse with
+ * RETURN   parsed program without any analysis
+ */
+static Program *parseGenerated(const GeneratedProgram *gen, VariableTable *vars)
+{
+    internVariable(vars, 0);
+    SyntaxError error;
+    Program *prog = parseText(gen->text, gen->length, vars, &error);
+    if (prog == NULL) {
+        fprintf(stderr, "ERROR: generated program is malformed, ");
+        printSyntaxError(stderr, &error);
+        fputc('\n', stderr);
+        exit(EXIT_FAILURE);
+    }
+    return prog;
+}
+
+/*
+ * Time the reference engine on a generated program.
+ * ARGS     gen    - generated program
+ *          repeat - number of timed executions
+ * RETURN   fastest execution in seconds
+ */
+static double measureReference(const GeneratedProgram *gen, long repeat)
+{
+    VariableTable *vars = createVariableTable();
+    Program *prog = parseGenerated(gen, vars);
+    Value *regs = createRegisters(vars);
+    double best = -1;
+    for (long r = 0; r < repeat; ++r) {
+        clearRegisters(vars, regs);
+        storeInputs(vars, regs, gen->inputs, gen->inputCount);
+        uint64_t start = profileClock();
+        executeProgram(prog, regs, NULL);
+        double seconds = (profileClock() - start) / 1e9;
+        if (best < 0 || seconds < best)
+            best = seconds;
+    }
+    clearRegisters(vars, regs);
+    free(regs);
+    freeProgram(prog);
+    freeVariableTable(vars);
+    return best;
+}
+
+/*
+ * Time one engine on a generated program and compare its results.
+ * ARGS     gen      - generated program
+ *          engine   - requested engine
+ *          passes   - optimiser passes applied first
+ *          repeat   - number of timed executions
+ *          fallback - destination of whether the tree engine ran instead
+ *          correct  - destination of whether all results matched
+ *          got      - destination of the first differing result, to be released
+ * RETURN   fastest execution in seconds
+ */
+static double measureEngine(const GeneratedProgram *gen, Engine engine, unsigned passes, long repeat,
+        bool *fallback, bool *correct, Value *got)
+{
+    VariableTable *vars = createVariableTable();
+    Program *prog = parseGenerated(gen, vars);
+    uint64_t hash = hashBytes(HASH_SEED, gen->text, gen->length);
+    if (passes != PASSES_NONE) {
+        optimiseProgram(prog, vars, passes, NULL);
+        hash = hashBytes(hash, &passes, sizeof(passes));
+    }
+    analyseFusedLoops(prog, NULL);
+    analyseAffineLoops(prog);
+    
+    // most random programs have no closed form, they are counted as
+    // fallbacks instead of warned about one by one
+    Engine prepared = engine;
+    if (engine == ENGINE_SYMBOLIC) {
+        SymbolicFailure failure;
+        ClosedForm *form = compileClosedForm(prog, vars, &failure);
+        if (form == NULL)
+            prepared = ENGINE_TREE;
+        freeClosedForm(form);
+    }
+    Executable exe;
+    prepareExecutable(&exe, prepared, prog, vars, hash);
+    LaneFile *lanes = exe.engine == ENGINE_SIMD ? createLaneFile(vars) : NULL;
+    *fallback = exe.engine != engine;
+    *correct = true;
+    
+    // lanes exceeding a machine word are left to the tree engine, just like
+    // in batch mode
+    Value *regs = createRegisters(vars);
+    double best = -1;
+    for (long r = 0; r < repeat; ++r) {
+        bool done = false;
+        uint64_t start = profileClock();
+        Value result;
+        if (lanes != NULL) {
+            done = runLanes(prog, gen->inputs, gen->inputCount, vars, lanes);
+            result = lanes->regs[0];
+            if (!done)
+                *fallback = true;
+        }
+        if (!done) {
+            clearRegisters(vars, regs);
+            storeInputs(vars, regs, gen->inputs, gen->inputCount);
+            start = profileClock();
+            runExecutable(&exe, regs);
+            result = regs[0];
+        }
+        double seconds = (profileClock() - start) / 1e9;
+        if (best < 0 || seconds < best)
+            best = seconds;
+        if (*correct && valueCompare(result, gen->result) != 0) {
+            *got = valueRetain(result);
+            *correct = false;
+        }
+    }
+    
+    clearRegisters(vars, regs);
+    free(regs);
+    freeLaneFile(lanes);
+    releaseExecutable(&exe);
+    freeProgram(prog);
+    freeVariableTable(vars);
+    return best;
+}
+
+/*
+ * Order speedups ascending, qsort callback.
+ */
+static int compareSpeedups(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Parse a count given on the command line.
+ * ARGS     text  - digits of the count
+ *          what  - description for the error message
+ *          min   - smallest valid count
+ * RETURN   the count, invalid counts terminate the process
+ */
+static unsigned long long parseCount(const char *text, const char *what, unsigned long long min)
+{
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (errno != 0 || *end != '\0' || end == text || text[0] == '-' || value < min) {
+        fprintf(stderr, "ERROR: invalid %s %s\n", what, text);
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
+/*
+ * Main function of the differential test.
+ * ARGS     argc - number of command line parameters
+ *          argv - vector of command line parameters
+ */
+int main(int argc, char *argv[])
+{
+    GenerateOptions opts;
+    defaultGenerateOptions(&opts);
+    unsigned long long seed = 1;
+    long programs = DIFF_PROGRAMS;
+    long repeat = DIFF_REPEAT;
+    unsigned passes = PASSES_NONE;
+    const char *output = NULL;
+    EngineResult results[ENGINE_COUNT];
+    memset(results, 0, sizeof(results));
+    for (int e = 0; e < ENGINE_COUNT; ++e)
+        results[e].enabled = true;
+    
+    // generator options are kept to tell how to reproduce a program
+    char reproduce[1024] = "";
+    for (int arg = 1; arg < argc; ++arg) {
+        if (parseGenerateOption(argv[arg], &opts)) {
+            if (strlen(reproduce) + strlen(argv[arg]) + 2 < sizeof(reproduce)) {
+                strcat(reproduce, " ");
+                strcat(reproduce, argv[arg]);
+            }
+        } else if (strncmp(argv[arg], "--seed=", 7) == 0) {
+            seed = parseCount(argv[arg] + 7, "seed", 0);
+        } else if (strncmp(argv[arg], "--programs=", 11) == 0) {
+            programs = (long)parseCount(argv[arg] + 11, "number of programs", 1);
+        } else if (strncmp(argv[arg], "--repeat=", 9) == 0) {
+            repeat = (long)parseCount(argv[arg] + 9, "number of repetitions", 1);
+        } else if (strcmp(argv[arg], "--optimise") == 0) {
+            passes = PASSES_ALL;
+        } else if (strncmp(argv[arg], "--output=", 9) == 0) {
+            output = argv[arg] + 9;
+        } else if (strncmp(argv[arg], "--engines=", 10) == 0) {
+            // comma separated list of engine names
+            char *list = malloc(strlen(argv[arg] + 10) + 1);
+            if (list == NULL) {
+                fprintf(stderr, "ERROR: unable to allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+            strcpy(list, argv[arg] + 10);
+            for (int e = 0; e < ENGINE_COUNT; ++e)
+                results[e].enabled = false;
+            for (char *name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+                Engine engine;
+                if (!parseEngine(name, &engine)) {
+                    fprintf(stderr, "ERROR: unknown engine %s\n", name);
+                    exit(EXIT_FAILURE);
+                }
+                results[engine].enabled = true;
+            }
+            free(list);
+        } else {
+            fprintf(stderr, "Usage: loop_diff [--seed=<n>] [--programs=<n>] [--engines=<e1>,<e2>,...] "
+                    "[--repeat=<n>]\n"
+                    "                 [--optimise] [--output=<file>] [<loopgen options>]\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    FILE *out = output != NULL ? fopen(output, "w") : stdout;
+    if (out == NULL) {
+        perror("ERROR: failed to open output file");
+        exit(EXIT_FAILURE);
+    }
+    for (int e = 0; e < ENGINE_COUNT; ++e) {
+        results[e].speedups = malloc(programs * sizeof(double));
+        if (results[e].speedups == NULL) {
+            fprintf(stderr, "ERROR: unable to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    // program p is generated from seed + p, so every program can be
+    // reproduced on its own
+    double reference = 0;
+    long mismatches = 0;
+    for (long p = 0; p < programs; ++p) {
+        GeneratedProgram gen;
+        generateProgram(&opts, seed + p, &gen);
+        double base = measureReference(&gen, repeat);
+        reference += base;
+        for (int e = 0; e < ENGINE_COUNT; ++e) {
+            EngineResult *res = &results[e];
+            if (!res->enabled)
+                continue;
+            bool fallback, correct;
+            Value got;
+            double seconds = measureEngine(&gen, (Engine)e, passes, repeat, &fallback, &correct, &got);
+            res->seconds += seconds;
+            res->speedups[res->count++] = seconds > 0 ? base / seconds : -1;
+            res->fallbacks += fallback;
+            if (correct)
+                continue;
+            ++res->mismatches;
+            if (mismatches++ >= DIFF_REPORTED) {
+                valueRelease(got);
+                continue;
+            }
+            fprintf(stderr, "MISMATCH engine %s, reproduce with: loopgen --seed=%llu%s\n    expected ",
+                    engineName((Engine)e), seed + p, reproduce);
+            valuePrint(stderr, gen.result);
+            fprintf(stderr, "\n    got ");
+            valuePrint(stderr, got);
+            valueRelease(got);
+            fprintf(stderr, "\n    inputs");
+            for (long i = 0; i < gen.inputCount; ++i) {
+                fputc(' ', stderr);
+                valuePrint(stderr, gen.inputs[i]);
+            }
+            fprintf(stderr, "\n%s", gen.text);
+        }
+        freeGeneratedProgram(&gen);
+    }
+    
+    fprintf(out, "{\n  \"programs\": %ld,\n  \"seed\": %llu,\n  \"repeat\": %ld,\n  \"optimise\": %s,\n"
+            "  \"reference_seconds\": ", programs, seed, repeat, passes != PASSES_NONE ? "true" : "false");
+    printNumber(out, reference);
+    fprintf(out, ",\n  \"engines\": [");
+    bool first = true;
+    for (int e = 0; e < ENGINE_COUNT; ++e) {
+        EngineResult *res = &results[e];
+        if (!res->enabled)
+            continue;
+        qsort(res->speedups, res->count, sizeof(double), compareSpeedups);
+        fprintf(out, "%s\n    {\"engine\": \"%s\", \"mismatches\": %ld, \"fallbacks\": %ld, \"exec_seconds\": ",
+                first ? "" : ",", engineName((Engine)e), res->mismatches, res->fallbacks);
+        first = false;
+        printNumber(out, res->seconds);
+        fprintf(out, ", \"speedup\": ");
+        printNumber(out, res->seconds > 0 ? reference / res->seconds : -1);
+        fprintf(out, ", \"median_speedup\": ");
+        printNumber(out, res->count > 0 ? res->speedups[res->count / 2] : -1);
+        fprintf(out, "}");
+        free(res->speedups);
+    }
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout)
+        fclose(out);
+    if (mismatches > 0)
+        fprintf(stderr, "ERROR: %ld mismatches\n", mismatches);
+    exit(mismatches > 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,92 @@
+/*
+ * loop_image.c
+ *
+ * Writer of corrupted program images for testing the checks of the image
+ * loader. Parses a small program, writes it as image and overwrites one field
+ * of its first assignment with a value no writer produces. Registered with
+ * CTest together with a run of loop on the image that has to be rejected,
+ * run with: ctest -R image
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image.h"
+#include "parser.h"
+#include "var.h"
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define IMAGE_PROGRAM "x0 := x1 + 1"    // program written as image
+#define IMAGE_HEADER_NODES 40           // offset of nodesOffset in ImageHeader
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Write the image of the test program with the addition flag of its first
+ * assignment set to 2, which is no valid bool.
+ * ARGS     stream - seekable output stream opened in binary mode
+ */
+static void writeCorruptAddition(FILE *stream)
+{
+    SyntaxError error;
+    VariableTable *vars = createVariableTable();
+    internVariable(vars, 0);
+    Program *prog = parseText(IMAGE_PROGRAM, strlen(IMAGE_PROGRAM), vars, &error);
+    if (prog == NULL || !writeImage(stream, prog, vars)) {
+        fprintf(stderr, "ERROR: failed to write image\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    // the image holds the arena as laid out in memory
+    uint64_t nodes;
+    uint8_t flag = 2;
+    long offset = (long)(prog->first * sizeof(Statement) + offsetof(Statement, as.assignment.isAddition));
+    if (fseek(stream, IMAGE_HEADER_NODES, SEEK_SET) != 0 || fread(&nodes, sizeof(nodes), 1, stream) != 1
+            || fseek(stream, (long)nodes + offset, SEEK_SET) != 0 || fwrite(&flag, 1, 1, stream) != 1) {
+        perror("ERROR: failed to corrupt image");
+        exit(EXIT_FAILURE);
+    }
+    freeProgram(prog);
+    freeVariableTable(vars);
+}
+
+/*
+ * Main function of the image corrupter.
+ * ARGS     argc - number of command line parameters
+ *          argv - vector of command line parameters
+ */
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: loop_image <output file>\n");
+        exit(EXIT_FAILURE);
+    }
+    FILE *stream = fopen(argv[1], "w+b");
+    if (stream == NULL) {
+        perror("ERROR: failed to open output file");
+        exit(EXIT_FAILURE);
+    }
+    writeCorruptAddition(stream);
+    if (fclose(stream) != 0) {
+        perror("ERROR: failed to write output file");
+        exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+}
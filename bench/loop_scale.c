@@ -0,0 +1,212 @@
+/*
+ * loop_scale.c
+ *
+ * Scale test of the parser and the execution engines. Generates a program of
+ * 10 million straight-line statements and a program nesting 1 million LOOPs,
+ * runs every engine on them and checks x0 against the value known from the
+ * generator. Neither size may be limited by the call stack, so a recursion
+ * left in any part of the pipeline shows up as a crash. Registered with
+ * CTest, run with: ctest -R scale
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "engine.h"
+#include "parser.h"
+#include "simd.h"
+#include "value.h"
+#include "var.h"
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define SCALE_STATEMENTS 10000000   // default length of the straight-line program
+#define SCALE_DEPTH 1000000         // default nesting depth of the nested program
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Generated program of the scale test.
+ */
+typedef struct {
+    const char *name;                       // name given on the command line
+    Value (*generate)(FILE *, long);        // writer of the program text
+    Value input;                            // value of x1
+} Workload;
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Write a program of n pseudo random statements copying x2 to x0 at the end.
+ * ARGS     stream - destination of the program text
+ *          n      - number of statements
+ * RETURN   x0 of the program
+ */
+static Value generateStraightLine(FILE *stream, long n)
+{
+    Value result = writeStraightLine(stream, n);
+    fprintf(stream, ";\nx0 := x2 + 0\n");
+    return result;
+}
+
+/*
+ * Write a program nesting n LOOPs over x1 around an increment of x0.
+ * ARGS     stream - destination of the program text
+ *          n      - nesting depth
+ * RETURN   x0 of the program run with x1 = 1
+ */
+static Value generateDeepNesting(FILE *stream, long n)
+{
+    writeDeepNesting(stream, 0, n);
+    return 1;
+}
+
+/*
+ * Workloads of the scale test.
+ */
+static const Workload workloads[] = {
+    { "straight_line", generateStraightLine, 0 },
+    { "deep_nesting", generateDeepNesting, 1 },
+};
+
+/*
+ * Run a workload with one engine and compare x0.
+ * ARGS     work     - workload to be run
+ *          prog     - parsed program of the workload
+ *          vars     - variable table of the program
+ *          hash     - hash of the program text
+ *          engine   - requested engine
+ *          expected - x0 known from the generator
+ * RETURN   true if every run produced the expected x0
+ */
+static bool runEngine(const Workload *work, Program *prog, const VariableTable *vars, uint64_t hash,
+        Engine engine, Value expected)
+{
+    Executable exe;
+    prepareExecutable(&exe, engine, prog, vars, hash);
+    Value *regs = createRegisters(vars);
+    Value inputs[1] = { work->input };
+    clearRegisters(vars, regs);
+    storeInputs(vars, regs, inputs, 1);
+    runExecutable(&exe, regs);
+    bool correct = valueCompare(regs[0], expected) == 0;
+    
+    // the lane engine only runs batches on its own
+    if (exe.engine == ENGINE_SIMD) {
+        LaneFile *lanes = createLaneFile(vars);
+        if (runLanes(prog, inputs, 1, vars, lanes)) {
+            for (long l = 0; l < lanes->width; ++l)
+                correct = correct && valueCompare(lanes->regs[l], expected) == 0;
+        }
+        freeLaneFile(lanes);
+    }
+    
+    clearRegisters(vars, regs);
+    free(regs);
+    releaseExecutable(&exe);
+    return correct;
+}
+
+/*
+ * Main function of the scale test.
+ * ARGS     argc - number of command line parameters
+ *          argv - vector of command line parameters
+ */
+int main(int argc, char *argv[])
+{
+    const Workload *work = NULL;
+    long size = -1;
+    bool enabled[ENGINE_COUNT];
+    for (int e = 0; e < ENGINE_COUNT; ++e)
+        enabled[e] = true;
+    
+    for (int arg = 1; arg < argc; ++arg) {
+        if (strncmp(argv[arg], "--workload=", 11) == 0) {
+            for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); ++w) {
+                if (strcmp(argv[arg] + 11, workloads[w].name) == 0)
+                    work = &workloads[w];
+            }
+            if (work == NULL) {
+                fprintf(stderr, "ERROR: unknown workload %s\n", argv[arg] + 11);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strncmp(argv[arg], "--size=", 7) == 0) {
+            char *end;
+            errno = 0;
+            size = strtol(argv[arg] + 7, &end, 10);
+            if (errno != 0 || *end != '\0' || size < 1) {
+                fprintf(stderr, "ERROR: invalid size %s\n", argv[arg] + 7);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strncmp(argv[arg], "--engines=", 10) == 0) {
+            // comma separated list of engine names
+            char *list = malloc(strlen(argv[arg] + 10) + 1);
+            if (list == NULL) {
+                fprintf(stderr, "ERROR: unable to allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+            strcpy(list, argv[arg] + 10);
+            for (int e = 0; e < ENGINE_COUNT; ++e)
+                enabled[e] = false;
+            for (char *name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+                Engine engine;
+                if (!parseEngine(name, &engine)) {
+                    fprintf(stderr, "ERROR: unknown engine %s\n", name);
+                    exit(EXIT_FAILURE);
+                }
+                enabled[engine] = true;
+            }
+            free(list);
+        } else {
+            work = NULL;
+            break;
+        }
+    }
+    if (work == NULL) {
+        fprintf(stderr, "Usage: loop_scale --workload=straight_line|deep_nesting [--size=<n>] "
+                "[--engines=<e1>,<e2>,...]\n");
+        exit(EXIT_FAILURE);
+    }
+    if (size < 0)
+        size = work->generate == generateStraightLine ? SCALE_STATEMENTS : SCALE_DEPTH;
+    
+    uint64_t hash;
+    FILE *stream = createTempFile();
+    Value expected = work->generate(stream, size);
+    rewind(stream);
+    VariableTable *vars = createVariableTable();
+    Program *prog = loadProgram(stream, vars, &hash);
+    bool passed = true;
+    for (int e = 0; e < ENGINE_COUNT; ++e) {
+        if (!enabled[e])
+            continue;
+        bool correct = runEngine(work, prog, vars, hash, (Engine)e, expected);
+        fprintf(stderr, "%s %ld %-8s %s\n", work->name, size, engineName((Engine)e),
+                correct ? "passed" : "FAILED");
+        passed = passed && correct;
+    }
+    
+    freeProgram(prog);
+    freeVariableTable(vars);
+    exit(passed ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,90 @@
+/*
+ * loopgen.c
+ *
+ * Command line front end of the program generator (generate.h). Writes one
+ * random LOOP program to stdout or a file and the inputs it was checked with
+ * to stderr as a single line, ready to be passed to loop:
+ *
+ *     loopgen --seed=7 > p.loop 2> inputs && loop p.loop $(cat inputs)
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "generate.h"
+#include "value.h"
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Main function of the generator.
+ * ARGS     argc - number of command line parameters
+ *          argv - vector of command line parameters
+ */
+int main(int argc, char *argv[])
+{
+    GenerateOptions opts;
+    defaultGenerateOptions(&opts);
+    unsigned long long seed = 1;
+    const char *output = NULL;
+    bool quiet = false;
+    
+    for (int arg = 1; arg < argc; ++arg) {
+        if (parseGenerateOption(argv[arg], &opts))
+            continue;
+        if (strncmp(argv[arg], "--seed=", 7) == 0) {
+            char *end;
+            errno = 0;
+            seed = strtoull(argv[arg] + 7, &end, 10);
+            if (errno != 0 || *end != '\0' || end == argv[arg] + 7 || argv[arg][7] == '-') {
+                fprintf(stderr, "ERROR: invalid seed %s\n", argv[arg] + 7);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strncmp(argv[arg], "--output=", 9) == 0) {
+            output = argv[arg] + 9;
+        } else if (strcmp(argv[arg], "--quiet") == 0) {
+            quiet = true;
+        } else {
+            fprintf(stderr, "Usage: loopgen [--seed=<n>] [--depth=<n>] [--statements=<n>] [--variables=<n>]\n"
+                    "               [--inputs=<n>] [--max-input=<n>] [--cost=<iterations>] [--macros=<n>]\n"
+                    "               [--output=<file>] [--quiet]\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    GeneratedProgram gen;
+    generateProgram(&opts, seed, &gen);
+    FILE *out = output != NULL ? fopen(output, "w") : stdout;
+    if (out == NULL) {
+        perror("ERROR: failed to open output file");
+        exit(EXIT_FAILURE);
+    }
+    if (fwrite(gen.text, 1, gen.length, out) != gen.length || (out != stdout && fclose(out) != 0)) {
+        perror("ERROR: failed to write program");
+        exit(EXIT_FAILURE);
+    }
+    
+    // the inputs are followed by nothing else, so the line can be passed on
+    if (!quiet) {
+        for (long i = 0; i < gen.inputCount; ++i) {
+            if (i > 0)
+                fputc(' ', stderr);
+            valuePrint(stderr, gen.inputs[i]);
+        }
+        fputc('\n', stderr);
+    }
+    freeGeneratedProgram(&gen);
+    exit(EXIT_SUCCESS);
+}
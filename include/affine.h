@@ -0,0 +1,86 @@
+/*
+ * affine.h
+ *
+ * Closed-form acceleration of LOOPs whose body is an affine transformation of
+ * the variables. A body qualifies if it contains additions, copies (a
+ * subtraction of zero) and nested LOOPs only, and if no variable controlling
+ * a nested LOOP is written inside the body. Then every iteration applies the
+ * same affine map, which is raised to the power of the LOOP limit by repeated
+ * squaring instead of iterating. LOOPs that only increment or reset variables
+ * are multiplied out directly.
+ *
+ * Since an assignment copies exactly one variable, every row of the matrix
+ * has at most one non-zero entry, which is always one. The map is therefore
+ * stored as a source variable (or none) plus an offset per variable.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef AFFINE_H
+#define AFFINE_H
+
+#include "parser.h"
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define AFFINE_MIN_LIMIT 8      // smallest LOOP limit worth being accelerated
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Operation of a summarised LOOP body. Operands are indices into the list of
+ * variables touched by the LOOP, not register slots.
+ */
+typedef struct {
+    bool isLoop;    // nested LOOP over variable a or assignment
+    long a;         // assigned variable or LOOP variable
+    long b;         // copied variable (assignment only)
+    NatNum nat;     // added constant (assignment only)
+    long length;    // number of operations of the nested body (LOOP only)
+} AffineOp;
+
+/*
+ * Summary of a LOOP body that is an affine transformation.
+ */
+typedef struct sAffineLoop {
+    long count;     // number of variables touched by the LOOP
+    long *slots;    // register slots of the touched variables
+    AffineOp *ops;  // operations of the body in program order
+    long length;    // number of operations
+} AffineLoop;
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Search the program for LOOPs with affine bodies and attach a summary to
+ * each of them (Loop.affine), all other LOOPs keep a NULL summary.
+ * ARGS     prog - program to be analysed
+ */
+void analyseAffineLoops(Program *prog);
+
+/*
+ * Decide whether a LOOP is worth being accelerated.
+ * ARGS     loop  - summary of the LOOP
+ *          limit - number of iterations
+ * RETURN   true if repeated squaring is cheaper than iterating
+ */
+bool isAffineWorthwhile(const AffineLoop *loop, Value limit);
+
+/*
+ * Apply the LOOP body limit times to the register file in closed form.
+ * ARGS     loop  - summary of the LOOP
+ *          limit - number of iterations
+ *          regs  - register file indexed by variable slots
+ */
+void executeAffineLoop(const AffineLoop *loop, Value limit, Value *regs);
+
+#endif /* AFFINE_H */
@@ -0,0 +1,44 @@
+/*
+ * alloc.h
+ *
+ * Memory allocation that terminates the interpreter on failure.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Allocate memory and terminate on failure.
+ * ARGS     size - number of bytes, 0 allocates a minimal block
+ * RETURN   pointer to the allocated memory
+ */
+void *allocate(size_t size);
+
+/*
+ * Allocate zeroed memory and terminate on failure.
+ * ARGS     count - number of elements, 0 allocates a minimal block
+ *          size  - size of one element
+ * RETURN   pointer to the allocated memory
+ */
+void *allocateZeroed(size_t count, size_t size);
+
+/*
+ * Resize an array and terminate on failure. Callers grow arrays by doubling
+ * their capacity, so appending stays linear.
+ * ARGS     ptr   - array to be resized or NULL
+ *          count - new number of elements, 0 keeps a minimal block
+ *          size  - size of one element
+ * RETURN   pointer to the resized array
+ */
+void *reallocate(void *ptr, size_t count, size_t size);
+
+#endif /* ALLOC_H */
@@ -0,0 +1,70 @@
+/*
+ * batch.h
+ *
+ * Reader for input vectors of the batch mode, allowing to evaluate a program
+ * parsed once for many inputs. Two formats are supported:
+ *
+ *  text   - one evaluation per line holding the decimal values of x1, x2, ...
+ *           separated by white space, empty lines are skipped
+ *  binary - one evaluation per record made of a 32 bit count n followed by
+ *           the n 64 bit values of x1 ... xn, all little endian
+ *
+ * Tom René Hennig
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "value.h"
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * State of an input vector stream.
+ */
+typedef struct {
+    FILE *stream;       // stream the vectors are read from
+    bool binary;        // read binary records instead of text lines
+    char *line;         // buffer of the current text line
+    size_t lineSize;    // allocated size of line
+    Value *inputs;      // values of the current vector
+    long capacity;      // allocated entries of inputs
+    long record;        // number of the current line or record (1-based)
+} BatchReader;
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Allocate a reader for input vectors.
+ * ARGS     stream - stream to read from
+ *          binary - true for binary records, false for text lines
+ * RETURN   pointer to the newly allocated reader
+ */
+BatchReader *createBatchReader(FILE *stream, bool binary);
+
+/*
+ * Free the reader and all of its buffers, the stream is not closed.
+ * ARGS     reader - reader to be freed (may be NULL)
+ */
+void freeBatchReader(BatchReader *reader);
+
+/*
+ * Read the next input vector. The values are new references owned by the
+ * caller, the array itself belongs to the reader and is overwritten by the
+ * next call.
+ * ARGS     reader - reader to read from
+ *          inputs - destination of the pointer to the values of x1, x2, ...
+ * RETURN   number of values or -1 at the end of the stream
+ */
+long readBatch(BatchReader *reader, Value **inputs);
+
+#endif /* BATCH_H */
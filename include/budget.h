@@ -0,0 +1,102 @@
+/*
+ * budget.h
+ *
+ * Execution budgets bounding a run by the number of LOOP iterations (fuel)
+ * and by a wall-clock deadline. Engines hand out fuel in slices to a local
+ * counter decremented whenever an iteration starts, so the budget itself is
+ * only consulted every BUDGET_SLICE iterations, which is also when the
+ * deadline is checked. Without a budget the counter starts at UINT64_MAX and
+ * is never refilled.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define BUDGET_SLICE 4096           // iterations between checks of the clock
+#define BUDGET_EXIT_STATUS 3        // exit status of runs exceeding a budget
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Limits of a run and its progress, the latter only exact once the run
+ * has been settled or stopped.
+ */
+typedef struct {
+    uint64_t fuel;          // LOOP iterations allowed, 0 for no limit
+    uint64_t deadline;      // profileClock() to stop at, 0 for none
+    uint64_t start;         // profileClock() at the start of the run
+    uint64_t granted;       // iterations handed out to the engine so far
+    uint64_t iterations;    // iterations run, set by settleBudget
+    uint64_t nanos;         // duration of the run, set by settleBudget
+    uint64_t statements;    // statements run, UINT64_MAX unless counted by the engine
+    bool outOfFuel;         // the run was stopped for lack of fuel
+    bool outOfTime;         // the run was stopped at the deadline
+    long depth;             // LOOPs and macro calls active when stopped
+    uint32_t line;          // source line of the innermost of them, 0 if unknown
+} Budget;
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Start the clock of a budget.
+ * ARGS     budget  - budget to be initialized
+ *          fuel    - LOOP iterations allowed, 0 for no limit
+ *          seconds - wall-clock time allowed, 0 for no limit
+ */
+void startBudget(Budget *budget, uint64_t fuel, double seconds);
+
+/*
+ * Hand out the next slice of fuel once the engine has used up the previous
+ * one, consuming one iteration of it for the iteration about to start.
+ * ARGS     budget - budget of the run
+ *          slice  - local counter of the engine, receives the iterations
+ *                   left in the new slice
+ * RETURN   false if the fuel is used up or the deadline has passed, the
+ *          engine has to stop then and report where by settleBudget
+ */
+bool refuelBudget(Budget *budget, uint64_t *slice);
+
+/*
+ * Record the progress of a run that has stopped or finished.
+ * ARGS     budget - budget of the run
+ *          slice  - local counter of the engine
+ *          depth  - LOOPs and macro calls active, 0 if the run finished
+ *          line   - source line of the innermost active LOOP, 0 if unknown
+ */
+void settleBudget(Budget *budget, uint64_t slice, long depth, uint32_t line);
+
+/*
+ * Check whether a run has been stopped by its budget.
+ * ARGS     budget - budget of the run
+ * RETURN   true if the fuel was used up or the deadline passed
+ */
+static inline bool isBudgetExceeded(const Budget *budget)
+{
+    return budget->outOfFuel || budget->outOfTime;
+}
+
+/*
+ * Print the progress of a run stopped by its budget as a single line.
+ * ARGS     stream - output stream
+ *          budget - settled budget of the run
+ */
+void printBudgetStats(FILE *stream, const Budget *budget);
+
+#endif /* BUDGET_H */
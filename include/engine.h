@@ -0,0 +1,119 @@
+/*
+ * engine.h
+ *
+ * Common interface of all execution engines. A parsed program is prepared
+ * once for the selected engine and may then be executed any number of times,
+ * also concurrently on different register files.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "budget.h"
+#include "jit.h"
+#include "parser.h"
+#include "symbolic.h"
+#include "transpile.h"
+#include "var.h"
+#include "vm.h"
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Execution engines selectable on the command line.
+ */
+typedef enum {
+    ENGINE_TREE,    // walk the syntax/semantics tree (reference)
+    ENGINE_VM,      // compile to bytecode and run the virtual machine
+    ENGINE_JIT,     // compile to machine code, falls back to ENGINE_TREE
+    ENGINE_CC,      // compile to a cached shared object, falls back likewise
+    ENGINE_SIMD,    // run batches lane parallel, single inputs like ENGINE_TREE
+    ENGINE_SYMBOLIC // evaluate closed forms, falls back to ENGINE_TREE
+} Engine;
+
+#define ENGINE_COUNT (ENGINE_SYMBOLIC + 1)
+
+/*
+ * Program prepared for repeated execution by one of the engines.
+ */
+typedef struct {
+    Engine engine;          // engine executing the program
+    Program *prog;          // syntax/semantics tree
+    Bytecode *bytecode;     // compiled program of ENGINE_VM
+    NativeCode *native;     // compiled program of ENGINE_JIT
+    SharedCode *shared;     // compiled program of ENGINE_CC
+    ClosedForm *closed;     // closed forms of ENGINE_SYMBOLIC
+} Executable;
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Look up an engine by its command line name.
+ * ARGS     name   - name of the engine (tree, vm, jit, cc, simd or symbolic)
+ *          engine - destination of the engine
+ * RETURN   false if there is no engine of that name
+ */
+bool parseEngine(const char *name, Engine *engine);
+
+/*
+ * Get the command line name of an engine.
+ * ARGS     engine - engine to be named
+ * RETURN   static string
+ */
+const char *engineName(Engine engine);
+
+/*
+ * Compile the program for the requested engine. The native backends are not
+ * available everywhere and fall back to the tree engine, as do programs
+ * without closed form.
+ * ARGS     exe    - destination of the prepared program
+ *          engine - requested engine
+ *          prog   - parsed program
+ *          vars   - variable table the program was parsed with
+ *          hash   - hash of the program text (only used by ENGINE_CC)
+ */
+void prepareExecutable(Executable *exe, Engine engine, Program *prog,
+        const VariableTable *vars, uint64_t hash);
+
+/*
+ * Release everything compiled by prepareExecutable.
+ * ARGS     exe - prepared program
+ */
+void releaseExecutable(Executable *exe);
+
+/*
+ * Check whether an engine enforces execution budgets. The native backends
+ * and closed forms run without any checks.
+ * ARGS     engine - requested engine
+ * RETURN   true if runBudgeted accepts a budget for the engine
+ */
+bool isBudgetSupported(Engine engine);
+
+/*
+ * Execute the prepared program once.
+ * ARGS     exe  - prepared program
+ *          regs - initialized register file indexed by variable slots
+ */
+void runExecutable(const Executable *exe, Value *regs);
+
+/*
+ * Execute the prepared program once within a budget.
+ * ARGS     exe    - prepared program
+ *          regs   - initialized register file indexed by variable slots
+ *          budget - started budget of the run or NULL for no limits
+ * RETURN   false if the budget was exceeded
+ */
+bool runBudgeted(const Executable *exe, Value *regs, Budget *budget);
+
+#endif /* ENGINE_H */
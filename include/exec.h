@@ -0,0 +1,60 @@
+/*
+ * exec.h
+ *
+ * Reference execution engine walking the syntax/semantics tree directly.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef EXEC_H
+#define EXEC_H
+
+#include <stdbool.h>
+
+#include "budget.h"
+#include "parser.h"
+#include "profile.h"
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Execute a single assignment: x_i := x_j +- nat.
+ * ARGS     ass  - assignment to be executed
+ *          regs - register file indexed by variable slots
+ */
+static inline void executeAssignment(const Assignment *ass, Value *regs)
+{
+    Value res;
+    if (ass->isAddition)
+        res = valueAdd(regs[ass->rvalue], ass->nat);
+    else
+        res = valueSub(regs[ass->rvalue], ass->nat);
+    valueRelease(regs[ass->lvalue]);
+    regs[ass->lvalue] = res;
+}
+
+/*
+ * Traverse the syntax/semantics tree and simulate execution.
+ * ARGS     prog   - program to be executed
+ *          regs   - initialized register file indexed by variable slots
+ *          budget - started budget of the run or NULL for no limits
+ * RETURN   false if the budget was exceeded, the registers then hold the
+ *          values at the point of stopping
+ */
+bool executeProgram(Program *prog, Value *regs, Budget *budget);
+
+/*
+ * Execute the program like executeProgram, but iterate every LOOP instead of
+ * applying superinstructions or closed forms and record how often every
+ * statement is executed and, if the profile is timed, how long every LOOP
+ * takes.
+ * ARGS     prog    - program to be executed
+ *          regs    - initialized register file indexed by variable slots
+ *          profile - profile created for the program, counters are added to
+ */
+void executeProfiled(Program *prog, Value *regs, Profile *profile);
+
+#endif /* EXEC_H */
@@ -0,0 +1,99 @@
+/*
+ * fuse.h
+ *
+ * Superinstructions for the idioms most LOOP programs are built from. LOOPs
+ * of the following shapes are annotated (Loop.fused) and executed in a single
+ * step by every engine:
+ *  add-var   - LOOP xa DO xb := xb + k END          xb := xb + k * xa
+ *  zero      - LOOP xa DO xa := xa - k END, k > 0   xa := 0
+ *  sub-var   - LOOP xa DO xb := xb - k END otherwise xb := xb - k * xa
+ *  mul-add   - LOOP xa DO LOOP xb DO xc := xc + k END END, c != b
+ *                                                   xc := xc + k * xa * xb
+ * Copies (x := y + 0) need no annotation, the virtual machine lowers them to
+ * a single move. The limit of a fused LOOP is read once on entry like for
+ * every LOOP, so xa may be written by the body. Fused LOOPs run no
+ * iterations, they are not charged to a budget.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef FUSE_H
+#define FUSE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "parser.h"
+#include "value.h"
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Statements replaced by superinstructions.
+ */
+typedef struct {
+    long loops[FUSED_COUNT];    // outermost fused LOOPs of every kind
+    long copies;                // assignments x := y + 0 with x != y
+    long fused;                 // statements replaced in total
+    long statements;            // statements of the program
+} FuseStats;
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Search the program for LOOPs of the shapes listed at the beginning of this
+ * file and annotate them (Loop.fused), all other LOOPs keep FUSED_NONE.
+ * ARGS     prog  - program to be analysed
+ *          stats - destination of the statements replaced or NULL
+ */
+void analyseFusedLoops(Program *prog, FuseStats *stats);
+
+/*
+ * Check whether an assignment is a copy of another variable.
+ * ARGS     ass - assignment to be checked
+ * RETURN   true for x := y + 0 and x := y - 0 with x != y
+ */
+static inline bool isCopy(const Assignment *ass)
+{
+    return ass->nat == 0 && ass->lvalue != ass->rvalue;
+}
+
+/*
+ * Add the product n * m * k to a register or subtract it, saturating at zero.
+ * ARGS     reg        - register to be updated
+ *          n          - first factor
+ *          m          - second factor
+ *          k          - constant factor
+ *          isAddition - add or subtract the product
+ */
+void accumulateProduct(Value *reg, Value n, Value m, NatNum k, bool isAddition);
+
+/*
+ * Execute a fused LOOP in a single step.
+ * ARGS     prog - program holding the LOOP
+ *          loop - LOOP annotated with a superinstruction
+ *          regs - register file indexed by variable slots
+ */
+void executeFusedLoop(const Program *prog, const Loop *loop, Value *regs);
+
+/*
+ * Get the name of a superinstruction as printed in statistics.
+ * ARGS     op - superinstruction to be named
+ * RETURN   static string
+ */
+const char *fusedName(FusedOp op);
+
+/*
+ * Print the statements replaced by every superinstruction.
+ * ARGS     stream - output stream
+ *          stats  - statistics reported by analyseFusedLoops
+ */
+void printFuseStats(FILE *stream, const FuseStats *stats);
+
+#endif /* FUSE_H */
@@ -0,0 +1,103 @@
+/*
+ * generate.h
+ *
+ * Generator of random well-formed LOOP programs for differential testing of
+ * the execution engines. Programs are built from random assignments, LOOPs
+ * and optionally macros, mixed with the idioms fused into superinstructions
+ * (fuse.h), so the fast paths are exercised as well. Every program is run
+ * once by the reference engine iterating every LOOP on random inputs, and
+ * programs exceeding the allowed number of LOOP iterations are discarded,
+ * so the cost of running a generated program is bounded. Programs end by
+ * adding every variable to x0, so a wrong value anywhere shows in the result.
+ *
+ * Generation is deterministic: the same options and seed always yield the
+ * same program and inputs.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef GENERATE_H
+#define GENERATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "value.h"
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define GENERATE_ATTEMPTS 1000      // programs drawn per seed before giving up
+#define GENERATE_MAX_DEPTH 256      // LOOP nesting, bodies are written recursively
+#define GENERATE_MAX_MACROS 1024    // macro definitions
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Shape of the programs to be generated.
+ */
+typedef struct {
+    uint64_t depth;         // maximum LOOP nesting
+    uint64_t statements;    // statements of the program outside of macros
+    uint64_t variables;     // variables x0, x1, ... of the program
+    uint64_t inputs;        // inputs x1, x2, ... given to the program
+    uint64_t maxInput;      // inputs are drawn from 0 ... maxInput
+    uint64_t cost;          // LOOP iterations allowed for the inputs
+    uint64_t macros;        // macro definitions preceding the program
+} GenerateOptions;
+
+/*
+ * Generated program with the inputs it was checked with.
+ */
+typedef struct {
+    char *text;             // program text, null terminated
+    size_t length;          // number of characters of the text
+    Value *inputs;          // values of x1, x2, ...
+    long inputCount;        // number of inputs
+    Value result;           // x0 computed by the reference engine
+    uint64_t iterations;    // LOOP iterations run by the reference engine
+} GeneratedProgram;
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Initialize the options with small programs of a few nested LOOPs.
+ * ARGS     opts - options to be initialized
+ */
+void defaultGenerateOptions(GenerateOptions *opts);
+
+/*
+ * Parse a command line option of the generator, one of --depth=<n>,
+ * --statements=<n>, --variables=<n>, --inputs=<n>, --max-input=<n>,
+ * --cost=<n> and --macros=<n>. Invalid values terminate the process.
+ * ARGS     arg  - command line parameter
+ *          opts - options to be updated
+ * RETURN   false if the parameter is no option of the generator
+ */
+bool parseGenerateOption(const char *arg, GenerateOptions *opts);
+
+/*
+ * Generate a program whose reference run on its inputs finishes within the
+ * allowed number of LOOP iterations.
+ * ARGS     opts - shape of the program
+ *          seed - seed of the random number generator
+ *          gen  - destination of the program
+ */
+void generateProgram(const GenerateOptions *opts, uint64_t seed, GeneratedProgram *gen);
+
+/*
+ * Release a generated program.
+ * ARGS     gen - program to be freed
+ */
+void freeGeneratedProgram(GeneratedProgram *gen);
+
+#endif /* GENERATE_H */
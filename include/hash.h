@@ -0,0 +1,45 @@
+/*
+ * hash.h
+ *
+ * 64 bit FNV-1a hashing used to key caches by program text.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define HASH_SEED 14695981039346656037ull   // FNV-1a offset basis
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Continue a hash over a block of bytes.
+ * ARGS     hash  - hash of the preceding data or HASH_SEED
+ *          bytes - data to be hashed
+ *          n     - number of bytes
+ * RETURN   updated hash
+ */
+uint64_t hashBytes(uint64_t hash, const void *bytes, size_t n);
+
+/*
+ * Hash the remaining content of a stream and rewind it afterwards.
+ * ARGS     hash   - hash of the preceding data or HASH_SEED
+ *          stream - seekable libc stream
+ * RETURN   updated hash
+ */
+uint64_t hashStream(uint64_t hash, FILE *stream);
+
+#endif /* HASH_H */
@@ -0,0 +1,70 @@
+/*
+ * image.h
+ *
+ * Precompiled programs (.loopc files). An image holds the statement arena of
+ * a parsed program in its in-memory layout together with the variable table
+ * and the constants exceeding a machine word. Statements refer to each other
+ * by index only, so an image is mapped into memory and executed in place
+ * without lexing, parsing or allocating statements.
+ *
+ * Images are bound to the layout of the writing build: the version, byte
+ * order and statement size are checked when loading.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "parser.h"
+#include "var.h"
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define IMAGE_EXTENSION ".loopc"    // file name extension of images
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Check whether a stream holds an image by its magic number. The stream is
+ * rewound afterwards.
+ * ARGS     stream - libc standard stream positioned at the beginning
+ * RETURN   true if the stream starts like an image
+ */
+bool isImage(FILE *stream);
+
+/*
+ * Write a program as image.
+ * ARGS     stream - seekable output stream opened in binary mode
+ *          prog   - program to be written, closed forms are not stored
+ *          vars   - variable table the program was parsed with
+ * RETURN   false if writing failed
+ */
+bool writeImage(FILE *stream, const Program *prog, const VariableTable *vars);
+
+/*
+ * Load an image written by writeImage. Regular files are mapped copy on
+ * write, other streams are read into a buffer. Invalid images terminate the
+ * process.
+ * ARGS     stream - libc standard stream positioned at the beginning
+ *          vars   - empty variable table or holding x0 in slot 0 only
+ * RETURN   pointer to the newly loaded program, released by freeProgram
+ */
+Program *loadImage(FILE *stream, VariableTable *vars);
+
+/*
+ * Release the memory of a loaded image, called by freeProgram.
+ * ARGS     prog - program loaded by loadImage
+ */
+void freeImage(Program *prog);
+
+#endif /* IMAGE_H */
@@ -0,0 +1,62 @@
+/*
+ * jit.h
+ *
+ * Native backend translating the syntax/semantics tree into x86-64 machine
+ * code. The register file stays in memory and is addressed relative to a
+ * callee-saved register, LOOPs become counted loops with their counters in
+ * the remaining callee-saved registers (or the stack frame once those are
+ * exhausted). Values beyond the machine word fast path, affine LOOPs and all
+ * other rare cases are handed to C helpers. Macro bodies become functions.
+ *
+ * On any other platform compileNative fails and the caller is expected to
+ * fall back to one of the interpreters.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef JIT_H
+#define JIT_H
+
+#include "parser.h"
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Executable machine code of a program.
+ */
+typedef struct {
+    void *memory;       // executable mapping holding the code
+    size_t size;        // size of the mapping in bytes
+    size_t entry;       // offset of the program behind the macro bodies
+} NativeCode;
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Translate the syntax/semantics tree into machine code.
+ * ARGS     prog - program to be compiled
+ * RETURN   pointer to the newly allocated code or NULL if the platform or
+ *          the program is not supported
+ */
+NativeCode *compileNative(Program *prog);
+
+/*
+ * Release the machine code.
+ * ARGS     code - code to be freed (may be NULL)
+ */
+void freeNative(NativeCode *code);
+
+/*
+ * Execute machine code on the given register file.
+ * ARGS     code - compiled program
+ *          regs - initialized register file indexed by variable slots
+ */
+void executeNative(const NativeCode *code, Value *regs);
+
+#endif /* JIT_H */
@@ -0,0 +1,110 @@
+/*
+ * memo.h
+ *
+ * Persistent store of program results, so repeated evaluations of the same
+ * program on the same inputs are answered without running the program. The
+ * store is a file holding a hash table of fixed size that is mapped into
+ * memory and shared by all processes using it.
+ *
+ * Results are keyed by a hash of the parsed program, independent of its
+ * formatting and of whether it was loaded from text or an image, and of the
+ * inputs, where inputs of zero and inputs to variables the program does not
+ * use are ignored. The table is set associative: every key maps to a set of
+ * MEMO_WAYS entries, the least recently used entry of the set is evicted.
+ * Results exceeding MEMO_LIMBS limbs are not stored.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "parser.h"
+#include "value.h"
+#include "var.h"
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define MEMO_ENTRIES 65536  // default number of entries of a new store
+#define MEMO_WAYS 8         // entries per set
+#define MEMO_LIMBS 24       // limbs of the largest stored result (768 bits)
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Key of a result, two independent hashes of the program and the inputs.
+ */
+typedef struct {
+    uint64_t hash;          // selects the set of entries
+    uint64_t check;         // tells apart keys of the same hash
+} MemoKey;
+
+typedef struct sMemoStore MemoStore;
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Hash a parsed program by its statements and variable identifiers.
+ * ARGS     prog - program as parsed or loaded, before optimising
+ *          vars - variable table the program was parsed with
+ * RETURN   key of the program without inputs
+ */
+MemoKey hashProgram(const Program *prog, const VariableTable *vars);
+
+/*
+ * Extend the key of a program by its inputs.
+ * ARGS     key    - key of the program
+ *          vars   - variable table the program was parsed with
+ *          inputs - values of x1, x2, ...
+ *          count  - number of values
+ * RETURN   key of the result
+ */
+MemoKey hashInputs(MemoKey key, const VariableTable *vars, const Value *inputs, long count);
+
+/*
+ * Open a store, creating it with the given number of entries if the file
+ * does not exist or does not hold a valid store. The size of existing
+ * stores is kept.
+ * ARGS     path    - path of the store file
+ *          entries - number of entries, rounded up to a power of two
+ * RETURN   pointer to the opened store, NULL with a warning printed if the
+ *          store cannot be used
+ */
+MemoStore *openMemoStore(const char *path, long entries);
+
+/*
+ * Unmap and close a store.
+ * ARGS     store - store to be closed (may be NULL)
+ */
+void closeMemoStore(MemoStore *store);
+
+/*
+ * Look up a result.
+ * ARGS     store  - opened store
+ *          key    - key of the result
+ *          result - destination of a new reference to the result
+ * RETURN   false if the store holds no result for the key
+ */
+bool lookupMemo(MemoStore *store, MemoKey key, Value *result);
+
+/*
+ * Store a result, evicting the least recently used result of its set.
+ * ARGS     store  - opened store
+ *          key    - key of the result
+ *          result - result to be stored
+ */
+void storeMemo(MemoStore *store, MemoKey key, Value result);
+
+#endif /* MEMO_H */
@@ -0,0 +1,114 @@
+/*
+ * optimise.h
+ *
+ * Optimiser rewriting a parsed program before it is executed. The optimiser
+ * runs a pipeline of passes, each of which can be enabled on its own:
+ *  constants   - constant propagation, assignments of values known at parse
+ *                time are rewritten to add the value to a variable known to
+ *                be zero
+ *  copies      - copy propagation, variables known to equal another variable
+ *                plus a constant are replaced by that variable
+ *  fold        - folding of consecutive assignments to the same variable,
+ *                e.g. x := x + a; x := x + b into x := x + (a + b)
+ *  dead-stores - elimination of assignments never read and of no-ops
+ *  zero-loops  - removal of LOOPs over variables known to be zero
+ *  hoist       - hoisting of loop-invariant assignments out of LOOP bodies
+ *
+ * Nothing is known about the inputs x1, x2, ... when optimising, only x0
+ * starts as zero. The pipeline is repeated until no pass changes anything or
+ * OPTIMISE_ROUNDS rounds are run. Programs calling macros are not optimised.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef OPTIMISE_H
+#define OPTIMISE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "parser.h"
+#include "var.h"
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define OPTIMISE_ROUNDS 4   // maximum number of runs of the whole pipeline
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Passes of the optimiser in the order listed at the beginning of this file.
+ */
+typedef enum {
+    PASS_CONSTANTS,
+    PASS_COPIES,
+    PASS_FOLD,
+    PASS_DEAD_STORES,
+    PASS_ZERO_LOOPS,
+    PASS_HOIST,
+    PASS_COUNT
+} Pass;
+
+#define PASSES_NONE 0u
+#define PASSES_ALL  ((1u << PASS_COUNT) - 1)
+
+/*
+ * Changes made by every pass.
+ */
+typedef struct {
+    long changes[PASS_COUNT];   // rewritten, removed or moved statements
+    long statements;            // statements before optimising
+    long remaining;             // statements after optimising
+    long rounds;                // runs of the pipeline
+} OptimiseStats;
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Get the name of a pass as used on the command line.
+ * ARGS     pass - pass to be named
+ * RETURN   static string
+ */
+const char *passName(Pass pass);
+
+/*
+ * Parse a comma separated list of pass names into a set of passes. "all"
+ * names every pass, a name preceded by '-' disables the pass. A list
+ * starting with a disabled pass starts with all passes enabled.
+ * ARGS     list   - list of names, e.g. "constants,fold" or "-hoist"
+ *          passes - destination of the set, one bit per Pass
+ * RETURN   false if the list holds an unknown name
+ */
+bool parsePasses(const char *list, unsigned *passes);
+
+/*
+ * Optimise a program in place. Once a pass changes the program, the
+ * statements are rebuilt into a newly allocated arena, so a program loaded
+ * from an image is copied out of it.
+ * Closed forms of LOOPs (affine.h) have to be analysed afterwards.
+ * ARGS     prog   - program to be optimised
+ *          vars   - variable table the program was parsed with
+ *          passes - set of enabled passes, one bit per Pass
+ *          stats  - destination of the changes made or NULL
+ */
+void optimiseProgram(Program *prog, const VariableTable *vars, unsigned passes,
+        OptimiseStats *stats);
+
+/*
+ * Print the changes made by every pass, one line per enabled pass.
+ * ARGS     stream - output stream
+ *          stats  - changes reported by optimiseProgram
+ *          passes - set of enabled passes
+ */
+void printOptimiseStats(FILE *stream, const OptimiseStats *stats, unsigned passes);
+
+#endif /* OPTIMISE_H */
@@ -0,0 +1,75 @@
+/*
+ * parallel.h
+ *
+ * Concurrent execution of independent top-level statements. The variables
+ * read and written by every top-level statement, including all statements
+ * nested in it, order the statements into levels of a dependency DAG: a
+ * statement depends on all earlier statements writing a variable it reads
+ * or writes and on all earlier statements reading a variable it writes.
+ *
+ * Levels holding at least two LOOPs run concurrently, every LOOP as part of
+ * its own with a private register file, the assignments of the level as one
+ * more part. Parts only share variables they read, so big numbers are
+ * copied into the private register files, as reference counting is not
+ * thread safe. All other levels are merged into parts running sequentially
+ * on the register file of the caller. Programs calling macros are not split
+ * and have a width of 1.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "engine.h"
+#include "parser.h"
+#include "pool.h"
+#include "value.h"
+#include "var.h"
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+typedef struct sParallelProgram ParallelProgram;
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Split a program into parts along the dependency DAG of its top-level
+ * statements and prepare every part for an engine.
+ * ARGS     prog   - program to be split, not modified
+ *          vars   - variable table the program was parsed with
+ *          engine - engine executing the parts
+ *          hash   - hash of the program text (only used by ENGINE_CC)
+ * RETURN   pointer to the newly prepared program
+ */
+ParallelProgram *prepareParallel(const Program *prog, const VariableTable *vars, Engine engine,
+        uint64_t hash);
+
+/*
+ * Get the largest number of parts running concurrently.
+ * ARGS     par - prepared program
+ * RETURN   1 if no top-level LOOPs are independent of each other
+ */
+long parallelWidth(const ParallelProgram *par);
+
+/*
+ * Execute the prepared program once.
+ * ARGS     par  - prepared program
+ *          regs - initialized register file indexed by variable slots
+ *          pool - workers running concurrent parts
+ */
+void runParallel(ParallelProgram *par, Value *regs, ThreadPool *pool);
+
+/*
+ * Release all parts of a prepared program.
+ * ARGS     par - prepared program (may be NULL)
+ */
+void freeParallel(ParallelProgram *par);
+
+#endif /* PARALLEL_H */
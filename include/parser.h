@@ -3,9 +3,26 @@
  *
  * Simple LL(1) parser with the following grammar:
  *  Program    := Statement Program | NULL
- *  Statement  := Assignment | Loop
+ *  Statement  := Assignment | Loop | Call | Macro
  *  Assignment := VarID ':=' VarID '+' NatNum | VarID ':=' VarID '-' NatNum
  *  Loop       := 'LOOP' VarID 'DO' Program 'END'
+ *  Call       := Name '(' VarID Arguments ')'
+ *  Arguments  := ',' VarID Arguments | NULL
+ *  Macro      := 'MACRO' Name '(' VarID Arguments ')' 'DO' Program 'END'
+ *
+ * Macros are only defined at the top level, before their first call, so they
+ * cannot be recursive. The variables of a macro body are its own: parameters
+ * are passed by reference, every other variable is local and starts at zero
+ * in every call. A call may pass a variable more than once, it then copies
+ * the arguments in and the written parameters back out in order. A macro
+ * body is parsed once and shared by its calls, only macros hardly larger
+ * than the code passing their arguments are inlined at the call site.
+ *
+ * Statements live in one arena in program order, a LOOP body right behind its
+ * head. The parser, the engines and the analyses walk this arena and keep
+ * the LOOPs they are inside of on an explicit stack instead of recursing, so
+ * neither the length of a sequence nor the nesting depth is limited by the
+ * call stack.
  *
  * Tom René Hennig
  */
@@ -14,19 +31,34 @@
 #define PARSER_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
+#include "token.h"
+#include "value.h"
+#include "var.h"
+
 
 /******************************************************************************
  *                             TYPE DECLARATIONS
  */
 
 /*
- * Declaration of primitive types
+ * Declaration of primitive types. After parsing a VarID holds the slot index
+ * of the variable in the variable table, not its identifier.
+ */
+typedef uint32_t VarID;
+
+typedef Value NatNum;
+
+/*
+ * Statements refer to each other by their index in the arena of the program,
+ * index 0 is never used and marks the absence of a statement.
  */
-typedef long VarID;
+typedef uint32_t NodeIndex;
 
-typedef long NatNum;
+#define NODE_NONE 0
 
 /*
  * Rules of the CFG listed at the beginning of this file
@@ -34,18 +66,9 @@ typedef long NatNum;
 typedef enum {
     STAT_ASSIGNMENT,
     STAT_LOOP,
+    STAT_CALL,
 } StatementType;
 
-typedef struct {
-    StatementType type;
-    void *data;
-} Statement;
-
-typedef struct sProgram {
-    Statement *statement;
-    struct sProgram *next;
-} Program;
-
 typedef struct {
     VarID lvalue;
     VarID rvalue;
@@ -53,11 +76,107 @@ typedef struct {
     bool isAddition;
 } Assignment;
 
+/*
+ * Superinstruction replacing a LOOP of a common shape, see fuse.h.
+ */
+typedef enum {
+    FUSED_NONE,
+    FUSED_ADD_VAR,                  // LOOP xa DO xb := xb + k END
+    FUSED_ZERO,                     // LOOP xa DO xa := xa - k END, k > 0
+    FUSED_SUB_VAR,                  // LOOP xa DO xb := xb - k END otherwise
+    FUSED_MUL_ADD,                  // LOOP xa DO LOOP xb DO xc := xc + k END END, c != b
+    FUSED_COUNT
+} FusedOp;
+
+/*
+ * The statements of a LOOP body including all nested bodies occupy the arena
+ * entries body ... end - 1 in program order, so a body can be scanned without
+ * following the nesting.
+ */
 typedef struct {
     VarID var;
-    Program *program;
+    NodeIndex body;                 // first statement of the body
+    NodeIndex end;                  // one past the last nested statement
+    FusedOp fused;                  // superinstruction replacing the LOOP
+    struct sAffineLoop *affine;     // closed form of the body (see affine.h)
 } Loop;
 
+/*
+ * Call of a macro body not inlined. The body occupies the arena entries
+ * body ... end - 1 like the body of a LOOP, but outside of any sequence, and
+ * is executed once. Parameters and local variables of a macro live in slots
+ * of hidden variables with negative identifiers: the call is surrounded by
+ * assignments copying the arguments into the parameters and the parameters
+ * back, the body resets its local variables to zero before returning.
+ */
+typedef struct {
+    NodeIndex body;                 // first statement of the macro body
+    NodeIndex end;                  // one past the last statement of the body
+} Call;
+
+/*
+ * Statement tagged with its type. The statements of a sequence are linked in
+ * program order by next.
+ */
+typedef struct {
+    StatementType type;
+    NodeIndex next;
+    union {
+        Assignment assignment;      // STAT_ASSIGNMENT
+        Loop loop;                  // STAT_LOOP
+        Call call;                  // STAT_CALL
+    } as;
+} Statement;
+
+/*
+ * Block of memory for auxiliary data owned by a program (see programAlloc).
+ */
+typedef struct sArenaChunk {
+    struct sArenaChunk *next;
+    size_t used;
+    size_t size;
+    unsigned char data[];
+} ArenaChunk;
+
+/*
+ * Variables of a macro kept for printing them as <macro>.xN, they occupy the
+ * slots base ... base + count - 1.
+ */
+typedef struct {
+    const char *name;       // name of the macro, null terminated
+    VarID base;             // slot of the first parameter
+    long count;             // number of parameters and local variables
+    const long *ids;        // identifier of every variable within the macro
+} MacroSymbol;
+
+/*
+ * Parsed program. All statements live in one array acting as bump arena, so
+ * the whole program is allocated with a handful of calls and released with a
+ * single call of freeProgram.
+ */
+typedef struct sProgram {
+    Statement *nodes;       // arena of statements (entry 0 unused)
+    uint32_t *lines;        // source line of every statement
+    NodeIndex count;        // number of used entries including entry 0
+    NodeIndex capacity;     // number of allocated entries
+    NodeIndex first;        // first statement of the program
+    ArenaChunk *chunks;     // auxiliary data, e.g. closed forms of LOOPs
+    const MacroSymbol *macros;  // variables of every macro (in chunks)
+    long macroCount;        // number of macros, 0 if not known
+    void *image;            // image holding nodes and lines if loaded from
+                            // a .loopc file (see image.h), otherwise NULL
+    size_t imageSize;       // size of the image
+    bool imageMapped;       // image is mapped instead of read into a buffer
+} Program;
+
+/*
+ * Syntax error reported by parseText.
+ */
+typedef struct {
+    const char *expected;   // description of the expected token
+    Token found;            // token found instead, holds line and column
+} SyntaxError;
+
 
 /******************************************************************************
  *                            FUNCTION DECLARATIONS
@@ -65,10 +184,55 @@ typedef struct {
 
 /*
  * Parse input from stream with the help of the lexer into an AST of the
- * structure as shown above.
+ * structure as shown above. Variable identifiers are resolved to slots of the
+ * given variable table. Syntax errors terminate the process.
  * ARGS     stream - libc standard stream
- * RETURN   pointer to the first executable program statement/the AST.
+ *          vars   - variable table to intern all variable identifiers into
+ * RETURN   pointer to the newly allocated program
+ */
+Program *parse(FILE *stream, VariableTable *vars);
+
+/*
+ * Parse a program held in memory like parse, but report syntax errors to the
+ * caller instead of terminating.
+ * ARGS     text   - program text, not necessarily null terminated
+ *          length - number of characters of the text
+ *          vars   - variable table to intern all variable identifiers into
+ *          error  - destination of a syntax error
+ * RETURN   pointer to the newly allocated program or NULL on syntax errors
+ */
+Program *parseText(const char *text, size_t length, VariableTable *vars, SyntaxError *error);
+
+/*
+ * Print a syntax error as line:column: expected ... instead of ...
+ * ARGS     stream - output stream
+ *          error  - syntax error reported by parseText
+ */
+void printSyntaxError(FILE *stream, const SyntaxError *error);
+
+/*
+ * Allocate auxiliary memory released together with the program.
+ * ARGS     prog - program owning the memory
+ *          size - number of bytes
+ * RETURN   pointer to uninitialized memory aligned for any basic type
+ */
+void *programAlloc(Program *prog, size_t size);
+
+/*
+ * Free the program including all of its statements and auxiliary memory.
+ * ARGS     prog - program to be freed (may be NULL)
+ */
+void freeProgram(Program *prog);
+
+/*
+ * Get a statement of the program by its index.
+ * ARGS     prog  - program holding the statement
+ *          index - index of the statement (not NODE_NONE)
+ * RETURN   pointer to the statement, valid until the program grows
  */
-Program *parse(FILE *stream);
+static inline Statement *programNode(const Program *prog, NodeIndex index)
+{
+    return &prog->nodes[index];
+}
 
 #endif /* PARSER_H */
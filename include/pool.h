@@ -0,0 +1,101 @@
+/*
+ * pool.h
+ *
+ * Fixed pool of worker threads running batches of independent tasks. Every
+ * worker owns a deque of task indices and pops from its front, idle workers
+ * steal the back half of another deque, so a few tasks of enormous cost do
+ * not leave the remaining workers waiting. Streams of tasks of unknown length
+ * are fed to the workers while earlier tasks are still running and handed
+ * back in order through a bounded window instead.
+ *
+ * Without POSIX threads all tasks run on the calling thread.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Task run by the pool.
+ * ARGS     context - pointer passed to runPool
+ *          worker  - index of the executing worker (0 ... workers - 1)
+ *          index   - index of the task (0 ... count - 1)
+ */
+typedef void (*PoolTask)(void *context, long worker, long index);
+
+/*
+ * Preparation of the next task of a stream, called in index order.
+ * ARGS     context - pointer passed to streamPool
+ *          index   - index of the task
+ * RETURN   false if the stream has ended
+ */
+typedef bool (*PoolFeed)(void *context, long index);
+
+/*
+ * Completion of a task of a stream, called in index order.
+ * ARGS     context - pointer passed to streamPool
+ *          index   - index of the finished task
+ */
+typedef void (*PoolEmit)(void *context, long index);
+
+typedef struct sThreadPool ThreadPool;
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Start a pool of worker threads, the calling thread acts as worker 0.
+ * ARGS     workers - number of workers, 0 for one per online processor
+ * RETURN   pointer to the newly started pool
+ */
+ThreadPool *createPool(long workers);
+
+/*
+ * Stop all worker threads and free the pool.
+ * ARGS     pool - pool to be stopped (may be NULL)
+ */
+void freePool(ThreadPool *pool);
+
+/*
+ * Get the number of workers of the pool.
+ * ARGS     pool - pool to be queried
+ * RETURN   number of workers including the calling thread
+ */
+long poolWorkers(const ThreadPool *pool);
+
+/*
+ * Run the tasks 0 ... count - 1 and wait until all of them are finished.
+ * ARGS     pool    - pool running the tasks
+ *          count   - number of tasks
+ *          task    - function called once for every task index
+ *          context - pointer passed on to task
+ */
+void runPool(ThreadPool *pool, long count, PoolTask task, void *context);
+
+/*
+ * Run a stream of tasks until feed reports its end and wait until all of
+ * them are emitted. Idle workers feed the next task as long as fewer than
+ * window tasks are fed but not yet emitted, so the slot index % window of a
+ * task is free again once it has been emitted. Feeding and emitting are
+ * serialized, tasks run concurrently.
+ * ARGS     pool    - pool running the tasks
+ *          window  - most tasks between feed and emit
+ *          feed    - function preparing the next task
+ *          task    - function called once for every task index
+ *          emit    - function handing on finished tasks
+ *          context - pointer passed on to the functions
+ */
+void streamPool(ThreadPool *pool, long window, PoolFeed feed, PoolTask task, PoolEmit emit,
+        void *context);
+
+#endif /* POOL_H */
@@ -0,0 +1,87 @@
+/*
+ * profile.h
+ *
+ * Execution profile of a LOOP program: how often every statement ran and how
+ * long every LOOP took. Profiles are collected by executeProfiled (exec.h)
+ * and reported as hot spots or as folded stacks for flamegraph tools.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "parser.h"
+#include "var.h"
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Counters of a profiled run, indexed by statement like the arena of the
+ * program. The time of a LOOP includes all nested statements, the time of a
+ * macro call all statements of the macro body.
+ */
+typedef struct {
+    NodeIndex count;        // number of entries, equal to prog->count
+    uint64_t *counts;       // executions of every statement
+    uint64_t *nanos;        // nanoseconds spent in every LOOP and call or NULL
+    uint64_t total;         // nanoseconds of the whole run if timed
+} Profile;
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Allocate a zeroed profile for a program.
+ * ARGS     prog  - program to be profiled
+ *          timed - also measure the time of every LOOP
+ * RETURN   pointer to the newly allocated profile
+ */
+Profile *createProfile(const Program *prog, bool timed);
+
+/*
+ * Free a profile.
+ * ARGS     profile - profile to be freed (may be NULL)
+ */
+void freeProfile(Profile *profile);
+
+/*
+ * Read the monotonic clock used for timing LOOPs.
+ * RETURN   nanoseconds since an arbitrary point in time
+ */
+uint64_t profileClock(void);
+
+/*
+ * Print the LOOPs taking the most time themselves, not counting nested
+ * LOOPs, and the most executed statements together with their source lines.
+ * ARGS     stream  - output stream
+ *          prog    - profiled program
+ *          vars    - variable table the program was parsed with
+ *          profile - profile of the program
+ *          limit   - number of entries per list
+ */
+void printHotspots(FILE *stream, const Program *prog, const VariableTable *vars,
+        const Profile *profile, long limit);
+
+/*
+ * Print the time spent in every LOOP itself as folded stacks, one line of
+ * semicolon separated enclosing LOOPs followed by nanoseconds per LOOP, as
+ * read by flamegraph.pl and compatible tools.
+ * ARGS     stream  - output stream
+ *          prog    - profiled program
+ *          vars    - variable table the program was parsed with
+ *          profile - timed profile of the program
+ */
+void printFolded(FILE *stream, const Program *prog, const VariableTable *vars,
+        const Profile *profile);
+
+#endif /* PROFILE_H */
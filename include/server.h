@@ -0,0 +1,42 @@
+/*
+ * server.h
+ *
+ * Long-lived server executing LOOP programs for clients connecting through
+ * a Unix domain socket. Programs are parsed and compiled once and kept in a
+ * cache of limited size keyed by the hash of their text, least recently used
+ * programs are evicted first. Every client is served by a thread of its own.
+ *
+ * Requests and replies are lines of text, every request is answered by
+ * exactly one reply, either "OK ..." or "ERROR <message>":
+ *  LOAD <length>                  followed by the program text of length
+ *                                 bytes, replies OK <hash>
+ *  RUN <hash> [<x1> [<x2> ...]]   runs a loaded program, replies OK <x0>
+ *  EVAL <length> [<x1> ...]       followed by the program text, loads and
+ *                                 runs it at once, replies OK <x0>
+ * Hashes are 16 hexadecimal digits. Evicted programs are reported as
+ * "ERROR unknown program" and have to be loaded again.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "engine.h"
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Serve requests on a Unix domain socket until the process is terminated.
+ * An existing file at the path of the socket is replaced.
+ * ARGS     path     - file system path of the socket
+ *          engine   - engine executing all programs
+ *          capacity - number of programs kept in the cache
+ *          passes   - optimiser passes run on every program (see optimise.h)
+ */
+void runServer(const char *path, Engine engine, long capacity, unsigned passes);
+
+#endif /* SERVER_H */
@@ -0,0 +1,88 @@
+/*
+ * simd.h
+ *
+ * Lane parallel executor running one program over several input vectors at
+ * once: 8 on processors supporting AVX2, detected at run time, 4 otherwise.
+ * The register file is kept in structure of arrays form, so every assignment
+ * becomes a vector addition or saturating subtraction (AVX2 or SSE2). LOOPs
+ * run for the largest trip count of all lanes and mask out lanes whose own
+ * count is exhausted, fused LOOPs (fuse.h) run in a single step.
+ *
+ * Lanes only hold machine word values. As soon as any lane reaches 2^63 the
+ * execution is abandoned and the caller is expected to evaluate the lanes
+ * one by one with a scalar engine.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "parser.h"
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define SIMD_LANES 8    // most input vectors executed at once
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Register file of all lanes. Lane l of slot s is regs[s * SIMD_LANES + l],
+ * only the first width lanes of every slot are executed.
+ */
+typedef struct {
+    long slots;         // number of variable slots
+    long width;         // number of lanes executed, see laneWidth
+    uint64_t *regs;     // values of all slots and lanes
+    Value *scalar;      // registers of a single lane for affine LOOPs
+} LaneFile;
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Get the number of lanes executed at once on this processor.
+ * RETURN   SIMD_LANES with AVX2, half of it otherwise
+ */
+long laneWidth(void);
+
+/*
+ * Allocate a zero initialized lane register file.
+ * ARGS     table - table to allocate the registers for
+ * RETURN   pointer to the newly allocated register file
+ */
+LaneFile *createLaneFile(const VariableTable *table);
+
+/*
+ * Free the lane register file.
+ * ARGS     lanes - register file to be freed (may be NULL)
+ */
+void freeLaneFile(LaneFile *lanes);
+
+/*
+ * Set every register of every lane to zero.
+ * ARGS     lanes - register file to be cleared
+ */
+void clearLaneFile(LaneFile *lanes);
+
+/*
+ * Execute the program on all lanes at once.
+ * ARGS     prog  - program to be executed
+ *          lanes - initialized register file
+ * RETURN   false if a value of any lane exceeded the machine word range, the
+ *          registers are undefined in that case
+ */
+bool executeLanes(Program *prog, LaneFile *lanes);
+
+#endif /* SIMD_H */
@@ -0,0 +1,97 @@
+/*
+ * stats.h
+ *
+ * Machine-readable summary of a run for --stats=json: the time spent in
+ * every phase, the size of the program, the work done by the engine and the
+ * peak memory of the process. The lexer is driven by the parser token by
+ * token, so both share the parse phase. Counts an engine does not keep are
+ * reported as null.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "parser.h"
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define STATS_UNKNOWN UINT64_MAX    // count not kept by the engine
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Phases of a run in the order they are passed.
+ */
+typedef enum {
+    PHASE_PARSE,        // lexing and parsing, or loading an image
+    PHASE_OPTIMISE,     // optimiser passes
+    PHASE_ANALYSE,      // superinstructions and closed forms of LOOPs
+    PHASE_PREPARE,      // compiling for the engine
+    PHASE_EXECUTE,      // running the program
+    PHASE_COUNT
+} Phase;
+
+/*
+ * Size of a program by kind of statement.
+ */
+typedef struct {
+    long assignments;
+    long loops;
+    long calls;
+} ProgramSize;
+
+/*
+ * Summary of a run.
+ */
+typedef struct {
+    uint64_t nanos[PHASE_COUNT];    // duration of every phase
+    ProgramSize parsed;             // statements as parsed
+    ProgramSize optimised;          // statements as executed
+    long fused;                     // statements replaced by superinstructions
+    long variables;                 // variable slots including hidden ones
+    uint64_t statements;            // statements executed or STATS_UNKNOWN
+    uint64_t iterations;            // LOOP iterations run or STATS_UNKNOWN
+    const char *requested;          // engine given on the command line
+    const char *engine;             // engine executing after fallbacks
+    bool cached;                    // result taken from the result cache
+    bool exceeded;                  // run stopped by its budget
+} RunStats;
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Count the statements of a program by kind.
+ * ARGS     prog - program to be measured
+ *          size - destination of the counts
+ */
+void measureProgram(const Program *prog, ProgramSize *size);
+
+/*
+ * Get the peak resident memory of the process.
+ * RETURN   peak in KiB or -1 where unknown
+ */
+long peakMemory(void);
+
+/*
+ * Print the summary of a run as a single JSON object.
+ * ARGS     stream - output stream
+ *          stats  - summary of the run
+ */
+void printRunStats(FILE *stream, const RunStats *stats);
+
+#endif /* STATS_H */
@@ -0,0 +1,107 @@
+/*
+ * symbolic.h
+ *
+ * Symbolic execution of whole programs, deriving a closed form of every
+ * variable in terms of the initial values of the variables. Closed forms are
+ * polynomials with natural coefficients over the following atoms:
+ *  x1          - initial value of a variable
+ *  b^e         - power, e.g. of an input raised to another input
+ *  C(n, k)     - binomial coefficient n choose k for a constant k
+ *  geom(a, n)  - geometric sum a^0 + a^1 + ... + a^(n-1)
+ *  max(p - q, 0) - difference as computed by the LOOP subtraction
+ *  [p > 0], [p = 0] - indicators, making the closed forms piecewise
+ *
+ * A LOOP is solved by executing its body once on symbols standing for the
+ * values at the beginning of an iteration, which yields a recurrence for
+ * every variable written in the body. Supported are variables whose new
+ * value does not depend on their old value, variables growing by a sum that
+ * is a polynomial in the iteration counter (x := x + p(k)), variables
+ * multiplied by a loop invariant (x := a * x + b) and variables decreased
+ * by a loop invariant. Variables depending on each other cyclically, e.g.
+ * swapped ones, are not supported unless the LOOP runs a constant number of
+ * iterations of at most SYMBOLIC_UNROLL, in which case it is unrolled.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef SYMBOLIC_H
+#define SYMBOLIC_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "parser.h"
+#include "value.h"
+#include "var.h"
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define SYMBOLIC_UNROLL 16          // LOOPs of constant limit unrolled at most
+#define SYMBOLIC_MAX_TERMS 1024     // terms of a single closed form
+#define SYMBOLIC_MAX_DEGREE 32      // degree of sums over the iteration counter
+#define SYMBOLIC_MAX_DEPTH 256      // nesting of LOOPs and of atoms
+#define SYMBOLIC_BUDGET (1L << 22)  // terms created while solving a program
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+typedef struct sClosedForm ClosedForm;
+
+/*
+ * Reason for a program having no closed form.
+ */
+typedef struct {
+    const char *reason;     // static description
+    uint32_t line;          // source line of the offending statement, 0 if none
+    long var;               // identifier of the offending variable, -1 if none
+} SymbolicFailure;
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Derive the closed forms of all variables written by a program.
+ * ARGS     prog    - parsed program, not modified
+ *          vars    - variable table the program was parsed with
+ *          failure - destination of the reason if there is no closed form
+ * RETURN   pointer to the newly allocated closed forms, NULL if any written
+ *          variable lies outside the supported class
+ */
+ClosedForm *compileClosedForm(const Program *prog, const VariableTable *vars,
+        SymbolicFailure *failure);
+
+/*
+ * Print the closed form of x0, assuming it starts as zero.
+ * ARGS     stream - output stream
+ *          form   - closed forms of the program
+ */
+void printClosedForm(FILE *stream, const ClosedForm *form);
+
+/*
+ * Print the reason for a program having no closed form.
+ * ARGS     stream  - output stream
+ *          failure - reason reported by compileClosedForm
+ */
+void printSymbolicFailure(FILE *stream, const SymbolicFailure *failure);
+
+/*
+ * Evaluate the closed forms instead of executing the program.
+ * ARGS     form - closed forms of the program
+ *          regs - initialized register file indexed by variable slots
+ */
+void executeClosedForm(const ClosedForm *form, Value *regs);
+
+/*
+ * Release closed forms.
+ * ARGS     form - closed forms (may be NULL)
+ */
+void freeClosedForm(ClosedForm *form);
+
+#endif /* SYMBOLIC_H */
@@ -1,7 +1,10 @@
 /*
  * token.h
  *
- * Simple lexer reading character by character and natural numbers.
+ * Simple lexer for LOOP programs. The whole input is mapped into memory (or
+ * read into one buffer if the stream cannot be mapped) and scanned with
+ * plain pointer loops. All state lives in a lexer object, so any number of
+ * streams can be lexed at once.
  *
  * Tom René Hennig
  */
@@ -9,8 +12,11 @@
 #ifndef TOKEN_H
 #define TOKEN_H
 
+#include <stddef.h>
 #include <stdio.h>
 
+#include "value.h"
+
 
 /******************************************************************************
  *                             TYPE DECLARATIONS
@@ -29,37 +35,65 @@ typedef enum {
     TOK_LOOP,       // keyword 'LOOP'
     TOK_DO,         // keyword 'DO'
     TOK_END,        // keyword 'END'
+    TOK_MACRO,      // keyword 'MACRO'
+    TOK_NAME,       // macro name of lower case letters, '_' and digits
+    TOK_LPAREN,     // opening parenthesis '('
+    TOK_RPAREN,     // closing parenthesis ')'
+    TOK_COMMA,      // comma ','
     TOK_EOF,        // reached end of file
     TOK_INVALID     // invalid token
 } TokenType;
 
 /*
  * Token consisting of its type and content. The content clearly depends on the
- * type. Variable identifiers, natural numbers and character IDs of ivalid
- * tokens are casted to long.
+ * type. Variable identifiers and character IDs of ivalid tokens are casted to
+ * long, natural numbers are of arbitrary precision. Names point into the input
+ * of the lexer and are only valid as long as the lexer, value holds their
+ * length. Line and column of the first character start counting at 1.
  */
 typedef struct {
     TokenType type;
     long value;
+    Value nat;
+    const char *text;
+    long line;
+    long column;
 } Token;
 
+typedef struct sLexer Lexer;
+
 
 /******************************************************************************
  *                            FUNCTION DECLARATIONS
  */
 
 /*
- * Read next token from given input stream, return value is stack object.
+ * Create a lexer over the remaining content of the stream. The content is
+ * consumed completely, the stream stays open.
  */
-Token nextToken(FILE *stream);
+Lexer *createLexer(FILE *stream);
 
 /*
- * Place already read token back in the imaginary token stream. Buffer size is
- * one and this call halts program on overflow. Cannot distinguish between
- * different streams!
+ * Create a lexer over a program text in memory. The text is not copied and
+ * has to outlive the lexer.
+ */
+Lexer *createTextLexer(const char *text, size_t length);
+
+/*
+ * Release the lexer and its input buffer or mapping.
  */
-void pushToken(Token tok);
+void freeLexer(Lexer *lex);
 
+/*
+ * Read next token of the lexer input, return value is stack object.
+ */
+Token nextToken(Lexer *lex);
+
+/*
+ * Place already read token back in the imaginary token stream. Buffer size is
+ * one and this call halts program on overflow.
+ */
+void pushToken(Lexer *lex, Token tok);
 
 /*
  * Print type and content in short form to given stream.
@@ -0,0 +1,89 @@
+/*
+ * transpile.h
+ *
+ * Ahead-of-time backend translating the syntax/semantics tree into a C
+ * function. The function either gets printed for use in other projects or is
+ * compiled into a shared object by the system C compiler and loaded with
+ * dlopen. Shared objects are cached on disk keyed by a hash of the program
+ * text, so recurring programs pay the compilation once.
+ *
+ * The cache directory is $LOOP_CACHE_DIR, $XDG_CACHE_HOME/loop or
+ * $HOME/.cache/loop (first one set), the compiler is $CC or cc.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef TRANSPILE_H
+#define TRANSPILE_H
+
+#include <stdint.h>
+
+#include "parser.h"
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Helpers of the host process called by the generated code for all cases
+ * beyond the machine word fast path. The tables list all assignments, all
+ * affine LOOP summaries and all fused LOOPs in program order.
+ */
+typedef struct {
+    void (*assign)(Value *regs, const void *ass);
+    void (*affine)(const void *loop, Value limit, Value *regs);
+    void (*fused)(const void *prog, const void *loop, Value *regs);
+    const void **assignments;
+    const void **affineLoops;
+    const void **fusedLoops;
+    const void *program;        // program holding the fused LOOPs
+} LoopRuntime;
+
+/*
+ * Loaded shared object of a program.
+ */
+typedef struct {
+    void *handle;                                   // handle from dlopen
+    void (*entry)(Value *, const LoopRuntime *);    // generated function
+    LoopRuntime runtime;                            // helpers passed to entry
+} SharedCode;
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Print the program as standalone C function loop_run(regs, runtime).
+ * ARGS     stream - output file stream
+ *          prog   - program to be translated
+ *          vars   - variable table the program was parsed with
+ */
+void emitC(FILE *stream, Program *prog, const VariableTable *vars);
+
+/*
+ * Load the shared object of a program from the cache, compiling it first if
+ * necessary.
+ * ARGS     prog - program to be translated
+ *          vars - variable table the program was parsed with
+ *          hash - hash of the program text
+ * RETURN   pointer to the newly loaded code or NULL if compiling or loading
+ *          failed or is not supported on this platform
+ */
+SharedCode *compileShared(Program *prog, const VariableTable *vars, uint64_t hash);
+
+/*
+ * Unload the shared object.
+ * ARGS     code - code to be unloaded (may be NULL)
+ */
+void freeShared(SharedCode *code);
+
+/*
+ * Execute the compiled program on the given register file.
+ * ARGS     code - loaded program
+ *          regs - initialized register file indexed by variable slots
+ */
+void executeShared(const SharedCode *code, Value *regs);
+
+#endif /* TRANSPILE_H */
@@ -0,0 +1,190 @@
+/*
+ * value.h
+ *
+ * Natural numbers of arbitrary precision. Values below 2^63 are stored
+ * directly in a machine word, so the common case costs a single test of the
+ * most significant bit. Larger values are stored as reference counted,
+ * immutable big numbers whose address is kept in the remaining bits.
+ *
+ * Ownership: every function returning a Value returns a new reference, that
+ * has to be handed back with valueRelease once it is no longer needed.
+ * Operands are only borrowed.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef VALUE_H
+#define VALUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Tagged natural number, see above.
+ */
+typedef uint64_t Value;
+
+#define VALUE_BIG       ((Value)1 << 63)    // tag of big numbers
+#define VALUE_MAX_SMALL (VALUE_BIG - 1)     // largest directly stored value
+
+/*
+ * Big number as little endian array of 32 bit limbs. The number is always
+ * normalized, i.e. it is at least 2^63 and its most significant limb is not
+ * zero.
+ */
+typedef struct sBigNum {
+    long refs;          // reference count, zero marks an immortal number
+    long length;        // number of limbs
+    uint32_t limbs[];   // limbs, least significant first
+} BigNum;
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Slow paths of the inline functions below, never call them directly.
+ */
+Value valueAddSlow(Value a, Value b);
+Value valueSubSlow(Value a, Value b);
+void valueRetainSlow(Value v);
+void valueReleaseSlow(Value v);
+
+/*
+ * Access the big number of a tagged value.
+ * ARGS     v - value with VALUE_BIG set
+ * RETURN   pointer to the big number
+ */
+static inline BigNum *valueBig(Value v)
+{
+    return (BigNum *)(uintptr_t)(v & ~VALUE_BIG);
+}
+
+/*
+ * Compute a + b.
+ * RETURN   new reference to the sum
+ */
+static inline Value valueAdd(Value a, Value b)
+{
+    Value res = a + b;
+    if (((a | b | res) & VALUE_BIG) == 0)
+        return res;
+    return valueAddSlow(a, b);
+}
+
+/*
+ * Compute max(a - b, 0).
+ * RETURN   new reference to the difference
+ */
+static inline Value valueSub(Value a, Value b)
+{
+    if (((a | b) & VALUE_BIG) == 0)
+        return a > b ? a - b : 0;
+    return valueSubSlow(a, b);
+}
+
+/*
+ * Acquire another reference to a value.
+ * RETURN   the value itself
+ */
+static inline Value valueRetain(Value v)
+{
+    if (v & VALUE_BIG)
+        valueRetainSlow(v);
+    return v;
+}
+
+/*
+ * Hand back a reference to a value, big numbers are freed with their last
+ * reference.
+ */
+static inline void valueRelease(Value v)
+{
+    if (v & VALUE_BIG)
+        valueReleaseSlow(v);
+}
+
+/*
+ * Number of iterations of a LOOP over the given value. Big numbers saturate,
+ * which is indistinguishable from the exact count in practice.
+ * RETURN   value as unsigned integer
+ */
+static inline uint64_t valueToCount(Value v)
+{
+    return (v & VALUE_BIG) ? UINT64_MAX : v;
+}
+
+/*
+ * Compute a * b, using Karatsuba multiplication for long operands.
+ * RETURN   new reference to the product
+ */
+Value valueMul(Value a, Value b);
+
+/*
+ * Compare two values.
+ * RETURN   negative, zero or positive if a is less, equal or greater than b
+ */
+int valueCompare(Value a, Value b);
+
+/*
+ * Number of significant bits of a value.
+ * RETURN   position of the highest set bit plus one (0 for zero)
+ */
+uint64_t valueBitLength(Value v);
+
+/*
+ * Test a single bit of a value.
+ * ARGS     v   - value to be tested
+ *          bit - position of the bit, 0 is the least significant
+ * RETURN   true if the bit is set
+ */
+bool valueBit(Value v, uint64_t bit);
+
+/*
+ * Make a value immortal, so it can be shared read-only (e.g. between
+ * threads) without reference counting. Used for program constants.
+ * RETURN   the value itself
+ */
+Value valueFreeze(Value v);
+
+/*
+ * Copy the limbs of a value, least significant first, without leading zeros.
+ * ARGS     v        - value to be copied
+ *          limbs    - destination of the limbs
+ *          capacity - number of limbs the destination holds
+ * RETURN   number of limbs of the value, nothing is copied if it exceeds
+ *          the capacity
+ */
+long valueToLimbs(Value v, uint32_t *limbs, long capacity);
+
+/*
+ * Create a value from limbs as copied by valueToLimbs.
+ * ARGS     limbs  - limbs, least significant first
+ *          length - number of limbs
+ * RETURN   new reference to the value
+ */
+Value valueFromLimbs(const uint32_t *limbs, long length);
+
+/*
+ * Parse a decimal natural number.
+ * ARGS     str - null terminated string of decimal digits
+ *          res - destination of the new reference on success
+ * RETURN   false if the string is empty or contains any other character
+ */
+bool valueParse(const char *str, Value *res);
+
+/*
+ * Print the decimal representation of a value to stream.
+ * ARGS     stream - output file stream
+ *          v      - value to be printed
+ */
+void valuePrint(FILE *stream, Value v);
+
+#endif /* VALUE_H */
@@ -1,8 +1,10 @@
 /*
  * var.h
  *
- * Simple linked list to hold a list of variables containing of an identifier
- * and a value (both on long).
+ * Variable table interning the (possibly sparse) identifiers of a LOOP program
+ * into dense slot indices. The parser resolves every variable identifier to
+ * its slot, so the executor can work on a contiguous register file instead of
+ * searching for identifiers at runtime.
  *
  * Tom René Hennig
  */
@@ -10,58 +12,82 @@
 #ifndef VAR_H
 #define VAR_H
 
+#include "value.h"
+
 
 /******************************************************************************
  *                             TYPE DECLARATIONS
  */
 
 /*
- * Variable as an element of a single linked list.
+ * Mapping between variable identifiers and slots. The identifiers are kept in
+ * slot order, the reverse mapping is an open addressing hash table, so huge
+ * identifiers like x1000000 cost a single slot only.
+ */
+typedef struct {
+    long *ids;          // identifier of every used slot
+    long *hash;         // hash table of slot + 1 (0 marks an empty bucket)
+    long count;         // number of used slots
+    long capacity;      // number of allocated entries in ids
+    long hashSize;      // number of buckets in hash (power of two)
+} VariableTable;
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Allocate a new and empty variable table.
+ * RETURN   pointer to the newly allocated table
  */
-typedef struct sVariable{
-    long id;
-    long value;
-    struct sVariable *next;
-} Variable;
+VariableTable *createVariableTable(void);
 
 /*
- * Definition of a list as an pointer to its first elelement
+ * Free the table and all of its buffers.
+ * ARGS     table - table to be freed (may be NULL)
  */
-typedef struct sVariable *VariableList;
+void freeVariableTable(VariableTable *table);
 
+/*
+ * Look up the slot of given identifier and allocate the next free slot, if
+ * the identifier is not yet known.
+ * ARGS     table - table to search for identifier
+ *          id    - identifier of variable to be searched for
+ * RETURN   slot index of the variable
+ */
+long internVariable(VariableTable *table, long id);
 
-/******************************************************************************
- *                            FUNCTION DECLARATIONS
+/*
+ * Look up the slot of given identifier without modifying the table.
+ * ARGS     table - table to search for identifier
+ *          id    - identifier of variable to be searched for
+ * RETURN   slot index of the variable or -1 if it is not in the table
  */
+long lookupVariable(const VariableTable *table, long id);
 
 /*
- * Add a variable to the list returning the list (necessary to allocate a new
- * listin case it was emtpy). If the identifier is already allocated nothing
- * is modified.
- * ARGS     list - list handle to add variable to
- *          id   - identifier of new variable
- * RETURN   possibly new handle of the list
+ * Allocate a register file with one zero initialized value per slot.
+ * ARGS     table - table to allocate the registers for
+ * RETURN   pointer to the first register
  */
-VariableList addVariable(VariableList list, long id);
+Value *createRegisters(const VariableTable *table);
 
 /*
- * Look up value of given identifier, add new variable to the list and
- * initialize it to zero, if it is not yet allocated.
- * WARNING: cannot add variables to an empty list!
- * ARGS     list - list to search for identifier
- *          id   - identifier of variable to be searched for
- * RETURN   value of the searched variable (0 if it has not been allocated yet)
+ * Release all values of a register file and set every register to zero.
+ * ARGS     table - table the registers were allocated for
+ *          regs  - register file to be cleared
  */
-long getValue(VariableList list, long id);
+void clearRegisters(const VariableTable *table, Value *regs);
 
 /*
- * Set the value of an variable in the given list, allocates a new variable
- * if necessary.
- * WARNING: cannot add variables to an empty list!
- * ARGS     list  - list to modify the value of variable identifier
- *          id    - identifier to search for
- *          value - new value of variable identifier
+ * Store input values x1 ... xn in their registers. Inputs the program never
+ * refers to cannot influence the result and are released right away.
+ * ARGS     table  - table the registers were allocated for
+ *          regs   - register file to be initialized
+ *          inputs - new references to the values of x1, x2, ...
+ *          count  - number of inputs
  */
-void setValue(VariableList list, long id, long value);
+void storeInputs(const VariableTable *table, Value *regs, const Value *inputs, long count);
 
 #endif
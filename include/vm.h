@@ -0,0 +1,99 @@
+/*
+ * vm.h
+ *
+ * Compiler lowering the syntax/semantics tree into a flat instruction array
+ * and a virtual machine executing it without recursion. LOOPs become a pair
+ * of LOOP/END instructions jumping to each other, the remaining iterations
+ * are kept on a separate counter stack. Macro bodies are compiled once and
+ * called, their return addresses are kept on the counter stack as well.
+ * Copies and fused LOOPs (fuse.h) become superinstructions.
+ *
+ * Tom René Hennig
+ */
+
+#ifndef VM_H
+#define VM_H
+
+#include <stdbool.h>
+
+#include "budget.h"
+#include "parser.h"
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Instruction set of the virtual machine.
+ */
+typedef enum {
+    OP_ADD,         // regs[a] := regs[b] + nat
+    OP_SUB,         // regs[a] := max(regs[b] - nat, 0)
+    OP_COPY,        // regs[a] := regs[b]
+    OP_ADD_VAR,     // regs[a] := regs[a] + nat * regs[b]
+    OP_SUB_VAR,     // regs[a] := max(regs[a] - nat * regs[b], 0)
+    OP_ZERO,        // regs[a] := 0
+    OP_MUL_ADD,     // regs[a] := regs[a] + nat * regs[b] * regs[c], c in OP_OPERAND
+    OP_OPERAND,     // third operand a of the preceding instruction, never executed
+    OP_AFFINE,      // apply affine[nat] regs[a] times and jump to b if worthwhile
+    OP_LOOP,        // push regs[a] onto counter stack, jump to b if zero
+    OP_END,         // decrement counter, jump to b unless it reached zero
+    OP_CALL,        // push the return address onto counter stack, jump to b
+    OP_RET,         // pop the return address and jump to it
+    OP_HALT         // stop execution
+} Opcode;
+
+/*
+ * Single instruction with up to three operands. Jump targets are absolute
+ * instruction indices.
+ */
+typedef struct {
+    Opcode op;
+    long a;
+    long b;
+    NatNum nat;
+} Instruction;
+
+/*
+ * Compiled program.
+ */
+typedef struct {
+    Instruction *code;  // instruction array terminated by OP_HALT
+    long length;        // number of used instructions
+    long capacity;      // number of allocated instructions
+    long maxDepth;      // maximum LOOP and call nesting depth (counter stack size)
+    long entry;         // first instruction of the program behind the macros
+    const struct sAffineLoop **affine;  // summaries referenced by OP_AFFINE
+    long affineCount;   // number of summaries
+} Bytecode;
+
+
+/******************************************************************************
+ *                            FUNCTION DECLARATIONS
+ */
+
+/*
+ * Lower the syntax/semantics tree into bytecode.
+ * ARGS     prog - program to be compiled
+ * RETURN   pointer to the newly allocated bytecode
+ */
+Bytecode *compileProgram(Program *prog);
+
+/*
+ * Free the bytecode and its instruction array.
+ * ARGS     code - bytecode to be freed (may be NULL)
+ */
+void freeBytecode(Bytecode *code);
+
+/*
+ * Execute bytecode on the given register file.
+ * ARGS     code   - compiled program
+ *          regs   - initialized register file indexed by variable slots
+ *          budget - started budget of the run or NULL for no limits
+ * RETURN   false if the budget was exceeded, the registers then hold the
+ *          values at the point of stopping
+ */
+bool executeBytecode(const Bytecode *code, Value *regs, Budget *budget);
+
+#endif /* VM_H */
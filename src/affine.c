@@ -0,0 +1,455 @@
+/*
+ * affine.c
+ *
+ * Closed-form acceleration of LOOPs whose body is an affine transformation of
+ * the variables. A body qualifies if it contains additions, copies (a
+ * subtraction of zero) and nested LOOPs only, and if no variable controlling
+ * a nested LOOP is written inside the body. Then every iteration applies the
+ * same affine map, which is raised to the power of the LOOP limit by repeated
+ * squaring instead of iterating.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "affine.h"
+#include "alloc.h"
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define AFFINE_BUDGET 16    // statements scanned per statement of the program
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Affine map over the touched variables of a LOOP: the new value of variable
+ * i is the old value of variable src[i] plus off[i], or off[i] alone if
+ * src[i] is negative.
+ */
+typedef struct {
+    long *src;
+    Value *off;
+} Map;
+
+/*
+ * Sequence of operations whose map is being computed: the body of a nested
+ * LOOP or the whole summary.
+ */
+typedef struct {
+    Map map;        // map of the operations passed so far
+    long end;       // index one past the last operation of the sequence
+    long loop;      // operation of the enclosing LOOP, -1 for the outermost
+} MapFrame;
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Check that all statements of a body are additions, copies or LOOPs and
+ * determine the highest slot used. Macro calls are not followed.
+ * ARGS     prog - program holding the body
+ *          loop - LOOP whose body is scanned including all nested bodies
+ * RETURN   highest slot used or -1 if the body is not affine
+ */
+static long scanBody(const Program *prog, const Loop *loop)
+{
+    long maxSlot = 0;
+    for (NodeIndex i = loop->body; i < loop->end; ++i) {
+        const Statement *stat = programNode(prog, i);
+        if (stat->type == STAT_ASSIGNMENT) {
+            const Assignment *ass = &stat->as.assignment;
+            if (!ass->isAddition && ass->nat != 0)
+                return -1;
+            if (ass->lvalue > maxSlot)
+                maxSlot = ass->lvalue;
+            if (ass->rvalue > maxSlot)
+                maxSlot = ass->rvalue;
+        } else if (stat->type == STAT_CALL) {
+            return -1;
+        } else if (stat->as.loop.var > maxSlot) {
+            maxSlot = stat->as.loop.var;
+        }
+    }
+    return maxSlot;
+}
+
+/*
+ * Check that no nested LOOP of a body is controlled by a variable written
+ * inside the body.
+ * ARGS     prog    - program holding the body
+ *          loop    - LOOP whose body is checked
+ *          written - flags indexed by slot, all false, used as scratch space
+ * RETURN   true if all nested LOOP limits are invariant
+ */
+static bool hasInvariantLimits(const Program *prog, const Loop *loop, bool *written)
+{
+    for (NodeIndex i = loop->body; i < loop->end; ++i) {
+        const Statement *stat = programNode(prog, i);
+        if (stat->type == STAT_ASSIGNMENT)
+            written[stat->as.assignment.lvalue] = true;
+    }
+    for (NodeIndex i = loop->body; i < loop->end; ++i) {
+        const Statement *stat = programNode(prog, i);
+        if (stat->type == STAT_LOOP && written[stat->as.loop.var])
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Translate a register slot to the index of a touched variable, adding it to
+ * the summary if necessary.
+ * ARGS     sum   - summary to add variable to
+ *          local - touched variable index by slot (-1 if not yet touched)
+ *          slot  - register slot
+ * RETURN   index of the touched variable
+ */
+static long touch(AffineLoop *sum, long *local, long slot)
+{
+    if (local[slot] < 0) {
+        local[slot] = sum->count;
+        sum->slots[sum->count++] = slot;
+    }
+    return local[slot];
+}
+
+/*
+ * Append the operations of a body to the summary. Operations are stored in
+ * program order just like the statements in the arena, so a nested LOOP
+ * covers as many operations as it has nested statements.
+ * ARGS     sum   - summary to append to
+ *          local - touched variable index by slot
+ *          prog  - program holding the body
+ *          loop  - LOOP whose body is appended
+ */
+static void appendOps(AffineLoop *sum, long *local, const Program *prog, const Loop *loop)
+{
+    for (NodeIndex i = loop->body; i < loop->end; ++i) {
+        const Statement *stat = programNode(prog, i);
+        AffineOp *op = &sum->ops[sum->length++];
+        if (stat->type == STAT_ASSIGNMENT) {
+            const Assignment *ass = &stat->as.assignment;
+            op->isLoop = false;
+            op->a = touch(sum, local, ass->lvalue);
+            op->b = touch(sum, local, ass->rvalue);
+            op->nat = ass->isAddition ? ass->nat : 0;
+            op->length = 0;
+        } else {
+            const Loop *nested = &stat->as.loop;
+            op->isLoop = true;
+            op->a = touch(sum, local, nested->var);
+            op->b = 0;
+            op->nat = 0;
+            op->length = nested->end - nested->body;
+        }
+    }
+}
+
+/*
+ * Build the summary of a LOOP if its body is affine. The summary is owned by
+ * the program and released by freeProgram.
+ * ARGS     prog - program holding the LOOP
+ *          loop - LOOP to be summarised
+ * RETURN   newly allocated summary or NULL if the body is not affine
+ */
+static AffineLoop *summariseLoop(Program *prog, const Loop *loop)
+{
+    long maxSlot = scanBody(prog, loop);
+    if (maxSlot < 0)
+        return NULL;
+    
+    bool *written = allocateZeroed(maxSlot + 1, sizeof(bool));
+    bool invariant = hasInvariantLimits(prog, loop, written);
+    free(written);
+    if (!invariant)
+        return NULL;
+    
+    long statements = loop->end - loop->body;
+    AffineLoop *sum = programAlloc(prog, sizeof(AffineLoop));
+    sum->count = 0;
+    sum->length = 0;
+    sum->slots = programAlloc(prog, 2 * statements * sizeof(long));
+    sum->ops = programAlloc(prog, statements * sizeof(AffineOp));
+    long *local = allocate((maxSlot + 1) * sizeof(long));
+    for (long i = 0; i <= maxSlot; ++i)
+        local[i] = -1;
+    appendOps(sum, local, prog, loop);
+    free(local);
+    return sum;
+}
+
+/*
+ * Search the program for LOOPs with affine bodies and attach a summary to
+ * each of them (Loop.affine), all other LOOPs keep a NULL summary.
+ * ARGS     prog - program to be analysed
+ */
+void analyseAffineLoops(Program *prog)
+{
+    // input check
+    if (prog == NULL) {
+        fprintf(stderr, "ERROR: cannot analyse missing program\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    // every LOOP is summarised on its own, so the summaries of deeply nested
+    // LOOPs add up quadratically; the innermost LOOPs run most often and are
+    // summarised first until the budget is used up
+    size_t budget = (size_t)AFFINE_BUDGET * prog->count;
+    for (NodeIndex i = prog->count - 1; i > 0; --i) {
+        Statement *stat = programNode(prog, i);
+        if (stat->type != STAT_LOOP)
+            continue;
+        size_t statements = stat->as.loop.end - stat->as.loop.body;
+        if (statements > budget)
+            continue;
+        stat->as.loop.affine = summariseLoop(prog, &stat->as.loop);
+        budget -= statements;
+    }
+}
+
+/*
+ * Decide whether a LOOP is worth being accelerated.
+ * ARGS     loop  - summary of the LOOP
+ *          limit - number of iterations
+ * RETURN   true if repeated squaring is cheaper than iterating
+ */
+bool isAffineWorthwhile(const AffineLoop *loop, Value limit)
+{
+    // big numbers are tagged by the most significant bit and thus large
+    return loop != NULL && limit >= AFFINE_MIN_LIMIT;
+}
+
+/*
+ * Allocate an affine map over n variables.
+ * ARGS     n - number of variables
+ * RETURN   map with unspecified sources and zero offsets
+ */
+static Map createMap(long n)
+{
+    Map map;
+    map.src = allocate(n * sizeof(long));
+    map.off = allocateZeroed(n, sizeof(Value));
+    return map;
+}
+
+/*
+ * Free the entries of a map.
+ * ARGS     map - map to be freed
+ *          n   - number of variables
+ */
+static void freeMap(Map map, long n)
+{
+    for (long i = 0; i < n; ++i)
+        valueRelease(map.off[i]);
+    free(map.src);
+    free(map.off);
+}
+
+/*
+ * Exchange the entries of two maps.
+ */
+static void swapMaps(Map *a, Map *b)
+{
+    Map tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+/*
+ * Initialize a map to the identity.
+ * ARGS     map - map to be initialized
+ *          n   - number of variables
+ */
+static void setIdentity(Map map, long n)
+{
+    for (long i = 0; i < n; ++i) {
+        valueRelease(map.off[i]);
+        map.src[i] = i;
+        map.off[i] = 0;
+    }
+}
+
+/*
+ * Compute the map applying first and then second. The result may not alias
+ * any of the operands.
+ * ARGS     res    - resulting map
+ *          first  - map applied first
+ *          second - map applied second
+ *          n      - number of variables
+ */
+static void compose(Map res, Map first, Map second, long n)
+{
+    for (long i = 0; i < n; ++i) {
+        long src = second.src[i];
+        valueRelease(res.off[i]);
+        if (src < 0) {
+            res.src[i] = -1;
+            res.off[i] = valueRetain(second.off[i]);
+        } else {
+            res.src[i] = first.src[src];
+            res.off[i] = valueAdd(first.off[src], second.off[i]);
+        }
+    }
+}
+
+/*
+ * Raise a map to the given power.
+ * ARGS     res  - resulting map (may not alias base)
+ *          base - map to be raised, overwritten during computation
+ *          exp  - exponent
+ *          n    - number of variables
+ */
+static void power(Map *res, Map *base, Value exp, long n)
+{
+    setIdentity(*res, n);
+    if (exp == 0)
+        return;
+    
+    // a map only incrementing or resetting variables is multiplied directly
+    bool stationary = true;
+    for (long i = 0; i < n && stationary; ++i)
+        stationary = base->src[i] == i || base->src[i] < 0;
+    if (stationary) {
+        for (long i = 0; i < n; ++i) {
+            res->src[i] = base->src[i];
+            if (base->src[i] < 0)
+                res->off[i] = valueRetain(base->off[i]);
+            else
+                res->off[i] = valueMul(base->off[i], exp);
+        }
+        return;
+    }
+    
+    // repeated squaring, powers of the same map commute
+    Map tmp = createMap(n);
+    uint64_t bits = valueBitLength(exp);
+    for (uint64_t bit = 0; bit < bits; ++bit) {
+        if (valueBit(exp, bit)) {
+            compose(tmp, *res, *base, n);
+            swapMaps(res, &tmp);
+        }
+        if (bit + 1 < bits) {
+            compose(tmp, *base, *base, n);
+            swapMaps(base, &tmp);
+        }
+    }
+    freeMap(tmp, n);
+}
+
+/*
+ * Compute the map of a single pass over the body of a LOOP. Limits of nested
+ * LOOPs are invariant, so they are read from the register file.
+ * ARGS     loop - summary of the LOOP
+ *          map  - resulting map
+ *          regs - register file indexed by variable slots
+ */
+static void summariseBody(const AffineLoop *loop, Map *map, const Value *regs)
+{
+    long n = loop->count;
+    MapFrame *frames = allocate(64 * sizeof(MapFrame));
+    size_t depth = 1, capacity = 64;
+    frames[0].map = *map;
+    frames[0].end = loop->length;
+    frames[0].loop = -1;
+    setIdentity(frames[0].map, n);
+    
+    Map pow = createMap(n);
+    Map tmp = createMap(n);
+    long i = 0;
+    for (;;) {
+        MapFrame *top = &frames[depth - 1];
+        if (i == top->end) {
+            if (depth == 1)
+                break;
+            
+            // end of a nested LOOP: raise its body map to its limit and
+            // append it to the enclosing sequence
+            Map *outer = &frames[depth - 2].map;
+            power(&pow, &top->map, regs[loop->slots[loop->ops[top->loop].a]], n);
+            compose(tmp, *outer, pow, n);
+            swapMaps(outer, &tmp);
+            freeMap(top->map, n);
+            --depth;
+            continue;
+        }
+        
+        const AffineOp *op = &loop->ops[i];
+        if (!op->isLoop) {
+            Value off = valueAdd(top->map.off[op->b], op->nat);
+            valueRelease(top->map.off[op->a]);
+            top->map.src[op->a] = top->map.src[op->b];
+            top->map.off[op->a] = off;
+            ++i;
+            continue;
+        }
+        
+        // nested LOOP: its body starts a new sequence
+        if (depth == capacity) {
+            capacity *= 2;
+            frames = reallocate(frames, capacity, sizeof(MapFrame));
+        }
+        frames[depth].map = createMap(n);
+        frames[depth].end = i + 1 + op->length;
+        frames[depth].loop = i;
+        setIdentity(frames[depth].map, n);
+        ++depth;
+        ++i;
+    }
+    
+    *map = frames[0].map;
+    freeMap(pow, n);
+    freeMap(tmp, n);
+    free(frames);
+}
+
+/*
+ * Apply the LOOP body limit times to the register file in closed form.
+ * ARGS     loop  - summary of the LOOP
+ *          limit - number of iterations
+ *          regs  - register file indexed by variable slots
+ */
+void executeAffineLoop(const AffineLoop *loop, Value limit, Value *regs)
+{
+    // input check
+    if (loop == NULL || regs == NULL) {
+        fprintf(stderr, "ERROR: cannot execute missing LOOP summary or without registers\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    long n = loop->count;
+    Map body = createMap(n);
+    Map total = createMap(n);
+    summariseBody(loop, &body, regs);
+    power(&total, &body, limit, n);
+    
+    // all new values depend on the old ones, so compute them first
+    Value *values = allocate(n * sizeof(Value));
+    for (long i = 0; i < n; ++i) {
+        long src = total.src[i];
+        values[i] = valueAdd(src < 0 ? 0 : regs[loop->slots[src]], total.off[i]);
+    }
+    for (long i = 0; i < n; ++i) {
+        valueRelease(regs[loop->slots[i]]);
+        regs[loop->slots[i]] = values[i];
+    }
+    
+    free(values);
+    freeMap(body, n);
+    freeMap(total, n);
+}
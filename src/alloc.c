@@ -0,0 +1,75 @@
+/*
+ * alloc.c
+ *
+ * Memory allocation that terminates the interpreter on failure.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "alloc.h"
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Allocate memory and terminate on failure.
+ * ARGS     size - number of bytes, 0 allocates a minimal block
+ * RETURN   pointer to the allocated memory
+ */
+void *allocate(size_t size)
+{
+    void *ptr = malloc(size > 0 ? size : 1);
+    if (ptr == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+/*
+ * Allocate zeroed memory and terminate on failure.
+ * ARGS     count - number of elements, 0 allocates a minimal block
+ *          size  - size of one element
+ * RETURN   pointer to the allocated memory
+ */
+void *allocateZeroed(size_t count, size_t size)
+{
+    void *ptr = calloc(count > 0 ? count : 1, size);
+    if (ptr == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+/*
+ * Resize an array and terminate on failure.
+ * ARGS     ptr   - array to be resized or NULL
+ *          count - new number of elements, 0 keeps a minimal block
+ *          size  - size of one element
+ * RETURN   pointer to the resized array
+ */
+void *reallocate(void *ptr, size_t count, size_t size)
+{
+    if (count > 0 && size > SIZE_MAX / count) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    ptr = realloc(ptr, count > 0 ? count * size : 1);
+    if (ptr == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
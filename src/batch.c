@@ -0,0 +1,200 @@
+/*
+ * batch.c
+ *
+ * Reader for input vectors of the batch mode, see batch.h for the formats.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Allocate a reader for input vectors.
+ * ARGS     stream - stream to read from
+ *          binary - true for binary records, false for text lines
+ * RETURN   pointer to the newly allocated reader
+ */
+BatchReader *createBatchReader(FILE *stream, bool binary)
+{
+    // input check
+    if (stream == NULL) {
+        fprintf(stderr, "ERROR: cannot read input vectors from missing stream\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    BatchReader *reader = calloc(1, sizeof(BatchReader));
+    if (reader == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    reader->stream = stream;
+    reader->binary = binary;
+    return reader;
+}
+
+/*
+ * Free the reader and all of its buffers, the stream is not closed.
+ * ARGS     reader - reader to be freed (may be NULL)
+ */
+void freeBatchReader(BatchReader *reader)
+{
+    if (reader == NULL)
+        return;
+    free(reader->line);
+    free(reader->inputs);
+    free(reader);
+}
+
+/*
+ * Append a value to the current input vector.
+ * ARGS     reader - reader holding the vector
+ *          count  - number of values already in the vector
+ *          v      - value to be appended
+ */
+static void appendInput(BatchReader *reader, long count, Value v)
+{
+    if (count == reader->capacity) {
+        reader->capacity = reader->capacity > 0 ? 2 * reader->capacity : 16;
+        reader->inputs = realloc(reader->inputs, reader->capacity * sizeof(Value));
+        if (reader->inputs == NULL) {
+            fprintf(stderr, "ERROR: unable to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    reader->inputs[count] = v;
+}
+
+/*
+ * Read a line of arbitrary length into the line buffer.
+ * ARGS     reader - reader to read from
+ * RETURN   false at the end of the stream
+ */
+static bool readLine(BatchReader *reader)
+{
+    size_t used = 0;
+    for (;;) {
+        if (reader->lineSize - used < 2) {
+            reader->lineSize = reader->lineSize > 0 ? 2 * reader->lineSize : 4096;
+            reader->line = realloc(reader->line, reader->lineSize);
+            if (reader->line == NULL) {
+                fprintf(stderr, "ERROR: unable to allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (fgets(reader->line + used, (int)(reader->lineSize - used), reader->stream) == NULL)
+            return used > 0;
+        used += strlen(reader->line + used);
+        if (reader->line[used - 1] == '\n')
+            return true;
+    }
+}
+
+/*
+ * Read the next text line holding at least one value.
+ */
+static long readTextBatch(BatchReader *reader)
+{
+    for (;;) {
+        if (!readLine(reader))
+            return -1;
+        ++reader->record;
+        
+        // split the line in place at white space
+        long count = 0;
+        for (char *tok = strtok(reader->line, " \t\r\n\v\f"); tok != NULL; tok = strtok(NULL, " \t\r\n\v\f")) {
+            Value v;
+            if (!valueParse(tok, &v)) {
+                fprintf(stderr, "ERROR: invalid natural number %s given for x%ld in line %ld\n",
+                        tok, count + 1, reader->record);
+                exit(EXIT_FAILURE);
+            }
+            appendInput(reader, count++, v);
+        }
+        if (count > 0)
+            return count;
+    }
+}
+
+/*
+ * Decode an unsigned little endian integer.
+ * ARGS     bytes - first byte
+ *          n     - number of bytes
+ * RETURN   decoded integer
+ */
+static uint64_t decodeLittleEndian(const unsigned char *bytes, int n)
+{
+    uint64_t res = 0;
+    for (int i = n - 1; i >= 0; --i)
+        res = res << 8 | bytes[i];
+    return res;
+}
+
+/*
+ * Read the next binary record.
+ */
+static long readBinaryBatch(BatchReader *reader)
+{
+    unsigned char buf[8];
+    size_t got = fread(buf, 1, 4, reader->stream);
+    if (got == 0)
+        return -1;
+    ++reader->record;
+    if (got != 4) {
+        fprintf(stderr, "ERROR: truncated header of record %ld\n", reader->record);
+        exit(EXIT_FAILURE);
+    }
+    
+    long count = (long)decodeLittleEndian(buf, 4);
+    for (long i = 0; i < count; ++i) {
+        if (fread(buf, 1, 8, reader->stream) != 8) {
+            fprintf(stderr, "ERROR: truncated value x%ld of record %ld\n", i + 1, reader->record);
+            exit(EXIT_FAILURE);
+        }
+        uint64_t n = decodeLittleEndian(buf, 8);
+        
+        // values of 2^63 and above do not fit into a machine word value
+        Value v = (Value)n;
+        if (n & VALUE_BIG) {
+            Value half = valueAdd((Value)(n >> 1), (Value)(n >> 1));
+            v = valueAdd(half, (Value)(n & 1));
+            valueRelease(half);
+        }
+        appendInput(reader, i, v);
+    }
+    return count;
+}
+
+/*
+ * Read the next input vector. The values are new references owned by the
+ * caller, the array itself belongs to the reader and is overwritten by the
+ * next call.
+ * ARGS     reader - reader to read from
+ *          inputs - destination of the pointer to the values of x1, x2, ...
+ * RETURN   number of values or -1 at the end of the stream
+ */
+long readBatch(BatchReader *reader, Value **inputs)
+{
+    // input check
+    if (reader == NULL || inputs == NULL) {
+        fprintf(stderr, "ERROR: cannot read input vector from missing reader\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    long count = reader->binary ? readBinaryBatch(reader) : readTextBatch(reader);
+    *inputs = reader->inputs;
+    return count;
+}
@@ -0,0 +1,121 @@
+/*
+ * budget.c
+ *
+ * Execution budgets bounding a run by LOOP iterations and wall-clock time,
+ * see budget.h.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "budget.h"
+#include "profile.h"
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Start the clock of a budget.
+ * ARGS     budget  - budget to be initialized
+ *          fuel    - LOOP iterations allowed, 0 for no limit
+ *          seconds - wall-clock time allowed, 0 for no limit
+ */
+void startBudget(Budget *budget, uint64_t fuel, double seconds)
+{
+    // input check
+    if (budget == NULL || !(seconds >= 0)) {
+        fprintf(stderr, "ERROR: cannot start missing budget or with negative time\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    budget->fuel = fuel;
+    budget->start = profileClock();
+    budget->deadline = 0;
+    if (seconds > 0)
+        budget->deadline = budget->start + (seconds < 1e9 ? (uint64_t)(seconds * 1e9) : UINT64_MAX / 2);
+    budget->granted = 0;
+    budget->iterations = 0;
+    budget->nanos = 0;
+    budget->statements = UINT64_MAX;
+    budget->outOfFuel = false;
+    budget->outOfTime = false;
+    budget->depth = 0;
+    budget->line = 0;
+}
+
+/*
+ * Hand out the next slice of fuel once the engine has used up the previous
+ * one, consuming one iteration of it for the iteration about to start.
+ * ARGS     budget - budget of the run
+ *          slice  - local counter of the engine, receives the iterations
+ *                   left in the new slice
+ * RETURN   false if the fuel is used up or the deadline has passed, the
+ *          engine has to stop then and report where by settleBudget
+ */
+bool refuelBudget(Budget *budget, uint64_t *slice)
+{
+    if (budget == NULL) {
+        *slice = UINT64_MAX;
+        return true;
+    }
+    
+    uint64_t grant = BUDGET_SLICE;
+    if (budget->fuel != 0 && budget->fuel - budget->granted < grant)
+        grant = budget->fuel - budget->granted;
+    budget->outOfFuel = grant == 0;
+    budget->outOfTime = budget->deadline != 0 && profileClock() >= budget->deadline;
+    if (isBudgetExceeded(budget)) {
+        *slice = 0;
+        return false;
+    }
+    budget->granted += grant;
+    *slice = grant - 1;
+    return true;
+}
+
+/*
+ * Record the progress of a run that has stopped or finished.
+ * ARGS     budget - budget of the run
+ *          slice  - local counter of the engine
+ *          depth  - LOOPs and macro calls active, 0 if the run finished
+ *          line   - source line of the innermost active LOOP, 0 if unknown
+ */
+void settleBudget(Budget *budget, uint64_t slice, long depth, uint32_t line)
+{
+    if (budget == NULL)
+        return;
+    budget->iterations = budget->granted - slice;
+    budget->nanos = profileClock() - budget->start;
+    budget->depth = depth;
+    budget->line = line;
+}
+
+/*
+ * Print the progress of a run stopped by its budget as a single line.
+ * ARGS     stream - output stream
+ *          budget - settled budget of the run
+ */
+void printBudgetStats(FILE *stream, const Budget *budget)
+{
+    // input check
+    if (stream == NULL || budget == NULL) {
+        fprintf(stderr, "ERROR: cannot print missing budget\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    fprintf(stream, "%s exceeded after %llu LOOP iterations in %.3f s, %ld LOOPs and calls active",
+            budget->outOfTime ? "deadline" : "fuel", (unsigned long long)budget->iterations,
+            budget->nanos / 1e9, budget->depth);
+    if (budget->line != 0)
+        fprintf(stream, ", innermost at line %u", (unsigned)budget->line);
+    fputc('\n', stream);
+}
@@ -0,0 +1,182 @@
+/*
+ * engine.c
+ *
+ * Common interface of all execution engines, see engine.h.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+#include "exec.h"
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+static const char *const engineNames[ENGINE_COUNT] = {
+    [ENGINE_TREE] = "tree",
+    [ENGINE_VM] = "vm",
+    [ENGINE_JIT] = "jit",
+    [ENGINE_CC] = "cc",
+    [ENGINE_SIMD] = "simd",
+    [ENGINE_SYMBOLIC] = "symbolic",
+};
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Look up an engine by its command line name.
+ * ARGS     name   - name of the engine (tree, vm, jit, cc, simd or symbolic)
+ *          engine - destination of the engine
+ * RETURN   false if there is no engine of that name
+ */
+bool parseEngine(const char *name, Engine *engine)
+{
+    // input check
+    if (name == NULL || engine == NULL) {
+        fprintf(stderr, "ERROR: cannot look up missing engine name\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    for (int i = 0; i < ENGINE_COUNT; ++i) {
+        if (strcmp(name, engineNames[i]) == 0) {
+            *engine = (Engine)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Get the command line name of an engine.
+ * ARGS     engine - engine to be named
+ * RETURN   static string
+ */
+const char *engineName(Engine engine)
+{
+    return engine >= 0 && engine < ENGINE_COUNT ? engineNames[engine] : "unknown";
+}
+
+/*
+ * Compile the program for the requested engine. The native backends are not
+ * available everywhere and fall back to the tree engine, as do programs
+ * without closed form.
+ * ARGS     exe    - destination of the prepared program
+ *          engine - requested engine
+ *          prog   - parsed program
+ *          vars   - variable table the program was parsed with
+ *          hash   - hash of the program text (only used by ENGINE_CC)
+ */
+void prepareExecutable(Executable *exe, Engine engine, Program *prog,
+        const VariableTable *vars, uint64_t hash)
+{
+    // input check
+    if (exe == NULL || prog == NULL) {
+        fprintf(stderr, "ERROR: cannot prepare missing program\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    memset(exe, 0, sizeof(Executable));
+    exe->engine = engine;
+    exe->prog = prog;
+    if (engine == ENGINE_VM) {
+        exe->bytecode = compileProgram(prog);
+    } else if (engine == ENGINE_JIT && (exe->native = compileNative(prog)) == NULL) {
+        exe->engine = ENGINE_TREE;
+    } else if (engine == ENGINE_CC && (exe->shared = compileShared(prog, vars, hash)) == NULL) {
+        fprintf(stderr, "WARNING: unable to build shared object, falling back to tree engine\n");
+        exe->engine = ENGINE_TREE;
+    } else if (engine == ENGINE_SYMBOLIC) {
+        SymbolicFailure failure;
+        if ((exe->closed = compileClosedForm(prog, vars, &failure)) == NULL) {
+            fprintf(stderr, "WARNING: no closed form, ");
+            printSymbolicFailure(stderr, &failure);
+            fprintf(stderr, ", falling back to tree engine\n");
+            exe->engine = ENGINE_TREE;
+        }
+    }
+}
+
+/*
+ * Release everything compiled by prepareExecutable.
+ * ARGS     exe - prepared program
+ */
+void releaseExecutable(Executable *exe)
+{
+    if (exe == NULL)
+        return;
+    freeBytecode(exe->bytecode);
+    freeNative(exe->native);
+    freeShared(exe->shared);
+    freeClosedForm(exe->closed);
+    exe->bytecode = NULL;
+    exe->native = NULL;
+    exe->shared = NULL;
+    exe->closed = NULL;
+}
+
+/*
+ * Check whether an engine enforces execution budgets. The native backends
+ * and closed forms run without any checks.
+ * ARGS     engine - requested engine
+ * RETURN   true if runBudgeted accepts a budget for the engine
+ */
+bool isBudgetSupported(Engine engine)
+{
+    return engine == ENGINE_TREE || engine == ENGINE_VM || engine == ENGINE_SIMD;
+}
+
+/*
+ * Execute the prepared program once.
+ * ARGS     exe  - prepared program
+ *          regs - initialized register file indexed by variable slots
+ */
+void runExecutable(const Executable *exe, Value *regs)
+{
+    runBudgeted(exe, regs, NULL);
+}
+
+/*
+ * Execute the prepared program once within a budget.
+ * ARGS     exe    - prepared program
+ *          regs   - initialized register file indexed by variable slots
+ *          budget - started budget of the run or NULL for no limits
+ * RETURN   false if the budget was exceeded
+ */
+bool runBudgeted(const Executable *exe, Value *regs, Budget *budget)
+{
+    // input check
+    if (budget != NULL && !isBudgetSupported(exe->engine)) {
+        fprintf(stderr, "ERROR: engine %s cannot run within a budget\n", engineName(exe->engine));
+        exit(EXIT_FAILURE);
+    }
+    
+    switch (exe->engine) {
+    case ENGINE_VM:
+        return executeBytecode(exe->bytecode, regs, budget);
+    case ENGINE_JIT:
+        executeNative(exe->native, regs);
+        return true;
+    case ENGINE_CC:
+        executeShared(exe->shared, regs);
+        return true;
+    case ENGINE_SYMBOLIC:
+        executeClosedForm(exe->closed, regs);
+        return true;
+    default:
+        return executeProgram(exe->prog, regs, budget);
+    }
+}
@@ -0,0 +1,200 @@
+/*
+ * exec.c
+ *
+ * Reference execution engine walking the syntax/semantics tree directly.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "affine.h"
+#include "exec.h"
+#include "fuse.h"
+#include "profile.h"
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define EXEC_STACK_SIZE 64  // LOOP nesting handled without heap allocation
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Iteration state of a LOOP being executed.
+ */
+typedef struct {
+    NodeIndex loop;         // index of the LOOP statement or macro call
+    uint64_t remaining;     // iterations left including the current one
+    uint64_t start;         // clock on entry if profiled
+} Frame;
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Execute a sequence of statements linked by their next index.
+ * ARGS     prog    - program holding the statements
+ *          first   - index of the first statement of the sequence
+ *          regs    - initialized register file indexed by variable slots
+ *          profile - profile to be updated or NULL, LOOPs are always
+ *                    iterated if given
+ *          budget  - budget charged for every LOOP iteration or NULL,
+ *                    receives the number of statements run
+ * RETURN   false if the budget was exceeded
+ */
+static bool executeSequence(const Program *prog, NodeIndex first, Value *regs, Profile *profile,
+        Budget *budget)
+{
+    uint64_t *counts = profile != NULL ? profile->counts : NULL;
+    uint64_t *nanos = profile != NULL ? profile->nanos : NULL;
+    uint64_t slice = budget != NULL ? 0 : UINT64_MAX;
+    Frame local[EXEC_STACK_SIZE];
+    Frame *stack = local;
+    size_t depth = 0, capacity = EXEC_STACK_SIZE;
+    uint64_t executed = 0;
+    bool exceeded = false;
+    
+    // execute the linked list of program statement separated by semicolons
+    NodeIndex i = first;
+    for (;;) {
+        while (i != NODE_NONE) {
+            const Statement *stat = programNode(prog, i);
+            ++executed;
+            if (counts != NULL)
+                ++counts[i];
+            if (stat->type == STAT_ASSIGNMENT) { // execute: x_i := x_j +- nat
+                executeAssignment(&stat->as.assignment, regs);
+                i = stat->next;
+                continue;
+            }
+            
+            // execute LOOP nat times, the limit is read once on entry, unless
+            // it is fused into a single step, and the body of a macro once
+            NodeIndex body = stat->as.call.body;
+            uint64_t count = 1;
+            if (stat->type == STAT_LOOP) {
+                const Loop *loop = &stat->as.loop;
+                Value limit = regs[loop->var];
+                body = loop->body;
+                count = valueToCount(limit);
+                if (counts == NULL && loop->fused != FUSED_NONE) {
+                    executeFusedLoop(prog, loop, regs);
+                    count = 0;
+                } else if (counts == NULL && isAffineWorthwhile(loop->affine, limit)) {
+                    executeAffineLoop(loop->affine, limit, regs);
+                    count = 0;
+                }
+                if (count == 0) {
+                    i = stat->next;
+                    continue;
+                }
+                if (slice-- == 0 && !refuelBudget(budget, &slice)) {
+                    settleBudget(budget, slice, (long)depth + 1, prog->lines[i]);
+                    exceeded = true;
+                    break;
+                }
+            }
+            if (depth == capacity) {
+                capacity *= 2;
+                Frame *grown = malloc(capacity * sizeof(Frame));
+                if (grown == NULL) {
+                    fprintf(stderr, "ERROR: unable to allocate memory\n");
+                    exit(EXIT_FAILURE);
+                }
+                memcpy(grown, stack, depth * sizeof(Frame));
+                if (stack != local)
+                    free(stack);
+                stack = grown;
+            }
+            stack[depth].loop = i;
+            stack[depth].remaining = count;
+            if (nanos != NULL)
+                stack[depth].start = profileClock();
+            ++depth;
+            i = body;
+        }
+        
+        // end of a body, repeat it or continue behind its LOOP or call
+        if (depth == 0 || exceeded)
+            break;
+        Frame *top = &stack[depth - 1];
+        const Statement *stat = programNode(prog, top->loop);
+        if (--top->remaining > 0) {
+            if (slice-- == 0 && !refuelBudget(budget, &slice)) {
+                settleBudget(budget, slice, (long)depth, prog->lines[top->loop]);
+                exceeded = true;
+                break;
+            }
+            i = stat->as.loop.body;
+        } else {
+            if (nanos != NULL)
+                nanos[top->loop] += profileClock() - top->start;
+            i = stat->next;
+            --depth;
+        }
+    }
+    if (stack != local)
+        free(stack);
+    if (!exceeded)
+        settleBudget(budget, slice, 0, 0);
+    if (budget != NULL)
+        budget->statements = executed;
+    return !exceeded;
+}
+
+/*
+ * Traverse the syntax/semantics tree and simulate execution.
+ * ARGS     prog   - program to be executed
+ *          regs   - initialized register file indexed by variable slots
+ *          budget - started budget of the run or NULL for no limits
+ * RETURN   false if the budget was exceeded, the registers then hold the
+ *          values at the point of stopping
+ */
+bool executeProgram(Program *prog, Value *regs, Budget *budget)
+{
+    // input check
+    if (prog == NULL || regs == NULL) {
+        fprintf(stderr, "ERROR: cannot execute empty program or without registers\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    return executeSequence(prog, prog->first, regs, NULL, budget);
+}
+
+/*
+ * Execute the program like executeProgram, but iterate every LOOP instead of
+ * applying superinstructions or closed forms and record how often every
+ * statement is executed and, if the profile is timed, how long every LOOP
+ * takes.
+ * ARGS     prog    - program to be executed
+ *          regs    - initialized register file indexed by variable slots
+ *          profile - profile created for the program, counters are added to
+ */
+void executeProfiled(Program *prog, Value *regs, Profile *profile)
+{
+    // input check
+    if (prog == NULL || regs == NULL || profile == NULL || profile->count != prog->count) {
+        fprintf(stderr, "ERROR: cannot execute empty program or without registers or profile\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    uint64_t start = profile->nanos != NULL ? profileClock() : 0;
+    executeSequence(prog, prog->first, regs, profile, NULL);
+    if (profile->nanos != NULL)
+        profile->total += profileClock() - start;
+}
@@ -0,0 +1,196 @@
+/*
+ * fuse.c
+ *
+ * Superinstructions for the idioms most LOOP programs are built from, see
+ * fuse.h.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fuse.h"
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+static const char *fusedNames[FUSED_COUNT] = {
+    "none", "add-var", "zero", "sub-var", "mul-add"
+};
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Find the superinstruction replacing a LOOP.
+ * ARGS     prog - program holding the LOOP
+ *          loop - LOOP to be classified
+ * RETURN   superinstruction or FUSED_NONE if the body has no supported shape
+ */
+static FusedOp classifyLoop(const Program *prog, const Loop *loop)
+{
+    if (loop->body == NODE_NONE)
+        return FUSED_NONE;
+    const Statement *body = programNode(prog, loop->body);
+    if (loop->end == loop->body + 1 && body->type == STAT_ASSIGNMENT) {
+        const Assignment *ass = &body->as.assignment;
+        if (ass->lvalue != ass->rvalue)
+            return FUSED_NONE;
+        if (ass->isAddition)
+            return FUSED_ADD_VAR;
+        return ass->lvalue == loop->var && ass->nat != 0 ? FUSED_ZERO : FUSED_SUB_VAR;
+    }
+    
+    // the inner limit is the same in every iteration unless the body writes it
+    if (loop->end != loop->body + 2 || body->type != STAT_LOOP)
+        return FUSED_NONE;
+    const Loop *inner = &body->as.loop;
+    const Statement *stat = programNode(prog, inner->body);
+    if (inner->end != loop->end || stat->type != STAT_ASSIGNMENT)
+        return FUSED_NONE;
+    const Assignment *ass = &stat->as.assignment;
+    if (!ass->isAddition || ass->lvalue != ass->rvalue || ass->lvalue == inner->var)
+        return FUSED_NONE;
+    return FUSED_MUL_ADD;
+}
+
+/*
+ * Search the program for LOOPs of the shapes listed in fuse.h and annotate
+ * them (Loop.fused), all other LOOPs keep FUSED_NONE. LOOPs nested in a
+ * fused LOOP are annotated as well, since profiling iterates the outer one,
+ * but only the outermost is counted.
+ * ARGS     prog  - program to be analysed
+ *          stats - destination of the statements replaced or NULL
+ */
+void analyseFusedLoops(Program *prog, FuseStats *stats)
+{
+    // input check
+    if (prog == NULL) {
+        fprintf(stderr, "ERROR: cannot analyse missing program\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    FuseStats counts;
+    memset(&counts, 0, sizeof(counts));
+    counts.statements = prog->count - 1;
+    NodeIndex covered = NODE_NONE;
+    for (NodeIndex i = 1; i < prog->count; ++i) {
+        Statement *stat = programNode(prog, i);
+        if (stat->type == STAT_ASSIGNMENT && isCopy(&stat->as.assignment)) {
+            ++counts.copies;
+            ++counts.fused;
+        }
+        if (stat->type != STAT_LOOP)
+            continue;
+        Loop *loop = &stat->as.loop;
+        loop->fused = classifyLoop(prog, loop);
+        if (loop->fused != FUSED_NONE && i >= covered) {
+            ++counts.loops[loop->fused];
+            counts.fused += loop->end - i;
+            covered = loop->end;
+        }
+    }
+    if (stats != NULL)
+        *stats = counts;
+}
+
+/*
+ * Add the product n * m * k to a register or subtract it, saturating at zero.
+ * ARGS     reg        - register to be updated
+ *          n          - first factor
+ *          m          - second factor
+ *          k          - constant factor
+ *          isAddition - add or subtract the product
+ */
+void accumulateProduct(Value *reg, Value n, Value m, NatNum k, bool isAddition)
+{
+    if (n == 0 || m == 0 || k == 0)
+        return;
+    
+    // factors of one are common and need no multiplication
+    Value product = valueRetain(n);
+    if (m != 1) {
+        Value next = valueMul(product, m);
+        valueRelease(product);
+        product = next;
+    }
+    if (k != 1) {
+        Value next = valueMul(product, k);
+        valueRelease(product);
+        product = next;
+    }
+    Value res = isAddition ? valueAdd(*reg, product) : valueSub(*reg, product);
+    valueRelease(product);
+    valueRelease(*reg);
+    *reg = res;
+}
+
+/*
+ * Execute a fused LOOP in a single step.
+ * ARGS     prog - program holding the LOOP
+ *          loop - LOOP annotated with a superinstruction
+ *          regs - register file indexed by variable slots
+ */
+void executeFusedLoop(const Program *prog, const Loop *loop, Value *regs)
+{
+    const Statement *body = programNode(prog, loop->body);
+    switch (loop->fused) {
+    case FUSED_ADD_VAR:
+    case FUSED_SUB_VAR:
+        accumulateProduct(&regs[body->as.assignment.lvalue], regs[loop->var], 1,
+                body->as.assignment.nat, loop->fused == FUSED_ADD_VAR);
+        break;
+    case FUSED_ZERO:
+        valueRelease(regs[loop->var]);
+        regs[loop->var] = 0;
+        break;
+    case FUSED_MUL_ADD: {
+        const Assignment *ass = &programNode(prog, body->as.loop.body)->as.assignment;
+        accumulateProduct(&regs[ass->lvalue], regs[loop->var], regs[body->as.loop.var], ass->nat, true);
+        break;
+    }
+    default:
+        fprintf(stderr, "ERROR: cannot execute LOOP without superinstruction\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Get the name of a superinstruction as printed in statistics.
+ * ARGS     op - superinstruction to be named
+ * RETURN   static string
+ */
+const char *fusedName(FusedOp op)
+{
+    return op < FUSED_COUNT ? fusedNames[op] : "unknown";
+}
+
+/*
+ * Print the statements replaced by every superinstruction.
+ * ARGS     stream - output stream
+ *          stats  - statistics reported by analyseFusedLoops
+ */
+void printFuseStats(FILE *stream, const FuseStats *stats)
+{
+    // input check
+    if (stream == NULL || stats == NULL) {
+        fprintf(stderr, "ERROR: cannot print missing fusion statistics\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    for (int op = FUSED_NONE + 1; op < FUSED_COUNT; ++op)
+        fprintf(stream, "FUSE: %-8s %ld LOOPs\n", fusedNames[op], stats->loops[op]);
+    fprintf(stream, "FUSE: %-8s %ld assignments\n", "copy", stats->copies);
+    fprintf(stream, "FUSE: %ld of %ld statements fused\n", stats->fused, stats->statements);
+}
@@ -0,0 +1,439 @@
+/*
+ * generate.c
+ *
+ * Generator of random well-formed LOOP programs, see generate.h.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "budget.h"
+#include "exec.h"
+#include "generate.h"
+#include "parser.h"
+#include "var.h"
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define GENERATE_MAX_CONSTANT 3     // constants added or subtracted
+#define GENERATE_MAX_PARAMS 3       // parameters of a macro
+#define GENERATE_MACRO_LOCALS 2     // local variables of a macro
+#define GENERATE_SMALL_BODY 4       // statements of most LOOP bodies
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * State of the generator while writing one program.
+ */
+typedef struct {
+    const GenerateOptions *opts;
+    uint64_t state;         // state of the random number generator
+    char *text;             // program text written so far
+    size_t length;          // number of characters written
+    size_t capacity;        // number of characters allocated
+    long *params;           // number of parameters of every macro
+} Generator;
+
+/*
+ * Variables visible to the sequence being written.
+ */
+typedef struct {
+    long first;             // identifier of the first variable
+    long count;             // number of variables
+    long macros;            // macros defined so far
+} Scope;
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Draw the next number of the random number generator (SplitMix64).
+ * ARGS     gen - state of the generator
+ * RETURN   uniformly distributed 64 bit number
+ */
+static uint64_t nextRandom(Generator *gen)
+{
+    uint64_t z = (gen->state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/*
+ * Draw a number below a bound.
+ * ARGS     gen   - state of the generator
+ *          bound - exclusive upper bound, greater than zero
+ * RETURN   number in 0 ... bound - 1, modulo bias is negligible here
+ */
+static long randomBelow(Generator *gen, long bound)
+{
+    return (long)(nextRandom(gen) % (uint64_t)bound);
+}
+
+/*
+ * Append formatted text to the program, growing the buffer if necessary.
+ * ARGS     gen    - state of the generator
+ *          format - printf format string
+ */
+static void writeText(Generator *gen, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(gen->text + gen->length, gen->capacity - gen->length, format, args);
+    va_end(args);
+    if (n < 0) {
+        fprintf(stderr, "ERROR: unable to format program text\n");
+        exit(EXIT_FAILURE);
+    }
+    if (gen->length + n >= gen->capacity) {
+        while (gen->length + n >= gen->capacity)
+            gen->capacity *= 2;
+        gen->text = realloc(gen->text, gen->capacity);
+        if (gen->text == NULL) {
+            fprintf(stderr, "ERROR: unable to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        va_start(args, format);
+        vsnprintf(gen->text + gen->length, gen->capacity - gen->length, format, args);
+        va_end(args);
+    }
+    gen->length += n;
+}
+
+/*
+ * Draw a variable of the scope.
+ * ARGS     gen   - state of the generator
+ *          scope - visible variables
+ * RETURN   identifier of the variable
+ */
+static long randomVariable(Generator *gen, const Scope *scope)
+{
+    return scope->first + randomBelow(gen, scope->count);
+}
+
+/*
+ * Write a call of a random macro. One in four arguments repeats an earlier
+ * one, so calls copying aliased arguments in and out are covered as well.
+ * ARGS     gen   - state of the generator
+ *          scope - visible variables, macros defined so far
+ * RETURN   false if no macro takes few enough parameters
+ */
+static bool writeCall(Generator *gen, const Scope *scope)
+{
+    long macro = randomBelow(gen, scope->macros);
+    long params = gen->params[macro];
+    if (params > scope->count)
+        return false;
+    
+    // the arguments are a random permutation prefix of the visible variables
+    // with some repeated
+    long ids[GENERATE_MAX_PARAMS + GENERATE_MACRO_LOCALS];
+    long pool[GENERATE_MAX_PARAMS + GENERATE_MACRO_LOCALS];
+    long count = scope->count < (long)(sizeof(pool) / sizeof(pool[0])) ? scope->count
+            : (long)(sizeof(pool) / sizeof(pool[0]));
+    long offset = randomBelow(gen, scope->count - count + 1);
+    for (long i = 0; i < count; ++i)
+        pool[i] = scope->first + offset + i;
+    for (long i = 0; i < params; ++i) {
+        if (i > 0 && randomBelow(gen, 4) == 0) {
+            ids[i] = ids[randomBelow(gen, i)];
+            continue;
+        }
+        long j = i + randomBelow(gen, count - i);
+        ids[i] = pool[j];
+        pool[j] = pool[i];
+    }
+    writeText(gen, "m%ld(", macro);
+    for (long i = 0; i < params; ++i)
+        writeText(gen, i > 0 ? ", x%ld" : "x%ld", ids[i]);
+    writeText(gen, ")");
+    return true;
+}
+
+/*
+ * Write one of the idioms fused into superinstructions.
+ * ARGS     gen       - state of the generator
+ *          scope     - visible variables
+ *          nesting   - LOOPs the idiom may nest at most
+ *          remaining - statements the idiom may take at most
+ * RETURN   number of statements written
+ */
+static long writeIdiom(Generator *gen, const Scope *scope, long nesting, long remaining)
+{
+    long a = randomVariable(gen, scope), b = randomVariable(gen, scope);
+    long c = randomVariable(gen, scope), k = randomBelow(gen, GENERATE_MAX_CONSTANT + 1);
+    long kind = randomBelow(gen, 4);
+    if (kind == 0 || nesting < 1 || remaining < 2) {
+        writeText(gen, "x%ld := x%ld + 0", a, b);
+        return 1;
+    }
+    if (kind == 1) {
+        writeText(gen, "LOOP x%ld DO x%ld := x%ld - %ld END", a, a, a, k);
+        return 2;
+    }
+    if (kind == 2 || nesting < 2 || remaining < 3) {
+        writeText(gen, "LOOP x%ld DO x%ld := x%ld %c %ld END", a, b, b, randomBelow(gen, 3) > 0 ? '+' : '-', k);
+        return 2;
+    }
+    writeText(gen, "LOOP x%ld DO LOOP x%ld DO x%ld := x%ld + %ld END END", a, b, c, c, k);
+    return 3;
+}
+
+/*
+ * Write a sequence of random statements separated by semicolons. LOOP
+ * bodies are written recursively, which is bounded by the nesting depth.
+ * ARGS     gen        - state of the generator
+ *          scope      - visible variables and macros
+ *          depth      - LOOPs enclosing the sequence
+ *          statements - number of statements including nested ones, > 0
+ */
+static void writeSequence(Generator *gen, const Scope *scope, long depth, long statements)
+{
+    long nesting = (long)gen->opts->depth - depth;
+    for (long remaining = statements; remaining > 0;) {
+        if (remaining < statements)
+            writeText(gen, "; ");
+        long r = randomBelow(gen, 100);
+        if (r < 30 && nesting > 0 && remaining >= 2) {
+            // most bodies are small, the others may take all statements left
+            long body = remaining - 1;
+            if (body > GENERATE_SMALL_BODY && randomBelow(gen, 2) == 0)
+                body = GENERATE_SMALL_BODY;
+            body = 1 + randomBelow(gen, body);
+            writeText(gen, "LOOP x%ld DO ", randomVariable(gen, scope));
+            writeSequence(gen, scope, depth + 1, body);
+            writeText(gen, " END");
+            remaining -= 1 + body;
+            continue;
+        }
+        if (r < 45) {
+            remaining -= writeIdiom(gen, scope, nesting, remaining);
+            continue;
+        }
+        if (r < 55 && scope->macros > 0 && writeCall(gen, scope)) {
+            --remaining;
+            continue;
+        }
+        long a = randomVariable(gen, scope), b = randomVariable(gen, scope);
+        writeText(gen, "x%ld := x%ld %c %ld", a, b, randomBelow(gen, 4) > 0 ? '+' : '-',
+                randomBelow(gen, GENERATE_MAX_CONSTANT + 1));
+        --remaining;
+    }
+}
+
+/*
+ * Write the macro definitions and the program. Macro bodies see their
+ * parameters and locals as x1, x2, ... and may call the macros before them.
+ * ARGS     gen - state of the generator
+ */
+static void writeProgram(Generator *gen)
+{
+    const GenerateOptions *opts = gen->opts;
+    gen->length = 0;
+    gen->text[0] = '\0';
+    for (long m = 0; m < (long)opts->macros; ++m) {
+        long params = 1 + randomBelow(gen, GENERATE_MAX_PARAMS);
+        Scope scope = { 1, params + GENERATE_MACRO_LOCALS, m };
+        writeText(gen, "MACRO m%ld(", m);
+        for (long i = 1; i <= params; ++i)
+            writeText(gen, i > 1 ? ", x%ld" : "x%ld", i);
+        writeText(gen, ") DO\n    ");
+        writeSequence(gen, &scope, 0, 1 + randomBelow(gen, 6));
+        writeText(gen, "\nEND;\n");
+        gen->params[m] = params;
+    }
+    Scope scope = { 0, (long)opts->variables, (long)opts->macros };
+    writeSequence(gen, &scope, 0, (long)opts->statements);
+    
+    // only x0 is compared, so the other variables are folded into it
+    for (long v = 1; v < (long)opts->variables; ++v)
+        writeText(gen, "; LOOP x%ld DO x0 := x0 + 1 END", v);
+    writeText(gen, "\n");
+}
+
+/*
+ * Run the program text once with the reference engine iterating every LOOP.
+ * ARGS     gen    - state of the generator holding the program text
+ *          inputs - values of x1, x2, ...
+ *          count  - number of inputs
+ *          out    - destination of the result and iterations
+ * RETURN   false if the run exceeds the allowed number of iterations
+ */
+static bool runReference(const Generator *gen, const Value *inputs, long count, GeneratedProgram *out)
+{
+    VariableTable *vars = createVariableTable();
+    internVariable(vars, 0);
+    SyntaxError error;
+    Program *prog = parseText(gen->text, gen->length, vars, &error);
+    if (prog == NULL) {
+        fprintf(stderr, "ERROR: generated program is malformed, ");
+        printSyntaxError(stderr, &error);
+        fprintf(stderr, "\n%s", gen->text);
+        exit(EXIT_FAILURE);
+    }
+    
+    Value *regs = createRegisters(vars);
+    storeInputs(vars, regs, inputs, count);
+    Budget budget;
+    startBudget(&budget, gen->opts->cost, 0);
+    bool finished = executeProgram(prog, regs, &budget);
+    out->result = regs[0];
+    out->iterations = budget.iterations;
+    regs[0] = 0;
+    if (!finished) {
+        valueRelease(out->result);
+        out->result = 0;
+    }
+    clearRegisters(vars, regs);
+    free(regs);
+    freeProgram(prog);
+    freeVariableTable(vars);
+    return finished;
+}
+
+/*
+ * Initialize the options with small programs of a few nested LOOPs.
+ * ARGS     opts - options to be initialized
+ */
+void defaultGenerateOptions(GenerateOptions *opts)
+{
+    // input check
+    if (opts == NULL) {
+        fprintf(stderr, "ERROR: cannot initialize missing generator options\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    opts->depth = 3;
+    opts->statements = 12;
+    opts->variables = 6;
+    opts->inputs = 3;
+    opts->maxInput = 8;
+    opts->cost = 100000;
+    opts->macros = 0;
+}
+
+/*
+ * Parse a command line option of the generator.
+ * ARGS     arg  - command line parameter
+ *          opts - options to be updated
+ * RETURN   false if the parameter is no option of the generator
+ */
+bool parseGenerateOption(const char *arg, GenerateOptions *opts)
+{
+    // input check
+    if (arg == NULL || opts == NULL) {
+        fprintf(stderr, "ERROR: cannot parse missing generator option\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    static const struct {
+        const char *name;
+        size_t offset;
+        uint64_t min;
+        uint64_t max;
+    } options[] = {
+        { "--depth=", offsetof(GenerateOptions, depth), 0, GENERATE_MAX_DEPTH },
+        { "--statements=", offsetof(GenerateOptions, statements), 1, LONG_MAX / 2 },
+        { "--variables=", offsetof(GenerateOptions, variables), 1, LONG_MAX / 2 },
+        { "--inputs=", offsetof(GenerateOptions, inputs), 0, LONG_MAX / 2 },
+        { "--max-input=", offsetof(GenerateOptions, maxInput), 0, UINT64_MAX - 1 },
+        { "--cost=", offsetof(GenerateOptions, cost), 1, UINT64_MAX },
+        { "--macros=", offsetof(GenerateOptions, macros), 0, GENERATE_MAX_MACROS },
+    };
+    for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); ++i) {
+        size_t length = strlen(options[i].name);
+        if (strncmp(arg, options[i].name, length) != 0)
+            continue;
+        char *end;
+        errno = 0;
+        unsigned long long value = strtoull(arg + length, &end, 10);
+        if (errno != 0 || *end != '\0' || end == arg + length || arg[length] == '-'
+                || value < options[i].min || value > options[i].max) {
+            fprintf(stderr, "ERROR: invalid value of %.*s %s\n", (int)length - 1, arg, arg + length);
+            exit(EXIT_FAILURE);
+        }
+        *(uint64_t *)((char *)opts + options[i].offset) = value;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Generate a program whose reference run on its inputs finishes within the
+ * allowed number of LOOP iterations. Programs exceeding it are discarded and
+ * drawn again from the continued random sequence.
+ * ARGS     opts - shape of the program
+ *          seed - seed of the random number generator
+ *          gen  - destination of the program
+ */
+void generateProgram(const GenerateOptions *opts, uint64_t seed, GeneratedProgram *gen)
+{
+    // input check
+    if (opts == NULL || gen == NULL || opts->inputs >= opts->variables) {
+        fprintf(stderr, "ERROR: cannot generate program without options or with more inputs than variables\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    Generator state;
+    state.opts = opts;
+    state.state = seed;
+    state.capacity = 256;
+    state.text = malloc(state.capacity);
+    state.params = malloc((opts->macros > 0 ? opts->macros : 1) * sizeof(long));
+    gen->inputCount = (long)opts->inputs;
+    gen->inputs = malloc((opts->inputs > 0 ? opts->inputs : 1) * sizeof(Value));
+    if (state.text == NULL || state.params == NULL || gen->inputs == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    for (long attempt = 0; attempt < GENERATE_ATTEMPTS; ++attempt) {
+        writeProgram(&state);
+        for (long i = 0; i < gen->inputCount; ++i)
+            gen->inputs[i] = (Value)(nextRandom(&state) % (opts->maxInput + 1));
+        if (runReference(&state, gen->inputs, gen->inputCount, gen)) {
+            free(state.params);
+            gen->text = state.text;
+            gen->length = state.length;
+            return;
+        }
+    }
+    fprintf(stderr, "ERROR: no program within %llu LOOP iterations after %d attempts, "
+            "raise --cost or lower --depth\n", (unsigned long long)opts->cost, GENERATE_ATTEMPTS);
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Release a generated program.
+ * ARGS     gen - program to be freed
+ */
+void freeGeneratedProgram(GeneratedProgram *gen)
+{
+    if (gen == NULL)
+        return;
+    free(gen->text);
+    free(gen->inputs);
+    valueRelease(gen->result);
+    gen->text = NULL;
+    gen->inputs = NULL;
+    gen->result = 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * hash.c
+ *
+ * 64 bit FNV-1a hashing used to key caches by program text.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stdlib.h>
+
+#include "hash.h"
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Continue a hash over a block of bytes.
+ * ARGS     hash  - hash of the preceding data or HASH_SEED
+ *          bytes - data to be hashed
+ *          n     - number of bytes
+ * RETURN   updated hash
+ */
+uint64_t hashBytes(uint64_t hash, const void *bytes, size_t n)
+{
+    const unsigned char *c = bytes;
+    for (size_t i = 0; i < n; ++i) {
+        hash ^= c[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+/*
+ * Hash the remaining content of a stream and rewind it afterwards.
+ * ARGS     hash   - hash of the preceding data or HASH_SEED
+ *          stream - seekable libc stream
+ * RETURN   updated hash
+ */
+uint64_t hashStream(uint64_t hash, FILE *stream)
+{
+    // input check
+    if (stream == NULL) {
+        fprintf(stderr, "ERROR: invalid stream to read from\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), stream)) > 0)
+        hash = hashBytes(hash, buf, n);
+    rewind(stream);
+    return hash;
+}
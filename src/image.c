@@ -0,0 +1,482 @@
+/*
+ * image.c
+ *
+ * Precompiled programs (.loopc files), see image.h.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define IMAGE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define IMAGE_MAGIC "LOOPC\r\n\032"    // detects text mode transfers
+#define IMAGE_VERSION 2                 // change whenever the layout changes
+#define IMAGE_BYTE_ORDER 0x01020304u    // written in the byte order of the host
+#define IMAGE_ALIGNMENT 16              // alignment of all sections
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Header at the beginning of every image, followed by the sections at the
+ * given offsets: the statement arena, the source line of every statement,
+ * the variable identifier of every slot as int64_t and the constants
+ * exceeding a machine word as null terminated decimal strings. Within the
+ * arena such constants are stored as VALUE_BIG | index into the constants.
+ */
+typedef struct {
+    char magic[8];              // IMAGE_MAGIC
+    uint32_t version;           // IMAGE_VERSION
+    uint32_t byteOrder;         // IMAGE_BYTE_ORDER
+    uint32_t statementSize;     // sizeof(Statement) of the writer
+    uint32_t count;             // arena entries including entry 0
+    uint32_t first;             // first statement of the program
+    uint32_t variables;         // number of variable slots
+    uint32_t constants;         // number of big constants
+    uint32_t reserved;          // zero
+    uint64_t nodesOffset;       // offset of the statement arena
+    uint64_t linesOffset;       // offset of the source lines
+    uint64_t varsOffset;        // offset of the variable identifiers
+    uint64_t constantsOffset;   // offset of the big constants
+    uint64_t size;              // size of the whole image
+} ImageHeader;
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Check whether a stream holds an image by its magic number. The stream is
+ * rewound afterwards.
+ * ARGS     stream - libc standard stream positioned at the beginning
+ * RETURN   true if the stream starts like an image
+ */
+bool isImage(FILE *stream)
+{
+    // input check
+    if (stream == NULL) {
+        fprintf(stderr, "ERROR: invalid stream to check for an image\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    char magic[sizeof(IMAGE_MAGIC) - 1];
+    bool found = fread(magic, 1, sizeof(magic), stream) == sizeof(magic)
+            && memcmp(magic, IMAGE_MAGIC, sizeof(magic)) == 0;
+    rewind(stream);
+    return found;
+}
+
+/*
+ * Write zero bytes up to the next multiple of IMAGE_ALIGNMENT.
+ * ARGS     stream - output stream
+ *          offset - current offset, updated
+ */
+static void writePadding(FILE *stream, uint64_t *offset)
+{
+    static const char zeros[IMAGE_ALIGNMENT];
+    size_t n = (size_t)(-*offset & (IMAGE_ALIGNMENT - 1));
+    fwrite(zeros, 1, n, stream);
+    *offset += n;
+}
+
+/*
+ * Write a program as image.
+ * ARGS     stream - seekable output stream opened in binary mode
+ *          prog   - program to be written, closed forms are not stored
+ *          vars   - variable table the program was parsed with
+ * RETURN   false if writing failed
+ */
+bool writeImage(FILE *stream, const Program *prog, const VariableTable *vars)
+{
+    // input check
+    if (stream == NULL || prog == NULL || vars == NULL) {
+        fprintf(stderr, "ERROR: cannot write missing program or variables\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = IMAGE_VERSION;
+    header.byteOrder = IMAGE_BYTE_ORDER;
+    header.statementSize = sizeof(Statement);
+    header.count = prog->count;
+    header.first = prog->first;
+    header.variables = (uint32_t)vars->count;
+    uint64_t offset = sizeof(header);
+    fwrite(&header, sizeof(header), 1, stream);
+    
+    // statements are copied field by field, so padding is written as zeros
+    writePadding(stream, &offset);
+    header.nodesOffset = offset;
+    for (NodeIndex i = 0; i < prog->count; ++i) {
+        Statement node;
+        memset(&node, 0, sizeof(node));
+        if (i != NODE_NONE) {
+            const Statement *stat = programNode(prog, i);
+            node.type = stat->type;
+            node.next = stat->next;
+            if (stat->type == STAT_LOOP) {
+                node.as.loop.var = stat->as.loop.var;
+                node.as.loop.body = stat->as.loop.body;
+                node.as.loop.end = stat->as.loop.end;
+            } else if (stat->type == STAT_CALL) {
+                node.as.call.body = stat->as.call.body;
+                node.as.call.end = stat->as.call.end;
+            } else {
+                node.as.assignment.lvalue = stat->as.assignment.lvalue;
+                node.as.assignment.rvalue = stat->as.assignment.rvalue;
+                node.as.assignment.isAddition = stat->as.assignment.isAddition;
+                node.as.assignment.nat = stat->as.assignment.nat;
+                if (node.as.assignment.nat & VALUE_BIG)
+                    node.as.assignment.nat = VALUE_BIG | header.constants++;
+            }
+        }
+        fwrite(&node, sizeof(node), 1, stream);
+    }
+    offset += (uint64_t)prog->count * sizeof(Statement);
+    
+    header.linesOffset = offset;
+    fwrite(prog->lines, sizeof(uint32_t), prog->count, stream);
+    offset += (uint64_t)prog->count * sizeof(uint32_t);
+    writePadding(stream, &offset);
+    
+    header.varsOffset = offset;
+    for (long i = 0; i < vars->count; ++i) {
+        int64_t id = vars->ids[i];
+        fwrite(&id, sizeof(id), 1, stream);
+    }
+    offset += (uint64_t)vars->count * sizeof(int64_t);
+    
+    // big constants in the order of their statements
+    header.constantsOffset = offset;
+    for (NodeIndex i = 1; i < prog->count; ++i) {
+        const Statement *stat = programNode(prog, i);
+        if (stat->type == STAT_ASSIGNMENT && (stat->as.assignment.nat & VALUE_BIG)) {
+            valuePrint(stream, stat->as.assignment.nat);
+            fputc('\0', stream);
+        }
+    }
+    long end = ftell(stream);
+    header.size = end >= 0 ? (uint64_t)end : 0;
+    
+    // complete the header
+    if (ferror(stream) || end < 0 || fseek(stream, 0, SEEK_SET) != 0)
+        return false;
+    fwrite(&header, sizeof(header), 1, stream);
+    return !ferror(stream) && fseek(stream, 0, SEEK_END) == 0;
+}
+
+/*
+ * Terminate on an invalid image.
+ * ARGS     reason - description of the defect
+ */
+static void invalidImage(const char *reason)
+{
+    fprintf(stderr, "ERROR: invalid program image, %s\n", reason);
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Map a regular file copy on write, statements are updated in place when
+ * closed forms are attached.
+ * ARGS     stream - input stream (libc)
+ *          size   - destination of the size of the mapping
+ * RETURN   mapping or NULL if the stream is no regular file or mapping failed
+ */
+static void *mapImage(FILE *stream, size_t *size)
+{
+#ifndef IMAGE_MMAP
+    (void)stream;
+    (void)size;
+    return NULL;
+#else
+    struct stat st;
+    if (fstat(fileno(stream), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        return NULL;
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+            fileno(stream), 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    *size = (size_t)st.st_size;
+    return map;
+#endif
+}
+
+/*
+ * Read the whole stream into a buffer aligned for any basic type.
+ * ARGS     stream - input stream (libc)
+ *          size   - destination of the number of bytes read
+ * RETURN   pointer to the newly allocated buffer
+ */
+static void *readImage(FILE *stream, size_t *size)
+{
+    size_t capacity = 1 << 16, length = 0, n;
+    char *buffer = malloc(capacity);
+    if (buffer == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    while ((n = fread(buffer + length, 1, capacity - length, stream)) > 0) {
+        length += n;
+        if (length == capacity) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+            if (buffer == NULL) {
+                fprintf(stderr, "ERROR: unable to allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    if (ferror(stream)) {
+        perror("ERROR: failed to read program image");
+        exit(EXIT_FAILURE);
+    }
+    *size = length;
+    return buffer;
+}
+
+/*
+ * Check that a section lies within the image and is aligned.
+ * ARGS     offset - offset of the section
+ *          length - size of the section in bytes
+ *          size   - size of the image
+ * RETURN   true if the section is valid
+ */
+static bool isSection(uint64_t offset, uint64_t length, size_t size)
+{
+    if (length > 0 && offset % IMAGE_ALIGNMENT != 0)
+        return false;
+    return offset <= size && length <= size - offset;
+}
+
+/*
+ * Check the links of all statements, so executing the image terminates.
+ * Like after parsing, every link points forward: the body of a LOOP starts
+ * right behind it, its successor follows its last nested statement and the
+ * successor of an assignment follows it directly. Only at the top level a
+ * link may skip statements, the bodies of macros defined in between. A
+ * called macro body is a range of top-level statements in front of the call
+ * that nothing but its own statements link into, and a macro body only
+ * calls bodies in front of itself, so calls never recurse.
+ * ARGS     prog      - loaded program
+ *          variables - number of variable slots
+ *          constants - number of big constants
+ */
+static void checkStatements(const Program *prog, uint32_t variables, uint32_t constants)
+{
+    if (prog->first == NODE_NONE || prog->first >= prog->count)
+        invalidImage("empty program");
+    NodeIndex *open = malloc(prog->count * sizeof(NodeIndex));
+    NodeIndex *ends = calloc(prog->count, sizeof(NodeIndex));
+    NodeIndex *owners = malloc(prog->count * sizeof(NodeIndex));
+    if (open == NULL || ends == NULL || owners == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    // end of every called macro body, indexed by its first statement
+    for (NodeIndex i = 1; i < prog->count; ++i) {
+        const Statement *stat = programNode(prog, i);
+        if (stat->type != STAT_CALL)
+            continue;
+        const Call *call = &stat->as.call;
+        if (call->body == NODE_NONE || call->body >= i || call->end <= call->body || call->end > i
+                || (ends[call->body] != 0 && ends[call->body] != call->end))
+            invalidImage("malformed call");
+        ends[call->body] = call->end;
+    }
+    
+    // top-level statements are owned by the macro body they belong to, or
+    // by NODE_NONE for the program, and may only be linked to by their owner
+    for (NodeIndex i = 0; i < prog->count; ++i)
+        owners[i] = UINT32_MAX;
+    owners[prog->first] = NODE_NONE;
+    size_t depth = 0;
+    NodeIndex region = NODE_NONE, regionEnd = prog->count;
+    for (NodeIndex i = 1; i < prog->count; ++i) {
+        const Statement *stat = programNode(prog, i);
+        while (depth > 0 && programNode(prog, open[depth - 1])->as.loop.end == i)
+            --depth;
+        if (depth == 0 && i == regionEnd) {
+            region = NODE_NONE;
+            regionEnd = prog->count;
+        }
+        if (ends[i] != 0) {
+            if (depth > 0 || region != NODE_NONE)
+                invalidImage("malformed macro body");
+            region = i;
+            regionEnd = ends[i];
+        }
+        bool top = depth == 0;
+        if (owners[i] != UINT32_MAX && (!top || owners[i] != region))
+            invalidImage("malformed statement sequence");
+        NodeIndex limit = depth > 0 ? programNode(prog, open[depth - 1])->as.loop.end : regionEnd;
+        NodeIndex after;
+        if (stat->type == STAT_LOOP) {
+            const Loop *loop = &stat->as.loop;
+            if (loop->var >= variables || loop->body != i + 1 || loop->end <= loop->body
+                    || loop->end > limit || loop->fused != FUSED_NONE || loop->affine != NULL)
+                invalidImage("malformed LOOP");
+            after = loop->end;
+            open[depth++] = i;
+        } else if (stat->type == STAT_ASSIGNMENT) {
+            // the flag is read as a byte, any other value than 0 or 1 in a
+            // bool is undefined
+            const Assignment *ass = &stat->as.assignment;
+            uint8_t addition;
+            memcpy(&addition, &ass->isAddition, sizeof(addition));
+            if (ass->lvalue >= variables || ass->rvalue >= variables || addition > 1
+                    || ((ass->nat & VALUE_BIG) && (ass->nat & ~VALUE_BIG) >= constants))
+                invalidImage("malformed assignment");
+            after = i + 1;
+        } else if (stat->type == STAT_CALL) {
+            if (region != NODE_NONE && ends[stat->as.call.body] > region)
+                invalidImage("malformed call");
+            after = i + 1;
+        } else {
+            invalidImage("unknown statement");
+        }
+        if (stat->next == NODE_NONE)
+            continue;
+        if ((top ? stat->next < after : stat->next != after) || stat->next >= limit)
+            invalidImage("malformed statement sequence");
+        if (top)
+            owners[stat->next] = region;
+    }
+    free(open);
+    free(ends);
+    free(owners);
+}
+
+/*
+ * Load an image written by writeImage. Regular files are mapped copy on
+ * write, other streams are read into a buffer. Invalid images terminate the
+ * process.
+ * ARGS     stream - libc standard stream positioned at the beginning
+ *          vars   - empty variable table or holding x0 in slot 0 only
+ * RETURN   pointer to the newly loaded program, released by freeProgram
+ */
+Program *loadImage(FILE *stream, VariableTable *vars)
+{
+    // input check
+    if (stream == NULL || vars == NULL) {
+        fprintf(stderr, "ERROR: invalid stream or variable table to load with\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    size_t size;
+    bool mapped = true;
+    char *base = mapImage(stream, &size);
+    if (base == NULL) {
+        base = readImage(stream, &size);
+        mapped = false;
+    }
+    
+    // check the header and the bounds of all sections
+    ImageHeader header;
+    if (size < sizeof(header))
+        invalidImage("truncated header");
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, IMAGE_MAGIC, sizeof(header.magic)) != 0)
+        invalidImage("missing magic number");
+    if (header.version != IMAGE_VERSION || header.byteOrder != IMAGE_BYTE_ORDER
+            || header.statementSize != sizeof(Statement))
+        invalidImage("written by an incompatible build, compile the program again");
+    if (header.size != size || header.variables == 0
+            || !isSection(header.nodesOffset, (uint64_t)header.count * sizeof(Statement), size)
+            || !isSection(header.linesOffset, (uint64_t)header.count * sizeof(uint32_t), size)
+            || !isSection(header.varsOffset, (uint64_t)header.variables * sizeof(int64_t), size)
+            || !isSection(header.constantsOffset, 0, size))
+        invalidImage("truncated sections");
+    
+    Program *prog = malloc(sizeof(Program));
+    if (prog == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    prog->nodes = (Statement *)(base + header.nodesOffset);
+    prog->lines = (uint32_t *)(base + header.linesOffset);
+    prog->count = header.count;
+    prog->capacity = header.count;
+    prog->first = header.first;
+    prog->chunks = NULL;
+    prog->macros = NULL;
+    prog->macroCount = 0;
+    prog->image = base;
+    prog->imageSize = size;
+    prog->imageMapped = mapped;
+    checkStatements(prog, header.variables, header.constants);
+    
+    // variables have to receive the slots they had when written
+    const int64_t *ids = (const int64_t *)(base + header.varsOffset);
+    for (uint32_t i = 0; i < header.variables; ++i) {
+        if (ids[i] < LONG_MIN || ids[i] > LONG_MAX || internVariable(vars, (long)ids[i]) != (long)i)
+            invalidImage("malformed variable table");
+    }
+    
+    // replace the indices of big constants by their values
+    Value *constants = malloc((header.constants > 0 ? header.constants : 1) * sizeof(Value));
+    if (constants == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    const char *text = base + header.constantsOffset;
+    for (uint32_t i = 0; i < header.constants; ++i) {
+        const char *end = memchr(text, '\0', (size_t)(base + size - text));
+        if (end == NULL || !valueParse(text, &constants[i]))
+            invalidImage("malformed constant");
+        constants[i] = valueFreeze(constants[i]);
+        text = end + 1;
+    }
+    for (NodeIndex i = 1; i < prog->count; ++i) {
+        Statement *stat = programNode(prog, i);
+        if (stat->type == STAT_ASSIGNMENT && (stat->as.assignment.nat & VALUE_BIG))
+            stat->as.assignment.nat = constants[stat->as.assignment.nat & ~VALUE_BIG];
+    }
+    free(constants);
+    return prog;
+}
+
+/*
+ * Release the memory of a loaded image, called by freeProgram.
+ * ARGS     prog - program loaded by loadImage
+ */
+void freeImage(Program *prog)
+{
+    if (prog == NULL || prog->image == NULL)
+        return;
+#ifdef IMAGE_MMAP
+    if (prog->imageMapped) {
+        munmap(prog->image, prog->imageSize);
+        prog->image = NULL;
+        return;
+    }
+#endif
+    free(prog->image);
+    prog->image = NULL;
+}
@@ -0,0 +1,740 @@
+/*
+ * jit.c
+ *
+ * Native backend translating the syntax/semantics tree into x86-64 machine
+ * code. The register file stays in memory and is addressed relative to a
+ * callee-saved register, LOOPs become counted loops with their counters in
+ * the remaining callee-saved registers (or the stack frame once those are
+ * exhausted). Fused LOOPs (fuse.h) become a few arithmetic instructions.
+ * Values beyond the machine word fast path, affine LOOPs and all other rare
+ * cases are handed to C helpers. Every macro body called becomes
+ * a function of its own, saving the counters of its callers like a C
+ * function would.
+ *
+ * Register usage of the generated code (System V calling convention):
+ *  rbx        base address of the register file
+ *  r12 - r15  counters of the four outermost LOOPs
+ *  rax, rcx, rdx, rsi, rdi  scratch
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "affine.h"
+#include "exec.h"
+#include "fuse.h"
+#include "jit.h"
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define JIT_SUPPORTED
+#include <sys/mman.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define COUNTER_REGISTERS 4     // LOOP counters held in r12 to r15
+#define MAX_SLOT (INT32_MAX / 8) // largest slot addressable by a displacement
+#define MAX_DEPTH 65536         // deepest LOOP nesting with counters on the stack
+#define MAX_STACK (1L << 20)    // stack bytes used by the code including calls
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Out of line code jumped to from the fast path and returning to it.
+ */
+typedef struct {
+    size_t jump;                    // position of the rel32 jumping to the stub
+    size_t resume;                  // position to continue at afterwards
+    const Assignment *ass;          // assignment to be executed in C or
+    const struct sAffineLoop *affine;   // LOOP to be applied in closed form or
+    const Loop *fused;              // fused LOOP to be executed in C
+} Stub;
+
+/*
+ * Code buffer of the assembler.
+ */
+typedef struct {
+    uint8_t *bytes;     // emitted code
+    size_t length;      // number of emitted bytes
+    size_t capacity;    // number of allocated bytes
+    Stub *stubs;        // pending out of line code
+    size_t stubCount;   // number of pending stubs
+    size_t stubCapacity;    // number of allocated stubs
+    const Program *prog;    // program holding the fused LOOPs
+} Assembler;
+
+/*
+ * LOOP whose body is being translated.
+ */
+typedef struct {
+    NodeIndex loop;     // index of the LOOP statement
+    size_t affine;      // position of the rel32 jumping to the affine stub
+    size_t skip;        // position of the rel32 skipping the body
+    size_t top;         // first instruction of the body
+} OpenLoop;
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+#ifdef JIT_SUPPORTED
+
+/*
+ * Execute an assignment the fast path cannot handle (big numbers).
+ * ARGS     regs - register file
+ *          ass  - assignment to be executed
+ */
+static void jitAssign(Value *regs, const Assignment *ass)
+{
+    executeAssignment(ass, regs);
+}
+
+/*
+ * Execute a fused LOOP the fast path cannot handle (big numbers).
+ * ARGS     regs - register file
+ *          prog - program holding the LOOP
+ *          loop - fused LOOP to be executed
+ */
+static void jitFused(Value *regs, const Program *prog, const Loop *loop)
+{
+    executeFusedLoop(prog, loop, regs);
+}
+
+/*
+ * Append raw bytes to the code buffer.
+ * ARGS     as    - assembler to append to
+ *          bytes - bytes to be appended
+ *          n     - number of bytes
+ */
+static void emitBytes(Assembler *as, const void *bytes, size_t n)
+{
+    if (as->length + n > as->capacity) {
+        while (as->length + n > as->capacity)
+            as->capacity *= 2;
+        as->bytes = realloc(as->bytes, as->capacity);
+        if (as->bytes == NULL) {
+            fprintf(stderr, "ERROR: unable to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(as->bytes + as->length, bytes, n);
+    as->length += n;
+}
+
+/*
+ * Append an instruction of up to four opcode bytes followed by a little
+ * endian immediate or displacement of the given size.
+ * ARGS     as    - assembler to append to
+ *          op    - opcode bytes
+ *          nop   - number of opcode bytes
+ *          imm   - immediate or displacement
+ *          nimm  - size of the immediate in bytes (0, 4 or 8)
+ */
+static void emitInstr(Assembler *as, const uint8_t *op, size_t nop, uint64_t imm, size_t nimm)
+{
+    uint8_t buf[16];
+    memcpy(buf, op, nop);
+    for (size_t i = 0; i < nimm; ++i)
+        buf[nop + i] = (uint8_t)(imm >> (8 * i));
+    emitBytes(as, buf, nop + nimm);
+}
+
+#define EMIT(as, imm, nimm, ...) \
+    do { \
+        static const uint8_t op_[] = { __VA_ARGS__ }; \
+        emitInstr(as, op_, sizeof(op_), (uint64_t)(imm), nimm); \
+    } while (0)
+
+/*
+ * Emit a relative jump (jmp or jcc) with a placeholder target.
+ * ARGS     as - assembler to append to
+ *          cc - condition code byte of jcc (0x80 to 0x8F) or 0 for jmp
+ * RETURN   position of the rel32 to be patched
+ */
+static size_t emitJump(Assembler *as, uint8_t cc)
+{
+    if (cc == 0) {
+        EMIT(as, 0, 4, 0xE9);
+    } else {
+        uint8_t op[] = { 0x0F, cc };
+        emitInstr(as, op, sizeof(op), 0, 4);
+    }
+    return as->length - 4;
+}
+
+/*
+ * Let a previously emitted jump point to target.
+ * ARGS     as     - assembler holding the jump
+ *          jump   - position of the rel32
+ *          target - destination of the jump
+ */
+static void patchJump(Assembler *as, size_t jump, size_t target)
+{
+    uint32_t rel = (uint32_t)(target - (jump + 4));
+    for (int i = 0; i < 4; ++i)
+        as->bytes[jump + i] = (uint8_t)(rel >> (8 * i));
+}
+
+/*
+ * Remember out of line code to be emitted after the function body.
+ * ARGS     as     - assembler to add stub to
+ *          jump   - position of the rel32 jumping to the stub
+ *          resume - position to continue at after the stub
+ *          ass    - assignment to be executed in C (or NULL)
+ *          affine - affine LOOP to be applied (or NULL)
+ *          fused  - fused LOOP to be executed in C (or NULL)
+ */
+static void addStub(Assembler *as, size_t jump, size_t resume, const Assignment *ass,
+        const struct sAffineLoop *affine, const Loop *fused)
+{
+    if (as->stubCount == as->stubCapacity) {
+        as->stubCapacity *= 2;
+        as->stubs = realloc(as->stubs, as->stubCapacity * sizeof(Stub));
+        if (as->stubs == NULL) {
+            fprintf(stderr, "ERROR: unable to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    Stub *stub = &as->stubs[as->stubCount++];
+    stub->jump = jump;
+    stub->resume = resume;
+    stub->ass = ass;
+    stub->affine = affine;
+    stub->fused = fused;
+}
+
+/*
+ * Determine the deepest LOOP nesting and the highest slot of a sequence,
+ * not counting the macro bodies it calls.
+ * ARGS     prog    - program to be scanned
+ *          first   - first statement of the sequence
+ *          maxSlot - highest slot, raised
+ * RETURN   maximum nesting depth
+ */
+static long scanProgram(const Program *prog, NodeIndex first, long *maxSlot)
+{
+    NodeIndex *open = NULL;
+    long depth = 0, capacity = 0, maxDepth = 0;
+    
+    NodeIndex i = first;
+    for (;;) {
+        while (i != NODE_NONE) {
+            const Statement *stat = programNode(prog, i);
+            if (stat->type == STAT_CALL) {
+                i = stat->next;
+            } else if (stat->type == STAT_ASSIGNMENT) {
+                const Assignment *ass = &stat->as.assignment;
+                if (ass->lvalue > *maxSlot)
+                    *maxSlot = ass->lvalue;
+                if (ass->rvalue > *maxSlot)
+                    *maxSlot = ass->rvalue;
+                i = stat->next;
+            } else {
+                if (stat->as.loop.var > *maxSlot)
+                    *maxSlot = stat->as.loop.var;
+                if (depth == capacity) {
+                    capacity = capacity > 0 ? 2 * capacity : 64;
+                    open = realloc(open, capacity * sizeof(NodeIndex));
+                    if (open == NULL) {
+                        fprintf(stderr, "ERROR: unable to allocate memory\n");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                open[depth++] = i;
+                if (depth > maxDepth)
+                    maxDepth = depth;
+                i = stat->as.loop.body;
+            }
+        }
+        if (depth == 0)
+            break;
+        i = programNode(prog, open[--depth])->next;
+    }
+    free(open);
+    return maxDepth;
+}
+
+/*
+ * Emit the fast path of an assignment, big numbers leave to a stub.
+ * ARGS     as  - assembler to append to
+ *          ass - assignment to be translated
+ */
+static void compileAssignment(Assembler *as, const Assignment *ass)
+{
+    uint32_t dst = (uint32_t)(8 * ass->lvalue);
+    uint32_t src = (uint32_t)(8 * ass->rvalue);
+    
+    // big constants are added in C only, subtracting them always yields zero
+    if (ass->isAddition && (ass->nat & VALUE_BIG)) {
+        EMIT(as, 0, 0, 0x48, 0x89, 0xDF);                   // mov rdi, rbx
+        EMIT(as, (uintptr_t)ass, 8, 0x48, 0xBE);            // mov rsi, ass
+        EMIT(as, (uintptr_t)&jitAssign, 8, 0x48, 0xB8);     // mov rax, jitAssign
+        EMIT(as, 0, 0, 0xFF, 0xD0);                         // call rax
+        return;
+    }
+    
+    // take the stub if the source or the old destination is a big number
+    EMIT(as, src, 4, 0x48, 0x8B, 0x83);                     // mov rax, [rbx+src]
+    EMIT(as, dst, 4, 0x48, 0x8B, 0x8B);                     // mov rcx, [rbx+dst]
+    EMIT(as, 0, 0, 0x48, 0x09, 0xC1);                       // or rcx, rax
+    size_t big = emitJump(as, 0x88);                        // js stub
+    
+    if (ass->isAddition) {
+        if (ass->nat <= INT32_MAX) {
+            EMIT(as, ass->nat, 4, 0x48, 0x05);              // add rax, imm32
+        } else {
+            EMIT(as, ass->nat, 8, 0x48, 0xB9);              // mov rcx, imm64
+            EMIT(as, 0, 0, 0x48, 0x01, 0xC8);               // add rax, rcx
+        }
+        // the sum of two small values overflows into the tag bit only
+        size_t overflow = emitJump(as, 0x88);               // js stub
+        EMIT(as, dst, 4, 0x48, 0x89, 0x83);                 // mov [rbx+dst], rax
+        addStub(as, overflow, as->length, ass, NULL, NULL);
+    } else {
+        EMIT(as, 0, 0, 0x31, 0xD2);                         // xor edx, edx
+        if (ass->nat & VALUE_BIG) {
+            EMIT(as, 0, 0, 0x48, 0x89, 0xD0);               // mov rax, rdx
+        } else if (ass->nat <= INT32_MAX) {
+            EMIT(as, ass->nat, 4, 0x48, 0x2D);              // sub rax, imm32
+        } else {
+            EMIT(as, ass->nat, 8, 0x48, 0xB9);              // mov rcx, imm64
+            EMIT(as, 0, 0, 0x48, 0x29, 0xC8);               // sub rax, rcx
+        }
+        EMIT(as, 0, 0, 0x48, 0x0F, 0x42, 0xC2);             // cmovb rax, rdx
+        EMIT(as, dst, 4, 0x48, 0x89, 0x83);                 // mov [rbx+dst], rax
+    }
+    addStub(as, big, as->length, ass, NULL, NULL);
+}
+
+/*
+ * Multiply rax by a constant, jumping to a stub on overflow.
+ * ARGS     as - assembler to append to
+ *          k  - factor below 2^63
+ * RETURN   position of the rel32 jumping to the stub
+ */
+static size_t emitMultiply(Assembler *as, NatNum k)
+{
+    if (k <= INT32_MAX) {
+        EMIT(as, k, 4, 0x48, 0x69, 0xC0);                   // imul rax, rax, imm32
+    } else {
+        EMIT(as, k, 8, 0x48, 0xBA);                         // mov rdx, imm64
+        EMIT(as, 0, 0, 0x48, 0x0F, 0xAF, 0xC2);             // imul rax, rdx
+    }
+    return emitJump(as, 0x80);                              // jo stub
+}
+
+/*
+ * Emit the fast path of a fused LOOP (fuse.h), big numbers and products
+ * beyond the machine word leave to a stub.
+ * ARGS     as   - assembler to append to
+ *          loop - fused LOOP to be translated
+ */
+static void compileFused(Assembler *as, const Loop *loop)
+{
+    const Statement *body = programNode(as->prog, loop->body);
+    const Assignment *ass = loop->fused == FUSED_MUL_ADD
+            ? &programNode(as->prog, body->as.loop.body)->as.assignment : &body->as.assignment;
+    uint32_t src = (uint32_t)(8 * loop->var);
+    uint32_t dst = (uint32_t)(8 * ass->lvalue);
+    if (ass->nat == 0 && loop->fused != FUSED_ZERO)
+        return;
+    if (ass->nat & VALUE_BIG) {
+        size_t jump = emitJump(as, 0);                      // jmp stub
+        addStub(as, jump, as->length, NULL, NULL, loop);
+        return;
+    }
+    
+    size_t jumps[4];
+    size_t count = 0;
+    switch (loop->fused) {
+    case FUSED_ZERO:
+        EMIT(as, src, 4, 0x48, 0x8B, 0x83);                 // mov rax, [rbx+src]
+        EMIT(as, 0, 0, 0x48, 0x85, 0xC0);                   // test rax, rax
+        jumps[count++] = emitJump(as, 0x88);                // js stub
+        EMIT(as, src, 8, 0x48, 0xC7, 0x83);                 // mov qword [rbx+src], 0 (disp32, imm32)
+        break;
+    case FUSED_ADD_VAR:
+    case FUSED_SUB_VAR:
+        EMIT(as, src, 4, 0x48, 0x8B, 0x83);                 // mov rax, [rbx+src]
+        EMIT(as, dst, 4, 0x48, 0x8B, 0x8B);                 // mov rcx, [rbx+dst]
+        EMIT(as, 0, 0, 0x48, 0x89, 0xC2);                   // mov rdx, rax
+        EMIT(as, 0, 0, 0x48, 0x09, 0xCA);                   // or rdx, rcx
+        jumps[count++] = emitJump(as, 0x88);                // js stub
+        jumps[count++] = emitMultiply(as, ass->nat);
+        if (loop->fused == FUSED_ADD_VAR) {
+            // the sum of two small values overflows into the tag bit only
+            EMIT(as, 0, 0, 0x48, 0x01, 0xC8);               // add rax, rcx
+            jumps[count++] = emitJump(as, 0x88);            // js stub
+            EMIT(as, dst, 4, 0x48, 0x89, 0x83);             // mov [rbx+dst], rax
+        } else {
+            EMIT(as, 0, 0, 0x31, 0xD2);                     // xor edx, edx
+            EMIT(as, 0, 0, 0x48, 0x29, 0xC1);               // sub rcx, rax
+            EMIT(as, 0, 0, 0x48, 0x0F, 0x42, 0xCA);         // cmovb rcx, rdx
+            EMIT(as, dst, 4, 0x48, 0x89, 0x8B);             // mov [rbx+dst], rcx
+        }
+        break;
+    default:
+        EMIT(as, src, 4, 0x48, 0x8B, 0x83);                 // mov rax, [rbx+src]
+        EMIT(as, 8 * body->as.loop.var, 4, 0x48, 0x8B, 0x93);   // mov rdx, [rbx+inner]
+        EMIT(as, dst, 4, 0x48, 0x8B, 0x8B);                 // mov rcx, [rbx+dst]
+        EMIT(as, 0, 0, 0x48, 0x89, 0xC6);                   // mov rsi, rax
+        EMIT(as, 0, 0, 0x48, 0x09, 0xCE);                   // or rsi, rcx
+        EMIT(as, 0, 0, 0x48, 0x09, 0xD6);                   // or rsi, rdx
+        jumps[count++] = emitJump(as, 0x88);                // js stub
+        EMIT(as, 0, 0, 0x48, 0x0F, 0xAF, 0xC2);             // imul rax, rdx
+        jumps[count++] = emitJump(as, 0x80);                // jo stub
+        jumps[count++] = emitMultiply(as, ass->nat);
+        EMIT(as, 0, 0, 0x48, 0x01, 0xC8);                   // add rax, rcx
+        jumps[count++] = emitJump(as, 0x88);                // js stub
+        EMIT(as, dst, 4, 0x48, 0x89, 0x83);                 // mov [rbx+dst], rax
+        break;
+    }
+    for (size_t i = 0; i < count; ++i)
+        addStub(as, jumps[i], as->length, NULL, NULL, loop);
+}
+
+/*
+ * Emit the head of a LOOP up to the first instruction of its body.
+ * ARGS     as    - assembler to append to
+ *          loop  - LOOP to be translated
+ *          depth - nesting depth of the LOOP (index of its counter)
+ *          open  - positions to be patched by closeLoop, set
+ */
+static void openLoop(Assembler *as, const Loop *loop, long depth, OpenLoop *open)
+{
+    EMIT(as, 8 * loop->var, 4, 0x48, 0x8B, 0x83);           // mov rax, [rbx+var]
+    
+    // large limits of affine LOOPs are applied in closed form
+    open->affine = 0;
+    if (loop->affine != NULL) {
+        EMIT(as, AFFINE_MIN_LIMIT, 4, 0x48, 0x3D);          // cmp rax, imm32
+        open->affine = emitJump(as, 0x83);                  // jae stub
+    }
+    
+    // big limits saturate, zero skips the body
+    EMIT(as, UINT32_MAX, 4, 0x48, 0xC7, 0xC2);              // mov rdx, -1
+    EMIT(as, 0, 0, 0x48, 0x85, 0xC0);                       // test rax, rax
+    EMIT(as, 0, 0, 0x48, 0x0F, 0x48, 0xC2);                 // cmovs rax, rdx
+    EMIT(as, 0, 0, 0x48, 0x85, 0xC0);                       // test rax, rax
+    open->skip = emitJump(as, 0x84);                        // jz after
+    
+    uint32_t frame = (uint32_t)(8 * (depth - COUNTER_REGISTERS));
+    if (depth < COUNTER_REGISTERS) {
+        uint8_t op[] = { 0x49, 0x89, (uint8_t)(0xC4 + depth) };
+        emitInstr(as, op, sizeof(op), 0, 0);                // mov r12+depth, rax
+    } else {
+        EMIT(as, frame, 4, 0x48, 0x89, 0x84, 0x24);         // mov [rsp+frame], rax
+    }
+    open->top = as->length;
+}
+
+/*
+ * Emit the tail of a LOOP after the last instruction of its body.
+ * ARGS     as    - assembler to append to
+ *          loop  - LOOP to be translated
+ *          depth - nesting depth of the LOOP (index of its counter)
+ *          open  - positions recorded by openLoop
+ */
+static void closeLoop(Assembler *as, const Loop *loop, long depth, const OpenLoop *open)
+{
+    uint32_t frame = (uint32_t)(8 * (depth - COUNTER_REGISTERS));
+    if (depth < COUNTER_REGISTERS) {
+        uint8_t op[] = { 0x49, 0xFF, (uint8_t)(0xCC + depth) };
+        emitInstr(as, op, sizeof(op), 0, 0);                // dec r12+depth
+    } else {
+        EMIT(as, frame, 4, 0x48, 0xFF, 0x8C, 0x24);         // dec qword [rsp+frame]
+    }
+    patchJump(as, emitJump(as, 0x85), open->top);           // jnz top
+    
+    patchJump(as, open->skip, as->length);
+    if (loop->affine != NULL)
+        addStub(as, open->affine, as->length, NULL, loop->affine, NULL);
+}
+
+/*
+ * Emit the code of a sequence of statements. Macro bodies called by the
+ * sequence have to be compiled before.
+ * ARGS     as      - assembler to append to
+ *          prog    - program to be translated
+ *          first   - first statement of the sequence
+ *          entries - first instruction of every macro body compiled, indexed
+ *                    by the first statement of the body
+ *          stack   - stack bytes used by every macro body, indexed likewise
+ * RETURN   stack bytes used by the macro bodies called, 0 if none
+ */
+static long compileStatements(Assembler *as, const Program *prog, NodeIndex first, const size_t *entries,
+        const long *stack)
+{
+    OpenLoop *open = NULL;
+    long depth = 0, capacity = 0, callee = 0;
+    
+    NodeIndex i = first;
+    for (;;) {
+        while (i != NODE_NONE) {
+            const Statement *stat = programNode(prog, i);
+            if (stat->type == STAT_ASSIGNMENT) {
+                compileAssignment(as, &stat->as.assignment);
+                i = stat->next;
+                continue;
+            }
+            if (stat->type == STAT_CALL) {
+                EMIT(as, 0, 0, 0x48, 0x89, 0xDF);           // mov rdi, rbx
+                EMIT(as, 0, 4, 0xE8);                       // call body
+                patchJump(as, as->length - 4, entries[stat->as.call.body]);
+                if (stack[stat->as.call.body] > callee)
+                    callee = stack[stat->as.call.body];
+                i = stat->next;
+                continue;
+            }
+            if (stat->as.loop.fused != FUSED_NONE) {
+                compileFused(as, &stat->as.loop);
+                i = stat->next;
+                continue;
+            }
+            if (depth == capacity) {
+                capacity = capacity > 0 ? 2 * capacity : 64;
+                open = realloc(open, capacity * sizeof(OpenLoop));
+                if (open == NULL) {
+                    fprintf(stderr, "ERROR: unable to allocate memory\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            open[depth].loop = i;
+            openLoop(as, &stat->as.loop, depth, &open[depth]);
+            ++depth;
+            i = stat->as.loop.body;
+        }
+        if (depth == 0)
+            break;
+        --depth;
+        const Statement *stat = programNode(prog, open[depth].loop);
+        closeLoop(as, &stat->as.loop, depth, &open[depth]);
+        i = stat->next;
+    }
+    free(open);
+    return callee;
+}
+
+/*
+ * Emit a sequence of statements as a function taking the register file.
+ * ARGS     as      - assembler to append to
+ *          prog    - program to be translated
+ *          first   - first statement of the sequence
+ *          entries - first instruction of every macro body compiled, indexed
+ *                    by the first statement of the body
+ *          stack   - stack bytes used by every macro body, indexed likewise
+ *          maxSlot - highest slot, raised
+ * RETURN   stack bytes used by the function including its callees, -1 if
+ *          they exceed MAX_STACK
+ */
+static long compileFunction(Assembler *as, const Program *prog, NodeIndex first, const size_t *entries,
+        const long *stack, long *maxSlot)
+{
+    // the six pushes leave the stack misaligned by 8, the frame fixes that
+    long maxDepth = scanProgram(prog, first, maxSlot);
+    if (maxDepth > MAX_DEPTH)
+        return -1;
+    long frameSlots = maxDepth > COUNTER_REGISTERS ? maxDepth - COUNTER_REGISTERS : 0;
+    uint32_t frame = (uint32_t)(8 * (frameSlots | 1));
+    EMIT(as, 0, 0, 0x55);                                   // push rbp
+    EMIT(as, 0, 0, 0x53);                                   // push rbx
+    EMIT(as, 0, 0, 0x41, 0x54);                             // push r12
+    EMIT(as, 0, 0, 0x41, 0x55);                             // push r13
+    EMIT(as, 0, 0, 0x41, 0x56);                             // push r14
+    EMIT(as, 0, 0, 0x41, 0x57);                             // push r15
+    EMIT(as, frame, 4, 0x48, 0x81, 0xEC);                   // sub rsp, frame
+    EMIT(as, 0, 0, 0x48, 0x89, 0xFB);                       // mov rbx, rdi
+    
+    long callee = compileStatements(as, prog, first, entries, stack);
+    
+    EMIT(as, frame, 4, 0x48, 0x81, 0xC4);                   // add rsp, frame
+    EMIT(as, 0, 0, 0x41, 0x5F);                             // pop r15
+    EMIT(as, 0, 0, 0x41, 0x5E);                             // pop r14
+    EMIT(as, 0, 0, 0x41, 0x5D);                             // pop r13
+    EMIT(as, 0, 0, 0x41, 0x5C);                             // pop r12
+    EMIT(as, 0, 0, 0x5B);                                   // pop rbx
+    EMIT(as, 0, 0, 0x5D);                                   // pop rbp
+    EMIT(as, 0, 0, 0xC3);                                   // ret
+    
+    // return address, pushes and frame come on top of the callees
+    if (callee < 0 || callee + 56 + (long)frame > MAX_STACK)
+        return -1;
+    return callee + 56 + (long)frame;
+}
+
+/*
+ * Emit all pending stubs after the function body.
+ * ARGS     as - assembler to append to
+ */
+static void compileStubs(Assembler *as)
+{
+    for (size_t i = 0; i < as->stubCount; ++i) {
+        Stub *stub = &as->stubs[i];
+        patchJump(as, stub->jump, as->length);
+        if (stub->ass != NULL) {
+            EMIT(as, 0, 0, 0x48, 0x89, 0xDF);               // mov rdi, rbx
+            EMIT(as, (uintptr_t)stub->ass, 8, 0x48, 0xBE);  // mov rsi, ass
+            EMIT(as, (uintptr_t)&jitAssign, 8, 0x48, 0xB8); // mov rax, jitAssign
+        } else if (stub->fused != NULL) {
+            EMIT(as, 0, 0, 0x48, 0x89, 0xDF);               // mov rdi, rbx
+            EMIT(as, (uintptr_t)as->prog, 8, 0x48, 0xBE);   // mov rsi, prog
+            EMIT(as, (uintptr_t)stub->fused, 8, 0x48, 0xBA);    // mov rdx, loop
+            EMIT(as, (uintptr_t)&jitFused, 8, 0x48, 0xB8);  // mov rax, jitFused
+        } else {
+            EMIT(as, 0, 0, 0x48, 0x89, 0xC6);               // mov rsi, rax
+            EMIT(as, (uintptr_t)stub->affine, 8, 0x48, 0xBF);   // mov rdi, affine
+            EMIT(as, 0, 0, 0x48, 0x89, 0xDA);               // mov rdx, rbx
+            EMIT(as, (uintptr_t)&executeAffineLoop, 8, 0x48, 0xB8); // mov rax, executeAffineLoop
+        }
+        EMIT(as, 0, 0, 0xFF, 0xD0);                         // call rax
+        patchJump(as, emitJump(as, 0), stub->resume);       // jmp resume
+    }
+}
+
+#endif /* JIT_SUPPORTED */
+
+/*
+ * Translate the syntax/semantics tree into machine code.
+ * ARGS     prog - program to be compiled
+ * RETURN   pointer to the newly allocated code or NULL if the platform or
+ *          the program is not supported
+ */
+NativeCode *compileNative(Program *prog)
+{
+    // input check
+    if (prog == NULL) {
+        fprintf(stderr, "ERROR: cannot compile empty program\n");
+        exit(EXIT_FAILURE);
+    }
+
+#ifndef JIT_SUPPORTED
+    return NULL;
+#else
+    Assembler as;
+    as.length = 0;
+    as.capacity = 4096;
+    as.bytes = malloc(as.capacity);
+    as.stubCount = 0;
+    as.stubCapacity = 64;
+    as.stubs = malloc(as.stubCapacity * sizeof(Stub));
+    as.prog = prog;
+    if (as.bytes == NULL || as.stubs == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    // mark the macro bodies called anywhere, then compile them in the order
+    // of the arena, which has every callee compiled before its callers
+    size_t *entries = NULL;
+    long *stack = NULL;
+    long maxSlot = 0, used = 0;
+    for (NodeIndex i = 1; i < prog->count; ++i) {
+        const Statement *stat = programNode(prog, i);
+        if (stat->type != STAT_CALL)
+            continue;
+        if (entries == NULL) {
+            entries = calloc(prog->count, sizeof(size_t));
+            stack = malloc(prog->count * sizeof(long));
+            if (entries == NULL || stack == NULL) {
+                fprintf(stderr, "ERROR: unable to allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        entries[stat->as.call.body] = 1;
+    }
+    for (NodeIndex i = 1; entries != NULL && i < prog->count && used >= 0; ++i) {
+        if (entries[i] == 0)
+            continue;
+        entries[i] = as.length;
+        used = stack[i] = compileFunction(&as, prog, i, entries, stack, &maxSlot);
+    }
+    size_t entry = as.length;
+    if (used >= 0)
+        used = compileFunction(&as, prog, prog->first, entries, stack, &maxSlot);
+    free(entries);
+    free(stack);
+    
+    // registers and counters in the stack frame have to be addressable by 32
+    // bit displacements, the frames have to fit on the stack
+    if (used < 0 || maxSlot > MAX_SLOT) {
+        free(as.bytes);
+        free(as.stubs);
+        return NULL;
+    }
+    compileStubs(&as);
+    
+    // copy code into a fresh mapping, which is never writable and executable
+    NativeCode *code = malloc(sizeof(NativeCode));
+    if (code == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    code->size = as.length;
+    code->entry = entry;
+    code->memory = mmap(NULL, code->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code->memory == MAP_FAILED) {
+        free(code);
+        code = NULL;
+    } else {
+        memcpy(code->memory, as.bytes, as.length);
+        if (mprotect(code->memory, code->size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(code->memory, code->size);
+            free(code);
+            code = NULL;
+        }
+    }
+    free(as.bytes);
+    free(as.stubs);
+    return code;
+#endif
+}
+
+/*
+ * Release the machine code.
+ * ARGS     code - code to be freed (may be NULL)
+ */
+void freeNative(NativeCode *code)
+{
+    if (code == NULL)
+        return;
+#ifdef JIT_SUPPORTED
+    munmap(code->memory, code->size);
+#endif
+    free(code);
+}
+
+/*
+ * Execute machine code on the given register file.
+ * ARGS     code - compiled program
+ *          regs - initialized register file indexed by variable slots
+ */
+void executeNative(const NativeCode *code, Value *regs)
+{
+    // input check
+    if (code == NULL || regs == NULL) {
+        fprintf(stderr, "ERROR: cannot execute missing machine code or without registers\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    void (*entry)(Value *);
+    *(void **)&entry = (uint8_t *)code->memory + code->entry;
+    entry(regs);
+}
@@ -15,98 +15,695 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "affine.h"
+#include "batch.h"
+#include "budget.h"
+#include "engine.h"
+#include "exec.h"
+#include "fuse.h"
+#include "hash.h"
+#include "image.h"
+#include "memo.h"
+#include "optimise.h"
+#include "parallel.h"
 #include "parser.h"
+#include "pool.h"
+#include "profile.h"
+#include "server.h"
+#include "simd.h"
+#include "stats.h"
+#include "symbolic.h"
+#include "value.h"
 #include "var.h"
 
 
 /******************************************************************************
- *                            FUNCTION DECLARATIONS
+ *                            GLOBAL DECLARATIONS
  */
 
-void executeProgram(Program *prog, VariableList vars);
+#define OUTPUT_BUFFER_SIZE (1 << 20)    // stdout buffer in batch mode
+#define BATCH_CHUNK_SIZE 64             // input vectors evaluated per task
+#define BATCH_WINDOW 256                // chunks read ahead of the printed one
+#define PROFILE_HOTSPOTS 10             // entries per list of --profile
+#define SERVER_CACHE_SIZE 64            // programs cached by --serve
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Position of an input vector in its chunk, sorted so that lanes executed
+ * together run LOOPs of similar counts.
+ */
+typedef struct {
+    const Value *inputs;    // values of x1, x2, ...
+    long count;             // number of values
+    long index;             // index of the vector within the chunk
+} VectorKey;
+
+/*
+ * Consecutive input vectors evaluated by one worker.
+ */
+typedef struct {
+    Value *inputs;                          // values of all vectors in the chunk
+    long capacity;                          // allocated entries of inputs
+    long offsets[BATCH_CHUNK_SIZE + 1];     // first value of every vector (count + 1)
+    Value results[BATCH_CHUNK_SIZE];        // x_0 of every vector
+    VectorKey order[BATCH_CHUNK_SIZE];      // vectors sorted by their inputs (SIMD)
+    long count;                             // number of vectors in the chunk
+} BatchChunk;
+
+/*
+ * Input vectors streamed through the pool in chunks. Workers share the
+ * program read-only and own one register file each.
+ */
+typedef struct {
+    const Executable *exe;      // prepared program
+    const VariableTable *vars;  // variable table of the program
+    BatchReader *reader;        // source of the vectors
+    Value **regs;               // register file of every worker
+    LaneFile **lanes;           // lane register file of every worker (SIMD)
+    BatchChunk *chunks;         // chunk of task i in slot i % BATCH_WINDOW
+} Batch;
 
 
 /******************************************************************************
  *                           FUNCTION DEFINITIONS
  */
 
+/*
+ * Evaluate one input vector of a chunk.
+ * ARGS     batch  - batch being evaluated
+ *          chunk  - chunk holding the vector
+ *          worker - index of the executing worker
+ *          index  - index of the vector within the chunk
+ */
+static void evaluateVector(Batch *batch, BatchChunk *chunk, long worker, long index)
+{
+    Value *regs = batch->regs[worker];
+    clearRegisters(batch->vars, regs);
+    storeInputs(batch->vars, regs, chunk->inputs + chunk->offsets[index],
+            chunk->offsets[index + 1] - chunk->offsets[index]);
+    runExecutable(batch->exe, regs);
+    chunk->results[index] = regs[0];
+    regs[0] = 0;
+}
+
+/*
+ * Order input vectors lexicographically by their values, qsort callback.
+ */
+static int compareVectors(const void *a, const void *b)
+{
+    const VectorKey *x = a, *y = b;
+    for (long i = 0; i < x->count && i < y->count; ++i) {
+        if (x->inputs[i] != y->inputs[i])
+            return x->inputs[i] < y->inputs[i] ? -1 : 1;
+    }
+    return (x->count > y->count) - (x->count < y->count);
+}
+
+/*
+ * Evaluate laneWidth similar input vectors of a chunk at once. Groups
+ * holding big inputs or overflowing a machine word are evaluated vector by
+ * vector instead.
+ * ARGS     batch  - batch being evaluated
+ *          chunk  - chunk holding the vectors, sorted
+ *          worker - index of the executing worker
+ *          first  - index of the first vector of the group in chunk->order
+ */
+static void evaluateLanes(Batch *batch, BatchChunk *chunk, long worker, long first)
+{
+    LaneFile *lanes = batch->lanes[worker];
+    const VectorKey *keys = chunk->order + first;
+    long width = chunk->count - first;
+    if (width > lanes->width)
+        width = lanes->width;
+    
+    clearLaneFile(lanes);
+    bool fits = true;
+    for (long l = 0; l < width && fits; ++l) {
+        for (long i = 0; i < keys[l].count; ++i) {
+            long slot = lookupVariable(batch->vars, i + 1);
+            if (keys[l].inputs[i] & VALUE_BIG)
+                fits = false;
+            else if (slot >= 0)
+                lanes->regs[slot * SIMD_LANES + l] = keys[l].inputs[i];
+        }
+    }
+    
+    if (fits && executeLanes(batch->exe->prog, lanes)) {
+        for (long l = 0; l < width; ++l)
+            chunk->results[keys[l].index] = lanes->regs[l];
+    } else {
+        for (long l = 0; l < width; ++l)
+            evaluateVector(batch, chunk, worker, keys[l].index);
+    }
+}
+
+/*
+ * Read the next chunk of input vectors, feed of the thread pool.
+ * ARGS     context - batch being evaluated
+ *          index   - index of the chunk
+ * RETURN   false at the end of the input
+ */
+static bool readChunk(void *context, long index)
+{
+    Batch *batch = context;
+    BatchChunk *chunk = &batch->chunks[index % BATCH_WINDOW];
+    chunk->count = 0;
+    chunk->offsets[0] = 0;
+    Value *inputs;
+    long count;
+    while (chunk->count < BATCH_CHUNK_SIZE && (count = readBatch(batch->reader, &inputs)) >= 0) {
+        long used = chunk->offsets[chunk->count];
+        if (used + count > chunk->capacity) {
+            while (used + count > chunk->capacity)
+                chunk->capacity = chunk->capacity > 0 ? 2 * chunk->capacity : BATCH_CHUNK_SIZE;
+            chunk->inputs = realloc(chunk->inputs, chunk->capacity * sizeof(Value));
+            if (chunk->inputs == NULL) {
+                fprintf(stderr, "ERROR: unable to allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        memcpy(chunk->inputs + used, inputs, count * sizeof(Value));
+        chunk->offsets[++chunk->count] = used + count;
+    }
+    return chunk->count > 0;
+}
+
+/*
+ * Evaluate all input vectors of a chunk, task of the thread pool.
+ * ARGS     context - batch being evaluated
+ *          worker  - index of the executing worker
+ *          index   - index of the chunk
+ */
+static void evaluateChunk(void *context, long worker, long index)
+{
+    Batch *batch = context;
+    BatchChunk *chunk = &batch->chunks[index % BATCH_WINDOW];
+    if (batch->exe->engine != ENGINE_SIMD) {
+        for (long i = 0; i < chunk->count; ++i)
+            evaluateVector(batch, chunk, worker, i);
+        return;
+    }
+    
+    for (long i = 0; i < chunk->count; ++i) {
+        chunk->order[i].inputs = chunk->inputs + chunk->offsets[i];
+        chunk->order[i].count = chunk->offsets[i + 1] - chunk->offsets[i];
+        chunk->order[i].index = i;
+    }
+    qsort(chunk->order, chunk->count, sizeof(VectorKey), compareVectors);
+    for (long i = 0; i < chunk->count; i += batch->lanes[worker]->width)
+        evaluateLanes(batch, chunk, worker, i);
+}
+
+/*
+ * Print x_0 of every input vector of a chunk, emit of the thread pool.
+ * ARGS     context - batch being evaluated
+ *          index   - index of the chunk
+ */
+static void printChunk(void *context, long index)
+{
+    Batch *batch = context;
+    BatchChunk *chunk = &batch->chunks[index % BATCH_WINDOW];
+    for (long i = 0; i < chunk->count; ++i) {
+        valuePrint(stdout, chunk->results[i]);
+        putchar('\n');
+        valueRelease(chunk->results[i]);
+    }
+}
+
+/*
+ * Evaluate the program for every input vector of a stream and print x_0 of
+ * each evaluation on its own line. Vectors are read in chunks while earlier
+ * chunks are still evaluated, so a vector of enormous cost keeps only its
+ * own worker busy. Results are printed in input order, at most BATCH_WINDOW
+ * chunks are held back behind an unfinished one.
+ * ARGS     exe    - prepared program
+ *          vars   - variable table the program was parsed with
+ *          stream - stream of input vectors
+ *          binary - true if the vectors are binary records
+ *          pool   - workers evaluating the vectors
+ */
+static void runBatch(const Executable *exe, const VariableTable *vars, FILE *stream,
+        bool binary, ThreadPool *pool)
+{
+    static char buffer[OUTPUT_BUFFER_SIZE];
+    setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+    
+    long workers = poolWorkers(pool);
+    Batch batch = { exe, vars, NULL, NULL, NULL, NULL };
+    batch.regs = malloc(workers * sizeof(Value *));
+    batch.lanes = malloc(workers * sizeof(LaneFile *));
+    batch.chunks = calloc(BATCH_WINDOW, sizeof(BatchChunk));
+    if (batch.regs == NULL || batch.lanes == NULL || batch.chunks == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (long i = 0; i < workers; ++i) {
+        batch.regs[i] = createRegisters(vars);
+        batch.lanes[i] = exe->engine == ENGINE_SIMD ? createLaneFile(vars) : NULL;
+    }
+    
+    batch.reader = createBatchReader(stream, binary);
+    streamPool(pool, BATCH_WINDOW, readChunk, evaluateChunk, printChunk, &batch);
+    freeBatchReader(batch.reader);
+    fflush(stdout);
+    
+    for (long i = 0; i < workers; ++i) {
+        clearRegisters(vars, batch.regs[i]);
+        free(batch.regs[i]);
+        freeLaneFile(batch.lanes[i]);
+    }
+    for (long i = 0; i < BATCH_WINDOW; ++i)
+        free(batch.chunks[i].inputs);
+    free(batch.regs);
+    free(batch.lanes);
+    free(batch.chunks);
+}
+
+/*
+ * Write a program as image, by default next to the program with the
+ * extension replaced by IMAGE_EXTENSION.
+ * ARGS     prog   - parsed program
+ *          vars   - variable table the program was parsed with
+ *          source - path of the program
+ *          output - path of the image or NULL
+ */
+static void writeProgramImage(const Program *prog, const VariableTable *vars, const char *source,
+        const char *output)
+{
+    char *path = NULL;
+    if (output == NULL) {
+        const char *dot = strrchr(source, '.');
+        const char *slash = strrchr(source, '/');
+        size_t length = dot != NULL && (slash == NULL || dot > slash) ? (size_t)(dot - source)
+                : strlen(source);
+        path = malloc(length + sizeof(IMAGE_EXTENSION));
+        if (path == NULL) {
+            fprintf(stderr, "ERROR: unable to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(path, source, length);
+        strcpy(path + length, IMAGE_EXTENSION);
+        output = path;
+    }
+    
+    FILE *stream = fopen(output, "wb");
+    if (stream == NULL) {
+        perror("ERROR: failed to open output file");
+        exit(EXIT_FAILURE);
+    }
+    if (!writeImage(stream, prog, vars) || fclose(stream) != 0) {
+        perror("ERROR: failed to write program image");
+        exit(EXIT_FAILURE);
+    }
+    free(path);
+}
+
+/*
+ * Write the summary of a run for --stats.
+ * ARGS     output - file name or "-" for stderr
+ *          stats  - summary of the run
+ */
+static void writeRunStats(const char *output, const RunStats *stats)
+{
+    FILE *stream = strcmp(output, "-") == 0 ? stderr : fopen(output, "w");
+    if (stream == NULL) {
+        perror("ERROR: failed to open statistics output file");
+        exit(EXIT_FAILURE);
+    }
+    printRunStats(stream, stats);
+    if (stream != stderr && fclose(stream) != 0) {
+        perror("ERROR: failed to write statistics");
+        exit(EXIT_FAILURE);
+    }
+}
+
 /*
  * Main function checking the command line parameters starting the parser,
- * initializing the varaible list and starting the execution of the AST.
+ * initializing the register file and starting the execution of the AST.
  * ARGS     argc - number of command line parameters
  *          argv - vector of command line parameters
  */
 int main(int argc, char *argv[])
 {
+    // read options preceding the program
+    Engine engine = ENGINE_TREE;
+    bool emit = false;
+    bool solve = false;
+    bool compile = false;
+    bool binary = false;
+    bool profiled = false;
+    bool report = false;
+    bool fuseReport = false;
+    bool parallel = false;
+    unsigned passes = PASSES_NONE;
+    const char *folded = NULL;
+    const char *batch = NULL;
+    const char *serve = NULL;
+    const char *memo = NULL;
+    const char *statsOutput = NULL;
+    long memoEntries = MEMO_ENTRIES;
+    long threads = -1;
+    long cache = SERVER_CACHE_SIZE;
+    unsigned long long fuel = 0;
+    double seconds = 0;
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; ++arg) {
+        if (strncmp(argv[arg], "--engine=", 9) == 0) {
+            if (!parseEngine(argv[arg] + 9, &engine)) {
+                fprintf(stderr, "ERROR: unknown engine %s\n", argv[arg] + 9);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[arg], "--emit-c") == 0) {
+            emit = true;
+        } else if (strcmp(argv[arg], "--emit-closed-form") == 0) {
+            solve = true;
+        } else if (strcmp(argv[arg], "--compile") == 0) {
+            compile = true;
+        } else if (strcmp(argv[arg], "--batch") == 0) {
+            batch = "-";
+        } else if (strncmp(argv[arg], "--batch=", 8) == 0) {
+            batch = argv[arg] + 8;
+        } else if (strcmp(argv[arg], "--profile") == 0) {
+            profiled = true;
+        } else if (strncmp(argv[arg], "--profile=", 10) == 0) {
+            profiled = true;
+            folded = argv[arg] + 10;
+        } else if (strcmp(argv[arg], "--optimise") == 0) {
+            passes = PASSES_ALL;
+        } else if (strncmp(argv[arg], "--optimise=", 11) == 0) {
+            if (!parsePasses(argv[arg] + 11, &passes)) {
+                fprintf(stderr, "ERROR: unknown optimiser passes %s\n", argv[arg] + 11);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[arg], "--optimise-report") == 0) {
+            report = true;
+        } else if (strcmp(argv[arg], "--fuse-report") == 0) {
+            fuseReport = true;
+        } else if (strcmp(argv[arg], "--stats=json") == 0) {
+            statsOutput = "-";
+        } else if (strncmp(argv[arg], "--stats=json:", 13) == 0 && argv[arg][13] != '\0') {
+            statsOutput = argv[arg] + 13;
+        } else if (strncmp(argv[arg], "--stats=", 8) == 0) {
+            fprintf(stderr, "ERROR: unknown statistics format %s\n", argv[arg] + 8);
+            exit(EXIT_FAILURE);
+        } else if (strcmp(argv[arg], "--parallel") == 0) {
+            parallel = true;
+        } else if (strcmp(argv[arg], "--binary") == 0) {
+            binary = true;
+        } else if (strncmp(argv[arg], "--serve=", 8) == 0) {
+            serve = argv[arg] + 8;
+        } else if (strncmp(argv[arg], "--cache=", 8) == 0) {
+            char *end;
+            errno = 0;
+            cache = strtol(argv[arg] + 8, &end, 10);
+            if (errno != 0 || *end != '\0' || end == argv[arg] + 8 || cache < 1) {
+                fprintf(stderr, "ERROR: invalid cache size %s\n", argv[arg] + 8);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strncmp(argv[arg], "--result-cache=", 15) == 0) {
+            memo = argv[arg] + 15;
+        } else if (strncmp(argv[arg], "--result-cache-size=", 20) == 0) {
+            char *end;
+            errno = 0;
+            memoEntries = strtol(argv[arg] + 20, &end, 10);
+            if (errno != 0 || *end != '\0' || end == argv[arg] + 20 || memoEntries < 1) {
+                fprintf(stderr, "ERROR: invalid result cache size %s\n", argv[arg] + 20);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strncmp(argv[arg], "--fuel=", 7) == 0) {
+            char *end;
+            errno = 0;
+            fuel = strtoull(argv[arg] + 7, &end, 10);
+            if (errno != 0 || *end != '\0' || end == argv[arg] + 7 || argv[arg][7] == '-' || fuel < 1) {
+                fprintf(stderr, "ERROR: invalid fuel %s\n", argv[arg] + 7);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strncmp(argv[arg], "--deadline=", 11) == 0) {
+            char *end;
+            errno = 0;
+            seconds = strtod(argv[arg] + 11, &end);
+            if (errno != 0 || *end != '\0' || end == argv[arg] + 11 || !(seconds > 0)) {
+                fprintf(stderr, "ERROR: invalid deadline %s\n", argv[arg] + 11);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strncmp(argv[arg], "--threads=", 10) == 0) {
+            char *end;
+            errno = 0;
+            threads = strtol(argv[arg] + 10, &end, 10);
+            if (errno != 0 || *end != '\0' || end == argv[arg] + 10 || threads < 0) {
+                fprintf(stderr, "ERROR: invalid number of threads %s\n", argv[arg] + 10);
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            fprintf(stderr, "ERROR: unknown option %s\n", argv[arg]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    // the server reads its programs from the socket
+    bool budgeted = fuel > 0 || seconds > 0;
+    if (serve != NULL && arg == argc && batch == NULL && !profiled && !emit && !solve && !budgeted
+            && statsOutput == NULL) {
+        runServer(serve, engine, cache, passes);
+        exit(EXIT_SUCCESS);
+    }
+    
     // check the number of command line parameters
-    if (argc < 2) {
-        fprintf(stderr, "Usage: loop <program> [<x1> [<x2> [ ... ]]]\n");
+    bool named = argc - arg == 3 && strcmp(argv[arg + 1], "-o") == 0;
+    if (argc - arg < 1 || serve != NULL || (batch != NULL && (argc - arg > 1 || profiled))
+            || (compile && (argc - arg != 1 && !named)) || (parallel && (batch != NULL || profiled))
+            || (budgeted && (batch != NULL || profiled || parallel))
+            || (statsOutput != NULL && (compile || emit || solve))) {
+        fprintf(stderr, "Usage: loop [<options>] [--emit-c] [--emit-closed-form] [--profile[=<file>]]\n"
+                "            [--result-cache=<file>] [--result-cache-size=<n>] [--parallel [--threads=<n>]]\n"
+                "            [--fuel=<iterations>] [--deadline=<seconds>] [--stats=json[:<file>]]\n"
+                "            <program> [<x1> [<x2> [ ... ]]]\n"
+                "       loop [<options>] --batch[=<file>] [--binary] [--threads=<n>] [--stats=json[:<file>]]\n"
+                "            <program>\n"
+                "       loop [<options>] [--cache=<n>] --serve=<socket>\n"
+                "       loop [<options>] --compile <program> [-o <image>]\n"
+                "Options: --engine=tree|vm|jit|cc|simd|symbolic\n"
+                "         --optimise[=<pass>,...]  passes: all constants copies fold dead-stores\n"
+                "                                  zero-loops hoist, -<pass> disables a pass\n"
+                "         --optimise-report        print the changes of every pass\n"
+                "         --fuse-report            print the statements fused into superinstructions\n");
         exit(EXIT_FAILURE);
     }
     
-    // try to open the given LOOP program
-    FILE *stream = fopen(argv[1], "r");
+    // try to open the given LOOP program or program image
+    FILE *stream = fopen(argv[arg], "rb");
     if (stream == NULL) {
         perror("ERROR: failed to open input file");
         exit(EXIT_FAILURE);
     }
     
-    // build the syntax/semantics tree
-    Program *prog = parse(stream);
-    VariableList vars = addVariable(NULL, 0);
-    for (int i = 2; i < argc; ++i) {
-        int tmp = atoi(argv[i]);
-        if (tmp < 0) {
-            fprintf(stderr, "ERROR: negative value %d given for x%d\n", tmp, i - 1);
+    // build the syntax/semantics tree, x_0 always resides in slot 0
+    RunStats run;
+    memset(&run, 0, sizeof(run));
+    run.statements = STATS_UNKNOWN;
+    run.iterations = STATS_UNKNOWN;
+    run.requested = engineName(engine);
+    uint64_t clock = profileClock();
+    uint64_t hash = engine == ENGINE_CC ? hashStream(HASH_SEED, stream) : 0;
+    VariableTable *vars = createVariableTable();
+    internVariable(vars, 0);
+    Program *prog = isImage(stream) ? loadImage(stream, vars) : parse(stream, vars);
+    run.nanos[PHASE_PARSE] = profileClock() - clock;
+    measureProgram(prog, &run.parsed);
+    MemoKey key = memo != NULL ? hashProgram(prog, vars) : (MemoKey){ 0, 0 };
+    if (passes != PASSES_NONE) {
+        OptimiseStats stats;
+        clock = profileClock();
+        optimiseProgram(prog, vars, passes, &stats);
+        run.nanos[PHASE_OPTIMISE] = profileClock() - clock;
+        if (report)
+            printOptimiseStats(stderr, &stats, passes);
+        hash = hash != 0 ? hashBytes(hash, &passes, sizeof(passes)) : 0;
+    }
+    measureProgram(prog, &run.optimised);
+    if (compile) {
+        writeProgramImage(prog, vars, argv[arg], named ? argv[arg + 2] : NULL);
+        exit(EXIT_SUCCESS);
+    }
+    if (solve) {
+        SymbolicFailure failure;
+        ClosedForm *form = compileClosedForm(prog, vars, &failure);
+        if (form == NULL) {
+            fprintf(stderr, "ERROR: no closed form, ");
+            printSymbolicFailure(stderr, &failure);
+            fputc('\n', stderr);
             exit(EXIT_FAILURE);
         }
-        setValue(vars, i - 1, tmp);
+        printClosedForm(stdout, form);
+        freeClosedForm(form);
+        exit(EXIT_SUCCESS);
+    }
+    FuseStats fused;
+    clock = profileClock();
+    analyseFusedLoops(prog, &fused);
+    analyseAffineLoops(prog);
+    run.nanos[PHASE_ANALYSE] = profileClock() - clock;
+    run.fused = fused.fused;
+    if (fuseReport)
+        printFuseStats(stderr, &fused);
+    if (emit) {
+        emitC(stdout, prog, vars);
+        exit(EXIT_SUCCESS);
     }
     
-    // start execution
-    executeProgram(prog, vars);
+    // profiles are taken by the tree engine iterating every LOOP
+    if (profiled && engine != ENGINE_TREE) {
+        fprintf(stderr, "WARNING: profiling with the tree engine instead of %s\n", engineName(engine));
+        engine = ENGINE_TREE;
+    }
+    if (budgeted && !isBudgetSupported(engine)) {
+        fprintf(stderr, "WARNING: enforcing the budget with the tree engine instead of %s\n", engineName(engine));
+        engine = ENGINE_TREE;
+    }
+    Executable exe;
     
-    // print result of LOOP program (x_0 per definition)
-    printf("%ld\n", getValue(vars, 0));
+    // batch mode evaluates the program for every vector of the input stream
+    if (batch != NULL) {
+        FILE *input = strcmp(batch, "-") == 0 ? stdin : fopen(batch, binary ? "rb" : "r");
+        if (input == NULL) {
+            perror("ERROR: failed to open batch input file");
+            exit(EXIT_FAILURE);
+        }
+        clock = profileClock();
+        prepareExecutable(&exe, engine, prog, vars, hash);
+        run.nanos[PHASE_PREPARE] = profileClock() - clock;
+        ThreadPool *pool = createPool(threads >= 0 ? threads : 1);
+        clock = profileClock();
+        runBatch(&exe, vars, input, binary, pool);
+        run.nanos[PHASE_EXECUTE] = profileClock() - clock;
+        freePool(pool);
+        releaseExecutable(&exe);
+        freeProgram(prog);
+        if (statsOutput != NULL) {
+            run.engine = engineName(exe.engine);
+            run.variables = vars->count;
+            writeRunStats(statsOutput, &run);
+        }
+        exit(EXIT_SUCCESS);
+    }
     
-    exit(EXIT_SUCCESS);
-}
-
-/*
- * Traverse the syntax/semantics tree and simulate execution.
- * ARGS     prog - first statement of the program
- *          vars - initialized varaible list
- */
-void executeProgram(Program *prog, VariableList vars)
-{
-    // input check
-    if (prog == NULL || vars == NULL) {
-        fprintf(stderr, "ERROR: cannot execute empty program or emtpy varaible list\n");
+    // otherwise the inputs are given on the command line
+    Value *regs = createRegisters(vars);
+    long count = argc - arg - 1;
+    Value *inputs = malloc((count > 0 ? count : 1) * sizeof(Value));
+    if (inputs == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
         exit(EXIT_FAILURE);
     }
+    for (long i = 0; i < count; ++i) {
+        if (!valueParse(argv[arg + 1 + i], &inputs[i])) {
+            fprintf(stderr, "ERROR: invalid natural number %s given for x%ld\n", argv[arg + 1 + i], i + 1);
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    // results of earlier runs are answered without preparing the program
+    MemoStore *store = memo != NULL && !profiled ? openMemoStore(memo, memoEntries) : NULL;
+    Value result;
+    if (store != NULL) {
+        key = hashInputs(key, vars, inputs, count);
+        if (lookupMemo(store, key, &result)) {
+            valuePrint(stdout, result);
+            putchar('\n');
+            if (statsOutput != NULL) {
+                run.engine = run.requested;
+                run.variables = vars->count;
+                run.cached = true;
+                writeRunStats(statsOutput, &run);
+            }
+            exit(EXIT_SUCCESS);
+        }
+    }
+    
+    // independent top-level LOOPs run concurrently, if there are any
+    clock = profileClock();
+    ParallelProgram *par = parallel ? prepareParallel(prog, vars, engine, hash) : NULL;
+    if (par != NULL && parallelWidth(par) < 2) {
+        fprintf(stderr, "WARNING: no independent top-level LOOPs, running sequentially\n");
+        freeParallel(par);
+        par = NULL;
+    }
+    if (par == NULL)
+        prepareExecutable(&exe, engine, prog, vars, hash);
+    run.nanos[PHASE_PREPARE] = profileClock() - clock;
+    run.engine = engineName(par != NULL || profiled ? engine : exe.engine);
+    run.variables = vars->count;
+    storeInputs(vars, regs, inputs, count);
+    free(inputs);
     
-    // execute the linked list of program statement separated by semicolons
-    do {
-        if (prog->statement->type == STAT_ASSIGNMENT) { // execute: x_i := x_j +- nat
-            Assignment *ass = prog->statement->data;
-            long res = getValue(vars, ass->rvalue);
-            if (ass->isAddition)
-                res += ass->nat;
-            else
-                res -= ass->nat;
-            if (res < 0)
-                res = 0;
-            setValue(vars, ass->lvalue, res);
-            // fprintf(stderr, "DEBUG: x%ld := x%ld %c %ld // %ld\n", ass->lvalue, ass->rvalue, ass->isAddition ? '+' : '-', ass->nat, res);
-        } else if (prog->statement->type == STAT_LOOP) { // execute LOOP nat times
-            Loop *loop = prog->statement->data;
-            long limit = getValue(vars, loop->var);
-            // fprintf(stderr, "DEBUG: LOOP x%ld DO // %ld\n", loop->var, limit);
-            for (int i = 1; i <= limit; ++i)
-                executeProgram(loop->program, vars);
-            // fprintf(stderr, "DEBUG: END\n");
+    // the engines counting iterations report them to a budget, which is
+    // unlimited unless --fuel or --deadline is given
+    Budget budget;
+    startBudget(&budget, fuel, seconds);
+    bool counted = statsOutput != NULL && par == NULL && isBudgetSupported(exe.engine);
+    clock = profileClock();
+    if (profiled) {
+        Profile *profile = createProfile(prog, true);
+        executeProfiled(prog, regs, profile);
+        run.nanos[PHASE_EXECUTE] = profileClock() - clock;
+        run.statements = 0;
+        for (NodeIndex i = 1; i < prog->count; ++i)
+            run.statements += profile->counts[i];
+        printHotspots(stderr, prog, vars, profile, PROFILE_HOTSPOTS);
+        FILE *output = folded != NULL ? fopen(folded, "w") : NULL;
+        if (folded != NULL && output == NULL) {
+            perror("ERROR: failed to open profile output file");
+            exit(EXIT_FAILURE);
         }
-        prog = prog->next;
-    } while (prog != NULL);
+        if (output != NULL) {
+            printFolded(output, prog, vars, profile);
+            fclose(output);
+        }
+        freeProfile(profile);
+    } else if (par != NULL) {
+        ThreadPool *pool = createPool(threads >= 0 ? threads : 0);
+        runParallel(par, regs, pool);
+        freePool(pool);
+        freeParallel(par);
+    } else if (budgeted || counted) {
+        // a run exceeding its budget reports its progress instead of x_0
+        bool finished = runBudgeted(&exe, regs, &budget);
+        run.statements = budget.statements;
+        run.iterations = budget.iterations;
+        if (!finished) {
+            fprintf(stderr, "ERROR: ");
+            printBudgetStats(stderr, &budget);
+            if (statsOutput != NULL) {
+                run.nanos[PHASE_EXECUTE] = profileClock() - clock;
+                run.exceeded = true;
+                writeRunStats(statsOutput, &run);
+            }
+            exit(BUDGET_EXIT_STATUS);
+        }
+    } else {
+        runExecutable(&exe, regs);
+    }
+    if (!profiled)
+        run.nanos[PHASE_EXECUTE] = profileClock() - clock;
+    if (par == NULL)
+        releaseExecutable(&exe);
+    freeProgram(prog);
+    if (store != NULL) {
+        storeMemo(store, key, regs[0]);
+        closeMemoStore(store);
+    }
+    
+    // print result of LOOP program (x_0 per definition)
+    valuePrint(stdout, regs[0]);
+    putchar('\n');
+    if (statsOutput != NULL)
+        writeRunStats(statsOutput, &run);
+    
+    exit(EXIT_SUCCESS);
 }
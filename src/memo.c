@@ -0,0 +1,381 @@
+/*
+ * memo.c
+ *
+ * Persistent store of program results, see memo.h.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "memo.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MEMO_MMAP
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define MEMO_MAGIC "LOOPMEM\n"
+#define MEMO_VERSION 1                  // change whenever the layout changes
+#define MEMO_BYTE_ORDER 0x01020304u     // written in the byte order of the host
+#define MEMO_CHECK_SEED 0x9e3779b97f4a7c15ull  // seed of the second hash
+#define MEMO_MAX_ENTRIES (1L << 28)     // largest store created (32 GiB)
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Header at the beginning of a store file, followed by the entries.
+ */
+typedef struct {
+    char magic[8];              // MEMO_MAGIC
+    uint32_t version;           // MEMO_VERSION
+    uint32_t byteOrder;         // MEMO_BYTE_ORDER
+    uint32_t entrySize;         // sizeof(MemoEntry) of the writer
+    uint32_t ways;              // MEMO_WAYS of the writer
+    uint64_t entries;           // number of entries, a power of two
+    uint64_t clock;             // counter of uses, the last use of an entry
+    uint64_t reserved[3];       // zero
+} MemoHeader;
+
+/*
+ * Stored result, empty as long as it was never used.
+ */
+typedef struct {
+    uint64_t hash;              // key of the result
+    uint64_t check;
+    uint64_t used;              // clock of the last use, 0 if empty
+    uint32_t length;            // number of limbs of the result
+    uint32_t reserved;          // zero
+    uint32_t limbs[MEMO_LIMBS]; // limbs of the result, least significant first
+} MemoEntry;
+
+struct sMemoStore {
+    int fd;                     // descriptor of the file, used for locking
+    MemoHeader *header;         // mapped file
+    MemoEntry *entries;         // entries following the header
+    size_t size;                // size of the mapping
+};
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Continue both hashes of a key over a block of bytes.
+ */
+static void hashKey(MemoKey *key, const void *bytes, size_t n)
+{
+    key->hash = hashBytes(key->hash, bytes, n);
+    key->check = hashBytes(key->check, bytes, n);
+}
+
+/*
+ * Continue both hashes of a key over a value, big or not.
+ */
+static void hashValue(MemoKey *key, Value v)
+{
+    uint32_t small[2];
+    const uint32_t *limbs = small;
+    int64_t length;
+    if (v & VALUE_BIG) {
+        limbs = valueBig(v)->limbs;
+        length = valueBig(v)->length;
+    } else {
+        length = valueToLimbs(v, small, 2);
+    }
+    hashKey(key, &length, sizeof(length));
+    hashKey(key, limbs, length * sizeof(uint32_t));
+}
+
+/*
+ * Hash a parsed program by its statements and variable identifiers.
+ * ARGS     prog - program as parsed or loaded, before optimising
+ *          vars - variable table the program was parsed with
+ * RETURN   key of the program without inputs
+ */
+MemoKey hashProgram(const Program *prog, const VariableTable *vars)
+{
+    // input check
+    if (prog == NULL || vars == NULL) {
+        fprintf(stderr, "ERROR: cannot hash missing program\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    // the arena holds the statements in program order, so the nesting is
+    // given by the number of statements of every LOOP and a call by the
+    // distance and length of the macro body, only links skipping macro
+    // bodies defined in between have to be hashed on their own
+    MemoKey key = { HASH_SEED, HASH_SEED ^ MEMO_CHECK_SEED };
+    if (prog->first != 1) {
+        int64_t first = prog->first;
+        hashKey(&key, &first, sizeof(first));
+    }
+    for (NodeIndex i = 1; i < prog->count; ++i) {
+        const Statement *stat = programNode(prog, i);
+        NodeIndex after = stat->type == STAT_LOOP ? stat->as.loop.end : i + 1;
+        if (stat->next != NODE_NONE && stat->next != after) {
+            int64_t skip[2] = { -3, stat->next - after };
+            hashKey(&key, skip, sizeof(skip));
+        }
+        int64_t words[3];
+        if (stat->type == STAT_LOOP) {
+            words[0] = -1;
+            words[1] = vars->ids[stat->as.loop.var];
+            words[2] = stat->as.loop.end - i;
+            hashKey(&key, words, sizeof(words));
+        } else if (stat->type == STAT_CALL) {
+            words[0] = -2;
+            words[1] = (int64_t)i - stat->as.call.body;
+            words[2] = stat->as.call.end - stat->as.call.body;
+            hashKey(&key, words, sizeof(words));
+        } else {
+            words[0] = stat->as.assignment.isAddition;
+            words[1] = vars->ids[stat->as.assignment.lvalue];
+            words[2] = vars->ids[stat->as.assignment.rvalue];
+            hashKey(&key, words, sizeof(words));
+            hashValue(&key, stat->as.assignment.nat);
+        }
+    }
+    return key;
+}
+
+/*
+ * Extend the key of a program by its inputs.
+ * ARGS     key    - key of the program
+ *          vars   - variable table the program was parsed with
+ *          inputs - values of x1, x2, ...
+ *          count  - number of values
+ * RETURN   key of the result
+ */
+MemoKey hashInputs(MemoKey key, const VariableTable *vars, const Value *inputs, long count)
+{
+    // input check
+    if (vars == NULL || (inputs == NULL && count > 0)) {
+        fprintf(stderr, "ERROR: cannot hash missing inputs\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    for (long i = 0; i < count; ++i) {
+        if (inputs[i] == 0 || lookupVariable(vars, i + 1) < 0)
+            continue;
+        int64_t id = i + 1;
+        hashKey(&key, &id, sizeof(id));
+        hashValue(&key, inputs[i]);
+    }
+    return key;
+}
+
+#ifdef MEMO_MMAP
+
+/*
+ * Check the header of a store file.
+ * ARGS     header - header read from the file
+ *          size   - size of the file
+ * RETURN   true if the file holds a store written by this build
+ */
+static bool isValidStore(const MemoHeader *header, off_t size)
+{
+    return memcmp(header->magic, MEMO_MAGIC, sizeof(header->magic)) == 0
+            && header->version == MEMO_VERSION && header->byteOrder == MEMO_BYTE_ORDER
+            && header->entrySize == sizeof(MemoEntry) && header->ways == MEMO_WAYS
+            && header->entries >= MEMO_WAYS && header->entries <= MEMO_MAX_ENTRIES
+            && (header->entries & (header->entries - 1)) == 0
+            && (uint64_t)size == sizeof(MemoHeader) + header->entries * sizeof(MemoEntry);
+}
+
+#endif
+
+/*
+ * Open a store, creating it with the given number of entries if the file
+ * does not exist or does not hold a valid store.
+ * ARGS     path    - path of the store file
+ *          entries - number of entries, rounded up to a power of two
+ * RETURN   pointer to the opened store, NULL with a warning printed if the
+ *          store cannot be used
+ */
+MemoStore *openMemoStore(const char *path, long entries)
+{
+    // input check
+    if (path == NULL || entries < 1) {
+        fprintf(stderr, "ERROR: cannot open result cache without path or entries\n");
+        exit(EXIT_FAILURE);
+    }
+
+#ifndef MEMO_MMAP
+    fprintf(stderr, "WARNING: result cache is not supported on this platform\n");
+    return NULL;
+#else
+    uint64_t count = MEMO_WAYS;
+    while (count < (uint64_t)entries && count < MEMO_MAX_ENTRIES)
+        count *= 2;
+    
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "WARNING: result cache %s unusable: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    
+    // concurrent processes must not see a store being created
+    flock(fd, LOCK_EX);
+    MemoHeader header;
+    struct stat info;
+    bool valid = fstat(fd, &info) == 0 && info.st_size >= (off_t)sizeof(header)
+            && pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header)
+            && isValidStore(&header, info.st_size);
+    if (!valid) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MEMO_MAGIC, sizeof(header.magic));
+        header.version = MEMO_VERSION;
+        header.byteOrder = MEMO_BYTE_ORDER;
+        header.entrySize = sizeof(MemoEntry);
+        header.ways = MEMO_WAYS;
+        header.entries = count;
+        header.clock = 0;
+        if (ftruncate(fd, 0) != 0 || ftruncate(fd, sizeof(header) + count * sizeof(MemoEntry)) != 0
+                || pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+            fprintf(stderr, "WARNING: result cache %s unusable: %s\n", path, strerror(errno));
+            flock(fd, LOCK_UN);
+            close(fd);
+            return NULL;
+        }
+    }
+    flock(fd, LOCK_UN);
+    
+    size_t size = sizeof(header) + header.entries * sizeof(MemoEntry);
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "WARNING: result cache %s unusable: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    MemoStore *store = malloc(sizeof(MemoStore));
+    if (store == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    store->fd = fd;
+    store->header = map;
+    store->entries = (MemoEntry *)(store->header + 1);
+    store->size = size;
+    return store;
+#endif
+}
+
+/*
+ * Unmap and close a store.
+ * ARGS     store - store to be closed (may be NULL)
+ */
+void closeMemoStore(MemoStore *store)
+{
+    if (store == NULL)
+        return;
+#ifdef MEMO_MMAP
+    munmap(store->header, store->size);
+    close(store->fd);
+#endif
+    free(store);
+}
+
+/*
+ * Look up a result.
+ * ARGS     store  - opened store
+ *          key    - key of the result
+ *          result - destination of a new reference to the result
+ * RETURN   false if the store holds no result for the key
+ */
+bool lookupMemo(MemoStore *store, MemoKey key, Value *result)
+{
+    // input check
+    if (store == NULL || result == NULL) {
+        fprintf(stderr, "ERROR: cannot look up result in missing cache\n");
+        exit(EXIT_FAILURE);
+    }
+
+#ifndef MEMO_MMAP
+    (void)key;
+    return false;
+#else
+    // readers only touch the clocks of the least recently used order, lost
+    // updates of concurrent readers are harmless
+    bool found = false;
+    flock(store->fd, LOCK_SH);
+    MemoEntry *set = store->entries + (key.hash & (store->header->entries - 1) & ~(uint64_t)(MEMO_WAYS - 1));
+    for (int w = 0; w < MEMO_WAYS && !found; ++w) {
+        if (set[w].used != 0 && set[w].hash == key.hash && set[w].check == key.check
+                && set[w].length <= MEMO_LIMBS) {
+            *result = valueFromLimbs(set[w].limbs, set[w].length);
+            set[w].used = ++store->header->clock;
+            found = true;
+        }
+    }
+    flock(store->fd, LOCK_UN);
+    return found;
+#endif
+}
+
+/*
+ * Store a result, evicting the least recently used result of its set.
+ * ARGS     store  - opened store
+ *          key    - key of the result
+ *          result - result to be stored
+ */
+void storeMemo(MemoStore *store, MemoKey key, Value result)
+{
+    // input check
+    if (store == NULL) {
+        fprintf(stderr, "ERROR: cannot store result in missing cache\n");
+        exit(EXIT_FAILURE);
+    }
+
+#ifndef MEMO_MMAP
+    (void)key;
+    (void)result;
+#else
+    uint32_t limbs[MEMO_LIMBS];
+    long length = valueToLimbs(result, limbs, MEMO_LIMBS);
+    if (length > MEMO_LIMBS)
+        return;
+    
+    // reuse the entry of the same key, an empty one or the least recently used
+    flock(store->fd, LOCK_EX);
+    MemoEntry *set = store->entries + (key.hash & (store->header->entries - 1) & ~(uint64_t)(MEMO_WAYS - 1));
+    MemoEntry *victim = &set[0];
+    for (int w = 0; w < MEMO_WAYS; ++w) {
+        if (set[w].used != 0 && set[w].hash == key.hash && set[w].check == key.check) {
+            victim = &set[w];
+            break;
+        }
+        if (set[w].used < victim->used)
+            victim = &set[w];
+    }
+    victim->hash = key.hash;
+    victim->check = key.check;
+    victim->length = (uint32_t)length;
+    victim->reserved = 0;
+    memcpy(victim->limbs, limbs, length * sizeof(uint32_t));
+    victim->used = ++store->header->clock;
+    flock(store->fd, LOCK_UN);
+#endif
+}
@@ -0,0 +1,944 @@
+/*
+ * optimise.c
+ *
+ * Optimiser rewriting a parsed program before it is executed. Every pass
+ * rewrites statements in place or marks them as removed or hoisted, then the
+ * arena is rebuilt in program order, so the next pass again finds the
+ * statements of every LOOP body in one contiguous range.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "image.h"
+#include "optimise.h"
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define OPTIMISE_BUDGET 16  // statements scanned per statement of the program
+
+static const char *passNames[PASS_COUNT] = {
+    "constants", "copies", "fold", "dead-stores", "zero-loops", "hoist"
+};
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Value of a variable known while optimising. Facts hold as long as their
+ * epoch equals the epoch of the analysis, so advancing the epoch forgets all
+ * facts at once.
+ */
+typedef struct {
+    Value value;
+    uint64_t epoch;
+} Constant;
+
+/*
+ * Fact variable = base + offset, holding as long as base keeps the version
+ * it had when the fact was recorded.
+ */
+typedef struct {
+    VarID base;
+    uint64_t version;
+    Value offset;
+    uint64_t epoch;
+} Copy;
+
+/*
+ * Facts about the variables at one point of the program.
+ */
+typedef struct {
+    Constant *constants;    // known value of every variable
+    Copy *copies;           // known copy of every variable
+    uint64_t *versions;     // number of writes to every variable
+    uint64_t epoch;         // epoch of the facts currently holding
+    VarID zero;             // variable most recently set to zero
+} Facts;
+
+/*
+ * Program being optimised and the marks left by the current pass, all
+ * indexed by statement.
+ */
+typedef struct {
+    Program *prog;
+    long varCount;          // number of variable slots
+    unsigned passes;        // set of enabled passes
+    OptimiseStats *stats;   // changes made so far
+    bool *removed;          // statements left out when rebuilding
+    NodeIndex *hoisted;     // first statement moved in front of every LOOP
+    NodeIndex *chain;       // next statement moved in front of the same LOOP
+    size_t budget;          // statements left to scan for LOOP summaries
+} Optimiser;
+
+/*
+ * LOOP being copied while rebuilding the arena.
+ */
+typedef struct {
+    NodeIndex old;          // LOOP in the old arena
+    NodeIndex copy;         // LOOP in the new arena
+    NodeIndex before;       // statement preceding the copy or NODE_NONE
+} Frame;
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Check whether a pass is enabled.
+ */
+static bool isEnabled(const Optimiser *opt, Pass pass)
+{
+    return (opt->passes >> pass) & 1;
+}
+
+/*
+ * Count a change made by a pass.
+ */
+static void record(Optimiser *opt, Pass pass)
+{
+    ++opt->stats->changes[pass];
+}
+
+/*
+ * Sum up the changes made by all passes.
+ */
+static long totalChanges(const OptimiseStats *stats)
+{
+    long sum = 0;
+    for (int p = 0; p < PASS_COUNT; ++p)
+        sum += stats->changes[p];
+    return sum;
+}
+
+/*
+ * Take the statements of a LOOP body from the scan budget.
+ * ARGS     opt  - optimiser
+ *          loop - LOOP whose body is to be scanned
+ * RETURN   false if the budget is used up, the body must not be scanned
+ */
+static bool spend(Optimiser *opt, const Loop *loop)
+{
+    size_t statements = loop->end - loop->body;
+    if (statements > opt->budget)
+        return false;
+    opt->budget -= statements;
+    return true;
+}
+
+/*
+ * Apply an assignment to a value known while optimising.
+ * ARGS     value      - value of the assigned variable
+ *          isAddition - true for addition, false for subtraction
+ *          nat        - added or subtracted constant
+ *          result     - destination of the assigned value
+ * RETURN   false if the result exceeds a machine word
+ */
+static bool applyConstant(Value value, bool isAddition, NatNum nat, Value *result)
+{
+    if ((value | nat) & VALUE_BIG)
+        return false;
+    if (isAddition) {
+        if (value > VALUE_MAX_SMALL - nat)
+            return false;
+        *result = value + nat;
+    } else {
+        *result = value > nat ? value - nat : 0;
+    }
+    return true;
+}
+
+/*
+ * Compose x := y op a followed by z := x op b into z := y op c. Subtraction
+ * truncates at zero, so a subtraction followed by an addition is composable
+ * only if one of the constants is zero.
+ * ARGS     firstAdd   - operation of the first assignment
+ *          a          - constant of the first assignment
+ *          secondAdd  - operation of the second assignment
+ *          b          - constant of the second assignment
+ *          isAddition - destination of the composed operation
+ *          nat        - destination of the composed constant
+ * RETURN   false if no single assignment has the same effect
+ */
+static bool composeAssignments(bool firstAdd, NatNum a, bool secondAdd, NatNum b,
+        bool *isAddition, NatNum *nat)
+{
+    if ((a | b) & VALUE_BIG)
+        return false;
+    
+    // subtracting zero copies the variable
+    if (!firstAdd && a == 0)
+        firstAdd = true;
+    if (firstAdd && secondAdd) {
+        if (a > VALUE_MAX_SMALL - b)
+            return false;
+        *isAddition = true;
+        *nat = a + b;
+    } else if (firstAdd) {
+        // (y + a) - b truncates exactly like y - (b - a)
+        *isAddition = a >= b;
+        *nat = a >= b ? a - b : b - a;
+    } else if (!secondAdd) {
+        if (a > VALUE_MAX_SMALL - b)
+            return false;
+        *isAddition = false;
+        *nat = a + b;
+    } else if (b == 0) {
+        *isAddition = false;
+        *nat = a;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Forget all facts about a variable that is written.
+ */
+static void forgetVariable(Facts *facts, VarID var)
+{
+    facts->constants[var].epoch = 0;
+    facts->copies[var].epoch = 0;
+    ++facts->versions[var];
+}
+
+/*
+ * Forget the facts about all variables written in a LOOP body, or all facts
+ * if the budget does not allow scanning the body.
+ * ARGS     opt   - optimiser
+ *          facts - facts at the LOOP
+ *          loop  - LOOP entered or left
+ */
+static void forgetWrites(Optimiser *opt, Facts *facts, const Loop *loop)
+{
+    if (!spend(opt, loop)) {
+        ++facts->epoch;
+        return;
+    }
+    for (NodeIndex k = loop->body; k < loop->end; ++k) {
+        const Statement *stat = programNode(opt->prog, k);
+        if (stat->type == STAT_ASSIGNMENT)
+            forgetVariable(facts, stat->as.assignment.lvalue);
+    }
+}
+
+/*
+ * Look up the known value of a variable.
+ * RETURN   false if the value is unknown
+ */
+static bool knownValue(const Facts *facts, VarID var, Value *value)
+{
+    if (facts->constants[var].epoch != facts->epoch)
+        return false;
+    *value = facts->constants[var].value;
+    return true;
+}
+
+/*
+ * Look up the variable another variable is a copy of.
+ * RETURN   false if the variable is no known copy
+ */
+static bool knownCopy(const Facts *facts, VarID var, Copy *copy)
+{
+    *copy = facts->copies[var];
+    return copy->epoch == facts->epoch && facts->versions[copy->base] == copy->version;
+}
+
+/*
+ * Find a variable known to be zero, preferably the one set most recently.
+ * RETURN   false if no such variable is known
+ */
+static bool knownZero(const Facts *facts, VarID *var)
+{
+    Value value;
+    if (knownValue(facts, facts->zero, &value) && value == 0) {
+        *var = facts->zero;
+        return true;
+    }
+    if (knownValue(facts, 0, &value) && value == 0) {
+        *var = 0;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Rewrite an assignment by the facts holding before it and update the facts.
+ * ARGS     opt   - optimiser
+ *          facts - facts before the assignment, afterwards the facts after it
+ *          asg   - assignment to be rewritten
+ */
+static void propagateAssignment(Optimiser *opt, Facts *facts, Assignment *asg)
+{
+    // read the variable the assigned variable is a copy of instead
+    Copy copy;
+    bool isAddition;
+    NatNum nat;
+    if (isEnabled(opt, PASS_COPIES) && knownCopy(facts, asg->rvalue, &copy)
+            && composeAssignments(true, copy.offset, asg->isAddition, asg->nat, &isAddition, &nat)) {
+        asg->rvalue = copy.base;
+        asg->isAddition = isAddition;
+        asg->nat = nat;
+        record(opt, PASS_COPIES);
+    }
+    
+    // assign known values as constant added to zero
+    Value value, result;
+    bool known = knownValue(facts, asg->rvalue, &value)
+            && applyConstant(value, asg->isAddition, asg->nat, &result);
+    VarID zero;
+    if (isEnabled(opt, PASS_CONSTANTS) && known && knownZero(facts, &zero)
+            && (asg->rvalue != zero || !asg->isAddition || asg->nat != result)) {
+        asg->rvalue = zero;
+        asg->isAddition = true;
+        asg->nat = result;
+        record(opt, PASS_CONSTANTS);
+    }
+    
+    forgetVariable(facts, asg->lvalue);
+    if (known) {
+        facts->constants[asg->lvalue] = (Constant){ result, facts->epoch };
+        if (result == 0)
+            facts->zero = asg->lvalue;
+    }
+    if (asg->isAddition && asg->rvalue != asg->lvalue) {
+        facts->copies[asg->lvalue] = (Copy){ asg->rvalue, facts->versions[asg->rvalue], asg->nat,
+                facts->epoch };
+    }
+}
+
+/*
+ * Propagate constants and copies forward through the program and remove
+ * LOOPs over variables known to be zero. A LOOP body may run any number of
+ * times, so the facts about the variables it writes are forgotten when
+ * entering and again when leaving the LOOP.
+ * ARGS     opt - optimiser
+ */
+static void propagateFacts(Optimiser *opt)
+{
+    Program *prog = opt->prog;
+    Facts facts;
+    facts.constants = allocateZeroed(opt->varCount, sizeof(Constant));
+    facts.copies = allocateZeroed(opt->varCount, sizeof(Copy));
+    facts.versions = allocateZeroed(opt->varCount, sizeof(uint64_t));
+    facts.epoch = 1;
+    facts.zero = 0;
+    NodeIndex *open = allocate(prog->count * sizeof(NodeIndex));
+    size_t depth = 0;
+    
+    // x0 starts as zero, nothing is known about the inputs
+    facts.constants[0] = (Constant){ 0, facts.epoch };
+    for (NodeIndex i = 1; i < prog->count; ++i) {
+        while (depth > 0 && programNode(prog, open[depth - 1])->as.loop.end <= i)
+            forgetWrites(opt, &facts, &programNode(prog, open[--depth])->as.loop);
+        
+        Statement *stat = programNode(prog, i);
+        if (stat->type == STAT_ASSIGNMENT) {
+            propagateAssignment(opt, &facts, &stat->as.assignment);
+            continue;
+        }
+        
+        // the count of a LOOP is read once when entering it
+        Loop *loop = &stat->as.loop;
+        Copy copy;
+        Value count;
+        if (isEnabled(opt, PASS_COPIES) && knownCopy(&facts, loop->var, &copy) && copy.offset == 0) {
+            loop->var = copy.base;
+            record(opt, PASS_COPIES);
+        }
+        if (isEnabled(opt, PASS_ZERO_LOOPS) && knownValue(&facts, loop->var, &count) && count == 0) {
+            opt->removed[i] = true;
+            record(opt, PASS_ZERO_LOOPS);
+            i = loop->end - 1;
+            continue;
+        }
+        forgetWrites(opt, &facts, loop);
+        open[depth++] = i;
+    }
+    
+    free(open);
+    free(facts.constants);
+    free(facts.copies);
+    free(facts.versions);
+}
+
+/*
+ * Fold every assignment with the assignments directly following it that
+ * modify the same variable.
+ * ARGS     opt - optimiser
+ */
+static void foldAssignments(Optimiser *opt)
+{
+    Program *prog = opt->prog;
+    for (NodeIndex i = 1; i < prog->count; ++i) {
+        Statement *stat = programNode(prog, i);
+        if (stat->type != STAT_ASSIGNMENT || opt->removed[i])
+            continue;
+        
+        Assignment *first = &stat->as.assignment;
+        for (NodeIndex j = stat->next; j != NODE_NONE; j = programNode(prog, j)->next) {
+            const Statement *succ = programNode(prog, j);
+            bool isAddition;
+            NatNum nat;
+            if (succ->type != STAT_ASSIGNMENT || succ->as.assignment.lvalue != first->lvalue
+                    || succ->as.assignment.rvalue != first->lvalue
+                    || !composeAssignments(first->isAddition, first->nat, succ->as.assignment.isAddition,
+                            succ->as.assignment.nat, &isAddition, &nat))
+                break;
+            first->isAddition = isAddition;
+            first->nat = nat;
+            opt->removed[j] = true;
+            record(opt, PASS_FOLD);
+        }
+    }
+}
+
+/*
+ * Collect the assignments of a LOOP body that can be hoisted in front of the
+ * LOOP, provided the assigned variable is not read after the LOOP: top level
+ * assignments from a variable not written in the body to a variable written
+ * only once and not read before in the body. The candidates are chained to
+ * opt->hoisted of the LOOP.
+ * ARGS     opt    - optimiser
+ *          index  - LOOP to be searched
+ *          writes - number of writes per variable, zero on entry and exit
+ *          reads  - read flag per variable, false on entry and exit
+ */
+static void findInvariants(Optimiser *opt, NodeIndex index, uint32_t *writes, bool *reads)
+{
+    Program *prog = opt->prog;
+    const Loop *loop = &programNode(prog, index)->as.loop;
+    if (!spend(opt, loop))
+        return;
+    
+    for (NodeIndex k = loop->body; k < loop->end; ++k) {
+        const Statement *stat = programNode(prog, k);
+        if (stat->type == STAT_ASSIGNMENT && writes[stat->as.assignment.lvalue] < UINT32_MAX)
+            ++writes[stat->as.assignment.lvalue];
+    }
+    
+    NodeIndex *tail = &opt->hoisted[index];
+    NodeIndex top = loop->body;
+    for (NodeIndex k = loop->body; k < loop->end; ++k) {
+        const Statement *stat = programNode(prog, k);
+        if (stat->type == STAT_LOOP) {
+            reads[stat->as.loop.var] = true;
+        } else {
+            const Assignment *asg = &stat->as.assignment;
+            if (k == top && asg->lvalue != loop->var && asg->rvalue != asg->lvalue
+                    && writes[asg->rvalue] == 0 && writes[asg->lvalue] == 1 && !reads[asg->lvalue]) {
+                *tail = k;
+                tail = &opt->chain[k];
+            }
+            reads[asg->rvalue] = true;
+        }
+        if (k == top)
+            top = stat->next;
+    }
+    *tail = NODE_NONE;
+    
+    for (NodeIndex k = loop->body; k < loop->end; ++k) {
+        const Statement *stat = programNode(prog, k);
+        if (stat->type == STAT_LOOP) {
+            reads[stat->as.loop.var] = false;
+        } else {
+            writes[stat->as.assignment.lvalue] = 0;
+            reads[stat->as.assignment.rvalue] = false;
+        }
+    }
+}
+
+/*
+ * Keep the candidates for hoisting out of a LOOP whose variable is not live
+ * after the LOOP, since the LOOP may run zero times.
+ * ARGS     opt   - optimiser
+ *          index - LOOP whose candidates are checked
+ *          live  - set of variables live after the LOOP
+ */
+static void selectInvariants(Optimiser *opt, NodeIndex index, const uint64_t *live)
+{
+    NodeIndex *link = &opt->hoisted[index];
+    while (*link != NODE_NONE) {
+        NodeIndex k = *link;
+        VarID var = programNode(opt->prog, k)->as.assignment.lvalue;
+        if ((live[var / 64] >> (var % 64)) & 1) {
+            *link = opt->chain[k];
+        } else {
+            // hoisted statements are left out of the body when rebuilding
+            opt->removed[k] = true;
+            record(opt, PASS_HOIST);
+            link = &opt->chain[k];
+        }
+    }
+}
+
+/*
+ * Add all variables read in a LOOP body to a set, or all variables if the
+ * budget does not allow scanning the body.
+ * ARGS     opt  - optimiser
+ *          loop - LOOP whose body is scanned
+ *          live - set of variables
+ */
+static void addReads(Optimiser *opt, const Loop *loop, uint64_t *live)
+{
+    if (!spend(opt, loop)) {
+        memset(live, 0xff, (opt->varCount + 63) / 64 * sizeof(uint64_t));
+        return;
+    }
+    for (NodeIndex k = loop->body; k < loop->end; ++k) {
+        const Statement *stat = programNode(opt->prog, k);
+        VarID var = stat->type == STAT_LOOP ? stat->as.loop.var : stat->as.assignment.rvalue;
+        live[var / 64] |= (uint64_t)1 << (var % 64);
+    }
+}
+
+/*
+ * Determine the variables whose values matter: x0, the variables controlling
+ * LOOPs and every variable assigned to one of them. Assignments to all other
+ * variables are dead, even if they read themselves, like counters.
+ * ARGS     opt    - optimiser
+ *          useful - destination of one flag per variable
+ */
+static void findUseful(Optimiser *opt, bool *useful)
+{
+    // assignments grouped by assigned variable
+    Program *prog = opt->prog;
+    size_t *starts = allocateZeroed(opt->varCount + 1, sizeof(size_t));
+    VarID *sources = allocate(prog->count * sizeof(VarID));
+    VarID *pending = allocate((opt->varCount + 1) * sizeof(VarID));
+    for (NodeIndex i = 1; i < prog->count; ++i) {
+        const Statement *stat = programNode(prog, i);
+        if (stat->type == STAT_ASSIGNMENT)
+            ++starts[stat->as.assignment.lvalue + 1];
+    }
+    for (long v = 0; v < opt->varCount; ++v)
+        starts[v + 1] += starts[v];
+    for (NodeIndex i = 1; i < prog->count; ++i) {
+        const Statement *stat = programNode(prog, i);
+        if (stat->type == STAT_ASSIGNMENT)
+            sources[starts[stat->as.assignment.lvalue]++] = stat->as.assignment.rvalue;
+    }
+    for (long v = opt->varCount; v > 0; --v)
+        starts[v] = starts[v - 1];
+    starts[0] = 0;
+    
+    size_t count = 0;
+    size_t slots = opt->varCount > 0 ? (size_t)opt->varCount : 0;
+    memset(useful, 0, slots * sizeof(bool));
+    useful[0] = true;
+    pending[count++] = 0;
+    for (NodeIndex i = 1; i < prog->count; ++i) {
+        const Statement *stat = programNode(prog, i);
+        if (stat->type == STAT_LOOP && !useful[stat->as.loop.var]) {
+            useful[stat->as.loop.var] = true;
+            pending[count++] = stat->as.loop.var;
+        }
+    }
+    while (count > 0) {
+        VarID var = pending[--count];
+        for (size_t k = starts[var]; k < starts[var + 1]; ++k) {
+            if (!useful[sources[k]]) {
+                useful[sources[k]] = true;
+                pending[count++] = sources[k];
+            }
+        }
+    }
+    
+    free(starts);
+    free(sources);
+    free(pending);
+}
+
+/*
+ * Walk the program backwards tracking the variables live after every
+ * statement, x0 being live at the end. The variables live at the end of a
+ * LOOP body are those live after the LOOP plus all variables read in the
+ * body, as read by the next iteration. Depending on the pass, assignments to
+ * variables not live afterwards or not useful at all are removed, or the
+ * hoisting candidates of every LOOP are checked against the variables live
+ * after it. The only statement of a program is never removed.
+ * ARGS     opt       - optimiser
+ *          eliminate - remove dead stores instead of selecting invariants
+ */
+static void walkLiveness(Optimiser *opt, bool eliminate)
+{
+    Program *prog = opt->prog;
+    uint64_t *live = allocateZeroed((opt->varCount + 63) / 64, sizeof(uint64_t));
+    NodeIndex *parents = allocate(prog->count * sizeof(NodeIndex));
+    NodeIndex *open = allocate(prog->count * sizeof(NodeIndex));
+    NodeIndex *path = allocate(prog->count * sizeof(NodeIndex));
+    size_t *marks = allocate(prog->count * sizeof(size_t));
+    VarID *killed = allocate(prog->count * sizeof(VarID));
+    bool *useful = NULL;
+    if (eliminate) {
+        useful = allocate(opt->varCount * sizeof(bool));
+        findUseful(opt, useful);
+    }
+    
+    // innermost LOOP enclosing every statement
+    size_t depth = 0;
+    for (NodeIndex i = 1; i < prog->count; ++i) {
+        while (depth > 0 && programNode(prog, open[depth - 1])->as.loop.end <= i)
+            --depth;
+        parents[i] = depth > 0 ? open[depth - 1] : NODE_NONE;
+        if (programNode(prog, i)->type == STAT_LOOP)
+            open[depth++] = i;
+    }
+    
+    // variables made dead inside a LOOP body are logged and revived when
+    // reaching the LOOP, since the body may run zero times
+    size_t logged = 0;
+    depth = 0;
+    live[0] = 1;
+    for (NodeIndex i = prog->count - 1; i > 0; --i) {
+        Statement *stat = programNode(prog, i);
+        if (depth > 0 && open[depth - 1] == i) {
+            --depth;
+            while (logged > marks[depth]) {
+                VarID var = killed[--logged];
+                live[var / 64] |= (uint64_t)1 << (var % 64);
+            }
+            live[stat->as.loop.var / 64] |= (uint64_t)1 << (stat->as.loop.var % 64);
+            continue;
+        }
+        
+        // enter the LOOPs whose bodies end with this statement, outermost first
+        NodeIndex top = depth > 0 ? open[depth - 1] : NODE_NONE;
+        size_t entered = 0;
+        for (NodeIndex p = parents[i]; p != top; p = parents[p])
+            path[entered++] = p;
+        while (entered > 0) {
+            NodeIndex loop = path[--entered];
+            if (!eliminate)
+                selectInvariants(opt, loop, live);
+            marks[depth] = logged;
+            open[depth++] = loop;
+            addReads(opt, &programNode(prog, loop)->as.loop, live);
+        }
+        
+        Assignment *asg = &stat->as.assignment;
+        bool isLive = (live[asg->lvalue / 64] >> (asg->lvalue % 64)) & 1;
+        if (eliminate && prog->count > 2 && (!isLive || !useful[asg->lvalue]
+                || (asg->lvalue == asg->rvalue && asg->nat == 0))) {
+            opt->removed[i] = true;
+            record(opt, PASS_DEAD_STORES);
+            continue;
+        }
+        if (isLive) {
+            if (depth > 0)
+                killed[logged++] = asg->lvalue;
+            live[asg->lvalue / 64] &= ~((uint64_t)1 << (asg->lvalue % 64));
+        }
+        live[asg->rvalue / 64] |= (uint64_t)1 << (asg->rvalue % 64);
+    }
+    
+    free(live);
+    free(parents);
+    free(open);
+    free(path);
+    free(marks);
+    free(killed);
+    free(useful);
+}
+
+/*
+ * Hoist loop-invariant assignments in front of their LOOPs, innermost LOOPs
+ * first until the budget is used up.
+ * ARGS     opt - optimiser
+ */
+static void hoistInvariants(Optimiser *opt)
+{
+    Program *prog = opt->prog;
+    uint32_t *writes = allocateZeroed(opt->varCount, sizeof(uint32_t));
+    bool *reads = allocateZeroed(opt->varCount, sizeof(bool));
+    for (NodeIndex i = prog->count - 1; i > 0; --i) {
+        if (programNode(prog, i)->type == STAT_LOOP)
+            findInvariants(opt, i, writes, reads);
+    }
+    free(writes);
+    free(reads);
+    walkLiveness(opt, false);
+}
+
+/*
+ * Link a statement copied into the new arena to its predecessor.
+ * ARGS     nodes  - new arena
+ *          frames - LOOPs being copied
+ *          depth  - number of LOOPs being copied
+ *          first  - first statement of the new program
+ *          last   - preceding statement of the sequence or NODE_NONE
+ *          index  - statement to be linked
+ */
+static void linkStatement(Statement *nodes, const Frame *frames, size_t depth, NodeIndex *first,
+        NodeIndex last, NodeIndex index)
+{
+    if (last != NODE_NONE)
+        nodes[last].next = index;
+    else if (depth > 0)
+        nodes[frames[depth - 1].copy].as.loop.body = index;
+    else
+        *first = index;
+}
+
+/*
+ * Copy the program into a new arena in program order, leaving out removed
+ * statements and LOOPs whose body became empty, and placing hoisted
+ * statements in front of their LOOPs. The marks of the pass are reset.
+ * ARGS     opt  - optimiser
+ *          pass - pass the changes are counted for
+ */
+static void rebuildProgram(Optimiser *opt, Pass pass)
+{
+    Program *prog = opt->prog;
+    NodeIndex capacity = prog->count + 1;
+    Statement *nodes = allocate(capacity * sizeof(Statement));
+    uint32_t *lines = allocate(capacity * sizeof(uint32_t));
+    Frame *frames = allocate(prog->count * sizeof(Frame));
+    NodeIndex count = 1, first = NODE_NONE, last = NODE_NONE;
+    size_t depth = 0;
+    
+    NodeIndex cursor = prog->first;
+    for (;;) {
+        if (cursor == NODE_NONE) {
+            if (depth == 0)
+                break;
+            Frame frame = frames[--depth];
+            if (last == NODE_NONE) {
+                // a LOOP with an empty body has no effect
+                count = frame.copy;
+                if (frame.before != NODE_NONE)
+                    nodes[frame.before].next = NODE_NONE;
+                else
+                    linkStatement(nodes, frames, depth, &first, NODE_NONE, NODE_NONE);
+                last = frame.before;
+                record(opt, pass);
+            } else {
+                nodes[frame.copy].as.loop.end = count;
+                last = frame.copy;
+            }
+            cursor = programNode(prog, frame.old)->next;
+            continue;
+        }
+        
+        const Statement *stat = programNode(prog, cursor);
+        if (opt->removed[cursor]) {
+            cursor = stat->next;
+            continue;
+        }
+        if (stat->type == STAT_LOOP) {
+            for (NodeIndex k = opt->hoisted[cursor]; k != NODE_NONE; k = opt->chain[k]) {
+                nodes[count] = *programNode(prog, k);
+                nodes[count].next = NODE_NONE;
+                lines[count] = prog->lines[k];
+                linkStatement(nodes, frames, depth, &first, last, count);
+                last = count++;
+            }
+        }
+        nodes[count] = *stat;
+        nodes[count].next = NODE_NONE;
+        lines[count] = prog->lines[cursor];
+        linkStatement(nodes, frames, depth, &first, last, count);
+        if (stat->type == STAT_LOOP) {
+            nodes[count].as.loop.body = NODE_NONE;
+            nodes[count].as.loop.fused = FUSED_NONE;
+            nodes[count].as.loop.affine = NULL;
+            frames[depth++] = (Frame){ cursor, count, last };
+            last = NODE_NONE;
+            cursor = stat->as.loop.body;
+        } else {
+            last = count;
+            cursor = stat->next;
+        }
+        ++count;
+    }
+    
+    // the grammar requires at least one statement
+    if (first == NODE_NONE) {
+        nodes[count].type = STAT_ASSIGNMENT;
+        nodes[count].next = NODE_NONE;
+        nodes[count].as.assignment = (Assignment){ 0, 0, 0, true };
+        lines[count] = prog->lines[prog->first];
+        first = count++;
+    }
+    
+    if (prog->image != NULL) {
+        freeImage(prog);
+    } else {
+        free(prog->nodes);
+        free(prog->lines);
+    }
+    prog->nodes = nodes;
+    prog->lines = lines;
+    prog->count = count;
+    prog->capacity = capacity;
+    prog->first = first;
+    free(frames);
+    
+    memset(opt->removed, 0, count * sizeof(bool));
+    memset(opt->hoisted, 0, count * sizeof(NodeIndex));
+}
+
+/*
+ * Get the name of a pass as used on the command line.
+ * ARGS     pass - pass to be named
+ * RETURN   static string
+ */
+const char *passName(Pass pass)
+{
+    return pass < PASS_COUNT ? passNames[pass] : "unknown";
+}
+
+/*
+ * Parse a comma separated list of pass names into a set of passes.
+ * ARGS     list   - list of names, e.g. "constants,fold" or "-hoist"
+ *          passes - destination of the set, one bit per Pass
+ * RETURN   false if the list holds an unknown name
+ */
+bool parsePasses(const char *list, unsigned *passes)
+{
+    // input check
+    if (list == NULL || passes == NULL) {
+        fprintf(stderr, "ERROR: cannot parse missing list of passes\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    unsigned set = *list == '-' ? PASSES_ALL : PASSES_NONE;
+    while (*list != '\0') {
+        bool disable = *list == '-';
+        const char *name = list + disable;
+        size_t length = strcspn(name, ",");
+        unsigned bits = 0;
+        if (length == 3 && strncmp(name, "all", 3) == 0)
+            bits = PASSES_ALL;
+        for (int p = 0; p < PASS_COUNT && bits == 0; ++p) {
+            if (strlen(passNames[p]) == length && strncmp(name, passNames[p], length) == 0)
+                bits = 1u << p;
+        }
+        if (bits == 0)
+            return false;
+        set = disable ? set & ~bits : set | bits;
+        list = name + length + (name[length] == ',');
+    }
+    *passes = set;
+    return true;
+}
+
+/*
+ * Optimise a program in place.
+ * ARGS     prog   - program to be optimised
+ *          vars   - variable table the program was parsed with
+ *          passes - set of enabled passes, one bit per Pass
+ *          stats  - destination of the changes made or NULL
+ */
+void optimiseProgram(Program *prog, const VariableTable *vars, unsigned passes,
+        OptimiseStats *stats)
+{
+    // input check
+    if (prog == NULL || vars == NULL) {
+        fprintf(stderr, "ERROR: cannot optimise missing program\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    OptimiseStats local;
+    if (stats == NULL)
+        stats = &local;
+    memset(stats, 0, sizeof(OptimiseStats));
+    stats->statements = prog->count - 1;
+    
+    // the arena never grows, except for one statement replacing an empty program
+    Optimiser opt;
+    opt.prog = prog;
+    opt.varCount = vars->count;
+    opt.passes = passes & PASSES_ALL;
+    opt.stats = stats;
+    opt.removed = allocateZeroed(prog->count + 1, sizeof(bool));
+    opt.hoisted = allocateZeroed(prog->count + 1, sizeof(NodeIndex));
+    opt.chain = allocateZeroed(prog->count + 1, sizeof(NodeIndex));
+    
+    // the passes scan the arena as a whole, so programs calling macro bodies
+    // are left alone, the bodies of macros inlined everywhere are dropped
+    bool calls = false;
+    for (NodeIndex i = 1; i < prog->count && !calls; ++i)
+        calls = programNode(prog, i)->type == STAT_CALL;
+    if (calls)
+        opt.passes = PASSES_NONE;
+    else if (opt.passes != PASSES_NONE)
+        rebuildProgram(&opt, PASS_DEAD_STORES);
+    
+    long before = -1;
+    while (opt.passes != PASSES_NONE && stats->rounds < OPTIMISE_ROUNDS && before != totalChanges(stats)) {
+        before = totalChanges(stats);
+        if (isEnabled(&opt, PASS_CONSTANTS) || isEnabled(&opt, PASS_COPIES)
+                || isEnabled(&opt, PASS_ZERO_LOOPS)) {
+            opt.budget = (size_t)OPTIMISE_BUDGET * prog->count;
+            long changes = totalChanges(stats);
+            propagateFacts(&opt);
+            if (totalChanges(stats) != changes)
+                rebuildProgram(&opt, PASS_ZERO_LOOPS);
+        }
+        if (isEnabled(&opt, PASS_FOLD)) {
+            long changes = totalChanges(stats);
+            foldAssignments(&opt);
+            if (totalChanges(stats) != changes)
+                rebuildProgram(&opt, PASS_FOLD);
+        }
+        if (isEnabled(&opt, PASS_HOIST)) {
+            opt.budget = (size_t)OPTIMISE_BUDGET * prog->count;
+            long changes = totalChanges(stats);
+            hoistInvariants(&opt);
+            if (totalChanges(stats) != changes)
+                rebuildProgram(&opt, PASS_HOIST);
+        }
+        if (isEnabled(&opt, PASS_DEAD_STORES)) {
+            opt.budget = (size_t)OPTIMISE_BUDGET * prog->count;
+            long changes = totalChanges(stats);
+            walkLiveness(&opt, true);
+            if (totalChanges(stats) != changes)
+                rebuildProgram(&opt, PASS_DEAD_STORES);
+        }
+        ++stats->rounds;
+    }
+    stats->remaining = prog->count - 1;
+    
+    free(opt.removed);
+    free(opt.hoisted);
+    free(opt.chain);
+}
+
+/*
+ * Print the changes made by every pass, one line per enabled pass.
+ * ARGS     stream - output stream
+ *          stats  - changes reported by optimiseProgram
+ *          passes - set of enabled passes
+ */
+void printOptimiseStats(FILE *stream, const OptimiseStats *stats, unsigned passes)
+{
+    // input check
+    if (stream == NULL || stats == NULL) {
+        fprintf(stderr, "ERROR: cannot print missing optimiser statistics\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    for (int p = 0; p < PASS_COUNT; ++p) {
+        if ((passes >> p) & 1)
+            fprintf(stream, "OPTIMISE: %-12s %ld changes\n", passNames[p], stats->changes[p]);
+    }
+    fprintf(stream, "OPTIMISE: %ld of %ld statements left after %ld rounds\n", stats->remaining,
+            stats->statements, stats->rounds);
+}
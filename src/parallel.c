@@ -0,0 +1,464 @@
+/*
+ * parallel.c
+ *
+ * Concurrent execution of independent top-level statements, see parallel.h.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "affine.h"
+#include "alloc.h"
+#include "fuse.h"
+#include "hash.h"
+#include "parallel.h"
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Top-level statements copied into a program of their own. Concurrent parts
+ * use local variable slots and a private register file, sequential parts use
+ * the slots of the whole program and run on the register file of the caller.
+ */
+typedef struct {
+    Program *prog;          // copied statements
+    VariableTable *vars;    // local variables, NULL for a sequential part
+    long *slots;            // slot of every local variable in the program
+                            // or -1 if the part does not touch it
+    long *writes;           // local slots written by the part
+    long writeCount;        // number of written local slots
+    long writeCapacity;     // number of allocated entries in writes
+    Value *regs;            // private register file
+    Executable exe;         // prepared statements
+} Part;
+
+/*
+ * Consecutive parts run concurrently, or a single part run alone.
+ */
+typedef struct {
+    long first;             // index of the first part
+    long count;             // number of parts
+} Stage;
+
+struct sParallelProgram {
+    Part *parts;
+    long partCount;
+    Stage *stages;
+    long stageCount;
+    long width;             // largest number of parts of a stage
+};
+
+/*
+ * Scratch memory indexed by the slots of the whole program, reset after
+ * building every part.
+ */
+typedef struct {
+    long *local;            // local slot of every variable or -1
+    bool *written;          // variable recorded as written
+    long *touched;          // variables with a local slot
+    long touchedCount;
+} SlotMap;
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Get the index one past the last statement nested in a statement.
+ */
+static NodeIndex statementEnd(const Program *prog, NodeIndex index)
+{
+    const Statement *stat = programNode(prog, index);
+    return stat->type == STAT_LOOP ? stat->as.loop.end : index + 1;
+}
+
+/*
+ * Translate a variable of a concurrent part to its local slot, allocating
+ * the slot on first use.
+ * ARGS     map  - slots allocated so far
+ *          vars - variable table of the whole program
+ *          part - part being built
+ *          var  - slot in the whole program
+ * RETURN   local slot
+ */
+static VarID localSlot(SlotMap *map, const VariableTable *vars, Part *part, VarID var)
+{
+    if (map->local[var] < 0) {
+        map->local[var] = internVariable(part->vars, vars->ids[var]);
+        map->touched[map->touchedCount++] = var;
+    }
+    return (VarID)map->local[var];
+}
+
+/*
+ * Copy top-level statements into a part and prepare it for an engine.
+ * ARGS     part       - destination of the part
+ *          prog       - program holding the statements
+ *          vars       - variable table of the program
+ *          roots      - top-level statements in the order they are run
+ *          count      - number of statements
+ *          concurrent - true for local slots and a private register file
+ *          map        - scratch memory
+ *          engine     - engine executing the part
+ *          hash       - hash of the part (only used by ENGINE_CC)
+ */
+static void buildPart(Part *part, const Program *prog, const VariableTable *vars,
+        const NodeIndex *roots, long count, bool concurrent, SlotMap *map, Engine engine, uint64_t hash)
+{
+    NodeIndex size = 1;
+    for (long r = 0; r < count; ++r)
+        size += statementEnd(prog, roots[r]) - roots[r];
+    Program *copy = allocate(sizeof(Program));
+    copy->nodes = allocate(size * sizeof(Statement));
+    copy->lines = allocate(size * sizeof(uint32_t));
+    copy->count = size;
+    copy->capacity = size;
+    copy->first = 1;
+    copy->chunks = NULL;
+    copy->macros = NULL;
+    copy->macroCount = 0;
+    copy->image = NULL;
+    copy->imageSize = 0;
+    copy->imageMapped = false;
+    part->prog = copy;
+    part->vars = NULL;
+    part->slots = NULL;
+    part->writes = NULL;
+    part->writeCount = 0;
+    part->writeCapacity = 0;
+    part->regs = NULL;
+    if (concurrent) {
+        part->vars = createVariableTable();
+        internVariable(part->vars, 0);
+    }
+    
+    // statements keep their relative positions, so links move along
+    NodeIndex index = 1;
+    for (long r = 0; r < count; ++r) {
+        NodeIndex end = statementEnd(prog, roots[r]);
+        NodeIndex delta = index - roots[r];
+        for (NodeIndex k = roots[r]; k < end; ++k, ++index) {
+            Statement *stat = &copy->nodes[index];
+            *stat = *programNode(prog, k);
+            copy->lines[index] = prog->lines[k];
+            if (stat->next != NODE_NONE)
+                stat->next += delta;
+            if (stat->type == STAT_LOOP) {
+                stat->as.loop.body += delta;
+                stat->as.loop.end += delta;
+                stat->as.loop.fused = FUSED_NONE;
+                stat->as.loop.affine = NULL;
+                if (concurrent)
+                    stat->as.loop.var = localSlot(map, vars, part, stat->as.loop.var);
+            } else if (concurrent) {
+                Assignment *asg = &stat->as.assignment;
+                if (!map->written[asg->lvalue]) {
+                    map->written[asg->lvalue] = true;
+                    if (part->writeCount == part->writeCapacity) {
+                        part->writeCapacity = part->writeCapacity > 0 ? 2 * part->writeCapacity : 64;
+                        part->writes = reallocate(part->writes, part->writeCapacity, sizeof(long));
+                    }
+                    part->writes[part->writeCount++] = asg->lvalue;
+                }
+                asg->lvalue = localSlot(map, vars, part, asg->lvalue);
+                asg->rvalue = localSlot(map, vars, part, asg->rvalue);
+            }
+        }
+        copy->nodes[index - (end - roots[r])].next = r + 1 < count ? index : NODE_NONE;
+    }
+    
+    if (concurrent) {
+        part->slots = allocate(part->vars->count * sizeof(long));
+        for (long l = 0; l < part->vars->count; ++l)
+            part->slots[l] = -1;
+        for (long t = 0; t < map->touchedCount; ++t) {
+            long var = map->touched[t];
+            part->slots[map->local[var]] = var;
+        }
+        for (long w = 0; w < part->writeCount; ++w) {
+            map->written[part->writes[w]] = false;
+            part->writes[w] = map->local[part->writes[w]];
+        }
+        for (long t = 0; t < map->touchedCount; ++t)
+            map->local[map->touched[t]] = -1;
+        map->touchedCount = 0;
+        part->regs = createRegisters(part->vars);
+    }
+    
+    analyseFusedLoops(copy, NULL);
+    analyseAffineLoops(copy);
+    prepareExecutable(&part->exe, engine, copy, concurrent ? part->vars : vars, hash);
+}
+
+/*
+ * Split a program into parts along the dependency DAG of its top-level
+ * statements and prepare every part for an engine.
+ * ARGS     prog   - program to be split, not modified
+ *          vars   - variable table the program was parsed with
+ *          engine - engine executing the parts
+ *          hash   - hash of the program text (only used by ENGINE_CC)
+ * RETURN   pointer to the newly prepared program
+ */
+ParallelProgram *prepareParallel(const Program *prog, const VariableTable *vars, Engine engine,
+        uint64_t hash)
+{
+    // input check
+    if (prog == NULL || vars == NULL) {
+        fprintf(stderr, "ERROR: cannot split missing program\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    // macro bodies lie outside the top-level statements and are not copied
+    // into parts, programs calling them are left to run sequentially
+    for (NodeIndex i = 1; i < prog->count; ++i) {
+        if (programNode(prog, i)->type == STAT_CALL) {
+            ParallelProgram *par = allocate(sizeof(ParallelProgram));
+            *par = (ParallelProgram){ NULL, 0, NULL, 0, 1 };
+            return par;
+        }
+    }
+    
+    long count = 0;
+    for (NodeIndex i = prog->first; i != NODE_NONE; i = programNode(prog, i)->next)
+        ++count;
+    NodeIndex *roots = allocate(count * sizeof(NodeIndex));
+    long *levels = allocate(count * sizeof(long));
+    long *lastWrite = allocateZeroed(vars->count, sizeof(long));
+    long *lastRead = allocateZeroed(vars->count, sizeof(long));
+    long *seenRead = allocate(vars->count * sizeof(long));
+    long *seenWrite = allocate(vars->count * sizeof(long));
+    for (long v = 0; v < vars->count; ++v)
+        seenRead[v] = seenWrite[v] = -1;
+    
+    // a statement runs one level after every statement it depends on
+    long r = 0, height = 0;
+    for (NodeIndex i = prog->first; i != NODE_NONE; i = programNode(prog, i)->next, ++r) {
+        roots[r] = i;
+        NodeIndex end = statementEnd(prog, i);
+        long level = 1;
+        for (NodeIndex k = i; k < end; ++k) {
+            const Statement *stat = programNode(prog, k);
+            VarID read = stat->type == STAT_LOOP ? stat->as.loop.var : stat->as.assignment.rvalue;
+            if (lastWrite[read] >= level)
+                level = lastWrite[read] + 1;
+            if (stat->type == STAT_ASSIGNMENT) {
+                VarID written = stat->as.assignment.lvalue;
+                if (lastWrite[written] >= level)
+                    level = lastWrite[written] + 1;
+                if (lastRead[written] >= level)
+                    level = lastRead[written] + 1;
+            }
+        }
+        for (NodeIndex k = i; k < end; ++k) {
+            const Statement *stat = programNode(prog, k);
+            VarID read = stat->type == STAT_LOOP ? stat->as.loop.var : stat->as.assignment.rvalue;
+            if (seenRead[read] != r) {
+                seenRead[read] = r;
+                if (lastRead[read] < level)
+                    lastRead[read] = level;
+            }
+            if (stat->type == STAT_ASSIGNMENT && seenWrite[stat->as.assignment.lvalue] != r) {
+                seenWrite[stat->as.assignment.lvalue] = r;
+                lastWrite[stat->as.assignment.lvalue] = level;
+            }
+        }
+        levels[r] = level;
+        if (height < level)
+            height = level;
+    }
+    free(lastWrite);
+    free(lastRead);
+    free(seenRead);
+    free(seenWrite);
+    
+    // statements sorted by level, in program order within a level
+    long *starts = allocateZeroed(height + 2, sizeof(long));
+    NodeIndex *order = allocate(count * sizeof(NodeIndex));
+    long *loops = allocateZeroed(height + 1, sizeof(long));
+    for (r = 0; r < count; ++r) {
+        ++starts[levels[r] + 1];
+        if (programNode(prog, roots[r])->type == STAT_LOOP)
+            ++loops[levels[r]];
+    }
+    for (long l = 1; l <= height; ++l)
+        starts[l + 1] += starts[l];
+    for (r = 0; r < count; ++r)
+        order[starts[levels[r]]++] = roots[r];
+    for (long l = height; l > 0; --l)
+        starts[l] = starts[l - 1];
+    starts[1] = 0;
+    
+    ParallelProgram *par = allocate(sizeof(ParallelProgram));
+    par->parts = allocate((count + 1) * sizeof(Part));
+    par->stages = allocate((2 * height + 1) * sizeof(Stage));
+    par->partCount = 0;
+    par->stageCount = 0;
+    par->width = 1;
+    SlotMap map;
+    map.local = allocate(vars->count * sizeof(long));
+    map.written = allocateZeroed(vars->count, sizeof(bool));
+    map.touched = allocate(vars->count * sizeof(long));
+    map.touchedCount = 0;
+    for (long v = 0; v < vars->count; ++v)
+        map.local[v] = -1;
+    
+    // levels without independent LOOPs are merged into sequential parts
+    long pending = 0;
+    NodeIndex *group = allocate((count > 0 ? count : 1) * sizeof(NodeIndex));
+    for (long l = 1; l <= height + 1; ++l) {
+        bool concurrent = l <= height && loops[l] >= 2;
+        if ((concurrent || l > height) && pending > 0) {
+            uint64_t code = hashBytes(hash, &par->partCount, sizeof(par->partCount));
+            buildPart(&par->parts[par->partCount], prog, vars, order + starts[l] - pending, pending, false,
+                    &map, engine, code);
+            par->stages[par->stageCount++] = (Stage){ par->partCount++, 1 };
+            pending = 0;
+        }
+        if (l > height)
+            break;
+        if (!concurrent) {
+            pending += starts[l + 1] - starts[l];
+            continue;
+        }
+        
+        // every LOOP on its own, the assignments of the level together
+        Stage stage = { par->partCount, 0 };
+        long assignments = 0;
+        for (long k = starts[l]; k < starts[l + 1]; ++k) {
+            uint64_t code = hashBytes(hash, &par->partCount, sizeof(par->partCount));
+            if (programNode(prog, order[k])->type == STAT_ASSIGNMENT) {
+                group[assignments++] = order[k];
+                continue;
+            }
+            buildPart(&par->parts[par->partCount++], prog, vars, &order[k], 1, true, &map, engine, code);
+            ++stage.count;
+        }
+        if (assignments > 0) {
+            uint64_t code = hashBytes(hash, &par->partCount, sizeof(par->partCount));
+            buildPart(&par->parts[par->partCount++], prog, vars, group, assignments, true, &map, engine, code);
+            ++stage.count;
+        }
+        par->stages[par->stageCount++] = stage;
+        if (par->width < stage.count)
+            par->width = stage.count;
+    }
+    
+    free(group);
+    free(map.local);
+    free(map.written);
+    free(map.touched);
+    free(starts);
+    free(order);
+    free(loops);
+    free(roots);
+    free(levels);
+    return par;
+}
+
+/*
+ * Get the largest number of parts running concurrently.
+ * ARGS     par - prepared program
+ * RETURN   1 if no top-level LOOPs are independent of each other
+ */
+long parallelWidth(const ParallelProgram *par)
+{
+    // input check
+    if (par == NULL) {
+        fprintf(stderr, "ERROR: cannot query missing program\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    return par->width;
+}
+
+/*
+ * Run a concurrent part of a stage, task of the thread pool.
+ * ARGS     context - first part of the stage
+ *          worker  - index of the executing worker
+ *          index   - index of the part within the stage
+ */
+static void runPart(void *context, long worker, long index)
+{
+    (void)worker;
+    Part *part = (Part *)context + index;
+    runExecutable(&part->exe, part->regs);
+}
+
+/*
+ * Execute the prepared program once.
+ * ARGS     par  - prepared program
+ *          regs - initialized register file indexed by variable slots
+ *          pool - workers running concurrent parts
+ */
+void runParallel(ParallelProgram *par, Value *regs, ThreadPool *pool)
+{
+    // input check
+    if (par == NULL || regs == NULL || pool == NULL) {
+        fprintf(stderr, "ERROR: cannot run missing program\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    for (long s = 0; s < par->stageCount; ++s) {
+        Part *parts = par->parts + par->stages[s].first;
+        long count = par->stages[s].count;
+        if (parts[0].vars == NULL) {
+            runExecutable(&parts[0].exe, regs);
+            continue;
+        }
+        
+        // every part owns copies of the big numbers it touches
+        for (long p = 0; p < count; ++p) {
+            for (long l = 0; l < parts[p].vars->count; ++l) {
+                Value v = parts[p].slots[l] >= 0 ? regs[parts[p].slots[l]] : 0;
+                parts[p].regs[l] = (v & VALUE_BIG) ? valueFromLimbs(valueBig(v)->limbs, valueBig(v)->length) : v;
+            }
+        }
+        runPool(pool, count, runPart, parts);
+        for (long p = 0; p < count; ++p) {
+            for (long w = 0; w < parts[p].writeCount; ++w) {
+                long l = parts[p].writes[w];
+                valueRelease(regs[parts[p].slots[l]]);
+                regs[parts[p].slots[l]] = parts[p].regs[l];
+                parts[p].regs[l] = 0;
+            }
+            clearRegisters(parts[p].vars, parts[p].regs);
+        }
+    }
+}
+
+/*
+ * Release all parts of a prepared program.
+ * ARGS     par - prepared program (may be NULL)
+ */
+void freeParallel(ParallelProgram *par)
+{
+    if (par == NULL)
+        return;
+    for (long p = 0; p < par->partCount; ++p) {
+        Part *part = &par->parts[p];
+        releaseExecutable(&part->exe);
+        freeProgram(part->prog);
+        if (part->vars != NULL) {
+            clearRegisters(part->vars, part->regs);
+            free(part->regs);
+            freeVariableTable(part->vars);
+        }
+        free(part->slots);
+        free(part->writes);
+    }
+    free(par->parts);
+    free(par->stages);
+    free(par);
+}
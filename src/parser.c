@@ -3,9 +3,12 @@
  *
  * Simple LL(1) parser with the following grammar:
  *  Program    := Statement Program | NULL
- *  Statement  := Assignment | Loop
+ *  Statement  := Assignment | Loop | Call | Macro
  *  Assignment := VarID ':=' VarID '+' NatNum | VarID ':=' VarID '-' NatNum
  *  Loop       := 'LOOP' VarID 'DO' Program 'END'
+ *  Call       := Name '(' VarID Arguments ')'
+ *  Arguments  := ',' VarID Arguments | NULL
+ *  Macro      := 'MACRO' Name '(' VarID Arguments ')' 'DO' Program 'END'
  *
  * Tom René Hennig
  */
@@ -16,185 +19,891 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
+#include "hash.h"
+#include "image.h"
 #include "parser.h"
 #include "token.h"
 
 
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define ARENA_CHUNK_SIZE 65536  // default size of auxiliary memory blocks
+#define PARSER_INLINE_SLACK 16  // statements a macro body may exceed the
+                                // copies of its arguments by to be inlined
+#define MACRO_READS 1           // usage flag of a macro variable read
+#define MACRO_WRITES 2          // usage flag of a macro variable written
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Outcome of reading a statement.
+ */
+typedef enum {
+    READ_ERROR,         // syntax error
+    READ_STATEMENTS,    // complete statements (assignment or call)
+    READ_LOOP,          // head of a LOOP
+    READ_MACRO          // head of a macro definition
+} ReadResult;
+
+/*
+ * Macro defined by the program. Its variables occupy the slots base ...
+ * base + count - 1 (parameters) and the following ones (locals).
+ */
+typedef struct {
+    char *name;             // name, not null terminated
+    size_t length;          // number of characters of the name
+    NodeIndex body;         // first statement of the body
+    NodeIndex end;          // one past the last statement of the body
+    VarID base;             // slot of the first parameter
+    long count;             // number of parameters
+    unsigned char *usage;   // MACRO_READS and MACRO_WRITES of every parameter
+    long *ids;              // identifier of every parameter and local variable
+    long locals;            // number of parameters and local variables
+} Macro;
+
+/*
+ * State of the parser while reading a program.
+ */
+typedef struct {
+    Lexer *lex;             // lexer to read from
+    VariableTable *vars;    // variable table of the program
+    Program *prog;          // program to append the statements to
+    SyntaxError *error;     // destination of a syntax error
+    Macro *macros;          // macros defined so far
+    long macroCount;        // number of macros
+    long macroCapacity;     // number of allocated macros
+    long *table;            // hash table of macro index + 1 by name
+    long tableSize;         // number of buckets (power of two or 0)
+    VariableTable *scope;   // identifiers of the macro being defined or NULL
+    VarID base;             // slot of its first variable
+    long localCount;        // number of its variables
+    VarID *args;            // variables of the list read last
+    long argCapacity;       // number of allocated entries in args
+    long zero;              // slot of the hidden variable kept zero or -1
+} Parser;
+
+
 /******************************************************************************
  *                           FUNCTION DEFINITIONS
  */
 
 /*
- * Foward declaration because of the cyclic structure of LOOP programs (nesting
- * of LOOPs).
+ * Append a statement to the arena of the program.
+ * ARGS     prog - program to append to
+ *          type - type of the new statement
+ *          line - source line the statement starts in
+ * RETURN   index of the new, otherwise uninitialized statement
  */
-Program *readProgram(FILE *stream);
+static NodeIndex appendNode(Program *prog, StatementType type, long line)
+{
+    if (prog->count == prog->capacity) {
+        if (prog->capacity > UINT32_MAX / 2) {
+            fprintf(stderr, "ERROR: program exceeds %lu statements\n", (unsigned long)UINT32_MAX / 2);
+            exit(EXIT_FAILURE);
+        }
+        prog->capacity *= 2;
+        prog->nodes = realloc(prog->nodes, prog->capacity * sizeof(Statement));
+        prog->lines = realloc(prog->lines, prog->capacity * sizeof(uint32_t));
+        if (prog->nodes == NULL || prog->lines == NULL) {
+            fprintf(stderr, "ERROR: unable to to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    NodeIndex index = prog->count++;
+    prog->nodes[index].type = type;
+    prog->nodes[index].next = NODE_NONE;
+    prog->lines[index] = line > (long)UINT32_MAX ? UINT32_MAX : (uint32_t)line;
+    return index;
+}
 
 /*
- * Read a statement from stream determining its type with the first token read.
- * ARGS     stream - libc stream to read from
- * RETURN   pointer to the newly read and allocated statement structure
+ * Check the slot of a variable for fitting into a VarID.
+ * ARGS     slot - slot returned by the variable table
+ * RETURN   slot as VarID
  */
-Statement *readStatement(FILE *stream)
+static VarID toVarID(long slot)
 {
-    // input check
-    if (stream == NULL) {
-        fprintf(stderr, "ERROR: invalid stream to read from\n");
+    if (slot > (long)UINT32_MAX) {
+        fprintf(stderr, "ERROR: program exceeds %lu variables\n", (unsigned long)UINT32_MAX);
         exit(EXIT_FAILURE);
     }
+    return (VarID)slot;
+}
+
+/*
+ * Allocate the slot of a new hidden variable. Hidden variables have negative
+ * identifiers, so they never clash with those of the program.
+ * ARGS     parser - state of the parser
+ * RETURN   slot of the variable
+ */
+static VarID hiddenVariable(Parser *parser)
+{
+    return toVarID(internVariable(parser->vars, -1 - parser->vars->count));
+}
+
+/*
+ * Get the slot of the hidden variable that is never written and thus always
+ * zero, allocating it on first use.
+ * ARGS     parser - state of the parser
+ * RETURN   slot of the variable
+ */
+static VarID zeroVariable(Parser *parser)
+{
+    if (parser->zero < 0)
+        parser->zero = hiddenVariable(parser);
+    return (VarID)parser->zero;
+}
+
+/*
+ * Resolve a variable identifier to its slot. Within a macro body the
+ * identifier is looked up in the scope of the macro, every new identifier
+ * gets the next hidden slot, so the variables of a macro occupy consecutive
+ * slots starting with its parameters.
+ * ARGS     parser - state of the parser
+ *          id     - identifier of the variable
+ * RETURN   slot of the variable
+ */
+static VarID readVariable(Parser *parser, long id)
+{
+    if (parser->scope == NULL)
+        return toVarID(internVariable(parser->vars, id));
+    long local = internVariable(parser->scope, id);
+    if (local == parser->localCount) {
+        VarID slot = hiddenVariable(parser);
+        if (slot != parser->base + local) {
+            fprintf(stderr, "ERROR: variables of macro not contiguous\n");
+            exit(EXIT_FAILURE);
+        }
+        ++parser->localCount;
+    }
+    return parser->base + (VarID)local;
+}
+
+/*
+ * Record a syntax error at the position of the offending token.
+ * ARGS     error    - destination of the error
+ *          expected - description of the expected token
+ *          tok      - token found instead
+ * RETURN   READ_ERROR to be passed on by the caller
+ */
+static ReadResult syntaxError(SyntaxError *error, const char *expected, Token tok)
+{
+    error->expected = expected;
+    error->found = tok;
+    return READ_ERROR;
+}
+
+/*
+ * Read a parenthesized list of variable identifiers into the argument buffer
+ * of the parser. The parameters of a definition have to be distinct, the
+ * arguments of a call may repeat a variable.
+ * ARGS     parser - state of the parser
+ *          count  - number of arguments expected, -1 for the parameters of
+ *                   a definition
+ *          length - destination of the number of variables read
+ * RETURN   READ_STATEMENTS on success
+ */
+static ReadResult readVariables(Parser *parser, long count, long *length)
+{
+    Token tok = nextToken(parser->lex);
+    if (tok.type != TOK_LPAREN)
+        return syntaxError(parser->error, "\'(\'", tok);
+    *length = 0;
+    for (;;) {
+        tok = nextToken(parser->lex);
+        if (tok.type != TOK_VAR_ID)
+            return syntaxError(parser->error, "variable identifier", tok);
+        VarID slot = readVariable(parser, tok.value);
+        for (long i = 0; count < 0 && i < *length; ++i) {
+            if (parser->args[i] == slot)
+                return syntaxError(parser->error, "variable identifier not listed before", tok);
+        }
+        if (*length == parser->argCapacity) {
+            parser->argCapacity = parser->argCapacity > 0 ? 2 * parser->argCapacity : 16;
+            parser->args = realloc(parser->args, parser->argCapacity * sizeof(VarID));
+            if (parser->args == NULL) {
+                fprintf(stderr, "ERROR: unable to to allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        parser->args[(*length)++] = slot;
+        
+        // a call passes exactly as many arguments as the macro has parameters
+        tok = nextToken(parser->lex);
+        if (tok.type == TOK_RPAREN && (count < 0 || *length == count))
+            return READ_STATEMENTS;
+        if (tok.type != TOK_COMMA || *length == count)
+            return syntaxError(parser->error, *length == count ? "\')\'" : "\',\'", tok);
+    }
+}
+
+/*
+ * Look up a macro by its name.
+ * ARGS     parser - state of the parser
+ *          tok    - name token
+ * RETURN   index of the macro or -1 if it is not defined
+ */
+static long findMacro(const Parser *parser, Token tok)
+{
+    if (parser->tableSize == 0)
+        return -1;
+    size_t length = (size_t)tok.value;
+    uint64_t hash = hashBytes(HASH_SEED, tok.text, length);
+    for (long b = (long)(hash & (uint64_t)(parser->tableSize - 1));; b = (b + 1) & (parser->tableSize - 1)) {
+        long index = parser->table[b] - 1;
+        if (index < 0)
+            return -1;
+        const Macro *macro = &parser->macros[index];
+        if (macro->length == length && memcmp(macro->name, tok.text, length) == 0)
+            return index;
+    }
+}
+
+/*
+ * Enter the macro defined last into the table of names, growing the table
+ * to keep it at most half full.
+ * ARGS     parser - state of the parser
+ */
+static void addMacro(Parser *parser)
+{
+    if (2 * parser->macroCount > parser->tableSize) {
+        long size = parser->tableSize > 0 ? 2 * parser->tableSize : 64;
+        long *table = calloc(size, sizeof(long));
+        if (table == NULL) {
+            fprintf(stderr, "ERROR: unable to to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        free(parser->table);
+        parser->table = table;
+        parser->tableSize = size;
+        for (long i = 0; i < parser->macroCount - 1; ++i) {
+            uint64_t hash = hashBytes(HASH_SEED, parser->macros[i].name, parser->macros[i].length);
+            long b = (long)(hash & (uint64_t)(size - 1));
+            while (table[b] != 0)
+                b = (b + 1) & (size - 1);
+            table[b] = i + 1;
+        }
+    }
+    const Macro *macro = &parser->macros[parser->macroCount - 1];
+    uint64_t hash = hashBytes(HASH_SEED, macro->name, macro->length);
+    long b = (long)(hash & (uint64_t)(parser->tableSize - 1));
+    while (parser->table[b] != 0)
+        b = (b + 1) & (parser->tableSize - 1);
+    parser->table[b] = parser->macroCount;
+}
+
+/*
+ * Read the head of a macro definition 'MACRO' Name '(' ... ')' 'DO' and open
+ * the scope of its body, which is read by the caller.
+ * ARGS     parser - state of the parser
+ * RETURN   READ_MACRO on success
+ */
+static ReadResult readMacro(Parser *parser)
+{
+    Token tok = nextToken(parser->lex);
+    if (tok.type != TOK_NAME)
+        return syntaxError(parser->error, "macro name", tok);
+    if (findMacro(parser, tok) >= 0)
+        return syntaxError(parser->error, "name of a new macro", tok);
+    if (parser->macroCount == parser->macroCapacity) {
+        parser->macroCapacity = parser->macroCapacity > 0 ? 2 * parser->macroCapacity : 16;
+        parser->macros = realloc(parser->macros, parser->macroCapacity * sizeof(Macro));
+        if (parser->macros == NULL) {
+            fprintf(stderr, "ERROR: unable to to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
     
-    // allocate memory for the new statement
-    Statement *stat = malloc(sizeof(Statement));
-    if (stat == NULL) {
+    // the macro only becomes visible once its body is complete
+    Macro *macro = &parser->macros[parser->macroCount];
+    macro->length = (size_t)tok.value;
+    macro->name = malloc(macro->length);
+    if (macro->name == NULL) {
         fprintf(stderr, "ERROR: unable to to allocate memory\n");
         exit(EXIT_FAILURE);
     }
+    memcpy(macro->name, tok.text, macro->length);
+    macro->body = NODE_NONE;
+    macro->end = NODE_NONE;
+    macro->usage = NULL;
+    macro->ids = NULL;
+    macro->locals = 0;
+    parser->scope = createVariableTable();
+    parser->localCount = 0;
+    parser->base = toVarID(parser->vars->count);
+    macro->base = parser->base;
+    ReadResult result = readVariables(parser, -1, &macro->count);
+    if (result != READ_STATEMENTS) {
+        free(macro->name);
+        return result;
+    }
+    ++parser->macroCount;
+    tok = nextToken(parser->lex);
+    if (tok.type != TOK_DO)
+        return syntaxError(parser->error, "\'DO\'", tok);
+    return READ_MACRO;
+}
+
+/*
+ * Complete the definition of the macro whose body has just been read. Local
+ * variables written by the body are reset by assignments appended to it.
+ * ARGS     parser - state of the parser
+ *          last   - last statement of the body at its top level
+ */
+static void closeMacro(Parser *parser, NodeIndex last)
+{
+    Program *prog = parser->prog;
+    Macro *macro = &parser->macros[parser->macroCount - 1];
+    uint32_t line = prog->lines[last];
     
-    // read first token to decide statement type from
-    Token tok = nextToken(stream);
-    switch (tok.type) {
-    case TOK_VAR_ID:                    // start reading assignment
-        stat->type = STAT_ASSIGNMENT;
-        stat->data = malloc(sizeof(Assignment));
-        if (stat->data == NULL) {
-            fprintf(stderr, "ERROR: unable to to allocate memory\n");
-            exit(EXIT_FAILURE);
+    // find the variables the body reads and writes, calls only touch the
+    // variables of other macros
+    unsigned char *usage = calloc(parser->localCount > 0 ? parser->localCount : 1, 1);
+    if (usage == NULL) {
+        fprintf(stderr, "ERROR: unable to to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (NodeIndex i = macro->body; i < prog->count; ++i) {
+        const Statement *stat = programNode(prog, i);
+        if (stat->type == STAT_ASSIGNMENT) {
+            if (stat->as.assignment.lvalue - parser->base < (VarID)parser->localCount)
+                usage[stat->as.assignment.lvalue - parser->base] |= MACRO_WRITES;
+            if (stat->as.assignment.rvalue - parser->base < (VarID)parser->localCount)
+                usage[stat->as.assignment.rvalue - parser->base] |= MACRO_READS;
+        } else if (stat->type == STAT_LOOP && stat->as.loop.var - parser->base < (VarID)parser->localCount) {
+            usage[stat->as.loop.var - parser->base] |= MACRO_READS;
         }
-        Assignment *ass = stat->data;
-        ass->lvalue = tok.value;
-        tok = nextToken(stream);
-        if (tok.type != TOK_ASS) {
-            fprintf(stderr, "PARSER: expected \':=\' instead of ");
-            printToken(stderr, tok);
-            fputc('\n', stderr);
-            exit(EXIT_FAILURE);
+    }
+    
+    for (long l = macro->count; l < parser->localCount; ++l) {
+        if (!(usage[l] & MACRO_WRITES))
+            continue;
+        NodeIndex index = appendNode(prog, STAT_ASSIGNMENT, line);
+        Assignment *ass = &prog->nodes[index].as.assignment;
+        ass->lvalue = parser->base + (VarID)l;
+        ass->rvalue = zeroVariable(parser);
+        ass->nat = 0;
+        ass->isAddition = true;
+        prog->nodes[last].next = index;
+        last = index;
+    }
+    macro->end = prog->count;
+    macro->usage = usage;
+    macro->ids = parser->scope->ids;
+    macro->locals = parser->localCount;
+    parser->scope->ids = NULL;
+    freeVariableTable(parser->scope);
+    parser->scope = NULL;
+    addMacro(parser);
+}
+
+/*
+ * Copy the body of a macro to the end of the arena, replacing its
+ * parameters by the arguments.
+ * ARGS     parser - state of the parser
+ *          macro  - macro to be inlined
+ *          args   - slots of the arguments
+ *          first  - destination of the first statement of the copy
+ *          last   - destination of the last statement at its top level
+ */
+static void inlineMacro(Parser *parser, const Macro *macro, const VarID *args, NodeIndex *first,
+        NodeIndex *last)
+{
+    Program *prog = parser->prog;
+    NodeIndex shift = prog->count - macro->body;
+    for (NodeIndex i = macro->body; i < macro->end; ++i) {
+        NodeIndex index = appendNode(prog, STAT_ASSIGNMENT, 0);
+        Statement *stat = programNode(prog, index);
+        *stat = *programNode(prog, i);
+        prog->lines[index] = prog->lines[i];
+        if (stat->next != NODE_NONE)
+            stat->next += shift;
+        VarID *vars[2] = { NULL, NULL };
+        if (stat->type == STAT_ASSIGNMENT) {
+            vars[0] = &stat->as.assignment.lvalue;
+            vars[1] = &stat->as.assignment.rvalue;
+        } else if (stat->type == STAT_LOOP) {
+            stat->as.loop.body += shift;
+            stat->as.loop.end += shift;
+            vars[0] = &stat->as.loop.var;
         }
-        tok = nextToken(stream);
-        if (tok.type != TOK_VAR_ID) {
-            fprintf(stderr, "PARSER: expected variable identifier instead of ");
-            printToken(stderr, tok);
-            fputc('\n', stderr);
-            exit(EXIT_FAILURE);
+        for (int v = 0; v < 2 && vars[v] != NULL; ++v) {
+            if (*vars[v] - macro->base < (VarID)macro->count)
+                *vars[v] = args[*vars[v] - macro->base];
         }
-        ass->rvalue = tok.value;
-        tok = nextToken(stream);
+    }
+    *first = macro->body + shift;
+    *last = *first;
+    while (programNode(prog, *last)->next != NODE_NONE)
+        *last = programNode(prog, *last)->next;
+}
+
+/*
+ * Append a statement to the sequence of statements a call is made of.
+ * ARGS     prog  - program holding the statements
+ *          node  - statement to be appended
+ *          first - first statement of the sequence or NODE_NONE
+ *          last  - last statement of the sequence
+ */
+static void appendToCall(Program *prog, NodeIndex node, NodeIndex *first, NodeIndex *last)
+{
+    if (*first == NODE_NONE)
+        *first = node;
+    else
+        prog->nodes[*last].next = node;
+    *last = node;
+}
+
+/*
+ * Append the assignment lvalue := rvalue + 0 to a call.
+ * ARGS     prog   - program holding the statements
+ *          line   - source line of the call
+ *          lvalue - slot to be assigned
+ *          rvalue - slot to be copied
+ *          first  - first statement of the call or NODE_NONE
+ *          last   - last statement of the call
+ */
+static void appendCopy(Program *prog, long line, VarID lvalue, VarID rvalue, NodeIndex *first,
+        NodeIndex *last)
+{
+    NodeIndex node = appendNode(prog, STAT_ASSIGNMENT, line);
+    Assignment *ass = &prog->nodes[node].as.assignment;
+    ass->lvalue = lvalue;
+    ass->rvalue = rvalue;
+    ass->nat = 0;
+    ass->isAddition = true;
+    appendToCall(prog, node, first, last);
+}
+
+/*
+ * Read the arguments of a macro call and either inline the macro or call
+ * its body, copying the arguments in and the parameters back out. A call
+ * passing a variable twice is never inlined: the copies give each parameter
+ * its own slot, and of two parameters written back to the same variable the
+ * later one wins.
+ * ARGS     parser - state of the parser
+ *          tok    - name token of the macro
+ *          first  - destination of the first statement of the call
+ *          last   - destination of the last statement of the call
+ * RETURN   READ_STATEMENTS on success
+ */
+static ReadResult readCall(Parser *parser, Token tok, NodeIndex *first, NodeIndex *last)
+{
+    Program *prog = parser->prog;
+    long line = tok.line;
+    long index = findMacro(parser, tok);
+    if (index < 0)
+        return syntaxError(parser->error, "name of a macro defined before", tok);
+    const Macro *macro = &parser->macros[index];
+    long count;
+    ReadResult result = readVariables(parser, macro->count, &count);
+    if (result != READ_STATEMENTS)
+        return result;
+    
+    // parameters the body uses are copied in, those it writes back out,
+    // inlining pays off as long as the body is hardly larger than that
+    long copies = 0;
+    bool aliased = false;
+    for (long p = 0; p < macro->count; ++p) {
+        copies += (macro->usage[p] != 0) + ((macro->usage[p] & MACRO_WRITES) != 0);
+        for (long q = 0; q < p; ++q)
+            aliased = aliased || parser->args[q] == parser->args[p];
+    }
+    if (!aliased && (long)(macro->end - macro->body) <= copies + 1 + PARSER_INLINE_SLACK) {
+        inlineMacro(parser, macro, parser->args, first, last);
+        return READ_STATEMENTS;
+    }
+    *first = *last = NODE_NONE;
+    for (long p = 0; p < macro->count; ++p) {
+        if (macro->usage[p] != 0)
+            appendCopy(prog, line, macro->base + (VarID)p, parser->args[p], first, last);
+    }
+    NodeIndex call = appendNode(prog, STAT_CALL, line);
+    prog->nodes[call].as.call.body = macro->body;
+    prog->nodes[call].as.call.end = macro->end;
+    appendToCall(prog, call, first, last);
+    for (long p = 0; p < macro->count; ++p) {
+        if (macro->usage[p] & MACRO_WRITES)
+            appendCopy(prog, line, parser->args[p], macro->base + (VarID)p, first, last);
+    }
+    return READ_STATEMENTS;
+}
+
+/*
+ * Read a statement from the lexer determining its type with the first token
+ * read. Of a LOOP only the head 'LOOP' VarID 'DO' is read, of a macro
+ * definition only the head up to 'DO'. A macro call may yield a sequence of
+ * statements.
+ * ARGS     parser - state of the parser
+ *          top    - true at the top level, where macros may be defined
+ *          first  - destination of the first statement read
+ *          last   - destination of the last statement read
+ * RETURN   kind of statement read or READ_ERROR on syntax errors
+ */
+static ReadResult readStatement(Parser *parser, bool top, NodeIndex *first, NodeIndex *last)
+{
+    // read first token to decide statement type from
+    Lexer *lex = parser->lex;
+    Program *prog = parser->prog;
+    SyntaxError *error = parser->error;
+    NodeIndex index;
+    Token tok = nextToken(lex);
+    long line = tok.line;
+    switch (tok.type) {
+    case TOK_VAR_ID: {                  // start reading assignment
+        Assignment ass;
+        ass.lvalue = readVariable(parser, tok.value);
+        tok = nextToken(lex);
+        if (tok.type != TOK_ASS)
+            return syntaxError(error, "\':=\'", tok);
+        tok = nextToken(lex);
+        if (tok.type != TOK_VAR_ID)
+            return syntaxError(error, "variable identifier", tok);
+        ass.rvalue = readVariable(parser, tok.value);
+        tok = nextToken(lex);
         if (tok.type == TOK_PLUS) {
-            ass->isAddition = true;
+            ass.isAddition = true;
         } else if (tok.type == TOK_MINUS) {
-            ass->isAddition = false;
+            ass.isAddition = false;
         } else {
-            fprintf(stderr, "PARSER: expected \'+\' or \'-\' instead of ");
-            printToken(stderr, tok);
-            fputc('\n', stderr);
-            exit(EXIT_FAILURE);
-        }
-        tok = nextToken(stream);
-        if (tok.type != TOK_NAT_NUM) {
-            fprintf(stderr, "PARSER: expected variable identifier instead of ");
-            printToken(stderr, tok);
-            fputc('\n', stderr);
-            exit(EXIT_FAILURE);
+            return syntaxError(error, "\'+\' or \'-\'", tok);
         }
-        ass->nat = tok.value;
-        break;
-    case TOK_LOOP:                      // start reading a loop
-        stat->type = STAT_LOOP;
-        stat->data = malloc(sizeof(Loop));
-        if (stat->data == NULL) {
-            fprintf(stderr, "ERROR: unable to to allocate memory\n");
-            exit(EXIT_FAILURE);
+        tok = nextToken(lex);
+        if (tok.type != TOK_NAT_NUM)
+            return syntaxError(error, "natural number", tok);
+        ass.nat = tok.nat;
+        index = appendNode(prog, STAT_ASSIGNMENT, line);
+        prog->nodes[index].as.assignment = ass;
+        *first = *last = index;
+        return READ_STATEMENTS;
+    }
+    case TOK_LOOP: {                    // start reading a loop, the body
+        Loop loop;                      // is read by the caller
+        tok = nextToken(lex);
+        if (tok.type != TOK_VAR_ID)
+            return syntaxError(error, "variable identifier", tok);
+        loop.var = readVariable(parser, tok.value);
+        loop.body = NODE_NONE;
+        loop.end = NODE_NONE;
+        loop.fused = FUSED_NONE;
+        loop.affine = NULL;
+        tok = nextToken(lex);
+        if (tok.type != TOK_DO)
+            return syntaxError(error, "\'DO\'", tok);
+        index = appendNode(prog, STAT_LOOP, line);
+        prog->nodes[index].as.loop = loop;
+        *first = *last = index;
+        return READ_LOOP;
+    }
+    case TOK_NAME:                      // call of a macro defined before
+        return readCall(parser, tok, first, last);
+    case TOK_MACRO:                     // definition of a macro, the body
+        if (top)                        // is read by the caller
+            return readMacro(parser);
+        return syntaxError(error, "variable identifier, \'LOOP\' or macro name", tok);
+    default:                            // report all other tokens
+        return syntaxError(error, top ? "variable identifier, \'LOOP\', \'MACRO\' or macro name"
+                : "variable identifier, \'LOOP\' or macro name", tok);
+    }
+}
+
+/*
+ * Read program as a sequence of semicolon separted statements. LOOPs whose
+ * body is being read are kept on a stack, the body of a macro definition as
+ * NODE_NONE.
+ * ARGS     parser - state of the parser
+ * RETURN   index of the first statement of the program or NODE_NONE on
+ *          syntax errors
+ */
+static NodeIndex readProgram(Parser *parser)
+{
+    Program *prog = parser->prog;
+    NodeIndex *open = NULL;     // LOOPs whose body is being read
+    size_t depth = 0, capacity = 0;
+    NodeIndex first = NODE_NONE, prev = NODE_NONE, outer = NODE_NONE;
+    
+    for (;;) {
+        // link the statement to its predecessor or as head of its sequence
+        NodeIndex index = NODE_NONE, last = NODE_NONE;
+        ReadResult result = readStatement(parser, depth == 0, &index, &last);
+        if (result == READ_ERROR) {
+            free(open);
+            return NODE_NONE;
         }
-        Loop *loop = stat->data;
-        tok = nextToken(stream);
-        if (tok.type != TOK_VAR_ID) {
-            fprintf(stderr, "PARSER: expected variable identifier instead of ");
-            printToken(stderr, tok);
-            fputc('\n', stderr);
-            exit(EXIT_FAILURE);
+        if (result != READ_MACRO) {
+            if (prev != NODE_NONE)
+                prog->nodes[prev].next = index;
+            else if (depth > 0 && open[depth - 1] == NODE_NONE)
+                parser->macros[parser->macroCount - 1].body = index;
+            else if (depth > 0)
+                prog->nodes[open[depth - 1]].as.loop.body = index;
+            else
+                first = index;
+            prev = last;
         }
-        loop->var = tok.value;
-        tok = nextToken(stream);
-        if (tok.type != TOK_DO) {
-            fprintf(stderr, "PARSER: expected \'DO\' instead of ");
-            printToken(stderr, tok);
-            fputc('\n', stderr);
-            exit(EXIT_FAILURE);
+        
+        // a LOOP head or macro definition opens a new sequence
+        if (result != READ_STATEMENTS) {
+            if (depth == capacity) {
+                capacity = capacity > 0 ? 2 * capacity : 64;
+                open = realloc(open, capacity * sizeof(NodeIndex));
+                if (open == NULL) {
+                    fprintf(stderr, "ERROR: unable to to allocate memory\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            if (result == READ_MACRO)
+                outer = prev;
+            open[depth++] = result == READ_MACRO ? NODE_NONE : index;
+            prev = NODE_NONE;
+            continue;
         }
-        loop->program = readProgram(stream);
-        tok = nextToken(stream);
-        if (tok.type != TOK_END) {
-            fprintf(stderr, "PARSER: expected \'END\' instead of ");
-            printToken(stderr, tok);
-            fputc('\n', stderr);
-            exit(EXIT_FAILURE);
+        
+        // a semicolon signals a following statement, otherwise the sequence
+        // ends and closes the innermost LOOP (or the program)
+        Token tok = nextToken(parser->lex);
+        while (tok.type != TOK_SEM) {
+            if (depth == 0) {
+                pushToken(parser->lex, tok);
+                free(open);
+                if (first == NODE_NONE)
+                    syntaxError(parser->error, "statement after macro definitions", tok);
+                return first;
+            }
+            if (tok.type != TOK_END) {
+                free(open);
+                syntaxError(parser->error, "\'END\'", tok);
+                return NODE_NONE;
+            }
+            if (open[--depth] == NODE_NONE) {
+                closeMacro(parser, prev);
+                prev = outer;
+            } else {
+                prev = open[depth];
+                prog->nodes[prev].as.loop.end = prog->count;
+            }
+            tok = nextToken(parser->lex);
         }
-        break;
-    default:                            // print error message on all other tokens
-        fprintf(stderr, "PARSER: expected variable identifier or \'LOOP\' instead of ");
-        printToken(stderr, tok);
-        fputc('\n', stderr);
-        exit(EXIT_FAILURE);
     }
-    return stat;
 }
 
 /*
- * Read program as a sequence of semicolon separted statements
- * ARGS     stream - libc stream to read from
- * RETURN   pointer to the newly read and allocated statement structure
+ * Copy names and variables of all macros into the program, so profiles can
+ * name the hidden variables of macro bodies.
+ * ARGS     parser - state of the parser after reading the program
  */
-Program *readProgram(FILE *stream)
+static void keepMacroSymbols(Parser *parser)
 {
-    // input check
-    if (stream == NULL) {
-        fprintf(stderr, "ERROR: invalid stream to read from\n");
-        exit(EXIT_FAILURE);
+    Program *prog = parser->prog;
+    if (parser->macroCount == 0)
+        return;
+    MacroSymbol *symbols = programAlloc(prog, parser->macroCount * sizeof(MacroSymbol));
+    for (long i = 0; i < parser->macroCount; ++i) {
+        const Macro *macro = &parser->macros[i];
+        char *name = programAlloc(prog, macro->length + 1);
+        memcpy(name, macro->name, macro->length);
+        name[macro->length] = '\0';
+        long *ids = programAlloc(prog, (macro->locals > 0 ? macro->locals : 1) * sizeof(long));
+        memcpy(ids, macro->ids, macro->locals * sizeof(long));
+        symbols[i].name = name;
+        symbols[i].base = macro->base;
+        symbols[i].count = macro->locals;
+        symbols[i].ids = ids;
     }
-    
-    // allocate memory for the new statement
+    prog->macros = symbols;
+    prog->macroCount = parser->macroCount;
+}
+
+/*
+ * Parse the input of a lexer into a newly allocated program.
+ * ARGS     lex   - lexer to read from
+ *          vars  - variable table to intern all variable identifiers into
+ *          error - destination of a syntax error
+ * RETURN   pointer to the newly allocated program or NULL on syntax errors
+ */
+static Program *parseLexer(Lexer *lex, VariableTable *vars, SyntaxError *error)
+{
+    // allocate the arena, entry 0 stays unused to represent NODE_NONE
     Program *prog = malloc(sizeof(Program));
     if (prog == NULL) {
         fprintf(stderr, "ERROR: unable to to allocate memory\n");
         exit(EXIT_FAILURE);
     }
+    prog->capacity = 1024;
+    prog->count = 1;
+    prog->chunks = NULL;
+    prog->macros = NULL;
+    prog->macroCount = 0;
+    prog->image = NULL;
+    prog->nodes = malloc(prog->capacity * sizeof(Statement));
+    prog->lines = malloc(prog->capacity * sizeof(uint32_t));
+    if (prog->nodes == NULL || prog->lines == NULL) {
+        fprintf(stderr, "ERROR: unable to to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    Parser parser;
+    memset(&parser, 0, sizeof(Parser));
+    parser.lex = lex;
+    parser.vars = vars;
+    parser.prog = prog;
+    parser.error = error;
+    parser.zero = -1;
     
-    // read first program statement
-    prog->statement = readStatement(stream);
-    
-    // Check if semicolon signals a following statement, and read recursively
-    // it if possible
-    Token tok = nextToken(stream);
-    if (tok.type == TOK_SEM) {
-        prog->next = readProgram(stream);
-    } else {
-        pushToken(tok);
+    // read program and check for terminating end of file character (EOF)
+    prog->first = readProgram(&parser);
+    bool valid = false;
+    if (prog->first != NODE_NONE) {
+        Token tok = nextToken(lex);
+        valid = tok.type == TOK_EOF;
+        if (!valid)
+            syntaxError(error, "EOF", tok);
     }
-    return prog;
+    if (valid)
+        keepMacroSymbols(&parser);
+    for (long i = 0; i < parser.macroCount; ++i) {
+        free(parser.macros[i].name);
+        free(parser.macros[i].usage);
+        free(parser.macros[i].ids);
+    }
+    free(parser.macros);
+    free(parser.table);
+    free(parser.args);
+    freeVariableTable(parser.scope);
+    if (valid)
+        return prog;
+    freeProgram(prog);
+    return NULL;
 }
 
 /*
  * Parse input from stream with the help of the lexer into an AST of the
- * structure as shown above.
+ * structure as shown above. Variable identifiers are resolved to slots of the
+ * given variable table. Syntax errors terminate the process.
  * ARGS     stream - libc standard stream
- * RETURN   pointer to the first executable program statement/the AST.
+ *          vars   - variable table to intern all variable identifiers into
+ * RETURN   pointer to the newly allocated program
  */
-Program *parse(FILE *stream)
+Program *parse(FILE *stream, VariableTable *vars)
 {
     // input check
-    if (stream == NULL) {
-        fprintf(stderr, "ERROR: invalid stream to read from\n");
+    if (stream == NULL || vars == NULL) {
+        fprintf(stderr, "ERROR: invalid stream or variable table to read with\n");
         exit(EXIT_FAILURE);
     }
     
-    // read program and check for terminating end of file character (EOF)
-    Program *prog = readProgram(stream);
-    Token tok = nextToken(stream);
-    if (tok.type != TOK_EOF) {
-        fprintf(stderr, "PARSER: expected EOF instead of ");
-        printToken(stderr, tok);
+    SyntaxError error;
+    Lexer *lex = createLexer(stream);
+    Program *prog = parseLexer(lex, vars, &error);
+    freeLexer(lex);
+    if (prog == NULL) {
+        fprintf(stderr, "PARSER: ");
+        printSyntaxError(stderr, &error);
         fputc('\n', stderr);
         exit(EXIT_FAILURE);
     }
     return prog;
 }
+
+/*
+ * Parse a program held in memory like parse, but report syntax errors to the
+ * caller instead of terminating.
+ * ARGS     text   - program text, not necessarily null terminated
+ *          length - number of characters of the text
+ *          vars   - variable table to intern all variable identifiers into
+ *          error  - destination of a syntax error
+ * RETURN   pointer to the newly allocated program or NULL on syntax errors
+ */
+Program *parseText(const char *text, size_t length, VariableTable *vars, SyntaxError *error)
+{
+    // input check
+    if ((text == NULL && length > 0) || vars == NULL || error == NULL) {
+        fprintf(stderr, "ERROR: invalid text or variable table to read with\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    Lexer *lex = createTextLexer(text, length);
+    Program *prog = parseLexer(lex, vars, error);
+    freeLexer(lex);
+    return prog;
+}
+
+/*
+ * Print a syntax error as line:column: expected ... instead of ...
+ * ARGS     stream - output stream
+ *          error  - syntax error reported by parseText
+ */
+void printSyntaxError(FILE *stream, const SyntaxError *error)
+{
+    // input check
+    if (stream == NULL || error == NULL) {
+        fprintf(stderr, "ERROR: cannot print missing syntax error\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    fprintf(stream, "%ld:%ld: expected %s instead of ", error->found.line, error->found.column,
+            error->expected);
+    printToken(stream, error->found);
+}
+
+/*
+ * Allocate auxiliary memory released together with the program.
+ * ARGS     prog - program owning the memory
+ *          size - number of bytes
+ * RETURN   pointer to uninitialized memory aligned for any basic type
+ */
+void *programAlloc(Program *prog, size_t size)
+{
+    // input check
+    if (prog == NULL) {
+        fprintf(stderr, "ERROR: cannot allocate memory for missing program\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    // bump allocation from the current chunk, start a new one if exhausted
+    size = (size + 15) & ~(size_t)15;
+    ArenaChunk *chunk = prog->chunks;
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        size_t capacity = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        chunk = malloc(sizeof(ArenaChunk) + capacity);
+        if (chunk == NULL) {
+            fprintf(stderr, "ERROR: unable to to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        chunk->next = prog->chunks;
+        chunk->used = 0;
+        chunk->size = capacity;
+        prog->chunks = chunk;
+    }
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+/*
+ * Free the program including all of its statements and auxiliary memory.
+ * ARGS     prog - program to be freed (may be NULL)
+ */
+void freeProgram(Program *prog)
+{
+    if (prog == NULL)
+        return;
+    while (prog->chunks != NULL) {
+        ArenaChunk *next = prog->chunks->next;
+        free(prog->chunks);
+        prog->chunks = next;
+    }
+    if (prog->image != NULL) {
+        freeImage(prog);
+    } else {
+        free(prog->nodes);
+        free(prog->lines);
+    }
+    free(prog);
+}
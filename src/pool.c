@@ -0,0 +1,436 @@
+/*
+ * pool.c
+ *
+ * Fixed pool of worker threads with work-stealing and streams of tasks, see
+ * pool.h.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pool.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define POOL_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+#ifdef POOL_THREADS
+
+/*
+ * Range of task indices owned by one worker. The owner takes tasks from the
+ * front, thieves take the back half.
+ */
+typedef struct {
+    pthread_mutex_t lock;   // protects begin and end
+    long begin;             // next task of the owner
+    long end;               // one past the last task
+    char pad[64];           // keep deques of different workers apart
+} Deque;
+
+#endif
+
+/*
+ * Stream of tasks run by the pool, see streamPool.
+ */
+typedef struct {
+    PoolFeed feed;              // preparation of the next task
+    PoolTask task;              // task run by the workers
+    PoolEmit emit;              // completion in index order
+    void *context;              // context of all three
+    long window;                // most tasks between feed and emit
+    bool *done;                 // finished flag of every slot
+    long next;                  // index of the next task to be fed
+    long emitted;               // index of the next task to be emitted
+    bool end;                   // feed reported the end of the stream
+#ifdef POOL_THREADS
+    pthread_mutex_t lock;       // protects all fields above but the functions
+    pthread_cond_t progress;    // signaled when tasks were emitted
+#endif
+} Stream;
+
+/*
+ * Worker threads and their deques.
+ */
+struct sThreadPool {
+    long workers;               // number of workers including the caller
+    PoolTask task;              // task of the current round
+    void *context;              // context of the current round
+    Stream *stream;             // stream of the current round or NULL
+#ifdef POOL_THREADS
+    pthread_t *threads;         // threads of workers 1 ... workers - 1
+    Deque *deques;              // deque of every worker
+    pthread_mutex_t lock;       // protects the fields below
+    pthread_cond_t start;       // signaled when a round starts
+    pthread_cond_t done;        // signaled when the last worker finished
+    long round;                 // number of started rounds
+    long active;                // workers still busy in the current round
+    bool stop;                  // set to terminate the workers
+#endif
+};
+
+#ifdef POOL_THREADS
+
+/*
+ * Start parameters of a worker thread.
+ */
+typedef struct {
+    ThreadPool *pool;
+    long id;
+} WorkerArgs;
+
+#endif
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+#ifdef POOL_THREADS
+
+/*
+ * Take the next task from the front of a deque.
+ * ARGS     deque - deque of the calling worker
+ * RETURN   task index or -1 if the deque is empty
+ */
+static long popTask(Deque *deque)
+{
+    pthread_mutex_lock(&deque->lock);
+    long index = deque->begin < deque->end ? deque->begin++ : -1;
+    pthread_mutex_unlock(&deque->lock);
+    return index;
+}
+
+/*
+ * Move the back half of another worker's tasks into the own deque.
+ * ARGS     pool - pool of the worker
+ *          id   - index of the stealing worker
+ * RETURN   false if all other deques are empty
+ */
+static bool stealTasks(ThreadPool *pool, long id)
+{
+    for (long i = 1; i < pool->workers; ++i) {
+        Deque *victim = &pool->deques[(id + i) % pool->workers];
+        pthread_mutex_lock(&victim->lock);
+        long available = victim->end - victim->begin;
+        long end = victim->end;
+        if (available > 0)
+            victim->end -= (available + 1) / 2;
+        long begin = victim->end;
+        pthread_mutex_unlock(&victim->lock);
+        
+        if (available > 0) {
+            Deque *own = &pool->deques[id];
+            pthread_mutex_lock(&own->lock);
+            own->begin = begin;
+            own->end = end;
+            pthread_mutex_unlock(&own->lock);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Run tasks until no worker has any left.
+ * ARGS     pool - pool of the worker
+ *          id   - index of the worker
+ */
+static void workRound(ThreadPool *pool, long id)
+{
+    for (;;) {
+        long index = popTask(&pool->deques[id]);
+        if (index >= 0)
+            pool->task(pool->context, id, index);
+        else if (!stealTasks(pool, id))
+            return;
+    }
+}
+
+/*
+ * Feed, run and emit tasks of a stream until it has ended.
+ * ARGS     stream - stream of the current round
+ *          id     - index of the worker
+ */
+static void workStream(Stream *stream, long id)
+{
+    pthread_mutex_lock(&stream->lock);
+    for (;;) {
+        while (!stream->end && stream->next - stream->emitted >= stream->window)
+            pthread_cond_wait(&stream->progress, &stream->lock);
+        if (stream->end)
+            break;
+        long index = stream->next;
+        if (!stream->feed(stream->context, index)) {
+            stream->end = true;
+            pthread_cond_broadcast(&stream->progress);
+            break;
+        }
+        ++stream->next;
+        pthread_mutex_unlock(&stream->lock);
+        
+        stream->task(stream->context, id, index);
+        
+        // whoever finishes the oldest task emits all finished ones behind it
+        pthread_mutex_lock(&stream->lock);
+        stream->done[index % stream->window] = true;
+        bool emitted = false;
+        while (stream->emitted < stream->next && stream->done[stream->emitted % stream->window]) {
+            stream->done[stream->emitted % stream->window] = false;
+            stream->emit(stream->context, stream->emitted++);
+            emitted = true;
+        }
+        if (emitted)
+            pthread_cond_broadcast(&stream->progress);
+    }
+    pthread_mutex_unlock(&stream->lock);
+}
+
+/*
+ * Main function of the worker threads.
+ * ARGS     arg - pointer to WorkerArgs (freed by the worker)
+ */
+static void *workerMain(void *arg)
+{
+    WorkerArgs args = *(WorkerArgs *)arg;
+    free(arg);
+    ThreadPool *pool = args.pool;
+    
+    long seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->round == seen && !pool->stop)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->round;
+        pthread_mutex_unlock(&pool->lock);
+        
+        if (pool->stream != NULL)
+            workStream(pool->stream, args.id);
+        else
+            workRound(pool, args.id);
+        
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0)
+            pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/*
+ * Start a round on all workers, take part as worker 0 and wait until every
+ * worker has finished.
+ * ARGS     pool - pool with the task or stream of the round set
+ */
+static void runRound(ThreadPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->active = pool->workers - 1;
+    ++pool->round;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    
+    if (pool->stream != NULL)
+        workStream(pool->stream, 0);
+    else
+        workRound(pool, 0);
+    
+    pthread_mutex_lock(&pool->lock);
+    while (pool->active > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+#endif /* POOL_THREADS */
+
+/*
+ * Start a pool of worker threads, the calling thread acts as worker 0.
+ * ARGS     workers - number of workers, 0 for one per online processor
+ * RETURN   pointer to the newly started pool
+ */
+ThreadPool *createPool(long workers)
+{
+    // input check
+    if (workers < 0) {
+        fprintf(stderr, "ERROR: invalid number of workers %ld\n", workers);
+        exit(EXIT_FAILURE);
+    }
+    
+    ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+    if (pool == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+#ifndef POOL_THREADS
+    pool->workers = 1;
+#else
+    if (workers == 0)
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+    pool->workers = workers > 0 ? workers : 1;
+    pool->threads = malloc(pool->workers * sizeof(pthread_t));
+    pool->deques = calloc(pool->workers, sizeof(Deque));
+    if (pool->threads == NULL || pool->deques == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (long i = 0; i < pool->workers; ++i)
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+    for (long i = 1; i < pool->workers; ++i) {
+        WorkerArgs *args = malloc(sizeof(WorkerArgs));
+        if (args == NULL) {
+            fprintf(stderr, "ERROR: unable to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        args->pool = pool;
+        args->id = i;
+        if (pthread_create(&pool->threads[i], NULL, workerMain, args) != 0) {
+            fprintf(stderr, "ERROR: unable to start worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+#endif
+    return pool;
+}
+
+/*
+ * Stop all worker threads and free the pool.
+ * ARGS     pool - pool to be stopped (may be NULL)
+ */
+void freePool(ThreadPool *pool)
+{
+    if (pool == NULL)
+        return;
+#ifdef POOL_THREADS
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (long i = 1; i < pool->workers; ++i)
+        pthread_join(pool->threads[i], NULL);
+    for (long i = 0; i < pool->workers; ++i)
+        pthread_mutex_destroy(&pool->deques[i].lock);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool->deques);
+#endif
+    free(pool);
+}
+
+/*
+ * Get the number of workers of the pool.
+ * ARGS     pool - pool to be queried
+ * RETURN   number of workers including the calling thread
+ */
+long poolWorkers(const ThreadPool *pool)
+{
+    return pool != NULL ? pool->workers : 1;
+}
+
+/*
+ * Run the tasks 0 ... count - 1 and wait until all of them are finished.
+ * ARGS     pool    - pool running the tasks
+ *          count   - number of tasks
+ *          task    - function called once for every task index
+ *          context - pointer passed on to task
+ */
+void runPool(ThreadPool *pool, long count, PoolTask task, void *context)
+{
+    // input check
+    if (pool == NULL || task == NULL) {
+        fprintf(stderr, "ERROR: cannot run tasks without pool or task\n");
+        exit(EXIT_FAILURE);
+    }
+
+#ifdef POOL_THREADS
+    if (pool->workers > 1) {
+        // hand out equal shares up front, stealing balances the rest
+        for (long i = 0; i < pool->workers; ++i) {
+            pool->deques[i].begin = count * i / pool->workers;
+            pool->deques[i].end = count * (i + 1) / pool->workers;
+        }
+        pool->task = task;
+        pool->context = context;
+        runRound(pool);
+        return;
+    }
+#endif
+    for (long i = 0; i < count; ++i)
+        task(context, 0, i);
+}
+
+/*
+ * Run a stream of tasks until feed reports its end and wait until all of
+ * them are emitted. Idle workers feed the next task as long as fewer than
+ * window tasks are fed but not yet emitted, so the slot index % window of a
+ * task is free again once it has been emitted. Feeding and emitting are
+ * serialized, tasks run concurrently.
+ * ARGS     pool    - pool running the tasks
+ *          window  - most tasks between feed and emit
+ *          feed    - function preparing the next task
+ *          task    - function called once for every task index
+ *          emit    - function handing on finished tasks
+ *          context - pointer passed on to the functions
+ */
+void streamPool(ThreadPool *pool, long window, PoolFeed feed, PoolTask task, PoolEmit emit,
+        void *context)
+{
+    // input check
+    if (pool == NULL || window < 1 || feed == NULL || task == NULL || emit == NULL) {
+        fprintf(stderr, "ERROR: cannot run stream without pool, window or functions\n");
+        exit(EXIT_FAILURE);
+    }
+
+#ifdef POOL_THREADS
+    if (pool->workers > 1) {
+        Stream stream;
+        stream.feed = feed;
+        stream.task = task;
+        stream.emit = emit;
+        stream.context = context;
+        stream.window = window;
+        stream.next = 0;
+        stream.emitted = 0;
+        stream.end = false;
+        stream.done = calloc(window, sizeof(bool));
+        if (stream.done == NULL) {
+            fprintf(stderr, "ERROR: unable to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_mutex_init(&stream.lock, NULL);
+        pthread_cond_init(&stream.progress, NULL);
+        pool->stream = &stream;
+        runRound(pool);
+        pool->stream = NULL;
+        pthread_mutex_destroy(&stream.lock);
+        pthread_cond_destroy(&stream.progress);
+        free(stream.done);
+        return;
+    }
+#endif
+    for (long i = 0; feed(context, i); ++i) {
+        task(context, 0, i);
+        emit(context, i);
+    }
+}
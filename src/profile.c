@@ -0,0 +1,360 @@
+/*
+ * profile.c
+ *
+ * Execution profile of a LOOP program, see profile.h.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "profile.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MONOTONIC_SUPPORTED
+#endif
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Statement ranked by some measure for the hot spot report.
+ */
+typedef struct {
+    NodeIndex index;
+    uint64_t key;
+} Ranked;
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Allocate a zeroed profile for a program.
+ * ARGS     prog  - program to be profiled
+ *          timed - also measure the time of every LOOP
+ * RETURN   pointer to the newly allocated profile
+ */
+Profile *createProfile(const Program *prog, bool timed)
+{
+    // input check
+    if (prog == NULL) {
+        fprintf(stderr, "ERROR: cannot profile missing program\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    Profile *profile = malloc(sizeof(Profile));
+    if (profile == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    profile->count = prog->count;
+    profile->counts = calloc(prog->count, sizeof(uint64_t));
+    profile->nanos = timed ? calloc(prog->count, sizeof(uint64_t)) : NULL;
+    profile->total = 0;
+    if (profile->counts == NULL || (timed && profile->nanos == NULL)) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return profile;
+}
+
+/*
+ * Free a profile.
+ * ARGS     profile - profile to be freed (may be NULL)
+ */
+void freeProfile(Profile *profile)
+{
+    if (profile == NULL)
+        return;
+    free(profile->counts);
+    free(profile->nanos);
+    free(profile);
+}
+
+/*
+ * Read the monotonic clock used for timing LOOPs.
+ * RETURN   nanoseconds since an arbitrary point in time
+ */
+uint64_t profileClock(void)
+{
+#ifdef MONOTONIC_SUPPORTED
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#else
+    return (uint64_t)clock() * (1000000000u / CLOCKS_PER_SEC);
+#endif
+}
+
+/*
+ * Get the time spent in a sequence itself, excluding the LOOPs and macro
+ * calls of the sequence.
+ * ARGS     prog    - profiled program
+ *          profile - timed profile of the program
+ *          first   - first statement of the sequence
+ *          time    - nanoseconds spent in the sequence
+ * RETURN   nanoseconds
+ */
+static uint64_t ownSequenceTime(const Program *prog, const Profile *profile, NodeIndex first,
+        uint64_t time)
+{
+    for (NodeIndex i = first; i != NODE_NONE; i = programNode(prog, i)->next) {
+        if (programNode(prog, i)->type != STAT_ASSIGNMENT)
+            time = time > profile->nanos[i] ? time - profile->nanos[i] : 0;
+    }
+    return time;
+}
+
+/*
+ * Get the time spent in a LOOP itself, excluding the LOOPs and macro calls of
+ * its body.
+ * ARGS     prog    - profiled program
+ *          profile - timed profile of the program
+ *          index   - index of the LOOP or NODE_NONE for the whole program
+ * RETURN   nanoseconds
+ */
+static uint64_t ownTime(const Program *prog, const Profile *profile, NodeIndex index)
+{
+    if (index == NODE_NONE)
+        return ownSequenceTime(prog, profile, prog->first, profile->total);
+    return ownSequenceTime(prog, profile, programNode(prog, index)->as.loop.body, profile->nanos[index]);
+}
+
+/*
+ * Print a variable as written in the source, variables of macro bodies as
+ * <macro>.xN.
+ * ARGS     stream - output stream
+ *          prog   - program holding the variable
+ *          vars   - variable table the program was parsed with
+ *          slot   - slot of the variable
+ */
+static void printVariable(FILE *stream, const Program *prog, const VariableTable *vars, VarID slot)
+{
+    for (long i = 0; vars->ids[slot] < 0 && i < prog->macroCount; ++i) {
+        const MacroSymbol *macro = &prog->macros[i];
+        if (slot >= macro->base && slot - macro->base < (VarID)macro->count) {
+            fprintf(stream, "%s.x%ld", macro->name, macro->ids[slot - macro->base]);
+            return;
+        }
+    }
+    fprintf(stream, "x%ld", vars->ids[slot]);
+}
+
+/*
+ * Print a statement as written in the source, without the body of LOOPs.
+ * ARGS     stream - output stream
+ *          prog   - program holding the statement
+ *          vars   - variable table the program was parsed with
+ *          index  - index of the statement
+ */
+static void printStatement(FILE *stream, const Program *prog, const VariableTable *vars,
+        NodeIndex index)
+{
+    const Statement *stat = programNode(prog, index);
+    if (stat->type == STAT_LOOP) {
+        fprintf(stream, "LOOP ");
+        printVariable(stream, prog, vars, stat->as.loop.var);
+        fprintf(stream, " DO");
+    } else if (stat->type == STAT_CALL) {
+        fprintf(stream, "call of macro at line %lu", (unsigned long)prog->lines[stat->as.call.body]);
+    } else {
+        const Assignment *ass = &stat->as.assignment;
+        printVariable(stream, prog, vars, ass->lvalue);
+        fprintf(stream, " := ");
+        printVariable(stream, prog, vars, ass->rvalue);
+        fprintf(stream, " %c ", ass->isAddition ? '+' : '-');
+        valuePrint(stream, ass->nat);
+    }
+}
+
+/*
+ * Order ranked statements by descending key, ties in program order.
+ * ARGS     a - first ranked statement
+ *          b - second ranked statement
+ * RETURN   negative, zero or positive like strcmp
+ */
+static int compareRanked(const void *a, const void *b)
+{
+    const Ranked *x = a, *y = b;
+    if (x->key != y->key)
+        return x->key > y->key ? -1 : 1;
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/*
+ * Print the LOOPs taking the most time themselves, not counting nested
+ * LOOPs, and the most executed statements together with their source lines.
+ * ARGS     stream  - output stream
+ *          prog    - profiled program
+ *          vars    - variable table the program was parsed with
+ *          profile - profile of the program
+ *          limit   - number of entries per list
+ */
+void printHotspots(FILE *stream, const Program *prog, const VariableTable *vars,
+        const Profile *profile, long limit)
+{
+    // input check
+    if (stream == NULL || prog == NULL || vars == NULL || profile == NULL
+            || profile->count != prog->count) {
+        fprintf(stderr, "ERROR: cannot report missing or mismatching profile\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    Ranked *ranked = malloc(prog->count * sizeof(Ranked));
+    if (ranked == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t executed = 0;
+    for (NodeIndex i = 1; i < prog->count; ++i)
+        executed += profile->counts[i];
+    fprintf(stream, "PROFILE: %llu statements executed", (unsigned long long)executed);
+    if (profile->nanos != NULL)
+        fprintf(stream, " in %.6f s", profile->total * 1e-9);
+    fputc('\n', stream);
+    
+    // LOOPs by own time, the remainder is spent at the top level
+    if (profile->nanos != NULL) {
+        long n = 0;
+        for (NodeIndex i = 1; i < prog->count; ++i) {
+            if (programNode(prog, i)->type == STAT_LOOP && profile->counts[i] > 0) {
+                ranked[n].index = i;
+                ranked[n++].key = ownTime(prog, profile, i);
+            }
+        }
+        qsort(ranked, n, sizeof(Ranked), compareRanked);
+        double total = profile->total > 0 ? (double)profile->total : 1;
+        fprintf(stream, "\nLOOPs by own time:\n%10s %7s %10s %14s %8s  %s\n",
+                "own s", "own %", "total s", "count", "line", "statement");
+        for (long r = 0; r < n && r < limit; ++r) {
+            NodeIndex i = ranked[r].index;
+            fprintf(stream, "%10.6f %6.2f%% %10.6f %14llu %8lu  ", ranked[r].key * 1e-9,
+                    100.0 * ranked[r].key / total, profile->nanos[i] * 1e-9,
+                    (unsigned long long)profile->counts[i], (unsigned long)prog->lines[i]);
+            printStatement(stream, prog, vars, i);
+            fputc('\n', stream);
+        }
+        uint64_t top = ownTime(prog, profile, NODE_NONE);
+        fprintf(stream, "%10.6f %6.2f%% %10.6f %14s %8s  (top level)\n", top * 1e-9,
+                100.0 * top / total, profile->total * 1e-9, "1", "-");
+    }
+    
+    // statements by executions
+    long n = 0;
+    for (NodeIndex i = 1; i < prog->count; ++i) {
+        if (profile->counts[i] > 0) {
+            ranked[n].index = i;
+            ranked[n++].key = profile->counts[i];
+        }
+    }
+    qsort(ranked, n, sizeof(Ranked), compareRanked);
+    fprintf(stream, "\nstatements by executions:\n%14s %7s %8s  %s\n", "count", "count %", "line",
+            "statement");
+    for (long r = 0; r < n && r < limit; ++r) {
+        NodeIndex i = ranked[r].index;
+        fprintf(stream, "%14llu %6.2f%% %8lu  ", (unsigned long long)ranked[r].key,
+                100.0 * ranked[r].key / (executed > 0 ? executed : 1), (unsigned long)prog->lines[i]);
+        printStatement(stream, prog, vars, i);
+        fputc('\n', stream);
+    }
+    free(ranked);
+}
+
+/*
+ * Print the time spent in every LOOP itself as folded stacks, one line of
+ * semicolon separated enclosing LOOPs followed by nanoseconds per LOOP, as
+ * read by flamegraph.pl and compatible tools. A macro body is shared by all
+ * its calls, so it is a frame of its own right below the program holding
+ * the time of all calls.
+ * ARGS     stream  - output stream
+ *          prog    - profiled program
+ *          vars    - variable table the program was parsed with
+ *          profile - timed profile of the program
+ */
+void printFolded(FILE *stream, const Program *prog, const VariableTable *vars,
+        const Profile *profile)
+{
+    // input check
+    if (stream == NULL || prog == NULL || vars == NULL || profile == NULL
+            || profile->count != prog->count || profile->nanos == NULL) {
+        fprintf(stderr, "ERROR: cannot report missing, mismatching or untimed profile\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    // time of every macro body summed up over its calls
+    NodeIndex *ends = NULL;
+    uint64_t *bodies = NULL;
+    for (NodeIndex i = 1; i < prog->count; ++i) {
+        const Statement *stat = programNode(prog, i);
+        if (stat->type != STAT_CALL)
+            continue;
+        if (ends == NULL) {
+            ends = calloc(prog->count, sizeof(NodeIndex));
+            bodies = calloc(prog->count, sizeof(uint64_t));
+            if (ends == NULL || bodies == NULL) {
+                fprintf(stderr, "ERROR: unable to allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        ends[stat->as.call.body] = stat->as.call.end;
+        bodies[stat->as.call.body] += profile->nanos[i];
+    }
+    
+    // the enclosing LOOPs of a statement are the LOOPs before it in the arena
+    // whose range still covers it, below the macro body covering it if any
+    NodeIndex *open = NULL;
+    size_t depth = 0, capacity = 0;
+    NodeIndex macro = NODE_NONE;
+    fprintf(stream, "program %llu\n", (unsigned long long)ownTime(prog, profile, NODE_NONE));
+    for (NodeIndex i = 1; i < prog->count; ++i) {
+        const Statement *stat = programNode(prog, i);
+        while (depth > 0 && programNode(prog, open[depth - 1])->as.loop.end <= i)
+            --depth;
+        if (macro != NODE_NONE && ends[macro] <= i)
+            macro = NODE_NONE;
+        if (depth == 0 && ends != NULL && ends[i] != 0) {
+            macro = i;
+            uint64_t own = ownSequenceTime(prog, profile, i, bodies[i]);
+            if (own > 0)
+                fprintf(stream, "program;macro (line %lu) %llu\n", (unsigned long)prog->lines[i],
+                        (unsigned long long)own);
+        }
+        if (stat->type != STAT_LOOP)
+            continue;
+        if (depth == capacity) {
+            capacity = capacity > 0 ? 2 * capacity : 64;
+            open = realloc(open, capacity * sizeof(NodeIndex));
+            if (open == NULL) {
+                fprintf(stderr, "ERROR: unable to allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        open[depth++] = i;
+        
+        uint64_t own = ownTime(prog, profile, i);
+        if (own == 0)
+            continue;
+        fprintf(stream, "program");
+        if (macro != NODE_NONE)
+            fprintf(stream, ";macro (line %lu)", (unsigned long)prog->lines[macro]);
+        for (size_t d = 0; d < depth; ++d) {
+            fprintf(stream, ";LOOP ");
+            printVariable(stream, prog, vars, programNode(prog, open[d])->as.loop.var);
+            fprintf(stream, " DO (line %lu)", (unsigned long)prog->lines[open[d]]);
+        }
+        fprintf(stream, " %llu\n", (unsigned long long)own);
+    }
+    free(open);
+    free(ends);
+    free(bodies);
+}
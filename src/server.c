@@ -0,0 +1,539 @@
+/*
+ * server.c
+ *
+ * Long-lived server executing LOOP programs, see server.h.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "affine.h"
+#include "fuse.h"
+#include "hash.h"
+#include "optimise.h"
+#include "server.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SERVER_SUPPORTED
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define SERVER_MAX_TEXT (1 << 26)   // longest program text accepted in bytes
+#define SERVER_BACKLOG 64           // pending connections of the socket
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+#ifdef SERVER_SUPPORTED
+
+/*
+ * Program kept in the cache. Entries are reference counted, the cache holds
+ * one reference and every request running the program another one, so
+ * evicted programs stay alive until their last run finished.
+ */
+typedef struct sCacheEntry {
+    uint64_t hash;                  // hash of the program text
+    char *text;                     // program text to rule out collisions
+    size_t length;                  // length of the program text
+    VariableTable *vars;            // variable table of the program
+    Program *prog;                  // parsed program
+    Executable exe;                 // program prepared for the engine
+    long refs;                      // number of references
+    struct sCacheEntry *prev;       // more recently used entry
+    struct sCacheEntry *next;       // less recently used entry
+    struct sCacheEntry *chain;      // next entry of the same bucket
+} CacheEntry;
+
+/*
+ * Programs indexed by hash and ordered by their last use.
+ */
+typedef struct {
+    pthread_mutex_t lock;           // guards all fields but engine and passes
+    Engine engine;                  // engine executing all programs
+    unsigned passes;                // optimiser passes run on all programs
+    CacheEntry **buckets;           // hash table, chained by chain
+    size_t mask;                    // number of buckets minus one
+    CacheEntry *first;              // most recently used entry
+    CacheEntry *last;               // least recently used entry
+    long count;                     // number of cached entries
+    long capacity;                  // maximum number of cached entries
+} ProgramCache;
+
+/*
+ * Connection of a client.
+ */
+typedef struct {
+    ProgramCache *cache;
+    int fd;
+} Client;
+
+#endif
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+#ifdef SERVER_SUPPORTED
+
+/*
+ * Release a reference to a cache entry, freeing it with the last one.
+ * ARGS     cache - cache the entry belongs to
+ *          entry - entry to be released
+ */
+static void releaseEntry(ProgramCache *cache, CacheEntry *entry)
+{
+    pthread_mutex_lock(&cache->lock);
+    bool last = --entry->refs == 0;
+    pthread_mutex_unlock(&cache->lock);
+    if (!last)
+        return;
+    releaseExecutable(&entry->exe);
+    freeProgram(entry->prog);
+    freeVariableTable(entry->vars);
+    free(entry->text);
+    free(entry);
+}
+
+/*
+ * Unlink an entry from the recently used list.
+ * ARGS     cache - cache holding the entry, locked
+ *          entry - entry to be unlinked
+ */
+static void unlinkEntry(ProgramCache *cache, CacheEntry *entry)
+{
+    if (entry->prev != NULL)
+        entry->prev->next = entry->next;
+    else
+        cache->first = entry->next;
+    if (entry->next != NULL)
+        entry->next->prev = entry->prev;
+    else
+        cache->last = entry->prev;
+}
+
+/*
+ * Look up a program, mark it as most recently used and acquire a reference.
+ * ARGS     cache - cache to search
+ *          hash  - hash of the program text
+ * RETURN   cache entry or NULL if the program is not cached
+ */
+static CacheEntry *acquireEntry(ProgramCache *cache, uint64_t hash)
+{
+    pthread_mutex_lock(&cache->lock);
+    CacheEntry *entry = cache->buckets[hash & cache->mask];
+    while (entry != NULL && entry->hash != hash)
+        entry = entry->chain;
+    if (entry != NULL) {
+        unlinkEntry(cache, entry);
+        entry->prev = NULL;
+        entry->next = cache->first;
+        if (cache->first != NULL)
+            cache->first->prev = entry;
+        else
+            cache->last = entry;
+        cache->first = entry;
+        ++entry->refs;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+}
+
+/*
+ * Evict the least recently used programs until the cache has room for one
+ * more entry.
+ * ARGS     cache - cache to shrink, locked
+ * RETURN   list of evicted entries linked by chain, their cache references
+ *          still have to be released
+ */
+static CacheEntry *evictEntries(ProgramCache *cache)
+{
+    CacheEntry *evicted = NULL;
+    while (cache->count >= cache->capacity && cache->last != NULL) {
+        CacheEntry *entry = cache->last;
+        unlinkEntry(cache, entry);
+        CacheEntry **link = &cache->buckets[entry->hash & cache->mask];
+        while (*link != entry)
+            link = &(*link)->chain;
+        *link = entry->chain;
+        entry->chain = evicted;
+        evicted = entry;
+        --cache->count;
+    }
+    return evicted;
+}
+
+/*
+ * Get a program from the cache, parsing and compiling it on a miss. Parsing
+ * and compiling happen outside the lock, so clients loading different
+ * programs do not wait for each other.
+ * ARGS     cache  - program cache
+ *          text   - program text
+ *          length - length of the program text
+ *          out    - stream receiving the reply on errors
+ * RETURN   acquired cache entry or NULL if an error was replied
+ */
+static CacheEntry *loadEntry(ProgramCache *cache, const char *text, size_t length, FILE *out)
+{
+    uint64_t hash = hashBytes(HASH_SEED, text, length);
+    CacheEntry *entry = acquireEntry(cache, hash);
+    if (entry == NULL) {
+        SyntaxError error;
+        VariableTable *vars = createVariableTable();
+        internVariable(vars, 0);
+        Program *prog = parseText(text, length, vars, &error);
+        if (prog == NULL) {
+            fprintf(out, "ERROR ");
+            printSyntaxError(out, &error);
+            fputc('\n', out);
+            freeVariableTable(vars);
+            return NULL;
+        }
+        optimiseProgram(prog, vars, cache->passes, NULL);
+        analyseFusedLoops(prog, NULL);
+        analyseAffineLoops(prog);
+        
+        entry = malloc(sizeof(CacheEntry));
+        char *copy = malloc(length > 0 ? length : 1);
+        if (entry == NULL || copy == NULL) {
+            fprintf(stderr, "ERROR: unable to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(copy, text, length);
+        entry->hash = hash;
+        entry->text = copy;
+        entry->length = length;
+        entry->vars = vars;
+        entry->prog = prog;
+        // compiled code of optimised programs is cached apart from the original
+        uint64_t code = cache->passes != PASSES_NONE ? hashBytes(hash, &cache->passes, sizeof(cache->passes))
+                : hash;
+        prepareExecutable(&entry->exe, cache->engine, prog, vars, code);
+        entry->refs = 2;
+        
+        // another client may have loaded the same program in the meantime
+        pthread_mutex_lock(&cache->lock);
+        CacheEntry *evicted = NULL;
+        CacheEntry *other = cache->buckets[hash & cache->mask];
+        while (other != NULL && other->hash != hash)
+            other = other->chain;
+        if (other == NULL) {
+            evicted = evictEntries(cache);
+            entry->prev = NULL;
+            entry->next = cache->first;
+            if (cache->first != NULL)
+                cache->first->prev = entry;
+            else
+                cache->last = entry;
+            cache->first = entry;
+            entry->chain = cache->buckets[hash & cache->mask];
+            cache->buckets[hash & cache->mask] = entry;
+            ++cache->count;
+        } else {
+            entry->refs = 1;
+        }
+        pthread_mutex_unlock(&cache->lock);
+        
+        while (evicted != NULL) {
+            CacheEntry *next = evicted->chain;
+            releaseEntry(cache, evicted);
+            evicted = next;
+        }
+        if (other != NULL) {
+            releaseEntry(cache, entry);
+            entry = acquireEntry(cache, hash);
+            if (entry == NULL) {
+                fprintf(out, "ERROR program evicted while loading\n");
+                return NULL;
+            }
+        }
+    }
+    
+    if (entry->length != length || memcmp(entry->text, text, length) != 0) {
+        releaseEntry(cache, entry);
+        fprintf(out, "ERROR hash collision with a cached program\n");
+        return NULL;
+    }
+    return entry;
+}
+
+/*
+ * Run a cached program with the inputs of a request and reply its result.
+ * ARGS     entry  - acquired cache entry
+ *          inputs - null terminated list of decimal inputs x1, x2, ...
+ *          out    - stream receiving the reply
+ */
+static void runEntry(CacheEntry *entry, char **inputs, FILE *out)
+{
+    long count = 0;
+    while (inputs[count] != NULL)
+        ++count;
+    Value *values = malloc((count > 0 ? count : 1) * sizeof(Value));
+    if (values == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (long i = 0; i < count; ++i) {
+        if (!valueParse(inputs[i], &values[i])) {
+            fprintf(out, "ERROR invalid natural number %s given for x%ld\n", inputs[i], i + 1);
+            while (i-- > 0)
+                valueRelease(values[i]);
+            free(values);
+            return;
+        }
+    }
+    
+    Value *regs = createRegisters(entry->vars);
+    storeInputs(entry->vars, regs, values, count);
+    free(values);
+    runExecutable(&entry->exe, regs);
+    fprintf(out, "OK ");
+    valuePrint(out, regs[0]);
+    fputc('\n', out);
+    clearRegisters(entry->vars, regs);
+    free(regs);
+}
+
+/*
+ * Read the length of a program text announced by a request.
+ * ARGS     word   - decimal length
+ *          length - destination of the length
+ * RETURN   false if the length is invalid or too large
+ */
+static bool readLength(const char *word, size_t *length)
+{
+    char *end;
+    errno = 0;
+    unsigned long n = word != NULL ? strtoul(word, &end, 10) : 0;
+    if (word == NULL || errno != 0 || *end != '\0' || end == word || *word == '-'
+            || n > SERVER_MAX_TEXT)
+        return false;
+    *length = (size_t)n;
+    return true;
+}
+
+/*
+ * Answer a single request.
+ * ARGS     cache - program cache
+ *          line  - request line without the program text, modified
+ *          in    - stream to read a program text from
+ *          out   - stream receiving the reply
+ * RETURN   false if the connection has to be closed
+ */
+static bool handleRequest(ProgramCache *cache, char *line, FILE *in, FILE *out)
+{
+    // split the request into words
+    size_t capacity = 8, count = 0;
+    char **words = malloc(capacity * sizeof(char *));
+    if (words == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    char *save;
+    for (char *word = strtok_r(line, " \t\r\n", &save); word != NULL;
+            word = strtok_r(NULL, " \t\r\n", &save)) {
+        if (count + 1 == capacity) {
+            capacity *= 2;
+            words = realloc(words, capacity * sizeof(char *));
+            if (words == NULL) {
+                fprintf(stderr, "ERROR: unable to allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        words[count++] = word;
+    }
+    words[count] = NULL;
+    
+    bool open = true;
+    size_t length;
+    if (count == 0) {
+        fprintf(out, "ERROR empty request\n");
+    } else if (strcmp(words[0], "RUN") == 0) {
+        char *end;
+        errno = 0;
+        uint64_t hash = count > 1 ? strtoull(words[1], &end, 16) : 0;
+        CacheEntry *entry = NULL;
+        if (count < 2 || errno != 0 || *end != '\0' || end == words[1])
+            fprintf(out, "ERROR invalid program hash\n");
+        else if ((entry = acquireEntry(cache, hash)) == NULL)
+            fprintf(out, "ERROR unknown program\n");
+        if (entry != NULL) {
+            runEntry(entry, words + 2, out);
+            releaseEntry(cache, entry);
+        }
+    } else if (strcmp(words[0], "LOAD") != 0 && strcmp(words[0], "EVAL") != 0) {
+        fprintf(out, "ERROR unknown request %s\n", words[0]);
+    } else if (!readLength(words[1], &length) || (words[0][0] == 'L' && count > 2)) {
+        // the text cannot be skipped without its length
+        fprintf(out, "ERROR invalid program length\n");
+        open = false;
+    } else {
+        char *text = malloc(length > 0 ? length : 1);
+        if (text == NULL) {
+            fprintf(stderr, "ERROR: unable to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        if (fread(text, 1, length, in) != length) {
+            open = false;
+        } else {
+            CacheEntry *entry = loadEntry(cache, text, length, out);
+            if (entry != NULL && words[0][0] == 'L')
+                fprintf(out, "OK %016llx\n", (unsigned long long)entry->hash);
+            else if (entry != NULL)
+                runEntry(entry, words + 2, out);
+            if (entry != NULL)
+                releaseEntry(cache, entry);
+        }
+        free(text);
+    }
+    free(words);
+    return open;
+}
+
+/*
+ * Serve the requests of a client until it closes the connection, thread
+ * function of every client.
+ * ARGS     context - client connection, freed when done
+ * RETURN   NULL
+ */
+static void *serveClient(void *context)
+{
+    Client *client = context;
+    int fd = dup(client->fd);
+    FILE *in = fdopen(client->fd, "r");
+    FILE *out = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (in == NULL || out == NULL) {
+        perror("WARNING: failed to open client connection");
+        if (in != NULL)
+            fclose(in);
+        else
+            close(client->fd);
+        if (out != NULL)
+            fclose(out);
+        else if (fd >= 0)
+            close(fd);
+        free(client);
+        return NULL;
+    }
+    
+    char *line = NULL;
+    size_t size = 0;
+    while (getline(&line, &size, in) > 0) {
+        bool open = handleRequest(client->cache, line, in, out);
+        if (fflush(out) != 0 || !open)
+            break;
+    }
+    free(line);
+    fclose(in);
+    fclose(out);
+    free(client);
+    return NULL;
+}
+
+#endif
+
+/*
+ * Serve requests on a Unix domain socket until the process is terminated.
+ * An existing file at the path of the socket is replaced.
+ * ARGS     path     - file system path of the socket
+ *          engine   - engine executing all programs
+ *          capacity - number of programs kept in the cache
+ *          passes   - optimiser passes run on every program (see optimise.h)
+ */
+void runServer(const char *path, Engine engine, long capacity, unsigned passes)
+{
+    // input check
+    if (path == NULL || capacity < 1) {
+        fprintf(stderr, "ERROR: cannot serve without socket path or cache\n");
+        exit(EXIT_FAILURE);
+    }
+
+#ifndef SERVER_SUPPORTED
+    (void)engine;
+    (void)passes;
+    fprintf(stderr, "ERROR: server mode is not supported on this platform\n");
+    exit(EXIT_FAILURE);
+#else
+    ProgramCache cache;
+    pthread_mutex_init(&cache.lock, NULL);
+    cache.engine = engine;
+    cache.passes = passes;
+    size_t buckets = 16;
+    while (buckets < (size_t)capacity * 2)
+        buckets *= 2;
+    cache.buckets = calloc(buckets, sizeof(CacheEntry *));
+    if (cache.buckets == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    cache.mask = buckets - 1;
+    cache.first = NULL;
+    cache.last = NULL;
+    cache.count = 0;
+    cache.capacity = capacity;
+    
+    // clients closing their connection early must not terminate the server
+    signal(SIGPIPE, SIG_IGN);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "ERROR: socket path exceeds %lu characters\n",
+                (unsigned long)sizeof(addr.sun_path) - 1);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(addr.sun_path, path);
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0
+            || listen(sock, SERVER_BACKLOG) != 0) {
+        perror("ERROR: failed to listen on socket");
+        exit(EXIT_FAILURE);
+    }
+    
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (;;) {
+        int fd = accept(sock, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED)
+                perror("WARNING: failed to accept connection");
+            continue;
+        }
+        Client *client = malloc(sizeof(Client));
+        if (client == NULL) {
+            fprintf(stderr, "ERROR: unable to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        client->cache = &cache;
+        client->fd = fd;
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, serveClient, client) != 0) {
+            perror("WARNING: failed to start client thread");
+            close(fd);
+            free(client);
+        }
+    }
+#endif
+}
@@ -0,0 +1,436 @@
+/*
+ * simd.c
+ *
+ * Lane parallel executor running one program over several input vectors at
+ * once, see simd.h.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "affine.h"
+#include "fuse.h"
+#include "simd.h"
+
+// AVX2 code is compiled for the function it is used in only and selected
+// at run time, so the build runs on any x86-64 processor
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_AVX2
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#define SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define SIMD_STACK_SIZE 32  // LOOP nesting handled without heap allocation
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Iteration state of a LOOP or macro call running on all lanes.
+ */
+typedef struct {
+    NodeIndex loop;                 // index of the LOOP statement or call
+    uint64_t iteration;             // number of the current iteration
+    uint64_t max;                   // largest count of all lanes
+    uint64_t count[SIMD_LANES];     // count of every lane
+    uint64_t inner[SIMD_LANES];     // lanes active in the current iteration
+} LaneFrame;
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Get the number of lanes executed at once on this processor.
+ * RETURN   SIMD_LANES with AVX2, half of it otherwise
+ */
+long laneWidth(void)
+{
+#ifdef SIMD_AVX2
+    return __builtin_cpu_supports("avx2") ? SIMD_LANES : SIMD_LANES / 2;
+#else
+    return SIMD_LANES / 2;
+#endif
+}
+
+/*
+ * Allocate a zero initialized lane register file.
+ * ARGS     table - table to allocate the registers for
+ * RETURN   pointer to the newly allocated register file
+ */
+LaneFile *createLaneFile(const VariableTable *table)
+{
+    // input check
+    if (table == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate lane registers for missing table\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    LaneFile *lanes = malloc(sizeof(LaneFile));
+    long slots = table->count > 0 ? table->count : 1;
+    if (lanes == NULL || (lanes->regs = calloc(slots * SIMD_LANES, sizeof(uint64_t))) == NULL
+            || (lanes->scalar = calloc(slots, sizeof(Value))) == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    lanes->slots = table->count;
+    lanes->width = laneWidth();
+    return lanes;
+}
+
+/*
+ * Free the lane register file.
+ * ARGS     lanes - register file to be freed (may be NULL)
+ */
+void freeLaneFile(LaneFile *lanes)
+{
+    if (lanes == NULL)
+        return;
+    free(lanes->regs);
+    free(lanes->scalar);
+    free(lanes);
+}
+
+/*
+ * Set every register of every lane to zero.
+ * ARGS     lanes - register file to be cleared
+ */
+void clearLaneFile(LaneFile *lanes)
+{
+    // input check
+    if (lanes == NULL) {
+        fprintf(stderr, "ERROR: unable to clear missing lane registers\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    memset(lanes->regs, 0, lanes->slots * SIMD_LANES * sizeof(uint64_t));
+}
+
+#ifdef SIMD_AVX2
+
+/*
+ * Execute an assignment of a constant below 2^63 on all SIMD_LANES lanes
+ * selected by mask with AVX2.
+ * ARGS     ass   - assignment to be executed
+ *          regs  - lane registers
+ *          mask  - all bits set for every active lane, zero otherwise
+ * RETURN   bitwise or of all assigned values, bit 63 signals an overflow
+ */
+__attribute__((target("avx2")))
+static uint64_t assignLanesAvx2(const Assignment *ass, uint64_t *regs, const uint64_t *mask)
+{
+    uint64_t *dst = regs + ass->lvalue * SIMD_LANES;
+    const uint64_t *src = regs + ass->rvalue * SIMD_LANES;
+    __m256i n = _mm256_set1_epi64x((long long)ass->nat);
+    __m256i acc = _mm256_setzero_si256();
+    for (int l = 0; l < SIMD_LANES; l += 4) {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + l));
+        __m256i m = _mm256_loadu_si256((const __m256i *)(mask + l));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + l));
+        __m256i v;
+        if (ass->isAddition)
+            v = _mm256_add_epi64(s, n);
+        else
+            v = _mm256_and_si256(_mm256_sub_epi64(s, n), _mm256_cmpgt_epi64(s, n));
+        v = _mm256_and_si256(v, m);
+        _mm256_storeu_si256((__m256i *)(dst + l), _mm256_or_si256(v, _mm256_andnot_si256(m, d)));
+        acc = _mm256_or_si256(acc, v);
+    }
+    uint64_t res[4];
+    _mm256_storeu_si256((__m256i *)res, acc);
+    return res[0] | res[1] | res[2] | res[3];
+}
+
+#endif /* SIMD_AVX2 */
+
+/*
+ * Execute an assignment on all lanes selected by mask.
+ * ARGS     ass   - assignment to be executed
+ *          regs  - lane registers
+ *          mask  - all bits set for every active lane, zero otherwise
+ *          width - number of lanes executed, see laneWidth
+ * RETURN   bitwise or of all assigned values, bit 63 signals an overflow
+ */
+static uint64_t assignLanes(const Assignment *ass, uint64_t *regs, const uint64_t *mask, long width)
+{
+    uint64_t *dst = regs + ass->lvalue * SIMD_LANES;
+    const uint64_t *src = regs + ass->rvalue * SIMD_LANES;
+    
+    // big constants overflow any addition and clear any subtrahend
+    if (ass->nat & VALUE_BIG) {
+        if (ass->isAddition)
+            return VALUE_BIG;
+        for (int l = 0; l < SIMD_LANES; ++l)
+            dst[l] &= ~mask[l];
+        return 0;
+    }
+
+#ifdef SIMD_AVX2
+    if (width == SIMD_LANES)
+        return assignLanesAvx2(ass, regs, mask);
+#endif
+#if defined(SIMD_SSE2)
+    __m128i n = _mm_set1_epi64x((long long)ass->nat);
+    __m128i acc = _mm_setzero_si128();
+    for (long l = 0; l < width; l += 2) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + l));
+        __m128i m = _mm_loadu_si128((const __m128i *)(mask + l));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + l));
+        __m128i v;
+        if (ass->isAddition) {
+            v = _mm_add_epi64(s, n);
+        } else {
+            // both operands are below 2^63, so the sign of the difference
+            // tells whether to clamp (SSE2 lacks 64 bit comparisons)
+            __m128i diff = _mm_sub_epi64(s, n);
+            __m128i borrow = _mm_shuffle_epi32(_mm_srai_epi32(diff, 31), _MM_SHUFFLE(3, 3, 1, 1));
+            v = _mm_andnot_si128(borrow, diff);
+        }
+        v = _mm_and_si128(v, m);
+        _mm_storeu_si128((__m128i *)(dst + l), _mm_or_si128(v, _mm_andnot_si128(m, d)));
+        acc = _mm_or_si128(acc, v);
+    }
+    uint64_t res[2];
+    _mm_storeu_si128((__m128i *)res, acc);
+    return res[0] | res[1];
+#else
+    uint64_t acc = 0;
+    for (long l = 0; l < width; ++l) {
+        uint64_t s = src[l];
+        uint64_t v = ass->isAddition ? s + ass->nat : (s > ass->nat ? s - ass->nat : 0);
+        v &= mask[l];
+        dst[l] = v | (dst[l] & ~mask[l]);
+        acc |= v;
+    }
+    return acc;
+#endif
+}
+
+/*
+ * Execute a fused LOOP (fuse.h) in a single step on all lanes selected by
+ * mask. Products are checked lane by lane, so this stays scalar.
+ * ARGS     prog  - program holding the LOOP
+ *          loop  - fused LOOP to be executed
+ *          regs  - lane registers
+ *          mask  - all bits set for every active lane, zero otherwise
+ * RETURN   bitwise or of all assigned values, bit 63 signals an overflow
+ */
+static uint64_t fusedLanes(const Program *prog, const Loop *loop, uint64_t *regs, const uint64_t *mask)
+{
+    const Statement *body = programNode(prog, loop->body);
+    const Assignment *ass = loop->fused == FUSED_MUL_ADD
+            ? &programNode(prog, body->as.loop.body)->as.assignment : &body->as.assignment;
+    uint64_t *dst = regs + ass->lvalue * SIMD_LANES;
+    const uint64_t *src = regs + loop->var * SIMD_LANES;
+    const uint64_t *inner = loop->fused == FUSED_MUL_ADD ? regs + body->as.loop.var * SIMD_LANES : NULL;
+    NatNum k = ass->nat;
+    
+    uint64_t acc = 0;
+    for (int l = 0; l < SIMD_LANES; ++l) {
+        if (mask[l] == 0)
+            continue;
+        uint64_t n = src[l], s = dst[l];
+        if (loop->fused == FUSED_ZERO) {
+            dst[l] = 0;
+            continue;
+        }
+        if (inner != NULL) {
+            // n * m as the first factor, the limit stays below 2^63
+            uint64_t m = inner[l];
+            if (n != 0 && m > VALUE_MAX_SMALL / n)
+                return VALUE_BIG;
+            n *= m;
+        }
+        if (n == 0 || k == 0)
+            continue;
+        if (loop->fused == FUSED_SUB_VAR) {
+            // big constants clear any subtrahend
+            dst[l] = (k & VALUE_BIG) == 0 && n < (s + k - 1) / k ? s - n * k : 0;
+            continue;
+        }
+        if ((k & VALUE_BIG) || n > (VALUE_MAX_SMALL - s) / k)
+            return VALUE_BIG;
+        dst[l] = s + n * k;
+        acc |= dst[l];
+    }
+    return acc;
+}
+
+/*
+ * Apply the closed form of an affine LOOP lane by lane.
+ * ARGS     affine - closed form of the LOOP body
+ *          count  - number of iterations of every lane (zero if inactive)
+ *          lanes  - lane register file
+ * RETURN   false if a value of any lane exceeded the machine word range
+ */
+static bool affineLanes(const AffineLoop *affine, const uint64_t *count, LaneFile *lanes)
+{
+    for (int l = 0; l < SIMD_LANES; ++l) {
+        if (count[l] == 0)
+            continue;
+        for (long s = 0; s < lanes->slots; ++s)
+            lanes->scalar[s] = lanes->regs[s * SIMD_LANES + l];
+        executeAffineLoop(affine, count[l], lanes->scalar);
+        
+        bool fits = true;
+        for (long s = 0; s < lanes->slots; ++s) {
+            Value v = lanes->scalar[s];
+            if (v & VALUE_BIG) {
+                fits = false;
+                valueRelease(v);
+            } else {
+                lanes->regs[s * SIMD_LANES + l] = v;
+            }
+        }
+        if (!fits)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Execute a statement sequence on all lanes selected by mask. A LOOP runs its
+ * body as often as the largest count of all lanes, every lane is masked out
+ * once its own count is exhausted.
+ * ARGS     prog  - program holding the sequence
+ *          first - index of the first statement of the sequence
+ *          lanes - lane register file
+ *          mask  - all bits set for every active lane, zero otherwise
+ * RETURN   false if a value of any lane exceeded the machine word range
+ */
+static bool executeLaneSequence(const Program *prog, NodeIndex first, LaneFile *lanes,
+        const uint64_t *mask)
+{
+    LaneFrame local[SIMD_STACK_SIZE];
+    LaneFrame *stack = local;
+    size_t depth = 0, capacity = SIMD_STACK_SIZE;
+    bool fits = true;
+    
+    NodeIndex i = first;
+    while (fits) {
+        while (i != NODE_NONE) {
+            const Statement *stat = programNode(prog, i);
+            const uint64_t *active = depth > 0 ? stack[depth - 1].inner : mask;
+            if (stat->type == STAT_ASSIGNMENT) {
+                if (assignLanes(&stat->as.assignment, lanes->regs, active, lanes->width) & VALUE_BIG) {
+                    fits = false;
+                    break;
+                }
+                i = stat->next;
+                continue;
+            }
+            
+            // fused LOOPs run in a single step
+            const Loop *loop = &stat->as.loop;
+            if (stat->type == STAT_LOOP && loop->fused != FUSED_NONE) {
+                if (fusedLanes(prog, loop, lanes->regs, active) & VALUE_BIG) {
+                    fits = false;
+                    break;
+                }
+                i = stat->next;
+                continue;
+            }
+            
+            // the body of a macro runs once on all active lanes
+            NodeIndex body = stat->type == STAT_CALL ? stat->as.call.body : loop->body;
+            uint64_t count[SIMD_LANES];
+            uint64_t max = 0;
+            for (int l = 0; l < SIMD_LANES; ++l) {
+                if (stat->type == STAT_CALL)
+                    count[l] = active[l] & 1;
+                else
+                    count[l] = lanes->regs[loop->var * SIMD_LANES + l] & active[l];
+                if (count[l] > max)
+                    max = count[l];
+            }
+            if (stat->type == STAT_LOOP && loop->affine != NULL && max >= AFFINE_MIN_LIMIT) {
+                if (!affineLanes(loop->affine, count, lanes)) {
+                    fits = false;
+                    break;
+                }
+                max = 0;
+            }
+            if (max == 0) {
+                i = stat->next;
+                continue;
+            }
+            
+            if (depth == capacity) {
+                capacity *= 2;
+                LaneFrame *grown = malloc(capacity * sizeof(LaneFrame));
+                if (grown == NULL) {
+                    fprintf(stderr, "ERROR: unable to allocate memory\n");
+                    exit(EXIT_FAILURE);
+                }
+                memcpy(grown, stack, depth * sizeof(LaneFrame));
+                if (stack != local)
+                    free(stack);
+                stack = grown;
+            }
+            LaneFrame *frame = &stack[depth++];
+            frame->loop = i;
+            frame->iteration = 0;
+            frame->max = max;
+            for (int l = 0; l < SIMD_LANES; ++l) {
+                frame->count[l] = count[l];
+                frame->inner[l] = count[l] > 0 ? ~(uint64_t)0 : 0;
+            }
+            i = body;
+        }
+        
+        // end of a body, repeat it for the lanes with iterations left
+        if (!fits || depth == 0)
+            break;
+        LaneFrame *top = &stack[depth - 1];
+        if (++top->iteration < top->max) {
+            for (int l = 0; l < SIMD_LANES; ++l)
+                top->inner[l] = top->count[l] > top->iteration ? ~(uint64_t)0 : 0;
+            i = programNode(prog, top->loop)->as.loop.body;
+        } else {
+            i = programNode(prog, top->loop)->next;
+            --depth;
+        }
+    }
+    if (stack != local)
+        free(stack);
+    return fits;
+}
+
+/*
+ * Execute the program on all lanes at once.
+ * ARGS     prog  - program to be executed
+ *          lanes - initialized register file
+ * RETURN   false if a value of any lane exceeded the machine word range, the
+ *          registers are undefined in that case
+ */
+bool executeLanes(Program *prog, LaneFile *lanes)
+{
+    // input check
+    if (prog == NULL || lanes == NULL) {
+        fprintf(stderr, "ERROR: cannot execute empty program or without lane registers\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    uint64_t mask[SIMD_LANES];
+    for (int l = 0; l < SIMD_LANES; ++l)
+        mask[l] = l < lanes->width ? ~(uint64_t)0 : 0;
+    return executeLaneSequence(prog, prog->first, lanes, mask);
+}
@@ -0,0 +1,143 @@
+/*
+ * stats.c
+ *
+ * Machine-readable summary of a run for --stats=json, see stats.h.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "stats.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RUSAGE_SUPPORTED
+#include <sys/resource.h>
+#endif
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+static const char *phaseNames[PHASE_COUNT] = {
+    "parse", "optimise", "analyse", "prepare", "execute"
+};
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Count the statements of a program by kind.
+ * ARGS     prog - program to be measured
+ *          size - destination of the counts
+ */
+void measureProgram(const Program *prog, ProgramSize *size)
+{
+    // input check
+    if (prog == NULL || size == NULL) {
+        fprintf(stderr, "ERROR: cannot measure missing program\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    size->assignments = 0;
+    size->loops = 0;
+    size->calls = 0;
+    for (NodeIndex i = 1; i < prog->count; ++i) {
+        StatementType type = programNode(prog, i)->type;
+        if (type == STAT_ASSIGNMENT)
+            ++size->assignments;
+        else if (type == STAT_LOOP)
+            ++size->loops;
+        else
+            ++size->calls;
+    }
+}
+
+/*
+ * Get the peak resident memory of the process.
+ * RETURN   peak in KiB or -1 where unknown
+ */
+long peakMemory(void)
+{
+#ifdef RUSAGE_SUPPORTED
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024;      // reported in bytes
+#else
+    return usage.ru_maxrss;             // reported in kilobytes
+#endif
+#else
+    return -1;
+#endif
+}
+
+/*
+ * Print a count as JSON, unknown counts as null.
+ * ARGS     stream - output stream
+ *          count  - count to be printed
+ */
+static void printCount(FILE *stream, uint64_t count)
+{
+    if (count == STATS_UNKNOWN)
+        fprintf(stream, "null");
+    else
+        fprintf(stream, "%llu", (unsigned long long)count);
+}
+
+/*
+ * Print the statements of a program by kind as a JSON object.
+ * ARGS     stream - output stream
+ *          size   - counts to be printed
+ */
+static void printSize(FILE *stream, const ProgramSize *size)
+{
+    fprintf(stream, "{\"total\": %ld, \"assignments\": %ld, \"loops\": %ld, \"calls\": %ld}",
+            size->assignments + size->loops + size->calls, size->assignments, size->loops, size->calls);
+}
+
+/*
+ * Print the summary of a run as a single JSON object.
+ * ARGS     stream - output stream
+ *          stats  - summary of the run
+ */
+void printRunStats(FILE *stream, const RunStats *stats)
+{
+    // input check
+    if (stream == NULL || stats == NULL) {
+        fprintf(stderr, "ERROR: cannot print missing run statistics\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    fprintf(stream, "{\"engine\": \"%s\", \"requested_engine\": \"%s\", \"phase_seconds\": {",
+            stats->engine, stats->requested);
+    for (int p = 0; p < PHASE_COUNT; ++p)
+        fprintf(stream, "%s\"%s\": %.9f", p > 0 ? ", " : "", phaseNames[p], stats->nanos[p] / 1e9);
+    fprintf(stream, "}, \"parsed_statements\": ");
+    printSize(stream, &stats->parsed);
+    fprintf(stream, ", \"executed_program\": ");
+    printSize(stream, &stats->optimised);
+    fprintf(stream, ", \"fused_statements\": %ld, \"variables\": %ld, \"statements_executed\": ",
+            stats->fused, stats->variables);
+    printCount(stream, stats->statements);
+    fprintf(stream, ", \"loop_iterations\": ");
+    printCount(stream, stats->iterations);
+    long peak = peakMemory();
+    fprintf(stream, ", \"peak_rss_kb\": ");
+    if (peak >= 0)
+        fprintf(stream, "%ld", peak);
+    else
+        fprintf(stream, "null");
+    fprintf(stream, ", \"cached\": %s, \"budget_exceeded\": %s}\n", stats->cached ? "true" : "false",
+            stats->exceeded ? "true" : "false");
+}
@@ -0,0 +1,1952 @@
+/*
+ * symbolic.c
+ *
+ * Symbolic execution of whole programs, see symbolic.h.
+ *
+ * Closed forms are polynomials in a canonical form: terms are sorted by their
+ * monomials, every monomial is a list of factors sorted by atom, and atoms
+ * are interned, so equal closed forms are equal term by term. Atoms are
+ * numbered in order of creation and only refer to atoms created before them.
+ * Polynomials are immutable and live in an arena released with the closed
+ * forms. Coefficients are frozen like program constants, so the closed forms
+ * can be evaluated concurrently.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "hash.h"
+#include "symbolic.h"
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define ARENA_CHUNK_SIZE (1 << 16)          // bytes per chunk of the arena
+#define SYMBOLIC_MAX_POWER (1u << 16)       // exponent of a factor
+#define FOLD_BITS 4096                      // largest power folded while solving
+#define EVALUATE_BITS ((uint64_t)1 << 36)   // largest power evaluated (8 GiB)
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Atoms as listed in symbolic.h. Symbols stand for the value of a variable
+ * at the beginning of an iteration, the index for the number of iterations
+ * run, both only occur while solving a LOOP.
+ */
+typedef enum {
+    ATOM_INPUT,     // initial value of variable slot n
+    ATOM_SYMBOL,    // variable slot n at the beginning of an iteration
+    ATOM_INDEX,     // iteration counter
+    ATOM_POW,       // a ^ b
+    ATOM_BINOM,     // C(a, n)
+    ATOM_GEOM,      // geom(a, b)
+    ATOM_MONUS,     // max(a - b, 0)
+    ATOM_POSITIVE,  // [a > 0]
+    ATOM_ZERO       // [a = 0]
+} AtomKind;
+
+/*
+ * Atom raised to a power.
+ */
+typedef struct {
+    uint32_t atom;
+    uint32_t power;
+} Factor;
+
+/*
+ * Coefficient times monomial, the factors are sorted by atom.
+ */
+typedef struct {
+    Value coef;
+    uint32_t length;
+    const Factor *factors;
+} Term;
+
+/*
+ * Sum of terms sorted by their monomials, the constant term comes first.
+ */
+typedef struct {
+    long count;
+    uint64_t hash;
+    Term terms[];
+} Poly;
+
+typedef struct {
+    AtomKind kind;
+    long n;             // slot (ATOM_INPUT, ATOM_SYMBOL) or k (ATOM_BINOM)
+    long serial;        // LOOP solved (ATOM_SYMBOL, ATOM_INDEX)
+    const Poly *a;      // operands, NULL if unused
+    const Poly *b;
+    long depth;         // nesting of atoms in the operands plus one
+    uint64_t hash;
+} Atom;
+
+/*
+ * State of the symbolic execution. Operations building closed forms return
+ * NULL once the program turned out to have no closed form.
+ */
+typedef struct {
+    const Program *prog;
+    const VariableTable *vars;
+    ArenaChunk *chunks;     // arena of polynomials and factors
+    Atom *atoms;            // interned atoms by number
+    uint32_t atomCount;
+    uint32_t atomCapacity;
+    uint32_t *table;        // hash table of atom numbers plus one, 0 if empty
+    uint32_t tableSize;
+    uint64_t *marks;        // per atom: query stamp << 1 | result (usesRange)
+    uint32_t markCapacity;
+    uint64_t stamp;
+    long budget;            // terms still to be created
+    long serial;            // LOOPs solved so far
+    long depth;             // nesting of the LOOP executed
+    const Poly *zero;
+    const Poly *one;
+    SymbolicFailure failure;
+    bool failed;
+    bool exhausted;         // failed for exceeding a limit
+} Context;
+
+/*
+ * Replacement of the atoms lo ... hi by polynomials (NULL keeps the atom),
+ * applied to all atoms depending on them as well. Results are memoised in a
+ * hash table of the atoms visited.
+ */
+typedef struct {
+    uint32_t lo;
+    uint32_t hi;
+    const Poly **by;
+    uint32_t limit;         // atoms created before the substitution
+    uint32_t *keys;         // atom number plus one, 0 if empty
+    const Poly **memo;      // result per key, NULL if unchanged
+    uint32_t capacity;
+    uint32_t used;
+} Substitution;
+
+/*
+ * Recurrences of the variables written by a LOOP. The symbols lo ... hi
+ * stand for the values of the written variables at the beginning of an
+ * iteration, the atom index for the number k of iterations run before.
+ */
+typedef struct {
+    NodeIndex node;             // the LOOP
+    const Poly **state;         // closed forms before the LOOP
+    const long *written;        // slots of the written variables
+    uint32_t lo;
+    uint32_t hi;
+    uint32_t index;
+    const Poly *k;              // atom k
+    const Poly *previousIndex;  // k - 1
+    const Poly **next;          // values after an iteration, in symbols
+    const Poly **closed;        // solved values after k iterations
+    const Poly **previous;      // solved values after k - 1 iterations
+} Recurrences;
+
+/*
+ * Memoised values of atoms during an evaluation.
+ */
+typedef struct {
+    const Context *ctx;
+    const Value *regs;
+    Value *values;
+    bool *known;
+} Evaluation;
+
+struct sClosedForm {
+    Context ctx;
+    const Poly **forms;     // closed form per slot, NULL if never written
+    const Poly *output;     // closed form of x0 starting as zero
+    long slots;
+};
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Allocate memory from the arena of the context, aligned to 8 bytes.
+ */
+static void *arenaAlloc(Context *ctx, size_t size)
+{
+    size = (size + 7) & ~(size_t)7;
+    if (ctx->chunks == NULL || ctx->chunks->size - ctx->chunks->used < size) {
+        size_t capacity = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        ArenaChunk *chunk = allocate(sizeof(ArenaChunk) + capacity);
+        chunk->next = ctx->chunks;
+        chunk->used = 0;
+        chunk->size = capacity;
+        ctx->chunks = chunk;
+    }
+    void *ptr = ctx->chunks->data + ctx->chunks->used;
+    ctx->chunks->used += size;
+    return ptr;
+}
+
+/*
+ * Record the first reason for the program having no closed form.
+ * ARGS     ctx    - context of the execution
+ *          reason - static description
+ *          node   - offending statement or NODE_NONE
+ *          slot   - offending variable or -1
+ * RETURN   NULL
+ */
+static const Poly *fail(Context *ctx, const char *reason, NodeIndex node, long slot)
+{
+    if (!ctx->failed) {
+        ctx->failed = true;
+        ctx->failure.reason = reason;
+        ctx->failure.line = node != NODE_NONE ? ctx->prog->lines[node] : 0;
+        ctx->failure.var = slot >= 0 ? ctx->vars->ids[slot] : -1;
+    }
+    return NULL;
+}
+
+/*
+ * Fail for exceeding one of the limits, which unrolling cannot help with.
+ */
+static const Poly *failTooLarge(Context *ctx)
+{
+    ctx->exhausted = true;
+    return fail(ctx, "closed form too large", NODE_NONE, -1);
+}
+
+/*
+ * Divide a value by a small divisor without remainder.
+ * RETURN   new reference to the quotient
+ */
+static Value divideSmall(Value v, uint32_t d)
+{
+    if ((v & VALUE_BIG) == 0)
+        return v / d;
+    const BigNum *big = valueBig(v);
+    uint32_t *limbs = allocate(big->length * sizeof(uint32_t));
+    uint64_t rest = 0;
+    for (long i = big->length - 1; i >= 0; --i) {
+        uint64_t current = rest << 32 | big->limbs[i];
+        limbs[i] = (uint32_t)(current / d);
+        rest = current % d;
+    }
+    long length = big->length;
+    while (length > 0 && limbs[length - 1] == 0)
+        --length;
+    Value res = valueFromLimbs(limbs, length);
+    free(limbs);
+    return res;
+}
+
+/*
+ * Compute the binomial coefficient n choose k.
+ * RETURN   new reference to the coefficient
+ */
+static Value binomialValue(Value n, long k)
+{
+    if (valueCompare(n, (Value)k) < 0)
+        return 0;
+    
+    // every partial product is a binomial coefficient itself, so the
+    // divisions are exact
+    Value res = 1;
+    for (long i = 0; i < k; ++i) {
+        Value factor = valueSub(n, (Value)i);
+        Value product = valueMul(res, factor);
+        valueRelease(factor);
+        valueRelease(res);
+        res = divideSmall(product, (uint32_t)(i + 1));
+        valueRelease(product);
+    }
+    return res;
+}
+
+/*
+ * Check that a^e for a >= 2 has at most the given number of bits.
+ */
+static bool isPowerBounded(Value a, Value e, uint64_t bits)
+{
+    return (e & VALUE_BIG) == 0 && e <= bits / valueBitLength(a);
+}
+
+/*
+ * Compute a^e by repeated squaring.
+ * ARGS     a    - base
+ *          e    - exponent
+ *          bits - largest number of bits of the result
+ *          res  - destination of the new reference to the power
+ * RETURN   false if the power exceeds the number of bits
+ */
+static bool powerValue(Value a, Value e, uint64_t bits, Value *res)
+{
+    if (e == 0 || a == 1) {
+        *res = 1;
+        return true;
+    }
+    if (a == 0) {
+        *res = 0;
+        return true;
+    }
+    if (!isPowerBounded(a, e, bits))
+        return false;
+    
+    Value power = 1;
+    for (uint64_t bit = valueBitLength(e); bit-- > 0;) {
+        Value square = valueMul(power, power);
+        valueRelease(power);
+        power = square;
+        if (valueBit(e, bit)) {
+            Value product = valueMul(power, a);
+            valueRelease(power);
+            power = product;
+        }
+    }
+    *res = power;
+    return true;
+}
+
+/*
+ * Compute a^0 + a^1 + ... + a^(n-1) by repeated doubling of the number of
+ * summands, as geom(a, 2m) = geom(a, m) * (1 + a^m) and geom(a, m + 1) =
+ * 1 + a * geom(a, m).
+ * ARGS     a    - ratio
+ *          n    - number of summands
+ *          bits - largest number of bits of the result
+ *          res  - destination of the new reference to the sum
+ * RETURN   false if the sum exceeds the number of bits
+ */
+static bool geometricValue(Value a, Value n, uint64_t bits, Value *res)
+{
+    if (a == 0 || n == 0) {
+        *res = n != 0;
+        return true;
+    }
+    if (a == 1) {
+        *res = valueRetain(n);
+        return true;
+    }
+    if (!isPowerBounded(a, n, bits))
+        return false;
+    
+    Value sum = 0, power = 1;
+    for (uint64_t bit = valueBitLength(n); bit-- > 0;) {
+        Value factor = valueAdd(power, 1);
+        Value doubled = valueMul(sum, factor);
+        Value square = valueMul(power, power);
+        valueRelease(factor);
+        valueRelease(sum);
+        valueRelease(power);
+        sum = doubled;
+        power = square;
+        if (valueBit(n, bit)) {
+            Value product = valueMul(sum, a);
+            valueRelease(sum);
+            sum = valueAdd(product, 1);
+            valueRelease(product);
+            product = valueMul(power, a);
+            valueRelease(power);
+            power = product;
+        }
+    }
+    valueRelease(power);
+    *res = sum;
+    return true;
+}
+
+/*
+ * Continue a hash over a value, big or not.
+ */
+static uint64_t hashSymbolValue(uint64_t hash, Value v)
+{
+    if (v & VALUE_BIG)
+        return hashBytes(hash, valueBig(v)->limbs, valueBig(v)->length * sizeof(uint32_t));
+    return hashBytes(hash, &v, sizeof(v));
+}
+
+/*
+ * Compare the monomials of two terms.
+ * RETURN   negative, zero or positive if a sorts before, equal or after b
+ */
+static int compareMonomials(const Term *a, const Term *b)
+{
+    uint32_t length = a->length < b->length ? a->length : b->length;
+    for (uint32_t i = 0; i < length; ++i) {
+        if (a->factors[i].atom != b->factors[i].atom)
+            return a->factors[i].atom < b->factors[i].atom ? -1 : 1;
+        if (a->factors[i].power != b->factors[i].power)
+            return a->factors[i].power < b->factors[i].power ? -1 : 1;
+    }
+    return (a->length > b->length) - (a->length < b->length);
+}
+
+/*
+ * Order terms by their monomials, qsort callback.
+ */
+static int compareTerms(const void *a, const void *b)
+{
+    return compareMonomials(a, b);
+}
+
+/*
+ * Allocate a polynomial of the given number of terms.
+ */
+static Poly *newPoly(Context *ctx, long count)
+{
+    Poly *p = arenaAlloc(ctx, sizeof(Poly) + count * sizeof(Term));
+    p->count = count;
+    return p;
+}
+
+/*
+ * Check the limits and hash a polynomial once all of its terms are set.
+ * RETURN   the polynomial or NULL if it exceeds the limits
+ */
+static const Poly *finishPoly(Context *ctx, Poly *p)
+{
+    ctx->budget -= p->count;
+    if (p->count > SYMBOLIC_MAX_TERMS || ctx->budget < 0)
+        return failTooLarge(ctx);
+    
+    uint64_t hash = HASH_SEED;
+    for (long i = 0; i < p->count; ++i) {
+        const Term *t = &p->terms[i];
+        hash = hashSymbolValue(hash, t->coef);
+        hash = hashBytes(hash, &t->length, sizeof(t->length));
+        if (t->length > 0)
+            hash = hashBytes(hash, t->factors, t->length * sizeof(Factor));
+    }
+    p->hash = hash;
+    return p;
+}
+
+/*
+ * Build a polynomial from terms in any order, adding up equal monomials.
+ * ARGS     ctx   - context of the execution
+ *          terms - terms with non-zero coefficients, sorted in place
+ *          count - number of terms
+ * RETURN   new polynomial
+ */
+static const Poly *polyFromTerms(Context *ctx, Term *terms, long count)
+{
+    qsort(terms, count, sizeof(Term), compareTerms);
+    Poly *p = newPoly(ctx, count);
+    long n = 0;
+    for (long i = 0; i < count; ++i) {
+        if (n > 0 && compareMonomials(&p->terms[n - 1], &terms[i]) == 0)
+            p->terms[n - 1].coef = valueFreeze(valueAdd(p->terms[n - 1].coef, terms[i].coef));
+        else
+            p->terms[n++] = terms[i];
+    }
+    p->count = n;
+    return finishPoly(ctx, p);
+}
+
+/*
+ * Create a constant polynomial.
+ * ARGS     ctx - context of the execution
+ *          v   - reference to the constant, taken over
+ * RETURN   new polynomial
+ */
+static const Poly *polyConstant(Context *ctx, Value v)
+{
+    if (v == 0)
+        return ctx->zero;
+    Poly *p = newPoly(ctx, 1);
+    p->terms[0].coef = valueFreeze(v);
+    p->terms[0].length = 0;
+    p->terms[0].factors = NULL;
+    return finishPoly(ctx, p);
+}
+
+/*
+ * Check whether a polynomial is constant.
+ * ARGS     p - polynomial
+ *          v - destination of the borrowed constant
+ * RETURN   false if the polynomial holds any atom
+ */
+static bool isConstant(const Poly *p, Value *v)
+{
+    if (p->count == 0) {
+        *v = 0;
+        return true;
+    }
+    if (p->count == 1 && p->terms[0].length == 0) {
+        *v = p->terms[0].coef;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Get the constant term of a polynomial.
+ * RETURN   borrowed constant, 0 if there is none
+ */
+static Value constantTerm(const Poly *p)
+{
+    return p->count > 0 && p->terms[0].length == 0 ? p->terms[0].coef : 0;
+}
+
+/*
+ * Check whether a polynomial is a single atom.
+ * RETURN   number of the atom or -1
+ */
+static long singleAtom(const Poly *p)
+{
+    if (p->count != 1 || p->terms[0].coef != 1 || p->terms[0].length != 1
+            || p->terms[0].factors[0].power != 1)
+        return -1;
+    return p->terms[0].factors[0].atom;
+}
+
+/*
+ * Compare two polynomials term by term.
+ */
+static bool polyEqual(const Poly *p, const Poly *q)
+{
+    if (p == q)
+        return true;
+    if (p == NULL || q == NULL || p->count != q->count || p->hash != q->hash)
+        return false;
+    for (long i = 0; i < p->count; ++i) {
+        if (valueCompare(p->terms[i].coef, q->terms[i].coef) != 0
+                || compareMonomials(&p->terms[i], &q->terms[i]) != 0)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Compute p + q.
+ */
+static const Poly *polyAdd(Context *ctx, const Poly *p, const Poly *q)
+{
+    if (p == NULL || q == NULL)
+        return NULL;
+    if (p->count == 0)
+        return q;
+    if (q->count == 0)
+        return p;
+    
+    Poly *r = newPoly(ctx, p->count + q->count);
+    long i = 0, j = 0, n = 0;
+    while (i < p->count || j < q->count) {
+        int c = i == p->count ? 1 : j == q->count ? -1 : compareMonomials(&p->terms[i], &q->terms[j]);
+        if (c < 0) {
+            r->terms[n++] = p->terms[i++];
+        } else if (c > 0) {
+            r->terms[n++] = q->terms[j++];
+        } else {
+            r->terms[n] = p->terms[i];
+            r->terms[n++].coef = valueFreeze(valueAdd(p->terms[i++].coef, q->terms[j++].coef));
+        }
+    }
+    r->count = n;
+    return finishPoly(ctx, r);
+}
+
+/*
+ * Multiply two terms.
+ * RETURN   false if an exponent exceeds SYMBOLIC_MAX_POWER
+ */
+static bool multiplyTerms(Context *ctx, const Term *a, const Term *b, Term *res)
+{
+    Factor *factors = arenaAlloc(ctx, (a->length + b->length) * sizeof(Factor));
+    uint32_t i = 0, j = 0, n = 0;
+    while (i < a->length || j < b->length) {
+        if (j == b->length || (i < a->length && a->factors[i].atom < b->factors[j].atom)) {
+            factors[n++] = a->factors[i++];
+        } else if (i == a->length || b->factors[j].atom < a->factors[i].atom) {
+            factors[n++] = b->factors[j++];
+        } else {
+            factors[n] = a->factors[i++];
+            factors[n++].power += b->factors[j++].power;
+            if (factors[n - 1].power > SYMBOLIC_MAX_POWER)
+                return false;
+        }
+    }
+    res->coef = valueFreeze(valueMul(a->coef, b->coef));
+    res->length = n;
+    res->factors = factors;
+    return true;
+}
+
+/*
+ * Compute p * q.
+ */
+static const Poly *polyMul(Context *ctx, const Poly *p, const Poly *q)
+{
+    if (p == NULL || q == NULL)
+        return NULL;
+    if (p->count == 0 || q->count == 0)
+        return ctx->zero;
+    if (polyEqual(p, ctx->one))
+        return q;
+    if (polyEqual(q, ctx->one))
+        return p;
+    if (p->count * q->count > SYMBOLIC_MAX_TERMS * 16L)
+        return failTooLarge(ctx);
+    
+    Term *terms = allocate(p->count * q->count * sizeof(Term));
+    long n = 0;
+    for (long i = 0; i < p->count; ++i) {
+        for (long j = 0; j < q->count; ++j) {
+            if (!multiplyTerms(ctx, &p->terms[i], &q->terms[j], &terms[n++])) {
+                free(terms);
+                return failTooLarge(ctx);
+            }
+        }
+    }
+    const Poly *r = polyFromTerms(ctx, terms, n);
+    free(terms);
+    return r;
+}
+
+/*
+ * Compute p^e for a small exponent.
+ */
+static const Poly *polyPow(Context *ctx, const Poly *p, uint64_t e)
+{
+    const Poly *r = ctx->one;
+    for (uint64_t i = 0; i < e; ++i)
+        r = polyMul(ctx, r, p);
+    return r;
+}
+
+/*
+ * Remove the terms two polynomials have in common from both, e.g. x + 3 and
+ * x + y + 1 are reduced to 2 and y.
+ */
+static void removeCommon(Context *ctx, const Poly *p, const Poly *q, const Poly **pr,
+        const Poly **qr)
+{
+    Poly *a = newPoly(ctx, p->count);
+    Poly *b = newPoly(ctx, q->count);
+    long i = 0, j = 0;
+    a->count = b->count = 0;
+    while (i < p->count || j < q->count) {
+        int c = i == p->count ? 1 : j == q->count ? -1 : compareMonomials(&p->terms[i], &q->terms[j]);
+        if (c < 0) {
+            a->terms[a->count++] = p->terms[i++];
+        } else if (c > 0) {
+            b->terms[b->count++] = q->terms[j++];
+        } else {
+            int order = valueCompare(p->terms[i].coef, q->terms[j].coef);
+            if (order > 0) {
+                a->terms[a->count] = p->terms[i];
+                a->terms[a->count++].coef = valueFreeze(valueSub(p->terms[i].coef, q->terms[j].coef));
+            } else if (order < 0) {
+                b->terms[b->count] = q->terms[j];
+                b->terms[b->count++].coef = valueFreeze(valueSub(q->terms[j].coef, p->terms[i].coef));
+            }
+            ++i;
+            ++j;
+        }
+    }
+    *pr = finishPoly(ctx, a);
+    *qr = finishPoly(ctx, b);
+}
+
+/*
+ * Intern an atom.
+ * ARGS     ctx    - context of the execution
+ *          kind   - kind of the atom
+ *          n      - slot or k, 0 if unused
+ *          serial - number of the solved LOOP, 0 if unused
+ *          a, b   - operands, NULL if unused
+ * RETURN   polynomial consisting of the atom
+ */
+static const Poly *atomPoly(Context *ctx, AtomKind kind, long n, long serial, const Poly *a,
+        const Poly *b)
+{
+    uint64_t words[3] = { kind, n, serial };
+    uint64_t hash = hashBytes(HASH_SEED, words, sizeof(words));
+    hash = hashBytes(hash, a != NULL ? &a->hash : &words[0], sizeof(uint64_t));
+    hash = hashBytes(hash, b != NULL ? &b->hash : &words[0], sizeof(uint64_t));
+    
+    // look the atom up, it is inserted into the empty entry found otherwise
+    uint32_t mask = ctx->tableSize - 1;
+    uint32_t index = (uint32_t)hash & mask;
+    for (; ctx->table[index] != 0; index = (index + 1) & mask) {
+        const Atom *atom = &ctx->atoms[ctx->table[index] - 1];
+        if (atom->hash == hash && atom->kind == kind && atom->n == n && atom->serial == serial
+                && polyEqual(atom->a, a) && polyEqual(atom->b, b))
+            break;
+    }
+    uint32_t id;
+    if (ctx->table[index] != 0) {
+        id = ctx->table[index] - 1;
+    } else {
+        if (ctx->atomCount == ctx->atomCapacity) {
+            ctx->atomCapacity *= 2;
+            ctx->atoms = reallocate(ctx->atoms, ctx->atomCapacity, sizeof(Atom));
+        }
+        long depth = 0;
+        for (int i = 0; i < 2; ++i) {
+            const Poly *p = i == 0 ? a : b;
+            for (long t = 0; p != NULL && t < p->count; ++t) {
+                for (uint32_t f = 0; f < p->terms[t].length; ++f) {
+                    if (ctx->atoms[p->terms[t].factors[f].atom].depth > depth)
+                        depth = ctx->atoms[p->terms[t].factors[f].atom].depth;
+                }
+            }
+        }
+        if (depth >= SYMBOLIC_MAX_DEPTH)
+            return failTooLarge(ctx);
+        id = ctx->atomCount++;
+        ctx->atoms[id] = (Atom){ kind, n, serial, a, b, depth + 1, hash };
+        ctx->table[index] = id + 1;
+        
+        // keep the table at most half full
+        if (ctx->atomCount * 2 > ctx->tableSize) {
+            free(ctx->table);
+            ctx->tableSize *= 2;
+            ctx->table = allocateZeroed(ctx->tableSize, sizeof(uint32_t));
+            for (uint32_t i = 0; i < ctx->atomCount; ++i) {
+                uint32_t slot = (uint32_t)ctx->atoms[i].hash & (ctx->tableSize - 1);
+                while (ctx->table[slot] != 0)
+                    slot = (slot + 1) & (ctx->tableSize - 1);
+                ctx->table[slot] = i + 1;
+            }
+        }
+    }
+    
+    Factor *factor = arenaAlloc(ctx, sizeof(Factor));
+    factor->atom = id;
+    factor->power = 1;
+    Poly *p = newPoly(ctx, 1);
+    p->terms[0] = (Term){ 1, 1, factor };
+    return finishPoly(ctx, p);
+}
+
+/*
+ * Replace all coefficients by one, as indicators do not depend on them.
+ */
+static const Poly *indicatorOperand(Context *ctx, const Poly *p)
+{
+    Poly *q = newPoly(ctx, p->count);
+    for (long i = 0; i < p->count; ++i) {
+        q->terms[i] = p->terms[i];
+        q->terms[i].coef = 1;
+    }
+    return finishPoly(ctx, q);
+}
+
+/*
+ * Create [p > 0].
+ */
+static const Poly *makePositive(Context *ctx, const Poly *p)
+{
+    if (p == NULL)
+        return NULL;
+    if (p->count == 0)
+        return ctx->zero;
+    if (constantTerm(p) != 0)
+        return ctx->one;
+    long atom = singleAtom(p);
+    if (atom >= 0 && ctx->atoms[atom].kind == ATOM_POSITIVE)
+        return p;
+    if (atom >= 0 && ctx->atoms[atom].kind == ATOM_ZERO)
+        return p;
+    return atomPoly(ctx, ATOM_POSITIVE, 0, 0, indicatorOperand(ctx, p), NULL);
+}
+
+/*
+ * Create [p = 0].
+ */
+static const Poly *makeZero(Context *ctx, const Poly *p)
+{
+    if (p == NULL)
+        return NULL;
+    if (p->count == 0)
+        return ctx->one;
+    if (constantTerm(p) != 0)
+        return ctx->zero;
+    long atom = singleAtom(p);
+    if (atom >= 0 && ctx->atoms[atom].kind == ATOM_POSITIVE)
+        return atomPoly(ctx, ATOM_ZERO, 0, 0, ctx->atoms[atom].a, NULL);
+    if (atom >= 0 && ctx->atoms[atom].kind == ATOM_ZERO)
+        return atomPoly(ctx, ATOM_POSITIVE, 0, 0, ctx->atoms[atom].a, NULL);
+    return atomPoly(ctx, ATOM_ZERO, 0, 0, indicatorOperand(ctx, p), NULL);
+}
+
+/*
+ * Create max(p - q, 0).
+ */
+static const Poly *makeMonus(Context *ctx, const Poly *p, const Poly *q)
+{
+    if (p == NULL || q == NULL)
+        return NULL;
+    if (q->count == 0)
+        return p;
+    
+    // subtractions in a row subtract the sum, as max(max(a - b, 0) - q, 0)
+    // equals max(a - (b + q), 0)
+    long atom = singleAtom(p);
+    if (atom >= 0 && ctx->atoms[atom].kind == ATOM_MONUS) {
+        const Poly *a = ctx->atoms[atom].a;
+        return makeMonus(ctx, a, polyAdd(ctx, ctx->atoms[atom].b, q));
+    }
+    
+    // all atoms are natural numbers, so common terms can be removed
+    const Poly *a, *b;
+    removeCommon(ctx, p, q, &a, &b);
+    if (a == NULL || b == NULL)
+        return NULL;
+    if (b->count == 0)
+        return a;
+    if (a->count == 0)
+        return ctx->zero;
+    Value va, vb;
+    if (isConstant(a, &va) && isConstant(b, &vb))
+        return polyConstant(ctx, valueSub(va, vb));
+    return atomPoly(ctx, ATOM_MONUS, 0, 0, a, b);
+}
+
+/*
+ * Create b^e.
+ */
+static const Poly *makePow(Context *ctx, const Poly *b, const Poly *e)
+{
+    if (b == NULL || e == NULL)
+        return NULL;
+    Value vb, ve, res;
+    bool constBase = isConstant(b, &vb);
+    bool constExp = isConstant(e, &ve);
+    if (constExp && ve == 0)
+        return ctx->one;
+    if (constExp && ve == 1)
+        return b;
+    if (constBase && vb == 0)
+        return makeZero(ctx, e);
+    if (constBase && vb == 1)
+        return ctx->one;
+    if (constBase && constExp && powerValue(vb, ve, FOLD_BITS, &res))
+        return polyConstant(ctx, res);
+    
+    // small powers of monomials and short sums are multiplied out
+    if (constExp && ve <= SYMBOLIC_MAX_DEGREE && b->count == 1) {
+        const Term *t = &b->terms[0];
+        if (powerValue(t->coef, ve, FOLD_BITS, &res)) {
+            Factor *factors = arenaAlloc(ctx, t->length * sizeof(Factor));
+            for (uint32_t i = 0; i < t->length; ++i) {
+                factors[i] = t->factors[i];
+                factors[i].power *= (uint32_t)ve;
+                if (factors[i].power > SYMBOLIC_MAX_POWER)
+                    return failTooLarge(ctx);
+            }
+            Poly *p = newPoly(ctx, 1);
+            p->terms[0] = (Term){ valueFreeze(res), t->length, factors };
+            return finishPoly(ctx, p);
+        }
+    }
+    if (constExp && ve <= 4 && b->count <= 4)
+        return polyPow(ctx, b, ve);
+    return atomPoly(ctx, ATOM_POW, 0, 0, b, e);
+}
+
+/*
+ * Create C(n, k).
+ */
+static const Poly *makeBinom(Context *ctx, const Poly *n, long k)
+{
+    if (n == NULL)
+        return NULL;
+    Value v;
+    if (k == 0)
+        return ctx->one;
+    if (k == 1)
+        return n;
+    if (isConstant(n, &v))
+        return polyConstant(ctx, binomialValue(v, k));
+    return atomPoly(ctx, ATOM_BINOM, k, 0, n, NULL);
+}
+
+/*
+ * Create geom(a, n).
+ */
+static const Poly *makeGeom(Context *ctx, const Poly *a, const Poly *n)
+{
+    if (a == NULL || n == NULL)
+        return NULL;
+    Value va, vn, res;
+    bool constRatio = isConstant(a, &va);
+    bool constCount = isConstant(n, &vn);
+    if (constCount && vn <= 1)
+        return vn == 0 ? ctx->zero : ctx->one;
+    if (constRatio && va == 0)
+        return makePositive(ctx, n);
+    if (constRatio && va == 1)
+        return n;
+    if (constRatio && constCount && geometricValue(va, vn, FOLD_BITS, &res))
+        return polyConstant(ctx, res);
+    return atomPoly(ctx, ATOM_GEOM, 0, 0, a, n);
+}
+
+/*
+ * Check whether an atom is or depends on one of the atoms lo ... hi.
+ */
+static bool atomUses(Context *ctx, uint32_t id, uint32_t lo, uint32_t hi)
+{
+    if (id < lo)
+        return false;
+    if (id <= hi)
+        return true;
+    if (ctx->marks[id] >> 1 == ctx->stamp)
+        return ctx->marks[id] & 1;
+    
+    const Atom *atom = &ctx->atoms[id];
+    bool uses = false;
+    for (int i = 0; i < 2 && !uses; ++i) {
+        const Poly *p = i == 0 ? atom->a : atom->b;
+        for (long t = 0; p != NULL && t < p->count && !uses; ++t) {
+            for (uint32_t f = 0; f < p->terms[t].length && !uses; ++f)
+                uses = atomUses(ctx, p->terms[t].factors[f].atom, lo, hi);
+        }
+    }
+    ctx->marks[id] = ctx->stamp << 1 | uses;
+    return uses;
+}
+
+/*
+ * Start a query of atomUses, the marks are valid until new atoms are made.
+ */
+static void startQuery(Context *ctx)
+{
+    if (ctx->markCapacity < ctx->atomCount) {
+        free(ctx->marks);
+        ctx->markCapacity = ctx->atomCapacity;
+        ctx->marks = allocateZeroed(ctx->markCapacity, sizeof(uint64_t));
+    }
+    ++ctx->stamp;
+}
+
+/*
+ * Check whether a polynomial depends on any of the atoms lo ... hi.
+ */
+static bool usesRange(Context *ctx, const Poly *p, uint32_t lo, uint32_t hi)
+{
+    startQuery(ctx);
+    for (long t = 0; t < p->count; ++t) {
+        for (uint32_t f = 0; f < p->terms[t].length; ++f) {
+            if (atomUses(ctx, p->terms[t].factors[f].atom, lo, hi))
+                return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Prepare the replacement of the atoms lo ... hi.
+ */
+static void startSubstitution(Context *ctx, Substitution *sub, uint32_t lo, uint32_t hi,
+        const Poly **by)
+{
+    sub->lo = lo;
+    sub->hi = hi;
+    sub->by = by;
+    sub->limit = ctx->atomCount;
+    sub->capacity = 64;
+    sub->used = 0;
+    sub->keys = allocateZeroed(sub->capacity, sizeof(uint32_t));
+    sub->memo = allocate(sub->capacity * sizeof(Poly *));
+}
+
+static void endSubstitution(Substitution *sub)
+{
+    free(sub->keys);
+    free(sub->memo);
+}
+
+/*
+ * Find the entry of an atom in the memo of a substitution.
+ * RETURN   index of the entry, its key is 0 if the atom is not memoised
+ */
+static uint32_t findSymbol(const Substitution *sub, uint32_t id)
+{
+    uint32_t mask = sub->capacity - 1;
+    uint32_t index = (id * 0x9e3779b1u) & mask;
+    while (sub->keys[index] != 0 && sub->keys[index] != id + 1)
+        index = (index + 1) & mask;
+    return index;
+}
+
+/*
+ * Memoise the result of an atom, keeping the memo at most half full.
+ */
+static void storeSymbol(Substitution *sub, uint32_t id, const Poly *res)
+{
+    if (2 * (sub->used + 1) > sub->capacity) {
+        uint32_t *keys = sub->keys;
+        const Poly **memo = sub->memo;
+        uint32_t capacity = sub->capacity;
+        sub->capacity *= 2;
+        sub->keys = allocateZeroed(sub->capacity, sizeof(uint32_t));
+        sub->memo = allocate(sub->capacity * sizeof(Poly *));
+        for (uint32_t i = 0; i < capacity; ++i) {
+            if (keys[i] != 0) {
+                uint32_t index = findSymbol(sub, keys[i] - 1);
+                sub->keys[index] = keys[i];
+                sub->memo[index] = memo[i];
+            }
+        }
+        free(keys);
+        free(memo);
+    }
+    uint32_t index = findSymbol(sub, id);
+    sub->keys[index] = id + 1;
+    sub->memo[index] = res;
+    ++sub->used;
+}
+
+static const Poly *substitute(Context *ctx, Substitution *sub, const Poly *p);
+
+/*
+ * Apply a substitution to an atom.
+ * RETURN   replacement of the atom, NULL if it stays unchanged
+ */
+static const Poly *substituteAtom(Context *ctx, Substitution *sub, uint32_t id)
+{
+    if (id < sub->lo || id >= sub->limit)
+        return NULL;
+    if (id <= sub->hi)
+        return sub->by[id - sub->lo];
+    uint32_t index = findSymbol(sub, id);
+    if (sub->keys[index] != 0)
+        return sub->memo[index];
+    
+    // the atom is copied, as new atoms may move the array
+    Atom atom = ctx->atoms[id];
+    const Poly *a = atom.a != NULL ? substitute(ctx, sub, atom.a) : NULL;
+    const Poly *b = atom.b != NULL ? substitute(ctx, sub, atom.b) : NULL;
+    const Poly *res = NULL;
+    if (ctx->failed) {
+        res = NULL;
+    } else if (a != atom.a || b != atom.b) {
+        switch (atom.kind) {
+        case ATOM_POW:
+            res = makePow(ctx, a, b);
+            break;
+        case ATOM_BINOM:
+            res = makeBinom(ctx, a, atom.n);
+            break;
+        case ATOM_GEOM:
+            res = makeGeom(ctx, a, b);
+            break;
+        case ATOM_MONUS:
+            res = makeMonus(ctx, a, b);
+            break;
+        case ATOM_POSITIVE:
+            res = makePositive(ctx, a);
+            break;
+        default:
+            res = makeZero(ctx, a);
+            break;
+        }
+    }
+    storeSymbol(sub, id, res);
+    return res;
+}
+
+/*
+ * Apply a substitution to a polynomial.
+ * RETURN   the polynomial itself if no atom changes, NULL on failure
+ */
+static const Poly *substitute(Context *ctx, Substitution *sub, const Poly *p)
+{
+    if (p == NULL)
+        return NULL;
+    bool changed = false;
+    for (long t = 0; t < p->count && !changed; ++t) {
+        for (uint32_t f = 0; f < p->terms[t].length && !changed; ++f)
+            changed = substituteAtom(ctx, sub, p->terms[t].factors[f].atom) != NULL;
+    }
+    if (ctx->failed)
+        return NULL;
+    if (!changed)
+        return p;
+    
+    // every term is split into its kept factors and the replaced ones
+    const Poly *sum = ctx->zero;
+    for (long t = 0; t < p->count && sum != NULL; ++t) {
+        const Term *term = &p->terms[t];
+        Factor *kept = arenaAlloc(ctx, term->length * sizeof(Factor));
+        Poly *product = newPoly(ctx, 1);
+        product->terms[0] = (Term){ term->coef, 0, kept };
+        for (uint32_t f = 0; f < term->length; ++f) {
+            if (substituteAtom(ctx, sub, term->factors[f].atom) == NULL)
+                kept[product->terms[0].length++] = term->factors[f];
+        }
+        const Poly *res = finishPoly(ctx, product);
+        for (uint32_t f = 0; f < term->length && res != NULL; ++f) {
+            const Poly *by = substituteAtom(ctx, sub, term->factors[f].atom);
+            if (by != NULL)
+                res = polyMul(ctx, res, polyPow(ctx, by, term->factors[f].power));
+        }
+        sum = polyAdd(ctx, sum, res);
+    }
+    return sum;
+}
+
+/*
+ * Multiply a polynomial in the iteration counter k, given by its
+ * coefficients c[j] of C(k, j), by C(k, b). As
+ * C(k, a) * C(k, b) = sum over i of (a + b - i)! / (i! (a - i)! (b - i)!) * C(k, a + b - i),
+ * the product has natural coefficients again.
+ * ARGS     c      - coefficients, SYMBOLIC_MAX_DEGREE + 1 of them
+ *          degree - highest index of a non-zero coefficient, updated
+ *          b      - index of the factor
+ * RETURN   false if the product exceeds SYMBOLIC_MAX_DEGREE
+ */
+static bool multiplyBasis(Value *c, long *degree, long b)
+{
+    if (*degree + b > SYMBOLIC_MAX_DEGREE)
+        return false;
+    Value res[SYMBOLIC_MAX_DEGREE + 1] = { 0 };
+    for (long a = 0; a <= *degree; ++a) {
+        if (c[a] == 0)
+            continue;
+        for (long i = 0; i <= a && i <= b; ++i) {
+            Value first = binomialValue((Value)(a + b - i), b);
+            Value second = binomialValue((Value)b, i);
+            Value factor = valueMul(first, second);
+            Value product = valueMul(c[a], factor);
+            Value sum = valueAdd(res[a + b - i], product);
+            valueRelease(first);
+            valueRelease(second);
+            valueRelease(factor);
+            valueRelease(product);
+            valueRelease(res[a + b - i]);
+            res[a + b - i] = sum;
+        }
+    }
+    for (long j = 0; j <= *degree + b; ++j) {
+        if (j <= *degree)
+            valueRelease(c[j]);
+        c[j] = res[j];
+    }
+    *degree += b;
+    return true;
+}
+
+/*
+ * Sum a polynomial over the iteration counter k from 0 to k - 1. The
+ * polynomial may depend on k by the atoms k, C(k, j), [k > 0] and [k = 0]
+ * only. Using C(0, j) + ... + C(k - 1, j) = C(k, j + 1), the sum is a
+ * polynomial of the same kind.
+ * ARGS     ctx   - context of the execution
+ *          p     - summand
+ *          index - number of the atom k
+ * RETURN   sum, NULL if the summand depends on k in any other way
+ */
+static const Poly *sumOverIndex(Context *ctx, const Poly *p, uint32_t index)
+{
+    const Poly *k = NULL;
+    const Poly *sum = ctx->zero;
+    for (long t = 0; t < p->count && sum != NULL; ++t) {
+        const Term *term = &p->terms[t];
+        Value c[SYMBOLIC_MAX_DEGREE + 1] = { 1 };
+        long degree = 0;
+        bool positive = false, zero = false;
+        
+        // split the monomial into factors independent of k and the rest
+        Factor *kept = arenaAlloc(ctx, term->length * sizeof(Factor));
+        uint32_t length = 0;
+        for (uint32_t f = 0; f < term->length; ++f) {
+            uint32_t id = term->factors[f].atom;
+            const Atom *atom = &ctx->atoms[id];
+            long inner = atom->a != NULL ? singleAtom(atom->a) : -1;
+            bool ok = true;
+            if (id == index) {
+                for (uint32_t i = 0; i < term->factors[f].power && ok; ++i)
+                    ok = multiplyBasis(c, &degree, 1);
+            } else if (atom->kind == ATOM_BINOM && inner == (long)index) {
+                for (uint32_t i = 0; i < term->factors[f].power && ok; ++i)
+                    ok = multiplyBasis(c, &degree, atom->n);
+            } else if (atom->kind == ATOM_POSITIVE && inner == (long)index) {
+                positive = true;
+            } else if (atom->kind == ATOM_ZERO && inner == (long)index) {
+                zero = true;
+            } else {
+                startQuery(ctx);
+                if (atomUses(ctx, id, index, index))
+                    ok = false;
+                kept[length++] = term->factors[f];
+            }
+            if (!ok) {
+                for (long j = 0; j <= degree; ++j)
+                    valueRelease(c[j]);
+                return NULL;
+            }
+        }
+        if (positive && zero) {
+            for (long j = 0; j <= degree; ++j)
+                valueRelease(c[j]);
+            continue;
+        }
+        
+        // [i > 0] only drops the summand i = 0, [i = 0] keeps only that one
+        Poly *coef = newPoly(ctx, 1);
+        coef->terms[0] = (Term){ term->coef, length, kept };
+        const Poly *factor = finishPoly(ctx, coef);
+        if (k == NULL)
+            k = atomPoly(ctx, ATOM_INDEX, ctx->atoms[index].n, ctx->atoms[index].serial, NULL, NULL);
+        const Poly *summed = ctx->zero;
+        for (long j = 0; j <= degree; ++j) {
+            const Poly *basis;
+            if (c[j] == 0)
+                continue;
+            if (zero)
+                basis = j == 0 ? makePositive(ctx, k) : ctx->zero;
+            else if (positive && j == 0)
+                basis = makeMonus(ctx, k, ctx->one);
+            else
+                basis = makeBinom(ctx, k, j + 1);
+            summed = polyAdd(ctx, summed, polyMul(ctx, polyConstant(ctx, c[j]), basis));
+        }
+        sum = polyAdd(ctx, sum, polyMul(ctx, factor, summed));
+    }
+    return sum;
+}
+
+static bool executeSequence(Context *ctx, const Poly **state, NodeIndex node);
+
+/*
+ * Collect the atoms lo ... hi an atom is or depends on, each of them once.
+ */
+static void collectAtoms(Context *ctx, uint32_t id, uint32_t lo, uint32_t hi, long *list, long *count)
+{
+    if (id < lo || ctx->marks[id] >> 1 == ctx->stamp)
+        return;
+    ctx->marks[id] = ctx->stamp << 1;
+    if (id <= hi) {
+        list[(*count)++] = id - lo;
+        return;
+    }
+    const Atom *atom = &ctx->atoms[id];
+    for (int i = 0; i < 2; ++i) {
+        const Poly *p = i == 0 ? atom->a : atom->b;
+        for (long t = 0; p != NULL && t < p->count; ++t) {
+            for (uint32_t f = 0; f < p->terms[t].length; ++f)
+                collectAtoms(ctx, p->terms[t].factors[f].atom, lo, hi, list, count);
+        }
+    }
+}
+
+/*
+ * Collect the atoms lo ... hi a polynomial depends on.
+ * ARGS     ctx  - context of the execution
+ *          p    - polynomial
+ *          lo   - first atom collected
+ *          hi   - last atom collected
+ *          list - destination of the atoms minus lo, room for hi - lo + 1
+ * RETURN   number of atoms collected
+ */
+static long collectSymbols(Context *ctx, const Poly *p, uint32_t lo, uint32_t hi, long *list)
+{
+    long count = 0;
+    startQuery(ctx);
+    for (long t = 0; t < p->count; ++t) {
+        for (uint32_t f = 0; f < p->terms[t].length; ++f)
+            collectAtoms(ctx, p->terms[t].factors[f].atom, lo, hi, list, &count);
+    }
+    return count;
+}
+
+/*
+ * Solve the recurrence of a single variable written by a LOOP, once all
+ * other variables it depends on are solved.
+ * ARGS     ctx   - context of the execution
+ *          rec   - recurrences of the LOOP
+ *          w     - index of the variable among the written ones
+ *          deps  - indices of the variables its new value depends on
+ *          count - number of dependencies
+ * RETURN   closed form of the variable after k iterations, NULL if the
+ *          recurrence is outside the supported class
+ */
+static const Poly *solveVariable(Context *ctx, Recurrences *rec, long w, const long *deps, long count)
+{
+    long slot = rec->written[w];
+    uint32_t symbol = rec->lo + (uint32_t)w;
+    const Poly *f = rec->next[w];
+    Substitution sub;
+    bool self = false;
+    for (long d = 0; d < count; ++d)
+        self = self || deps[d] == w;
+    
+    if (!self) {
+        // independent of its old value, the variable holds its initial value
+        // before the first iteration and a function of the values of the
+        // previous iteration afterwards
+        const Poly *by[1] = { rec->previousIndex };
+        startSubstitution(ctx, &sub, rec->index, rec->index, by);
+        for (long d = 0; d < count; ++d) {
+            if (rec->previous[deps[d]] == NULL)
+                rec->previous[deps[d]] = substitute(ctx, &sub, rec->closed[deps[d]]);
+        }
+        endSubstitution(&sub);
+        startSubstitution(ctx, &sub, rec->lo, rec->hi, rec->previous);
+        const Poly *value = substitute(ctx, &sub, f);
+        endSubstitution(&sub);
+        return polyAdd(ctx, polyMul(ctx, makeZero(ctx, rec->k), rec->state[slot]),
+                polyMul(ctx, makePositive(ctx, rec->k), value));
+    }
+    
+    // decreased by an invariant amount, x := x - q
+    long single = singleAtom(f);
+    if (single >= 0 && ctx->atoms[single].kind == ATOM_MONUS && singleAtom(ctx->atoms[single].a) == (long)symbol
+            && !usesRange(ctx, ctx->atoms[single].b, rec->lo, rec->index))
+        return makeMonus(ctx, rec->state[slot], polyMul(ctx, rec->k, ctx->atoms[single].b));
+    
+    // split the new value into a * x + e
+    Term *factor = allocate(f->count * sizeof(Term));
+    Term *offset = allocate(f->count * sizeof(Term));
+    long factors = 0, offsets = 0;
+    bool linear = true;
+    for (long t = 0; t < f->count && linear; ++t) {
+        const Term *term = &f->terms[t];
+        uint32_t at = 0;
+        while (at < term->length && term->factors[at].atom != symbol)
+            ++at;
+        if (at == term->length) {
+            offset[offsets++] = *term;
+        } else if (term->factors[at].power > 1) {
+            linear = false;
+        } else {
+            Factor *rest = arenaAlloc(ctx, term->length * sizeof(Factor));
+            memcpy(rest, term->factors, at * sizeof(Factor));
+            memcpy(rest + at, term->factors + at + 1, (term->length - at - 1) * sizeof(Factor));
+            factor[factors++] = (Term){ term->coef, term->length - 1, rest };
+        }
+    }
+    const Poly *a = linear ? polyFromTerms(ctx, factor, factors) : NULL;
+    const Poly *e = linear ? polyFromTerms(ctx, offset, offsets) : NULL;
+    free(factor);
+    free(offset);
+    if (ctx->failed)
+        return NULL;
+    if (!linear || usesRange(ctx, a, symbol, symbol) || usesRange(ctx, e, symbol, symbol))
+        return fail(ctx, "variable updated non-linearly in LOOP", rec->node, slot);
+    if (usesRange(ctx, a, rec->lo, rec->index))
+        return fail(ctx, "variable multiplied by a value changing in LOOP", rec->node, slot);
+    
+    startSubstitution(ctx, &sub, rec->lo, rec->hi, rec->closed);
+    const Poly *increment = substitute(ctx, &sub, e);
+    endSubstitution(&sub);
+    Value one;
+    if (increment == NULL)
+        return NULL;
+    if (isConstant(a, &one) && one == 1) {
+        // x := x + e(k)
+        const Poly *sum = sumOverIndex(ctx, increment, rec->index);
+        if (sum == NULL)
+            return fail(ctx, "variable increased by an unsupported amount in LOOP", rec->node, slot);
+        return polyAdd(ctx, rec->state[slot], sum);
+    }
+    if (usesRange(ctx, increment, rec->lo, rec->index))
+        return fail(ctx, "variable multiplied and increased by a value changing in LOOP", rec->node, slot);
+    
+    // x := a * x + e
+    return polyAdd(ctx, polyMul(ctx, makePow(ctx, a, rec->k), rec->state[slot]),
+            polyMul(ctx, increment, makeGeom(ctx, a, rec->k)));
+}
+
+/*
+ * Solve the recurrences of the variables written by a LOOP, see symbolic.h.
+ * The state is only changed if all of them are solved.
+ * ARGS     ctx     - context of the execution
+ *          state   - closed form of every variable before the LOOP
+ *          node    - the LOOP
+ *          limit   - closed form of the number of iterations
+ *          written - slots of the variables written in the body
+ *          width   - number of written variables
+ * RETURN   false if any recurrence is outside the supported class
+ */
+static bool solveRecurrences(Context *ctx, const Poly **state, NodeIndex node, const Poly *limit,
+        const long *written, long width)
+{
+    const Loop *loop = &programNode(ctx->prog, node)->as.loop;
+    long slots = ctx->vars->count;
+    long serial = ++ctx->serial;
+    Recurrences rec;
+    rec.node = node;
+    rec.state = state;
+    rec.written = written;
+    
+    // symbols lo ... hi stand for the written variables, index for k
+    const Poly **inner = allocate(slots * sizeof(Poly *));
+    memcpy(inner, state, slots * sizeof(Poly *));
+    rec.lo = ctx->atomCount;
+    for (long w = 0; w < width; ++w)
+        inner[written[w]] = atomPoly(ctx, ATOM_SYMBOL, written[w], serial, NULL, NULL);
+    rec.hi = rec.lo + (uint32_t)width - 1;
+    rec.k = atomPoly(ctx, ATOM_INDEX, 0, serial, NULL, NULL);
+    rec.index = rec.hi + 1;
+    rec.previousIndex = makeMonus(ctx, rec.k, ctx->one);
+    rec.next = allocate(width * sizeof(Poly *));
+    rec.closed = allocateZeroed(width, sizeof(Poly *));
+    rec.previous = allocateZeroed(width, sizeof(Poly *));
+    
+    // dependencies of every variable in one array, the variables depending
+    // on a variable in another one
+    long *offsets = allocateZeroed(width + 1, sizeof(long));
+    long *pending = allocateZeroed(width, sizeof(long));
+    long *firstUser = allocateZeroed(width + 1, sizeof(long));
+    long *order = allocate(width * sizeof(long));
+    long capacity = width, edges = 0;
+    long *deps = allocate(capacity * sizeof(long));
+    long *users = NULL;
+    long solved = 0, queued = 0;
+    if (executeSequence(ctx, inner, loop->body)) {
+        for (long w = 0; w < width; ++w) {
+            rec.next[w] = inner[written[w]];
+            if (capacity - edges < width) {
+                capacity = 2 * capacity + width;
+                deps = reallocate(deps, capacity, sizeof(long));
+            }
+            edges += collectSymbols(ctx, rec.next[w], rec.lo, rec.hi, deps + edges);
+            offsets[w + 1] = edges;
+            for (long d = offsets[w]; d < edges; ++d) {
+                if (deps[d] != w) {
+                    ++pending[w];
+                    ++firstUser[deps[d] + 1];
+                }
+            }
+            if (pending[w] == 0)
+                order[queued++] = w;
+        }
+        for (long w = 0; w < width; ++w)
+            firstUser[w + 1] += firstUser[w];
+        users = allocate((edges > 0 ? edges : 1) * sizeof(long));
+        long *fill = allocate(width * sizeof(long));
+        memcpy(fill, firstUser, width * sizeof(long));
+        for (long w = 0; w < width; ++w) {
+            for (long d = offsets[w]; d < offsets[w + 1]; ++d) {
+                if (deps[d] != w)
+                    users[fill[deps[d]]++] = w;
+            }
+        }
+        free(fill);
+    }
+    
+    // solve the variables in topological order of their dependencies
+    while (solved < queued && !ctx->failed) {
+        long w = order[solved++];
+        rec.closed[w] = solveVariable(ctx, &rec, w, deps + offsets[w], offsets[w + 1] - offsets[w]);
+        if (rec.closed[w] == NULL) {
+            fail(ctx, "variable without closed form in LOOP", node, written[w]);
+            break;
+        }
+        for (long u = firstUser[w]; u < firstUser[w + 1]; ++u) {
+            if (--pending[users[u]] == 0)
+                order[queued++] = users[u];
+        }
+    }
+    for (long w = 0; w < width && !ctx->failed; ++w) {
+        if (pending[w] > 0)
+            fail(ctx, "variables depending on each other cyclically in LOOP", node, written[w]);
+    }
+    
+    // instantiate the closed forms for the number of iterations
+    if (!ctx->failed) {
+        Substitution sub;
+        const Poly *by[1] = { limit };
+        startSubstitution(ctx, &sub, rec.index, rec.index, by);
+        for (long w = 0; w < width && !ctx->failed; ++w) {
+            rec.closed[w] = substitute(ctx, &sub, rec.closed[w]);
+            if (rec.closed[w] != NULL && usesRange(ctx, rec.closed[w], rec.lo, rec.index))
+                fail(ctx, "variable without closed form in LOOP", node, written[w]);
+        }
+        endSubstitution(&sub);
+        for (long w = 0; w < width && !ctx->failed; ++w)
+            state[written[w]] = rec.closed[w];
+    }
+    free(inner);
+    free(rec.next);
+    free(rec.closed);
+    free(rec.previous);
+    free(offsets);
+    free(pending);
+    free(firstUser);
+    free(order);
+    free(deps);
+    free(users);
+    return !ctx->failed;
+}
+
+/*
+ * Collect the variables written by a range of statements including the
+ * bodies of the macros called, each macro body is scanned once.
+ * ARGS     ctx       - context of the execution
+ *          body      - first statement of the range
+ *          end       - one past the last statement of the range
+ *          isWritten - flag of every slot, updated
+ *          written   - slots written, appended to
+ *          width     - number of slots written, updated
+ */
+static void collectWritten(Context *ctx, NodeIndex body, NodeIndex end, bool *isWritten, long *written,
+        long *width)
+{
+    const Program *prog = ctx->prog;
+    bool *scanned = NULL;
+    NodeIndex *ranges = NULL;
+    long count = 1, capacity = 0;
+    NodeIndex first = body, last = end;
+    for (;;) {
+        for (NodeIndex i = first; i < last; ++i) {
+            const Statement *stat = programNode(prog, i);
+            if (stat->type == STAT_ASSIGNMENT && !isWritten[stat->as.assignment.lvalue]) {
+                isWritten[stat->as.assignment.lvalue] = true;
+                written[(*width)++] = stat->as.assignment.lvalue;
+            } else if (stat->type == STAT_CALL) {
+                if (scanned == NULL)
+                    scanned = allocateZeroed(prog->count, sizeof(bool));
+                if (scanned[stat->as.call.body])
+                    continue;
+                scanned[stat->as.call.body] = true;
+                if (2 * count >= capacity) {
+                    capacity = capacity > 0 ? 2 * capacity : 64;
+                    ranges = reallocate(ranges, capacity, sizeof(NodeIndex));
+                }
+                ranges[2 * count - 2] = stat->as.call.body;
+                ranges[2 * count - 1] = stat->as.call.end;
+                ++count;
+            }
+        }
+        if (--count == 0)
+            break;
+        first = ranges[2 * count - 2];
+        last = ranges[2 * count - 1];
+    }
+    free(ranges);
+    free(scanned);
+}
+
+/*
+ * Execute a LOOP symbolically, solving it in closed form or unrolling it if
+ * it runs a small constant number of iterations.
+ * ARGS     ctx   - context of the execution
+ *          state - closed form of every variable, updated
+ *          node  - the LOOP
+ */
+static void executeLoop(Context *ctx, const Poly **state, NodeIndex node)
+{
+    const Loop *loop = &programNode(ctx->prog, node)->as.loop;
+    const Poly *limit = state[loop->var];
+    Value count = 0;
+    bool constant = isConstant(limit, &count);
+    if (constant && count == 0)
+        return;
+    if (ctx->depth == SYMBOLIC_MAX_DEPTH) {
+        ctx->exhausted = true;
+        fail(ctx, "LOOPs nested too deeply", node, -1);
+        return;
+    }
+    
+    long slots = ctx->vars->count;
+    long *written = allocate(slots * sizeof(long));
+    bool *isWritten = allocateZeroed(slots, sizeof(bool));
+    long width = 0;
+    collectWritten(ctx, loop->body, loop->end, isWritten, written, &width);
+    
+    ++ctx->depth;
+    if (width > 0 && !solveRecurrences(ctx, state, node, limit, written, width) && !ctx->exhausted
+            && constant && count <= SYMBOLIC_UNROLL) {
+        ctx->failed = false;
+        for (Value i = 0; i < count && !ctx->failed; ++i)
+            executeSequence(ctx, state, loop->body);
+    }
+    --ctx->depth;
+    free(written);
+    free(isWritten);
+}
+
+/*
+ * Execute a sequence of statements symbolically, the body of a macro called
+ * like a LOOP running once.
+ * ARGS     ctx   - context of the execution
+ *          state - closed form of every variable, updated
+ *          node  - first statement of the sequence
+ * RETURN   false if the program has no closed form
+ */
+static bool executeSequence(Context *ctx, const Poly **state, NodeIndex node)
+{
+    for (; node != NODE_NONE && !ctx->failed; node = programNode(ctx->prog, node)->next) {
+        const Statement *stat = programNode(ctx->prog, node);
+        if (stat->type == STAT_LOOP) {
+            executeLoop(ctx, state, node);
+        } else if (stat->type == STAT_CALL) {
+            if (ctx->depth == SYMBOLIC_MAX_DEPTH) {
+                ctx->exhausted = true;
+                fail(ctx, "LOOPs nested too deeply", node, -1);
+                break;
+            }
+            ++ctx->depth;
+            executeSequence(ctx, state, stat->as.call.body);
+            --ctx->depth;
+        } else {
+            const Assignment *ass = &stat->as.assignment;
+            const Poly *nat = polyConstant(ctx, valueRetain(ass->nat));
+            state[ass->lvalue] = ass->isAddition ? polyAdd(ctx, state[ass->rvalue], nat)
+                    : makeMonus(ctx, state[ass->rvalue], nat);
+        }
+        if (ctx->failed && ctx->failure.line == 0)
+            ctx->failure.line = ctx->prog->lines[node];
+    }
+    return !ctx->failed;
+}
+
+/*
+ * Release everything allocated by the context.
+ */
+static void releaseContext(Context *ctx)
+{
+    while (ctx->chunks != NULL) {
+        ArenaChunk *next = ctx->chunks->next;
+        free(ctx->chunks);
+        ctx->chunks = next;
+    }
+    free(ctx->atoms);
+    free(ctx->table);
+    free(ctx->marks);
+}
+
+/*
+ * Derive the closed forms of all variables written by a program.
+ * ARGS     prog    - parsed program, not modified
+ *          vars    - variable table the program was parsed with
+ *          failure - destination of the reason if there is no closed form
+ * RETURN   pointer to the newly allocated closed forms, NULL if any written
+ *          variable lies outside the supported class
+ */
+ClosedForm *compileClosedForm(const Program *prog, const VariableTable *vars,
+        SymbolicFailure *failure)
+{
+    // input check
+    if (prog == NULL || vars == NULL || failure == NULL) {
+        fprintf(stderr, "ERROR: cannot solve missing program\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    ClosedForm *form = allocateZeroed(1, sizeof(ClosedForm));
+    Context *ctx = &form->ctx;
+    ctx->prog = prog;
+    ctx->vars = vars;
+    ctx->atomCapacity = 64;
+    ctx->atoms = allocate(ctx->atomCapacity * sizeof(Atom));
+    ctx->tableSize = 128;
+    ctx->table = allocateZeroed(ctx->tableSize, sizeof(uint32_t));
+    ctx->budget = SYMBOLIC_BUDGET;
+    ctx->zero = finishPoly(ctx, newPoly(ctx, 0));
+    ctx->one = polyConstant(ctx, 1);
+    
+    // every variable starts as its initial value, x0 is atom 0, the hidden
+    // variables of macros start as zero
+    long slots = vars->count;
+    const Poly **initial = allocate(slots * sizeof(Poly *));
+    form->slots = slots;
+    form->forms = allocate(slots * sizeof(Poly *));
+    for (long s = 0; s < slots; ++s) {
+        initial[s] = form->forms[s] = vars->ids[s] < 0 ? ctx->zero
+                : atomPoly(ctx, ATOM_INPUT, s, 0, NULL, NULL);
+    }
+    if (!executeSequence(ctx, form->forms, prog->first)) {
+        *failure = ctx->failure;
+        free(initial);
+        freeClosedForm(form);
+        return NULL;
+    }
+    for (long s = 0; s < slots; ++s) {
+        if (polyEqual(form->forms[s], initial[s]))
+            form->forms[s] = NULL;
+    }
+    free(initial);
+    
+    Substitution sub;
+    const Poly *by[1] = { ctx->zero };
+    startSubstitution(ctx, &sub, 0, 0, by);
+    form->output = substitute(ctx, &sub, form->forms[0] != NULL ? form->forms[0] : ctx->zero);
+    endSubstitution(&sub);
+    return form;
+}
+
+static void printPoly(FILE *stream, const Context *ctx, const Poly *p);
+
+/*
+ * Print a polynomial as operand, in parentheses unless it is a constant or
+ * a single variable.
+ */
+static void printOperand(FILE *stream, const Context *ctx, const Poly *p)
+{
+    Value v;
+    long atom = singleAtom(p);
+    bool plain = isConstant(p, &v) || (atom >= 0 && ctx->atoms[atom].kind == ATOM_INPUT);
+    if (!plain)
+        fputc('(', stream);
+    printPoly(stream, ctx, p);
+    if (!plain)
+        fputc(')', stream);
+}
+
+/*
+ * Print an atom raised to a power.
+ */
+static void printFactor(FILE *stream, const Context *ctx, Factor factor)
+{
+    const Atom *atom = &ctx->atoms[factor.atom];
+    bool wrapped = atom->kind == ATOM_POW && factor.power > 1;
+    if (wrapped)
+        fputc('(', stream);
+    switch (atom->kind) {
+    case ATOM_INPUT:
+        fprintf(stream, "x%ld", ctx->vars->ids[atom->n]);
+        break;
+    case ATOM_SYMBOL:
+        fprintf(stream, "x%ld'", ctx->vars->ids[atom->n]);
+        break;
+    case ATOM_INDEX:
+        fputc('k', stream);
+        break;
+    case ATOM_POW:
+        printOperand(stream, ctx, atom->a);
+        fputc('^', stream);
+        printOperand(stream, ctx, atom->b);
+        break;
+    case ATOM_BINOM:
+        fputs("C(", stream);
+        printPoly(stream, ctx, atom->a);
+        fprintf(stream, ", %ld)", atom->n);
+        break;
+    case ATOM_GEOM:
+        fputs("geom(", stream);
+        printPoly(stream, ctx, atom->a);
+        fputs(", ", stream);
+        printPoly(stream, ctx, atom->b);
+        fputc(')', stream);
+        break;
+    case ATOM_MONUS:
+        fputs("max(", stream);
+        printPoly(stream, ctx, atom->a);
+        fputs(" - ", stream);
+        if (atom->b->count > 1)
+            printOperand(stream, ctx, atom->b);
+        else
+            printPoly(stream, ctx, atom->b);
+        fputs(", 0)", stream);
+        break;
+    case ATOM_POSITIVE:
+    case ATOM_ZERO:
+        fputc('[', stream);
+        printPoly(stream, ctx, atom->a);
+        fputs(atom->kind == ATOM_POSITIVE ? " > 0]" : " = 0]", stream);
+        break;
+    }
+    if (wrapped)
+        fputc(')', stream);
+    if (factor.power > 1)
+        fprintf(stream, "^%u", factor.power);
+}
+
+/*
+ * Print a polynomial, terms of higher degree first.
+ */
+static void printPoly(FILE *stream, const Context *ctx, const Poly *p)
+{
+    if (p->count == 0)
+        fputc('0', stream);
+    for (long t = p->count - 1; t >= 0; --t) {
+        const Term *term = &p->terms[t];
+        bool coef = term->coef != 1 || term->length == 0;
+        if (t < p->count - 1)
+            fputs(" + ", stream);
+        if (coef)
+            valuePrint(stream, term->coef);
+        for (uint32_t f = 0; f < term->length; ++f) {
+            if (coef || f > 0)
+                fputc('*', stream);
+            printFactor(stream, ctx, term->factors[f]);
+        }
+    }
+}
+
+/*
+ * Print the closed form of x0, assuming it starts as zero.
+ * ARGS     stream - output stream
+ *          form   - closed forms of the program
+ */
+void printClosedForm(FILE *stream, const ClosedForm *form)
+{
+    // input check
+    if (stream == NULL || form == NULL) {
+        fprintf(stderr, "ERROR: cannot print missing closed form\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    fputs("x0 = ", stream);
+    printPoly(stream, &form->ctx, form->output);
+    fputc('\n', stream);
+}
+
+/*
+ * Print the reason for a program having no closed form.
+ * ARGS     stream  - output stream
+ *          failure - reason reported by compileClosedForm
+ */
+void printSymbolicFailure(FILE *stream, const SymbolicFailure *failure)
+{
+    // input check
+    if (stream == NULL || failure == NULL) {
+        fprintf(stderr, "ERROR: cannot print missing failure\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    if (failure->line > 0)
+        fprintf(stream, "%u: ", failure->line);
+    fputs(failure->reason, stream);
+    if (failure->var >= 0)
+        fprintf(stream, " (x%ld)", failure->var);
+}
+
+static Value evaluatePoly(Evaluation *eval, const Poly *p);
+
+/*
+ * Evaluate an atom once per evaluation.
+ * RETURN   borrowed value of the atom
+ */
+static Value evaluateAtom(Evaluation *eval, uint32_t id)
+{
+    if (eval->known[id])
+        return eval->values[id];
+    
+    const Atom *atom = &eval->ctx->atoms[id];
+    Value a = atom->a != NULL ? evaluatePoly(eval, atom->a) : 0;
+    Value b = atom->b != NULL ? evaluatePoly(eval, atom->b) : 0;
+    Value res = 0;
+    bool fits = true;
+    switch (atom->kind) {
+    case ATOM_INPUT:
+        res = valueRetain(eval->regs[atom->n]);
+        break;
+    case ATOM_POW:
+        fits = powerValue(a, b, EVALUATE_BITS, &res);
+        break;
+    case ATOM_BINOM:
+        res = binomialValue(a, atom->n);
+        break;
+    case ATOM_GEOM:
+        fits = geometricValue(a, b, EVALUATE_BITS, &res);
+        break;
+    case ATOM_MONUS:
+        res = valueSub(a, b);
+        break;
+    case ATOM_POSITIVE:
+        res = a != 0;
+        break;
+    case ATOM_ZERO:
+        res = a == 0;
+        break;
+    default:
+        fprintf(stderr, "ERROR: closed form refers to unsolved LOOP\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!fits) {
+        fprintf(stderr, "ERROR: closed form evaluates to a number too large to be stored\n");
+        exit(EXIT_FAILURE);
+    }
+    valueRelease(a);
+    valueRelease(b);
+    eval->values[id] = res;
+    eval->known[id] = true;
+    return res;
+}
+
+/*
+ * Evaluate a polynomial.
+ * RETURN   new reference to the value
+ */
+static Value evaluatePoly(Evaluation *eval, const Poly *p)
+{
+    Value sum = 0;
+    for (long t = 0; t < p->count; ++t) {
+        const Term *term = &p->terms[t];
+        Value product = valueRetain(term->coef);
+        for (uint32_t f = 0; f < term->length && product != 0; ++f) {
+            Value power, res;
+            if (!powerValue(evaluateAtom(eval, term->factors[f].atom), term->factors[f].power,
+                    EVALUATE_BITS, &power)) {
+                fprintf(stderr, "ERROR: closed form evaluates to a number too large to be stored\n");
+                exit(EXIT_FAILURE);
+            }
+            res = valueMul(product, power);
+            valueRelease(product);
+            valueRelease(power);
+            product = res;
+        }
+        Value res = valueAdd(sum, product);
+        valueRelease(sum);
+        valueRelease(product);
+        sum = res;
+    }
+    return sum;
+}
+
+/*
+ * Evaluate the closed forms instead of executing the program.
+ * ARGS     form - closed forms of the program
+ *          regs - initialized register file indexed by variable slots
+ */
+void executeClosedForm(const ClosedForm *form, Value *regs)
+{
+    // input check
+    if (form == NULL || regs == NULL) {
+        fprintf(stderr, "ERROR: cannot evaluate missing closed form\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    // all closed forms refer to the initial values, so the registers are
+    // only updated once every variable is evaluated
+    uint32_t atoms = form->ctx.atomCount;
+    Evaluation eval = { &form->ctx, regs, NULL, NULL };
+    eval.values = allocate(atoms * sizeof(Value));
+    eval.known = allocateZeroed(atoms, sizeof(bool));
+    Value *results = allocate(form->slots * sizeof(Value));
+    for (long s = 0; s < form->slots; ++s)
+        results[s] = form->forms[s] != NULL ? evaluatePoly(&eval, form->forms[s]) : 0;
+    for (long s = 0; s < form->slots; ++s) {
+        if (form->forms[s] != NULL) {
+            valueRelease(regs[s]);
+            regs[s] = results[s];
+        }
+    }
+    for (uint32_t i = 0; i < atoms; ++i) {
+        if (eval.known[i])
+            valueRelease(eval.values[i]);
+    }
+    free(eval.values);
+    free(eval.known);
+    free(results);
+}
+
+/*
+ * Release closed forms.
+ * ARGS     form - closed forms (may be NULL)
+ */
+void freeClosedForm(ClosedForm *form)
+{
+    if (form == NULL)
+        return;
+    releaseContext(&form->ctx);
+    free(form->forms);
+    free(form);
+}
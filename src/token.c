@@ -1,7 +1,7 @@
 /*
  * token.c
  *
- * Simple lexer reading character by character and natural numbers.
+ * Simple lexer scanning a memory mapped or buffered input, see token.h.
  *
  * Tom René Hennig
  */
@@ -11,18 +11,45 @@
  */
 
 #include <ctype.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdlib.h>
 
 #include "token.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#define LEXER_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 
 /******************************************************************************
  *                            GLOBAL DECLARATIONS
  */
 
-static Token buf;               // Buffer for returned tokens in token stream
-static bool bufUsed = false;    // used-flag for token buffer
+#define LEXER_BUFFER_SIZE 65536 // initial size of the input buffer
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * State of the lexer. The input is one contiguous block of memory which is
+ * either mapped or read into a buffer.
+ */
+struct sLexer {
+    const char *pos;        // next unread character
+    const char *end;        // one past the last character
+    const char *lineStart;  // first character of the current line
+    long line;              // number of the current line
+    char *buffer;           // input read from stream (NULL if mapped)
+    void *map;              // mapping of the input file (NULL if buffered)
+    size_t mapSize;         // length of the mapping
+    Token pushed;           // token placed back by pushToken
+    bool hasPushed;         // used-flag for the pushed token
+};
 
 
 /******************************************************************************
@@ -30,12 +57,76 @@ static bool bufUsed = false;    // used-flag for token buffer
  */
 
 /*
- * Read next token from given input stream.
+ * Map the remaining content of a regular file into memory.
+ * ARGUMENTS    lex    - lexer to attach the mapping to
+ *              stream - input stream (libc)
+ * RETURN       false if the stream is no regular file or mapping failed
+ */
+static bool mapStream(Lexer *lex, FILE *stream)
+{
+#ifndef LEXER_MMAP
+    (void)lex;
+    (void)stream;
+    return false;
+#else
+    struct stat st;
+    long offset = ftell(stream);
+    if (offset < 0 || fstat(fileno(stream), &st) != 0 || !S_ISREG(st.st_mode)
+            || st.st_size <= offset)
+        return false;
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(stream), 0);
+    if (map == MAP_FAILED)
+        return false;
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+    
+    lex->map = map;
+    lex->mapSize = (size_t)st.st_size;
+    lex->pos = (const char *)map + offset;
+    lex->end = (const char *)map + st.st_size;
+    fseek(stream, 0, SEEK_END);
+    return true;
+#endif
+}
+
+/*
+ * Read the remaining content of a stream into one buffer.
+ * ARGUMENTS    lex    - lexer to attach the buffer to
+ *              stream - input stream (libc)
+ */
+static void readStream(Lexer *lex, FILE *stream)
+{
+    size_t size = LEXER_BUFFER_SIZE, length = 0, n;
+    char *buffer = malloc(size);
+    if (buffer == NULL) {
+        fprintf(stderr, "ERROR: unable to to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    while ((n = fread(buffer + length, 1, size - length, stream)) > 0) {
+        length += n;
+        if (length == size) {
+            size *= 2;
+            buffer = realloc(buffer, size);
+            if (buffer == NULL) {
+                fprintf(stderr, "ERROR: unable to to allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    if (ferror(stream)) {
+        perror("ERROR: failed to read input");
+        exit(EXIT_FAILURE);
+    }
+    lex->buffer = buffer;
+    lex->pos = buffer;
+    lex->end = buffer + length;
+}
+
+/*
+ * Create a lexer over the remaining content of the stream.
  * ARGUMENTS    stream - input stream (libc)
- * RETURN       token read from input stream with type attribute is guaranteed
- *              to contain reasonable value
+ * RETURN       pointer to the newly allocated lexer
  */
-Token nextToken(FILE *stream)
+Lexer *createLexer(FILE *stream)
 {
     // input check
     if (stream == NULL) {
@@ -43,46 +134,177 @@ Token nextToken(FILE *stream)
         exit(EXIT_FAILURE);
     }
     
+    Lexer *lex = calloc(1, sizeof(Lexer));
+    if (lex == NULL) {
+        fprintf(stderr, "ERROR: unable to to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!mapStream(lex, stream))
+        readStream(lex, stream);
+    lex->lineStart = lex->pos;
+    lex->line = 1;
+    return lex;
+}
+
+/*
+ * Create a lexer over a program text in memory.
+ * ARGUMENTS    text   - program text, not necessarily null terminated
+ *              length - number of characters
+ * RETURN       pointer to the newly allocated lexer
+ */
+Lexer *createTextLexer(const char *text, size_t length)
+{
+    // input check
+    if (text == NULL && length > 0) {
+        fprintf(stderr, "ERROR: invalid text to read from\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    Lexer *lex = calloc(1, sizeof(Lexer));
+    if (lex == NULL) {
+        fprintf(stderr, "ERROR: unable to to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    lex->pos = text;
+    lex->end = text + length;
+    lex->lineStart = lex->pos;
+    lex->line = 1;
+    return lex;
+}
+
+/*
+ * Release the lexer and its input buffer or mapping.
+ * ARGUMENTS    lex - lexer to be freed (may be NULL)
+ */
+void freeLexer(Lexer *lex)
+{
+    if (lex == NULL)
+        return;
+#ifdef LEXER_MMAP
+    if (lex->map != NULL)
+        munmap(lex->map, lex->mapSize);
+#endif
+    free(lex->buffer);
+    free(lex);
+}
+
+/*
+ * Match the remaining characters of a keyword.
+ * ARGUMENTS    lex  - lexer positioned behind the first character
+ *              rest - remaining characters of the keyword
+ *              tok  - token to be completed
+ *              type - token type on success
+ */
+static void matchKeyword(Lexer *lex, const char *rest, Token *tok, TokenType type)
+{
+    for (; *rest != '\0'; ++rest) {
+        if (lex->pos == lex->end || *lex->pos != *rest) {
+            tok->type = TOK_INVALID;
+            tok->value = lex->pos == lex->end ? EOF : *lex->pos++;
+            return;
+        }
+        ++lex->pos;
+    }
+    tok->type = type;
+}
+
+/*
+ * Check whether a character may continue a name.
+ * ARGUMENTS    c - character to be checked
+ * RETURN       true for lower case letters, digits and underscores
+ */
+static inline bool isNameCharacter(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+/*
+ * Read next token of the lexer input.
+ * ARGUMENTS    lex - lexer to read from
+ * RETURN       token read from input with type attribute is guaranteed to
+ *              contain reasonable value
+ */
+Token nextToken(Lexer *lex)
+{
+    // input check
+    if (lex == NULL) {
+        fprintf(stderr, "ERROR: invalid lexer to read from\n");
+        exit(EXIT_FAILURE);
+    }
+    
     // Return buffer content if buffer is used and reset used-flag
-    if (bufUsed) {
-        bufUsed = false;
-        return buf;
+    if (lex->hasPushed) {
+        lex->hasPushed = false;
+        return lex->pushed;
     }
     
-    // Skip leading blanks and whitespace characters
-    int c = fgetc(stream);
-    while (isspace(c) && c != EOF)
-        c = fgetc(stream);
+    // Skip leading blanks and whitespace characters, line breaks only occur
+    // here so counting them is all it takes to track the position
+    const char *p = lex->pos, *end = lex->end;
+    while (p < end && isspace((unsigned char)*p)) {
+        if (*p == '\n') {
+            ++lex->line;
+            lex->lineStart = p + 1;
+        }
+        ++p;
+    }
     
     Token tok;
+    tok.line = lex->line;
+    tok.column = (long)(p - lex->lineStart) + 1;
+    if (p == end) {
+        lex->pos = p;
+        tok.type = TOK_EOF;
+        return tok;
+    }
+    
+    char c = *p++;
+    if (c == 'x' && p < end && isNameCharacter(*p) && (unsigned char)(*p - '0') >= 10)
+        c = 'a';    // a name starting with x, not a variable identifier
     switch (c) {
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g':
+    case 'h': case 'i': case 'j': case 'k': case 'l': case 'm': case 'n':
+    case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'y': case 'z': case '_':   // beginning name
+        tok.type = TOK_NAME;
+        tok.text = p - 1;
+        while (p < end && isNameCharacter(*p))
+            ++p;
+        tok.value = (long)(p - tok.text);
+        break;
     case 'x':       // beginning variable identifier, read identifier number
         tok.type = TOK_VAR_ID;
         tok.value = 0;
-        while (isdigit(c = fgetc(stream))) {
-            tok.value *= 10;
-            tok.value += c - '0';
+        for (; p < end && (unsigned char)(*p - '0') < 10; ++p) {
+            if (tok.value > (LONG_MAX - 9) / 10) {    // identifier too large
+                tok.type = TOK_INVALID;
+                tok.value = (unsigned char)*p++;
+                break;
+            }
+            tok.value = tok.value * 10 + (*p - '0');
         }
-        ungetc(c, stream);
         break;
     case '0': case '1': case '2': case '3': case '4':   // beginning natural
     case '5': case '6': case '7': case '8': case '9':   // number
         tok.type = TOK_NAT_NUM;
-        tok.value = c - '0';
-        while (isdigit(c = fgetc(stream))) {
-            tok.value *= 10;
-            tok.value += c - '0';
+        tok.nat = c - '0';
+        for (; p < end && (unsigned char)(*p - '0') < 10; ++p) {
+            if (tok.nat <= (VALUE_MAX_SMALL - 9) / 10) {
+                tok.nat = tok.nat * 10 + (Value)(*p - '0');
+            } else {
+                // continue on big numbers, program constants are shared
+                Value tmp = valueMul(tok.nat, 10);
+                valueRelease(tok.nat);
+                tok.nat = valueAdd(tmp, (Value)(*p - '0'));
+                valueRelease(tmp);
+            }
         }
-        ungetc(c, stream);
+        tok.nat = valueFreeze(tok.nat);
         break;
     case ':':       // beginning assignment operator
-        if ((c = fgetc(stream)) != '=') {
-            tok.type = TOK_INVALID;
-            tok.value = c;
-            break;
-        }
-        tok.type = TOK_ASS;
-        break;
+        lex->pos = p;
+        matchKeyword(lex, "=", &tok, TOK_ASS);
+        return tok;
     case '+':       // plus operator
         tok.type = TOK_PLUS;
         break;
@@ -93,68 +315,53 @@ Token nextToken(FILE *stream)
         tok.type = TOK_SEM;
         break;
     case 'L':       // beginning keyword 'LOOP'
-        if ((c = fgetc(stream)) != 'O') {
-            tok.type = TOK_INVALID;
-            tok.value = c;
-            break;
-        }
-        if ((c = fgetc(stream)) != 'O') {
-            tok.type = TOK_INVALID;
-            tok.value = c;
-            break;
-        }
-        if ((c = fgetc(stream)) != 'P') {
-            tok.type = TOK_INVALID;
-            tok.value = c;
-            break;
-        }
-        tok.type = TOK_LOOP;
-        break;
+        lex->pos = p;
+        matchKeyword(lex, "OOP", &tok, TOK_LOOP);
+        return tok;
     case 'D':       // beginning keyword 'DO'
-        if ((c = fgetc(stream)) != 'O') {
-            tok.type = TOK_INVALID;
-            tok.value = c;
-            break;
-        }
-        tok.type = TOK_DO;
-        break;
+        lex->pos = p;
+        matchKeyword(lex, "O", &tok, TOK_DO);
+        return tok;
     case 'E':       // beginning keyword 'END'
-        if ((c = fgetc(stream)) != 'N') {
-            tok.type = TOK_INVALID;
-            tok.value = c;
-            break;
-        }
-        if ((c = fgetc(stream)) != 'D') {
-            tok.type = TOK_INVALID;
-            tok.value = c;
-            break;
-        }
-        tok.type = TOK_END;
+        lex->pos = p;
+        matchKeyword(lex, "ND", &tok, TOK_END);
+        return tok;
+    case 'M':       // beginning keyword 'MACRO'
+        lex->pos = p;
+        matchKeyword(lex, "ACRO", &tok, TOK_MACRO);
+        return tok;
+    case '(':       // opening parenthesis
+        tok.type = TOK_LPAREN;
         break;
-    case EOF:       // reached end of file
-        tok.type = TOK_EOF;
+    case ')':       // closing parenthesis
+        tok.type = TOK_RPAREN;
+        break;
+    case ',':       // comma
+        tok.type = TOK_COMMA;
         break;
     default:        // found invalid character
         tok.type = TOK_INVALID;
-        tok.value = c;
+        tok.value = (unsigned char)c;
         break;
     }
+    lex->pos = p;
     return tok;
 }
 
 /*
  * Write token to buffer, if possible.
- * ARGUMENTS    tok - token to be pushed into buffer
+ * ARGUMENTS    lex - lexer the token was read from
+ *              tok - token to be pushed into buffer
  * RETURN       return on success, exit on filled buffer
  */
-void pushToken(Token tok)
+void pushToken(Lexer *lex, Token tok)
 {
-    if (bufUsed) {
+    if (lex->hasPushed) {
         fprintf(stderr, "ERROR: cannot push back more than one token\n");
         exit(EXIT_FAILURE);
     }
-    buf = tok;
-    bufUsed = true;
+    lex->pushed = tok;
+    lex->hasPushed = true;
 }
 
 /*
@@ -176,7 +383,8 @@ void printToken(FILE* stream, Token tok)
         fprintf(stream, "variable identifier x%ld", tok.value);
         break;
     case TOK_NAT_NUM:
-        fprintf(stream, "number %ld", tok.value);
+        fprintf(stream, "number ");
+        valuePrint(stream, tok.nat);
         break;
     case TOK_ASS:
         fprintf(stream, "assignment operator \':=\'");
@@ -199,6 +407,21 @@ void printToken(FILE* stream, Token tok)
     case TOK_END:
         fprintf(stream, "\'END\' keyword");
         break;
+    case TOK_MACRO:
+        fprintf(stream, "\'MACRO\' keyword");
+        break;
+    case TOK_NAME:
+        fprintf(stream, "macro name");
+        break;
+    case TOK_LPAREN:
+        fprintf(stream, "\'(\'");
+        break;
+    case TOK_RPAREN:
+        fprintf(stream, "\')\'");
+        break;
+    case TOK_COMMA:
+        fprintf(stream, "comma");
+        break;
     case TOK_EOF:
         fprintf(stream, "EOF");
         break;
@@ -0,0 +1,607 @@
+/*
+ * transpile.c
+ *
+ * Ahead-of-time backend translating the syntax/semantics tree into a C
+ * function. The function either gets printed for use in other projects or is
+ * compiled into a shared object by the system C compiler and loaded with
+ * dlopen. Shared objects are cached on disk keyed by a hash of the program
+ * text, so recurring programs pay the compilation once. Every macro body
+ * called becomes a static function of its own.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "affine.h"
+#include "exec.h"
+#include "fuse.h"
+#include "hash.h"
+#include "transpile.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SHARED_SUPPORTED
+#include <dlfcn.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+// part of the cache key, change whenever the generated code changes
+#define TRANSPILER_VERSION "loop-transpile-4"
+
+#define MAX_INDENT 32           // deepest indentation of the generated code
+#define MAX_SHARED_DEPTH 4096   // deepest LOOP nesting handed to the compiler
+#define MAX_SHARED_SIZE 2048    // most statements handed to the compiler
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Growable list of pointers into the syntax tree.
+ */
+typedef struct {
+    const void **items;
+    long count;
+    long capacity;
+} PointerList;
+
+/*
+ * State of the code generator.
+ */
+typedef struct {
+    FILE *stream;       // output stream (NULL while only collecting tables)
+    PointerList assignments;    // assignments in program order
+    PointerList affineLoops;    // affine summaries in program order
+    PointerList fusedLoops;     // fused LOOPs in program order
+    long maxDepth;      // deepest LOOP nesting emitted
+} Emitter;
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Append a pointer to a list.
+ * ARGS     list - list to append to
+ *          item - pointer to be appended
+ * RETURN   index of the new entry
+ */
+static long appendPointer(PointerList *list, const void *item)
+{
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity > 0 ? 2 * list->capacity : 64;
+        list->items = realloc(list->items, list->capacity * sizeof(void *));
+        if (list->items == NULL) {
+            fprintf(stderr, "ERROR: unable to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    list->items[list->count] = item;
+    return list->count++;
+}
+
+/*
+ * Print indentation of the given depth. Deeper code stays at the maximum
+ * indentation, so the output grows linearly with the nesting depth.
+ */
+static void indent(Emitter *em, long depth)
+{
+    for (long i = 0; i < depth && i < MAX_INDENT; ++i)
+        fputs("    ", em->stream);
+}
+
+/*
+ * Emit an assignment with the machine word fast path inline.
+ * ARGS     em    - code generator
+ *          ass   - assignment to be translated
+ *          depth - indentation depth
+ */
+static void emitAssignment(Emitter *em, const Assignment *ass, long depth)
+{
+    long index = appendPointer(&em->assignments, ass);
+    if (em->stream == NULL)
+        return;
+    
+    indent(em, depth);
+    unsigned long long nat = ass->nat;
+    if (ass->isAddition && (nat & VALUE_BIG)) {
+        fprintf(em->stream, "rt->assign(r, rt->assignments[%ld]);\n", index);
+    } else if (ass->isAddition) {
+        fprintf(em->stream, "{ Value s = r[%ld], v = s + UINT64_C(%llu); "
+                "if (((s | r[%ld] | v) >> 63) == 0) r[%ld] = v; "
+                "else rt->assign(r, rt->assignments[%ld]); }\n",
+                (long)ass->rvalue, nat, (long)ass->lvalue, (long)ass->lvalue, index);
+    } else if (nat & VALUE_BIG) {
+        fprintf(em->stream, "if (((r[%ld] | r[%ld]) >> 63) == 0) r[%ld] = 0; "
+                "else rt->assign(r, rt->assignments[%ld]);\n",
+                (long)ass->rvalue, (long)ass->lvalue, (long)ass->lvalue, index);
+    } else {
+        fprintf(em->stream, "{ Value s = r[%ld]; "
+                "if (((s | r[%ld]) >> 63) == 0) r[%ld] = s > UINT64_C(%llu) ? s - UINT64_C(%llu) : 0; "
+                "else rt->assign(r, rt->assignments[%ld]); }\n",
+                (long)ass->rvalue, (long)ass->lvalue, (long)ass->lvalue, nat, nat, index);
+    }
+}
+
+/*
+ * Emit a fused LOOP (fuse.h) as a single step with the machine word fast
+ * path inline. Products that do not fit a machine word are left to the host.
+ * ARGS     em    - code generator
+ *          prog  - program holding the LOOP
+ *          loop  - LOOP to be translated
+ *          depth - indentation depth
+ */
+static void emitFused(Emitter *em, const Program *prog, const Loop *loop, long depth)
+{
+    long index = appendPointer(&em->fusedLoops, loop);
+    if (em->stream == NULL)
+        return;
+    
+    const Statement *body = programNode(prog, loop->body);
+    const Assignment *ass = loop->fused == FUSED_MUL_ADD
+            ? &programNode(prog, body->as.loop.body)->as.assignment : &body->as.assignment;
+    unsigned long long k = ass->nat;
+    long a = (long)loop->var, b = (long)ass->lvalue;
+    if (k == 0 && loop->fused != FUSED_ZERO)
+        return;
+    
+    indent(em, depth);
+    if (k & VALUE_BIG) {
+        fprintf(em->stream, "rt->fused(rt->program, rt->fusedLoops[%ld], r);\n", index);
+    } else if (loop->fused == FUSED_ZERO) {
+        fprintf(em->stream, "if ((r[%ld] >> 63) == 0) r[%ld] = 0; "
+                "else rt->fused(rt->program, rt->fusedLoops[%ld], r);\n", a, a, index);
+    } else if (loop->fused == FUSED_ADD_VAR) {
+        fprintf(em->stream, "{ Value n = r[%ld], s = r[%ld]; "
+                "if (((n | s) >> 63) == 0 && n <= (INT64_MAX - s) / UINT64_C(%llu)) r[%ld] = s + n * UINT64_C(%llu); "
+                "else rt->fused(rt->program, rt->fusedLoops[%ld], r); }\n", a, b, k, b, k, index);
+    } else if (loop->fused == FUSED_SUB_VAR) {
+        fprintf(em->stream, "{ Value n = r[%ld], s = r[%ld]; "
+                "if (((n | s) >> 63) == 0) r[%ld] = n < (s + UINT64_C(%llu)) / UINT64_C(%llu) ? s - n * UINT64_C(%llu) : 0; "
+                "else rt->fused(rt->program, rt->fusedLoops[%ld], r); }\n", a, b, b, k - 1, k, k, index);
+    } else {
+        fprintf(em->stream, "{ Value n = r[%ld], m = r[%ld], s = r[%ld]; "
+                "if (((n | m | s) >> 63) == 0 && (m == 0 || n <= (INT64_MAX - s) / UINT64_C(%llu) / m)) "
+                "r[%ld] = s + n * m * UINT64_C(%llu); "
+                "else rt->fused(rt->program, rt->fusedLoops[%ld], r); }\n",
+                a, (long)body->as.loop.var, b, k, b, k, index);
+    }
+}
+
+/*
+ * Emit the head of a LOOP as counted for loop, preceded by its closed form if
+ * affine.
+ * ARGS     em    - code generator
+ *          loop  - LOOP to be translated
+ *          depth - indentation and nesting depth
+ */
+static void openLoop(Emitter *em, const Loop *loop, long depth)
+{
+    long index = loop->affine != NULL ? appendPointer(&em->affineLoops, loop->affine) : -1;
+    if (em->stream == NULL)
+        return;
+    
+    indent(em, depth);
+    fprintf(em->stream, "{\n");
+    indent(em, depth + 1);
+    fprintf(em->stream, "Value l%ld = r[%ld];\n", depth, (long)loop->var);
+    if (index >= 0) {
+        indent(em, depth + 1);
+        fprintf(em->stream, "if (l%ld >= %d) rt->affine(rt->affineLoops[%ld], l%ld, r); else\n",
+                depth, AFFINE_MIN_LIMIT, index, depth);
+    }
+    indent(em, depth + 1);
+    fprintf(em->stream, "for (uint64_t c%ld = (l%ld >> 63) ? UINT64_MAX : l%ld; c%ld > 0; --c%ld) {\n",
+            depth, depth, depth, depth, depth);
+}
+
+/*
+ * Emit the closing braces of a LOOP.
+ * ARGS     em    - code generator
+ *          depth - indentation and nesting depth
+ */
+static void closeLoop(Emitter *em, long depth)
+{
+    if (em->stream == NULL)
+        return;
+    indent(em, depth + 1);
+    fprintf(em->stream, "}\n");
+    indent(em, depth);
+    fprintf(em->stream, "}\n");
+}
+
+/*
+ * Emit all statements of a sequence.
+ * ARGS     em    - code generator
+ *          prog  - program to be translated
+ *          first - first statement of the sequence
+ */
+static void emitStatements(Emitter *em, const Program *prog, NodeIndex first)
+{
+    NodeIndex *open = NULL;
+    long depth = 0, capacity = 0;
+    
+    NodeIndex i = first;
+    for (;;) {
+        while (i != NODE_NONE) {
+            const Statement *stat = programNode(prog, i);
+            if (stat->type == STAT_ASSIGNMENT) {
+                emitAssignment(em, &stat->as.assignment, 1 + 2 * depth);
+                i = stat->next;
+                continue;
+            }
+            if (stat->type == STAT_CALL) {
+                if (em->stream != NULL) {
+                    indent(em, 1 + 2 * depth);
+                    fprintf(em->stream, "m%lu(r, rt);\n", (unsigned long)stat->as.call.body);
+                }
+                i = stat->next;
+                continue;
+            }
+            if (stat->as.loop.fused != FUSED_NONE) {
+                emitFused(em, prog, &stat->as.loop, 1 + 2 * depth);
+                i = stat->next;
+                continue;
+            }
+            if (depth == capacity) {
+                capacity = capacity > 0 ? 2 * capacity : 64;
+                open = realloc(open, capacity * sizeof(NodeIndex));
+                if (open == NULL) {
+                    fprintf(stderr, "ERROR: unable to allocate memory\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            openLoop(em, &stat->as.loop, 1 + 2 * depth);
+            open[depth++] = i;
+            if (depth > em->maxDepth)
+                em->maxDepth = depth;
+            i = stat->as.loop.body;
+        }
+        if (depth == 0)
+            break;
+        --depth;
+        closeLoop(em, 1 + 2 * depth);
+        i = programNode(prog, open[depth])->next;
+    }
+    free(open);
+}
+
+/*
+ * Emit the functions of all macro bodies called, named after their first
+ * statement, followed by loop_run. Macros are defined before they are
+ * called, so in the order of the arena every callee precedes its callers.
+ * ARGS     em   - code generator
+ *          prog - program to be translated
+ */
+static void emitFunctions(Emitter *em, const Program *prog)
+{
+    bool *called = NULL;
+    for (NodeIndex i = 1; i < prog->count; ++i) {
+        const Statement *stat = programNode(prog, i);
+        if (stat->type != STAT_CALL)
+            continue;
+        if (called == NULL) {
+            called = calloc(prog->count, sizeof(bool));
+            if (called == NULL) {
+                fprintf(stderr, "ERROR: unable to allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        called[stat->as.call.body] = true;
+    }
+    for (NodeIndex i = 1; called != NULL && i < prog->count; ++i) {
+        if (!called[i])
+            continue;
+        if (em->stream != NULL)
+            fprintf(em->stream, "static void m%lu(Value *r, const LoopRuntime *rt)\n{\n", (unsigned long)i);
+        emitStatements(em, prog, i);
+        if (em->stream != NULL)
+            fprintf(em->stream, "}\n\n");
+    }
+    free(called);
+    
+    if (em->stream != NULL)
+        fprintf(em->stream, "void loop_run(Value *r, const LoopRuntime *rt)\n{\n");
+    emitStatements(em, prog, prog->first);
+    if (em->stream != NULL)
+        fprintf(em->stream, "}\n");
+}
+
+/*
+ * Print the program as standalone C function loop_run(regs, runtime).
+ * ARGS     stream - output file stream
+ *          prog   - program to be translated
+ *          vars   - variable table the program was parsed with
+ */
+void emitC(FILE *stream, Program *prog, const VariableTable *vars)
+{
+    // input check
+    if (stream == NULL || prog == NULL || vars == NULL) {
+        fprintf(stderr, "ERROR: cannot translate without stream, program or variables\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    fprintf(stream, "/*\n"
+            " * Generated from a LOOP program. Call loop_run with a register file\n"
+            " * holding natural numbers below 2^63 directly; all other cases are passed\n"
+            " * on to the runtime helpers of the host. Registers map to variables:\n");
+    for (long i = 0; i < vars->count; ++i)
+        fprintf(stream, " *  r[%ld] = x%ld\n", i, vars->ids[i]);
+    fprintf(stream, " */\n\n"
+            "#include <stdint.h>\n\n"
+            "typedef uint64_t Value;\n\n"
+            "typedef struct {\n"
+            "    void (*assign)(Value *regs, const void *ass);\n"
+            "    void (*affine)(const void *loop, Value limit, Value *regs);\n"
+            "    void (*fused)(const void *prog, const void *loop, Value *regs);\n"
+            "    const void **assignments;\n"
+            "    const void **affineLoops;\n"
+            "    const void **fusedLoops;\n"
+            "    const void *program;\n"
+            "} LoopRuntime;\n\n");
+    
+    Emitter em = { stream, { NULL, 0, 0 }, { NULL, 0, 0 }, { NULL, 0, 0 }, 0 };
+    emitFunctions(&em, prog);
+    free(em.assignments.items);
+    free(em.affineLoops.items);
+    free(em.fusedLoops.items);
+}
+
+#ifdef SHARED_SUPPORTED
+
+/*
+ * Slow path of an assignment called by the generated code.
+ */
+static void sharedAssign(Value *regs, const void *ass)
+{
+    executeAssignment(ass, regs);
+}
+
+/*
+ * Closed form of an affine LOOP called by the generated code.
+ */
+static void sharedAffine(const void *loop, Value limit, Value *regs)
+{
+    executeAffineLoop(loop, limit, regs);
+}
+
+/*
+ * Fused LOOP beyond the machine word called by the generated code.
+ */
+static void sharedFused(const void *prog, const void *loop, Value *regs)
+{
+    executeFusedLoop(prog, loop, regs);
+}
+
+/*
+ * Create a directory including all missing parents.
+ * ARGS     path - directory to be created
+ * RETURN   true if the directory exists afterwards
+ */
+static bool createDirectory(const char *path)
+{
+    char *tmp = strdup(path);
+    if (tmp == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (char *c = tmp + 1; *c != '\0'; ++c) {
+        if (*c == '/') {
+            *c = '\0';
+            mkdir(tmp, 0755);
+            *c = '/';
+        }
+    }
+    bool ok = mkdir(tmp, 0755) == 0 || errno == EEXIST;
+    free(tmp);
+    return ok;
+}
+
+/*
+ * Determine the cache directory, see transpile.h.
+ * RETURN   newly allocated path or NULL if no location is known
+ */
+static char *cacheDirectory(void)
+{
+    const char *dir = getenv("LOOP_CACHE_DIR");
+    const char *suffix = "";
+    if (dir == NULL || *dir == '\0') {
+        dir = getenv("XDG_CACHE_HOME");
+        suffix = "/loop";
+    }
+    if (dir == NULL || *dir == '\0') {
+        dir = getenv("HOME");
+        suffix = "/.cache/loop";
+    }
+    if (dir == NULL || *dir == '\0')
+        return NULL;
+    
+    char *path = malloc(strlen(dir) + strlen(suffix) + 1);
+    if (path == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(path, dir);
+    strcat(path, suffix);
+    return path;
+}
+
+/*
+ * Translate the program and compile it into a shared object.
+ * ARGS     prog - program to be translated
+ *          vars - variable table the program was parsed with
+ *          path - destination of the shared object
+ * RETURN   true on success
+ */
+static bool buildShared(Program *prog, const VariableTable *vars, const char *path)
+{
+    // the paths end up in a shell command
+    if (strchr(path, '\'') != NULL)
+        return false;
+    const char *cc = getenv("CC");
+    if (cc == NULL || *cc == '\0')
+        cc = "cc";
+    
+    // build under temporary names and publish atomically by renaming
+    size_t size = strlen(path) + 64;
+    char *source = malloc(size);
+    char *object = malloc(size);
+    char *command = malloc(strlen(cc) + 3 * size);
+    if (source == NULL || object == NULL || command == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    // unique names, the same program may be built by several threads at once
+    snprintf(source, size, "%s.XXXXXX", path);
+    int fd = mkstemp(source);
+    snprintf(object, size, "%s.tmp", source);
+    
+    bool ok = false;
+    FILE *stream = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (stream != NULL) {
+        emitC(stream, prog, vars);
+        ok = fclose(stream) == 0;
+    } else if (fd >= 0) {
+        close(fd);
+    }
+    if (ok) {
+        sprintf(command, "%s -O2 -shared -fPIC -o '%s' -x c '%s'", cc, object, source);
+        ok = system(command) == 0 && rename(object, path) == 0;
+    }
+    if (fd >= 0)
+        remove(source);
+    remove(object);
+    free(source);
+    free(object);
+    free(command);
+    return ok;
+}
+
+#endif /* SHARED_SUPPORTED */
+
+/*
+ * Load the shared object of a program from the cache, compiling it first if
+ * necessary.
+ * ARGS     prog - program to be translated
+ *          vars - variable table the program was parsed with
+ *          hash - hash of the program text
+ * RETURN   pointer to the newly loaded code or NULL if compiling or loading
+ *          failed or is not supported on this platform
+ */
+SharedCode *compileShared(Program *prog, const VariableTable *vars, uint64_t hash)
+{
+    // input check
+    if (prog == NULL || vars == NULL) {
+        fprintf(stderr, "ERROR: cannot compile empty program or without variables\n");
+        exit(EXIT_FAILURE);
+    }
+
+#ifndef SHARED_SUPPORTED
+    (void)hash;
+    return NULL;
+#else
+    char *dir = cacheDirectory();
+    if (dir == NULL || !createDirectory(dir)) {
+        free(dir);
+        return NULL;
+    }
+    
+    // collect the tables in the order the generated code expects, programs
+    // nested too deeply or too long for the C compiler to finish within
+    // seconds are left to the other engines
+    Emitter em = { NULL, { NULL, 0, 0 }, { NULL, 0, 0 }, { NULL, 0, 0 }, 0 };
+    emitFunctions(&em, prog);
+    
+    // the same text yields other code if its LOOPs were not analysed
+    hash = hashBytes(hash, TRANSPILER_VERSION, strlen(TRANSPILER_VERSION));
+    hash = hashBytes(hash, &em.affineLoops.count, sizeof(em.affineLoops.count));
+    hash = hashBytes(hash, &em.fusedLoops.count, sizeof(em.fusedLoops.count));
+    char *path = malloc(strlen(dir) + 32);
+    if (path == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(path, "%s/%016llx.so", dir, (unsigned long long)hash);
+    
+    SharedCode *code = NULL;
+    bool fits = em.maxDepth <= MAX_SHARED_DEPTH && prog->count <= MAX_SHARED_SIZE;
+    if (fits && (access(path, R_OK) == 0 || buildShared(prog, vars, path))) {
+        void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+        void *entry = handle != NULL ? dlsym(handle, "loop_run") : NULL;
+        if (entry != NULL) {
+            code = malloc(sizeof(SharedCode));
+            if (code == NULL) {
+                fprintf(stderr, "ERROR: unable to allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+            code->handle = handle;
+            *(void **)&code->entry = entry;
+            code->runtime.assign = sharedAssign;
+            code->runtime.affine = sharedAffine;
+            code->runtime.fused = sharedFused;
+            code->runtime.assignments = em.assignments.items;
+            code->runtime.affineLoops = em.affineLoops.items;
+            code->runtime.fusedLoops = em.fusedLoops.items;
+            code->runtime.program = prog;
+        } else if (handle != NULL) {
+            dlclose(handle);
+        }
+    }
+    if (code == NULL) {
+        free(em.assignments.items);
+        free(em.affineLoops.items);
+        free(em.fusedLoops.items);
+    }
+    free(dir);
+    free(path);
+    return code;
+#endif
+}
+
+/*
+ * Unload the shared object.
+ * ARGS     code - code to be unloaded (may be NULL)
+ */
+void freeShared(SharedCode *code)
+{
+    if (code == NULL)
+        return;
+#ifdef SHARED_SUPPORTED
+    dlclose(code->handle);
+#endif
+    free(code->runtime.assignments);
+    free(code->runtime.affineLoops);
+    free(code->runtime.fusedLoops);
+    free(code);
+}
+
+/*
+ * Execute the compiled program on the given register file.
+ * ARGS     code - loaded program
+ *          regs - initialized register file indexed by variable slots
+ */
+void executeShared(const SharedCode *code, Value *regs)
+{
+    // input check
+    if (code == NULL || regs == NULL) {
+        fprintf(stderr, "ERROR: cannot execute missing shared object or without registers\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    code->entry(regs, &code->runtime);
+}
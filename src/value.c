@@ -0,0 +1,557 @@
+/*
+ * value.c
+ *
+ * Natural numbers of arbitrary precision. Values below 2^63 are stored
+ * directly in a machine word, so the common case costs a single test of the
+ * most significant bit. Larger values are stored as reference counted,
+ * immutable big numbers whose address is kept in the remaining bits.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "value.h"
+
+
+/******************************************************************************
+ *                            GLOBAL DECLARATIONS
+ */
+
+#define KARATSUBA_THRESHOLD 32      // minimum limbs to split operands at
+#define DECIMAL_BASE 1000000000u    // largest power of ten in a limb
+#define DECIMAL_DIGITS 9            // number of digits of DECIMAL_BASE - 1
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * Limb view of an arbitrary value. Small values are split into the local
+ * buffer, so the view must not be copied.
+ */
+typedef struct {
+    const uint32_t *limbs;
+    long length;
+    uint32_t buf[2];
+} Digits;
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Allocate a big number with uninitialized limbs.
+ * ARGS     length - number of limbs
+ * RETURN   pointer to the new number holding a single reference
+ */
+static BigNum *allocBig(long length)
+{
+    BigNum *n = malloc(sizeof(BigNum) + (length > 0 ? length : 1) * sizeof(uint32_t));
+    if (n == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((uintptr_t)n & VALUE_BIG) {
+        fprintf(stderr, "ERROR: address of big number collides with value tag\n");
+        exit(EXIT_FAILURE);
+    }
+    n->refs = 1;
+    n->length = length;
+    return n;
+}
+
+/*
+ * Strip leading zero limbs and convert the number to a small value if it
+ * fits. The number is freed in that case.
+ * ARGS     n - freshly computed number holding a single reference
+ * RETURN   tagged or small value
+ */
+static Value normalize(BigNum *n)
+{
+    while (n->length > 0 && n->limbs[n->length - 1] == 0)
+        --n->length;
+    if (n->length <= 2) {
+        Value v = 0;
+        if (n->length > 0)
+            v = n->limbs[0];
+        if (n->length > 1)
+            v |= (Value)n->limbs[1] << 32;
+        if ((v & VALUE_BIG) == 0) {
+            free(n);
+            return v;
+        }
+    }
+    return (Value)(uintptr_t)n | VALUE_BIG;
+}
+
+/*
+ * Create the limb view of a value.
+ * ARGS     v - value to be viewed
+ *          d - view to be initialized
+ */
+static void digitsOf(Value v, Digits *d)
+{
+    if (v & VALUE_BIG) {
+        d->limbs = valueBig(v)->limbs;
+        d->length = valueBig(v)->length;
+        return;
+    }
+    d->buf[0] = (uint32_t)v;
+    d->buf[1] = (uint32_t)(v >> 32);
+    d->limbs = d->buf;
+    d->length = d->buf[1] != 0 ? 2 : d->buf[0] != 0 ? 1 : 0;
+}
+
+/*
+ * Compare two limb arrays without leading zeros.
+ * RETURN   negative, zero or positive if a is less, equal or greater than b
+ */
+static int compareLimbs(const uint32_t *a, long la, const uint32_t *b, long lb)
+{
+    if (la != lb)
+        return la < lb ? -1 : 1;
+    for (long i = la - 1; i >= 0; --i)
+        if (a[i] != b[i])
+            return a[i] < b[i] ? -1 : 1;
+    return 0;
+}
+
+/*
+ * Add src to dst in place, propagating the carry through all of dst.
+ * ARGS     dst  - accumulator
+ *          ld   - number of limbs of dst, must be able to hold the sum
+ *          src  - summand
+ *          ls   - number of limbs of src (at most ld)
+ */
+static void addLimbs(uint32_t *dst, long ld, const uint32_t *src, long ls)
+{
+    uint64_t carry = 0;
+    long i = 0;
+    for (; i < ls; ++i) {
+        carry += (uint64_t)dst[i] + src[i];
+        dst[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    for (; carry != 0 && i < ld; ++i) {
+        carry += dst[i];
+        dst[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+}
+
+/*
+ * Subtract src from dst in place, dst must not be less than src.
+ * ARGS     dst  - minuend and difference
+ *          ld   - number of limbs of dst
+ *          src  - subtrahend
+ *          ls   - number of limbs of src (at most ld)
+ */
+static void subLimbs(uint32_t *dst, long ld, const uint32_t *src, long ls)
+{
+    int64_t borrow = 0;
+    long i = 0;
+    for (; i < ls; ++i) {
+        int64_t diff = (int64_t)dst[i] - src[i] - borrow;
+        borrow = diff < 0;
+        dst[i] = (uint32_t)(diff + (borrow << 32));
+    }
+    for (; borrow != 0 && i < ld; ++i) {
+        int64_t diff = (int64_t)dst[i] - borrow;
+        borrow = diff < 0;
+        dst[i] = (uint32_t)(diff + (borrow << 32));
+    }
+}
+
+/*
+ * Accumulate the product a * b onto res by long multiplication.
+ * ARGS     res - accumulator of at least la + lb limbs
+ *          a   - first factor
+ *          la  - number of limbs of a
+ *          b   - second factor
+ *          lb  - number of limbs of b
+ */
+static void mulSchool(uint32_t *res, const uint32_t *a, long la, const uint32_t *b, long lb)
+{
+    for (long i = 0; i < la; ++i) {
+        uint64_t carry = 0;
+        for (long j = 0; j < lb; ++j) {
+            carry += (uint64_t)a[i] * b[j] + res[i + j];
+            res[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        for (long k = i + lb; carry != 0; ++k) {
+            carry += res[k];
+            res[k] = (uint32_t)carry;
+            carry >>= 32;
+        }
+    }
+}
+
+/*
+ * Compute the product a * b with Karatsuba's method. Unbalanced operands are
+ * cut into slices of the shorter length first.
+ * ARGS     res - zero initialized result of la + lb limbs
+ *          a   - first factor
+ *          la  - number of limbs of a
+ *          b   - second factor
+ *          lb  - number of limbs of b
+ */
+static void mulKaratsuba(uint32_t *res, const uint32_t *a, long la, const uint32_t *b, long lb)
+{
+    if (la < lb) {
+        const uint32_t *t = a;
+        a = b;
+        b = t;
+        long lt = la;
+        la = lb;
+        lb = lt;
+    }
+    if (lb < KARATSUBA_THRESHOLD) {
+        mulSchool(res, a, la, b, lb);
+        return;
+    }
+    if (la >= 2 * lb) {
+        uint32_t *slice = malloc(2 * lb * sizeof(uint32_t));
+        if (slice == NULL) {
+            fprintf(stderr, "ERROR: unable to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        for (long i = 0; i < la; i += lb) {
+            long ls = la - i < lb ? la - i : lb;
+            memset(slice, 0, 2 * lb * sizeof(uint32_t));
+            mulKaratsuba(slice, a + i, ls, b, lb);
+            addLimbs(res + i, la + lb - i, slice, ls + lb);
+        }
+        free(slice);
+        return;
+    }
+    
+    // a = a1 * B^m + a0 and b = b1 * B^m + b0
+    long m = lb / 2;
+    long la1 = la - m, lb1 = lb - m;
+    long ls = la1 + 1;
+    uint32_t *tmp = calloc(2 * ls + 2 * ls + 2 * la, sizeof(uint32_t));
+    if (tmp == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    uint32_t *sa = tmp;             // a0 + a1
+    uint32_t *sb = sa + ls;         // b0 + b1
+    uint32_t *z1 = sb + ls;         // (a0 + a1) * (b0 + b1)
+    uint32_t *z = z1 + 2 * ls;      // z0 and z2
+    
+    memcpy(sa, a + m, la1 * sizeof(uint32_t));
+    addLimbs(sa, ls, a, m);
+    memcpy(sb, b + m, lb1 * sizeof(uint32_t));
+    addLimbs(sb, ls, b, m);
+    mulKaratsuba(z1, sa, ls, sb, ls);
+    
+    // z0 = a0 * b0
+    mulKaratsuba(z, a, m, b, m);
+    addLimbs(res, la + lb, z, 2 * m);
+    subLimbs(z1, 2 * ls, z, 2 * m);
+    
+    // z2 = a1 * b1
+    memset(z, 0, (la1 + lb1) * sizeof(uint32_t));
+    mulKaratsuba(z, a + m, la1, b + m, lb1);
+    addLimbs(res + 2 * m, la + lb - 2 * m, z, la1 + lb1);
+    subLimbs(z1, 2 * ls, z, la1 + lb1);
+    
+    // z1 - z0 - z2 fits into the remaining limbs of the result
+    long l1 = 2 * ls;
+    while (l1 > 0 && z1[l1 - 1] == 0)
+        --l1;
+    addLimbs(res + m, la + lb - m, z1, l1);
+    free(tmp);
+}
+
+/*
+ * Slow path of valueAdd, see value.h.
+ */
+Value valueAddSlow(Value a, Value b)
+{
+    if (b == 0)
+        return valueRetain(a);
+    if (a == 0)
+        return valueRetain(b);
+    
+    Digits da, db;
+    digitsOf(a, &da);
+    digitsOf(b, &db);
+    if (da.length < db.length) {
+        digitsOf(b, &da);
+        digitsOf(a, &db);
+    }
+    BigNum *n = allocBig(da.length + 1);
+    memcpy(n->limbs, da.limbs, da.length * sizeof(uint32_t));
+    n->limbs[da.length] = 0;
+    addLimbs(n->limbs, n->length, db.limbs, db.length);
+    return normalize(n);
+}
+
+/*
+ * Slow path of valueSub, see value.h.
+ */
+Value valueSubSlow(Value a, Value b)
+{
+    if (b == 0)
+        return valueRetain(a);
+    
+    Digits da, db;
+    digitsOf(a, &da);
+    digitsOf(b, &db);
+    if (compareLimbs(da.limbs, da.length, db.limbs, db.length) <= 0)
+        return 0;
+    BigNum *n = allocBig(da.length);
+    memcpy(n->limbs, da.limbs, da.length * sizeof(uint32_t));
+    subLimbs(n->limbs, n->length, db.limbs, db.length);
+    return normalize(n);
+}
+
+/*
+ * Slow path of valueRetain, see value.h.
+ */
+void valueRetainSlow(Value v)
+{
+    BigNum *n = valueBig(v);
+    if (n->refs > 0)
+        ++n->refs;
+}
+
+/*
+ * Slow path of valueRelease, see value.h.
+ */
+void valueReleaseSlow(Value v)
+{
+    BigNum *n = valueBig(v);
+    if (n->refs > 0 && --n->refs == 0)
+        free(n);
+}
+
+/*
+ * Compute a * b, using Karatsuba multiplication for long operands.
+ * RETURN   new reference to the product
+ */
+Value valueMul(Value a, Value b)
+{
+    // product of two small values below 2^63
+    if (((a | b) & VALUE_BIG) == 0 && (a == 0 || b <= VALUE_MAX_SMALL / a))
+        return a * b;
+    
+    Digits da, db;
+    digitsOf(a, &da);
+    digitsOf(b, &db);
+    if (da.length == 0 || db.length == 0)
+        return 0;
+    BigNum *n = allocBig(da.length + db.length);
+    memset(n->limbs, 0, n->length * sizeof(uint32_t));
+    mulKaratsuba(n->limbs, da.limbs, da.length, db.limbs, db.length);
+    return normalize(n);
+}
+
+/*
+ * Compare two values.
+ * RETURN   negative, zero or positive if a is less, equal or greater than b
+ */
+int valueCompare(Value a, Value b)
+{
+    if (((a | b) & VALUE_BIG) == 0)
+        return a < b ? -1 : a > b;
+    
+    Digits da, db;
+    digitsOf(a, &da);
+    digitsOf(b, &db);
+    return compareLimbs(da.limbs, da.length, db.limbs, db.length);
+}
+
+/*
+ * Number of significant bits of a value.
+ * RETURN   position of the highest set bit plus one (0 for zero)
+ */
+uint64_t valueBitLength(Value v)
+{
+    Digits d;
+    digitsOf(v, &d);
+    if (d.length == 0)
+        return 0;
+    uint64_t bits = (uint64_t)(d.length - 1) * 32;
+    for (uint32_t top = d.limbs[d.length - 1]; top != 0; top >>= 1)
+        ++bits;
+    return bits;
+}
+
+/*
+ * Test a single bit of a value.
+ * ARGS     v   - value to be tested
+ *          bit - position of the bit, 0 is the least significant
+ * RETURN   true if the bit is set
+ */
+bool valueBit(Value v, uint64_t bit)
+{
+    Digits d;
+    digitsOf(v, &d);
+    if (bit / 32 >= (uint64_t)d.length)
+        return false;
+    return (d.limbs[bit / 32] >> (bit % 32)) & 1;
+}
+
+/*
+ * Make a value immortal, so it can be shared read-only (e.g. between
+ * threads) without reference counting. Used for program constants.
+ * RETURN   the value itself
+ */
+Value valueFreeze(Value v)
+{
+    if (v & VALUE_BIG)
+        valueBig(v)->refs = 0;
+    return v;
+}
+
+/*
+ * Copy the limbs of a value, least significant first, without leading zeros.
+ * ARGS     v        - value to be copied
+ *          limbs    - destination of the limbs
+ *          capacity - number of limbs the destination holds
+ * RETURN   number of limbs of the value, nothing is copied if it exceeds
+ *          the capacity
+ */
+long valueToLimbs(Value v, uint32_t *limbs, long capacity)
+{
+    Digits d;
+    digitsOf(v, &d);
+    if (d.length <= capacity)
+        memcpy(limbs, d.limbs, d.length * sizeof(uint32_t));
+    return d.length;
+}
+
+/*
+ * Create a value from limbs as copied by valueToLimbs.
+ * ARGS     limbs  - limbs, least significant first
+ *          length - number of limbs
+ * RETURN   new reference to the value
+ */
+Value valueFromLimbs(const uint32_t *limbs, long length)
+{
+    BigNum *n = allocBig(length > 2 ? length : 2);
+    memset(n->limbs, 0, n->length * sizeof(uint32_t));
+    if (length > 0)
+        memcpy(n->limbs, limbs, length * sizeof(uint32_t));
+    return normalize(n);
+}
+
+/*
+ * Multiply a limb array by a small factor and add a small summand in place.
+ * ARGS     n      - number to be modified, grown if necessary
+ *          factor - factor below 2^32
+ *          add    - summand below 2^32
+ * RETURN   possibly reallocated number
+ */
+static BigNum *mulAddSmall(BigNum *n, uint32_t factor, uint32_t add)
+{
+    uint64_t carry = add;
+    for (long i = 0; i < n->length; ++i) {
+        carry += (uint64_t)n->limbs[i] * factor;
+        n->limbs[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    if (carry != 0) {
+        n = realloc(n, sizeof(BigNum) + (n->length + 1) * sizeof(uint32_t));
+        if (n == NULL) {
+            fprintf(stderr, "ERROR: unable to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        n->limbs[n->length++] = (uint32_t)carry;
+    }
+    return n;
+}
+
+/*
+ * Parse a decimal natural number.
+ * ARGS     str - null terminated string of decimal digits
+ *          res - destination of the new reference on success
+ * RETURN   false if the string is empty or contains any other character
+ */
+bool valueParse(const char *str, Value *res)
+{
+    if (str == NULL || *str == '\0')
+        return false;
+    for (const char *c = str; *c != '\0'; ++c)
+        if (*c < '0' || *c > '9')
+            return false;
+    
+    // fast path for numbers fitting into a machine word
+    Value v = 0;
+    const char *c = str;
+    while (*c != '\0' && v <= (VALUE_MAX_SMALL - 9) / 10)
+        v = v * 10 + (Value)(*c++ - '0');
+    if (*c == '\0') {
+        *res = v;
+        return true;
+    }
+    
+    // continue in chunks of digits on a big number
+    BigNum *n = allocBig(2);
+    n->limbs[0] = (uint32_t)v;
+    n->limbs[1] = (uint32_t)(v >> 32);
+    while (*c != '\0') {
+        uint32_t factor = 1, chunk = 0;
+        for (int i = 0; i < DECIMAL_DIGITS && *c != '\0'; ++i) {
+            factor *= 10;
+            chunk = chunk * 10 + (uint32_t)(*c++ - '0');
+        }
+        n = mulAddSmall(n, factor, chunk);
+    }
+    *res = normalize(n);
+    return true;
+}
+
+/*
+ * Print the decimal representation of a value to stream.
+ * ARGS     stream - output file stream
+ *          v      - value to be printed
+ */
+void valuePrint(FILE *stream, Value v)
+{
+    if ((v & VALUE_BIG) == 0) {
+        fprintf(stream, "%llu", (unsigned long long)v);
+        return;
+    }
+    
+    // split number into chunks of decimal digits by repeated division
+    BigNum *n = valueBig(v);
+    long length = n->length;
+    uint32_t *limbs = malloc(length * sizeof(uint32_t));
+    uint32_t *chunks = malloc((length * 32 / 29 + 2) * sizeof(uint32_t));
+    if (limbs == NULL || chunks == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(limbs, n->limbs, length * sizeof(uint32_t));
+    long count = 0;
+    do {
+        uint64_t rem = 0;
+        for (long i = length - 1; i >= 0; --i) {
+            rem = (rem << 32) | limbs[i];
+            limbs[i] = (uint32_t)(rem / DECIMAL_BASE);
+            rem %= DECIMAL_BASE;
+        }
+        chunks[count++] = (uint32_t)rem;
+        while (length > 0 && limbs[length - 1] == 0)
+            --length;
+    } while (length > 0);
+    
+    fprintf(stream, "%lu", (unsigned long)chunks[count - 1]);
+    for (long i = count - 2; i >= 0; --i)
+        fprintf(stream, "%09lu", (unsigned long)chunks[i]);
+    free(limbs);
+    free(chunks);
+}
@@ -1,8 +1,10 @@
 /*
  * var.c
  *
- * Simple linked list to hold a list of variables containing of an identifier
- * and a value (both on long).
+ * Variable table interning the (possibly sparse) identifiers of a LOOP program
+ * into dense slot indices. The parser resolves every variable identifier to
+ * its slot, so the executor can work on a contiguous register file instead of
+ * searching for identifiers at runtime.
  *
  * Tom René Hennig
  */
@@ -23,111 +25,207 @@
  */
 
 /*
- * Add a variable to the list returning the list (necessary to allocate a new
- * listin case it was emtpy). If the identifier is already allocated nothing
- * is modified.
- * ARGS     list - list handle to add variable to
- *          id   - identifier of new variable
- * RETURN   possibly new handle of the list
+ * Compute the first bucket of an identifier (Fibonacci hashing).
+ * ARGS     id       - identifier to be hashed
+ *          hashSize - number of buckets (power of two)
+ * RETURN   bucket index in range [0, hashSize)
  */
-VariableList addVariable(VariableList list, long id)
+static long hashIdentifier(long id, long hashSize)
 {
-    Variable *tmp = list;
+    unsigned long long h = (unsigned long long)id * 11400714819323198485ull;
+    return (long)((h >> 32) & (unsigned long long)(hashSize - 1));
+}
+
+/*
+ * Search the bucket of given identifier.
+ * ARGS     table - table to search in
+ *          id    - identifier to be searched for
+ * RETURN   index of the bucket holding the identifier or of the empty bucket
+ *          terminating the probe sequence
+ */
+static long findBucket(const VariableTable *table, long id)
+{
+    long mask = table->hashSize - 1;
+    long i = hashIdentifier(id, table->hashSize);
+    while (table->hash[i] != 0 && table->ids[table->hash[i] - 1] != id)
+        i = (i + 1) & mask;
+    return i;
+}
+
+/*
+ * Double the number of buckets and reinsert all slots.
+ * ARGS     table - table to be grown
+ */
+static void growHash(VariableTable *table)
+{
+    long *old = table->hash;
+    long oldSize = table->hashSize;
     
-    // Allocate new list if necessary
-    if (list == NULL) {
-        tmp = malloc(sizeof(Variable));
-        if (tmp == NULL) {
+    table->hashSize *= 2;
+    table->hash = calloc(table->hashSize, sizeof(long));
+    if (table->hash == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (long i = 0; i < oldSize; ++i)
+        if (old[i] != 0)
+            table->hash[findBucket(table, table->ids[old[i] - 1])] = old[i];
+    free(old);
+}
+
+/*
+ * Allocate a new and empty variable table.
+ * RETURN   pointer to the newly allocated table
+ */
+VariableTable *createVariableTable(void)
+{
+    VariableTable *table = malloc(sizeof(VariableTable));
+    if (table == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    table->count = 0;
+    table->capacity = 16;
+    table->hashSize = 32;
+    table->ids = malloc(table->capacity * sizeof(long));
+    table->hash = calloc(table->hashSize, sizeof(long));
+    if (table->ids == NULL || table->hash == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return table;
+}
+
+/*
+ * Free the table and all of its buffers.
+ * ARGS     table - table to be freed (may be NULL)
+ */
+void freeVariableTable(VariableTable *table)
+{
+    if (table == NULL)
+        return;
+    free(table->ids);
+    free(table->hash);
+    free(table);
+}
+
+/*
+ * Look up the slot of given identifier and allocate the next free slot, if
+ * the identifier is not yet known.
+ * ARGS     table - table to search for identifier
+ *          id    - identifier of variable to be searched for
+ * RETURN   slot index of the variable
+ */
+long internVariable(VariableTable *table, long id)
+{
+    // input check
+    if (table == NULL) {
+        fprintf(stderr, "ERROR: unable to intern variable in missing table\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    long bucket = findBucket(table, id);
+    if (table->hash[bucket] != 0)
+        return table->hash[bucket] - 1;
+    
+    // append identifier to the slot list
+    if (table->count == table->capacity) {
+        table->capacity *= 2;
+        table->ids = realloc(table->ids, table->capacity * sizeof(long));
+        if (table->ids == NULL) {
             fprintf(stderr, "ERROR: unable to allocate memory\n");
             exit(EXIT_FAILURE);
         }
-        tmp->id = id;
-        tmp->value = 0;
-        tmp->next = NULL;
-        return tmp;
     }
+    long slot = table->count++;
+    table->ids[slot] = id;
+    table->hash[bucket] = slot + 1;
     
-    // Walk till the end of the list and check whether the new identifier is
-    // already in the list
-    while (tmp->next != NULL) {
-        if (tmp->id == id) {
-            fprintf(stderr, "WARNING: tried to double allocate variable");
-            return list;
-        }
-        tmp = tmp->next;
+    // keep load factor of the hash table below one half
+    if (2 * table->count > table->hashSize)
+        growHash(table);
+    return slot;
+}
+
+/*
+ * Look up the slot of given identifier without modifying the table.
+ * ARGS     table - table to search for identifier
+ *          id    - identifier of variable to be searched for
+ * RETURN   slot index of the variable or -1 if it is not in the table
+ */
+long lookupVariable(const VariableTable *table, long id)
+{
+    // input check
+    if (table == NULL) {
+        fprintf(stderr, "ERROR: unable to look up variable in missing table\n");
+        exit(EXIT_FAILURE);
     }
     
-    // Allocate new element at the end of the list
-    tmp->next = malloc(sizeof(Variable));
-    if (tmp->next == NULL) {
+    return table->hash[findBucket(table, id)] - 1;
+}
+
+/*
+ * Allocate a register file with one zero initialized value per slot.
+ * ARGS     table - table to allocate the registers for
+ * RETURN   pointer to the first register
+ */
+Value *createRegisters(const VariableTable *table)
+{
+    // input check
+    if (table == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate registers for missing table\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    // always allocate at least one register to get a valid pointer
+    Value *regs = calloc(table->count > 0 ? table->count : 1, sizeof(Value));
+    if (regs == NULL) {
         fprintf(stderr, "ERROR: unable to allocate memory\n");
         exit(EXIT_FAILURE);
     }
-    tmp = tmp->next;
-    tmp->id = id;
-    tmp->value = 0;
-    tmp->next = NULL;
-    return list;
+    return regs;
 }
 
 /*
- * Look up value of given identifier, add new variable to the list and
- * initialize it to zero, if it is not yet allocated.
- * WARNING: cannot add variables to an empty list!
- * ARGS     list - list to search for identifier
- *          id   - identifier of variable to be searched for
- * RETURN   value of the searched variable (0 if it has not been allocated yet)
+ * Release all values of a register file and set every register to zero.
+ * ARGS     table - table the registers were allocated for
+ *          regs  - register file to be cleared
  */
-long getValue(VariableList list, long id)
+void clearRegisters(const VariableTable *table, Value *regs)
 {
-    Variable *tmp = list;
-    
     // input check
-    if (list == NULL) {
-        fprintf(stderr, "ERROR: unable to obtain value from empty variable list\n");
+    if (table == NULL || regs == NULL) {
+        fprintf(stderr, "ERROR: unable to clear missing registers\n");
         exit(EXIT_FAILURE);
     }
     
-    // walk through the list and search identifier
-    do {
-        if (tmp->id == id)
-            return tmp->value;
-        tmp = tmp->next;
-    } while (tmp != NULL);
-    
-    // add identifier to list if is not already there
-    addVariable(list, id);
-    return 0;
+    for (long i = 0; i < table->count; ++i) {
+        valueRelease(regs[i]);
+        regs[i] = 0;
+    }
 }
 
 /*
- * Set the value of an variable in the given list, allocates a new variable
- * if necessary.
- * WARNING: cannot add variables to an empty list!
- * ARGS     list  - list to modify the value of variable identifier
- *          id    - identifier to search for
- *          value - new value of variable identifier
+ * Store input values x1 ... xn in their registers. Inputs the program never
+ * refers to cannot influence the result and are released right away.
+ * ARGS     table  - table the registers were allocated for
+ *          regs   - register file to be initialized
+ *          inputs - new references to the values of x1, x2, ...
+ *          count  - number of inputs
  */
-void setValue(VariableList list, long id, long value)
+void storeInputs(const VariableTable *table, Value *regs, const Value *inputs, long count)
 {
-    Variable *tmp = list;
-    
     // input check
-    if (list == NULL) {
-        fprintf(stderr, "ERROR: unable to set value of an empty variable list\n");
+    if (table == NULL || regs == NULL || (inputs == NULL && count > 0)) {
+        fprintf(stderr, "ERROR: unable to store inputs in missing registers\n");
         exit(EXIT_FAILURE);
     }
     
-    // walk through the list and search identifier
-    do {
-        if (tmp->id == id) {
-            tmp->value = value;
-            return;
-        }
-        tmp = tmp->next;
-    } while (tmp != NULL);
-    
-    // add identifier to list if is not already there
-    list = addVariable(list, id);
-    setValue(list, id, value);
+    for (long i = 0; i < count; ++i) {
+        long slot = lookupVariable(table, i + 1);
+        if (slot >= 0)
+            regs[slot] = inputs[i];
+        else
+            valueRelease(inputs[i]);
+    }
 }
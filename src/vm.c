@@ -0,0 +1,431 @@
+/*
+ * vm.c
+ *
+ * Compiler lowering the syntax/semantics tree into a flat instruction array
+ * and a virtual machine executing it without recursion. LOOPs become a pair
+ * of LOOP/END instructions jumping to each other, the remaining iterations
+ * are kept on a separate counter stack. Macro bodies are compiled once and
+ * called, their return addresses are kept on the counter stack as well.
+ * Copies and fused LOOPs (fuse.h) become superinstructions.
+ *
+ * Tom René Hennig
+ */
+
+
+/******************************************************************************
+ *                              INCLUDE SECTION
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "affine.h"
+#include "budget.h"
+#include "fuse.h"
+#include "vm.h"
+
+
+/******************************************************************************
+ *                             TYPE DECLARATIONS
+ */
+
+/*
+ * LOOP whose body is being compiled.
+ */
+typedef struct {
+    NodeIndex loop;     // index of the LOOP statement
+    long begin;         // index of its OP_LOOP instruction
+    long affine;        // index of its OP_AFFINE instruction or -1
+} OpenLoop;
+
+
+/******************************************************************************
+ *                           FUNCTION DEFINITIONS
+ */
+
+/*
+ * Append an instruction to the bytecode, growing the array if necessary.
+ * ARGS     code - bytecode to append to
+ *          op   - opcode of the new instruction
+ *          a    - first operand
+ *          b    - second operand
+ *          nat  - constant operand
+ * RETURN   index of the new instruction
+ */
+static long emit(Bytecode *code, Opcode op, long a, long b, NatNum nat)
+{
+    if (code->length == code->capacity) {
+        code->capacity *= 2;
+        code->code = realloc(code->code, code->capacity * sizeof(Instruction));
+        if (code->code == NULL) {
+            fprintf(stderr, "ERROR: unable to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    Instruction *ins = &code->code[code->length];
+    ins->op = op;
+    ins->a = a;
+    ins->b = b;
+    ins->nat = nat;
+    return code->length++;
+}
+
+/*
+ * Emit the superinstruction of a fused LOOP.
+ * ARGS     code - bytecode to append to
+ *          prog - program holding the LOOP
+ *          loop - LOOP annotated with a superinstruction
+ */
+static void compileFusedLoop(Bytecode *code, const Program *prog, const Loop *loop)
+{
+    const Statement *body = programNode(prog, loop->body);
+    const Assignment *ass = &body->as.assignment;
+    switch (loop->fused) {
+    case FUSED_ADD_VAR:
+        emit(code, OP_ADD_VAR, ass->lvalue, loop->var, ass->nat);
+        break;
+    case FUSED_SUB_VAR:
+        emit(code, OP_SUB_VAR, ass->lvalue, loop->var, ass->nat);
+        break;
+    case FUSED_ZERO:
+        emit(code, OP_ZERO, loop->var, 0, 0);
+        break;
+    case FUSED_MUL_ADD:
+        ass = &programNode(prog, body->as.loop.body)->as.assignment;
+        emit(code, OP_MUL_ADD, ass->lvalue, loop->var, ass->nat);
+        emit(code, OP_OPERAND, body->as.loop.var, 0, 0);
+        break;
+    default:
+        fprintf(stderr, "ERROR: cannot compile LOOP without superinstruction\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Emit the instructions of a sequence of statements. Macro bodies called by
+ * the sequence have to be compiled before.
+ * ARGS     code    - bytecode to append to
+ *          prog    - program to be compiled
+ *          first   - first statement of the sequence
+ *          entries - first instruction of every macro body compiled, indexed
+ *                    by the first statement of the body
+ *          usage   - counter stack entries used by every macro body, indexed
+ *                    likewise
+ * RETURN   counter stack entries used by the sequence
+ */
+static long compileStatements(Bytecode *code, const Program *prog, NodeIndex first, const long *entries,
+        const long *usage)
+{
+    OpenLoop *open = NULL;
+    long depth = 0, capacity = 0, maxDepth = 0;
+    
+    NodeIndex i = first;
+    for (;;) {
+        while (i != NODE_NONE) {
+            const Statement *stat = programNode(prog, i);
+            if (stat->type == STAT_ASSIGNMENT) {
+                const Assignment *ass = &stat->as.assignment;
+                if (isCopy(ass))
+                    emit(code, OP_COPY, ass->lvalue, ass->rvalue, 0);
+                else
+                    emit(code, ass->isAddition ? OP_ADD : OP_SUB, ass->lvalue, ass->rvalue, ass->nat);
+                i = stat->next;
+                continue;
+            }
+            if (stat->type == STAT_CALL) {
+                // the return address is kept on the counter stack
+                emit(code, OP_CALL, 0, entries[stat->as.call.body], 0);
+                if (depth + 1 + usage[stat->as.call.body] > maxDepth)
+                    maxDepth = depth + 1 + usage[stat->as.call.body];
+                i = stat->next;
+                continue;
+            }
+            
+            // fused LOOPs replace the whole LOOP by a single instruction
+            const Loop *loop = &stat->as.loop;
+            if (loop->fused != FUSED_NONE) {
+                compileFusedLoop(code, prog, loop);
+                i = stat->next;
+                continue;
+            }
+            
+            // jump targets of LOOP are patched after the body is known, an
+            // affine LOOP is preceded by its closed form skipping the LOOP
+            long affine = -1;
+            if (loop->affine != NULL) {
+                code->affine = realloc(code->affine, (code->affineCount + 1) * sizeof(*code->affine));
+                if (code->affine == NULL) {
+                    fprintf(stderr, "ERROR: unable to allocate memory\n");
+                    exit(EXIT_FAILURE);
+                }
+                code->affine[code->affineCount] = loop->affine;
+                affine = emit(code, OP_AFFINE, loop->var, 0, code->affineCount++);
+            }
+            if (depth == capacity) {
+                capacity = capacity > 0 ? 2 * capacity : 64;
+                open = realloc(open, capacity * sizeof(OpenLoop));
+                if (open == NULL) {
+                    fprintf(stderr, "ERROR: unable to allocate memory\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            open[depth].loop = i;
+            open[depth].begin = emit(code, OP_LOOP, loop->var, 0, 0);
+            open[depth].affine = affine;
+            if (++depth > maxDepth)
+                maxDepth = depth;
+            i = loop->body;
+        }
+        
+        // the body of the innermost open LOOP is complete
+        if (depth == 0)
+            break;
+        OpenLoop *top = &open[--depth];
+        long end = emit(code, OP_END, 0, top->begin + 1, 0);
+        code->code[top->begin].b = end + 1;
+        if (top->affine >= 0)
+            code->code[top->affine].b = end + 1;
+        i = programNode(prog, top->loop)->next;
+    }
+    free(open);
+    return maxDepth;
+}
+
+/*
+ * Lower the syntax/semantics tree into bytecode. Every macro body called is
+ * compiled once in front of the program, ending with OP_RET. Macros are
+ * defined before they are called, so the bodies are compiled in the order
+ * of the arena to have every callee compiled before its callers.
+ * ARGS     prog - program to be compiled
+ * RETURN   pointer to the newly allocated bytecode
+ */
+Bytecode *compileProgram(Program *prog)
+{
+    // input check
+    if (prog == NULL) {
+        fprintf(stderr, "ERROR: cannot compile empty program\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    Bytecode *code = malloc(sizeof(Bytecode));
+    if (code == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    code->length = 0;
+    code->capacity = 64;
+    code->maxDepth = 0;
+    code->affine = NULL;
+    code->affineCount = 0;
+    code->code = malloc(code->capacity * sizeof(Instruction));
+    if (code->code == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    // mark the macro bodies called anywhere, then compile them in order
+    long *entries = NULL, *usage = NULL;
+    for (NodeIndex i = 1; i < prog->count; ++i) {
+        const Statement *stat = programNode(prog, i);
+        if (stat->type != STAT_CALL)
+            continue;
+        if (entries == NULL) {
+            entries = malloc(prog->count * sizeof(long));
+            usage = malloc(prog->count * sizeof(long));
+            if (entries == NULL || usage == NULL) {
+                fprintf(stderr, "ERROR: unable to allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+            for (NodeIndex j = 0; j < prog->count; ++j)
+                entries[j] = -1;
+        }
+        entries[stat->as.call.body] = 0;
+    }
+    for (NodeIndex i = 1; entries != NULL && i < prog->count; ++i) {
+        if (entries[i] < 0)
+            continue;
+        entries[i] = code->length;
+        usage[i] = compileStatements(code, prog, i, entries, usage);
+        emit(code, OP_RET, 0, 0, 0);
+    }
+    code->entry = code->length;
+    code->maxDepth = compileStatements(code, prog, prog->first, entries, usage);
+    emit(code, OP_HALT, 0, 0, 0);
+    free(entries);
+    free(usage);
+    return code;
+}
+
+/*
+ * Free the bytecode and its instruction array.
+ * ARGS     code - bytecode to be freed (may be NULL)
+ */
+void freeBytecode(Bytecode *code)
+{
+    if (code == NULL)
+        return;
+    free(code->code);
+    free(code->affine);
+    free(code);
+}
+
+/*
+ * Dispatch helpers: GCC compatible compilers jump directly from handler to
+ * handler through a table of label addresses (threaded code), all other
+ * compilers fall back to a switch inside an endless loop.
+ */
+#if defined(__GNUC__)
+#define VM_DISPATCH()   goto *labels[ip->op]
+#define VM_CASE(op)     L_##op
+#else
+#define VM_DISPATCH()   goto dispatch
+#define VM_CASE(op)     case op
+#endif
+
+/*
+ * Execute bytecode on the given register file.
+ * ARGS     code   - compiled program
+ *          regs   - initialized register file indexed by variable slots
+ *          budget - started budget of the run or NULL for no limits
+ * RETURN   false if the budget was exceeded, the registers then hold the
+ *          values at the point of stopping
+ */
+bool executeBytecode(const Bytecode *code, Value *regs, Budget *budget)
+{
+    // input check
+    if (code == NULL || regs == NULL) {
+        fprintf(stderr, "ERROR: cannot execute missing bytecode or without registers\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    // counter stack holding the remaining iterations of all active LOOPs
+    uint64_t *counters = malloc((code->maxDepth + 1) * sizeof(uint64_t));
+    if (counters == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t *top = counters;
+    uint64_t slice = budget != NULL ? 0 : UINT64_MAX;
+    const Instruction *ip = code->code + code->entry;
+    Value res;
+
+#if defined(__GNUC__)
+    static void *labels[] = {
+        [OP_ADD] = &&L_OP_ADD,
+        [OP_SUB] = &&L_OP_SUB,
+        [OP_COPY] = &&L_OP_COPY,
+        [OP_ADD_VAR] = &&L_OP_ADD_VAR,
+        [OP_SUB_VAR] = &&L_OP_SUB_VAR,
+        [OP_ZERO] = &&L_OP_ZERO,
+        [OP_MUL_ADD] = &&L_OP_MUL_ADD,
+        [OP_AFFINE] = &&L_OP_AFFINE,
+        [OP_LOOP] = &&L_OP_LOOP,
+        [OP_END] = &&L_OP_END,
+        [OP_CALL] = &&L_OP_CALL,
+        [OP_RET] = &&L_OP_RET,
+        [OP_HALT] = &&L_OP_HALT,
+    };
+    VM_DISPATCH();
+#else
+dispatch:
+    switch (ip->op) {
+#endif
+
+    VM_CASE(OP_ADD):
+        res = valueAdd(regs[ip->b], ip->nat);
+        valueRelease(regs[ip->a]);
+        regs[ip->a] = res;
+        ++ip;
+        VM_DISPATCH();
+    
+    VM_CASE(OP_SUB):
+        res = valueSub(regs[ip->b], ip->nat);
+        valueRelease(regs[ip->a]);
+        regs[ip->a] = res;
+        ++ip;
+        VM_DISPATCH();
+    
+    VM_CASE(OP_COPY):
+        res = valueRetain(regs[ip->b]);
+        valueRelease(regs[ip->a]);
+        regs[ip->a] = res;
+        ++ip;
+        VM_DISPATCH();
+    
+    VM_CASE(OP_ADD_VAR):
+        accumulateProduct(&regs[ip->a], regs[ip->b], 1, ip->nat, true);
+        ++ip;
+        VM_DISPATCH();
+    
+    VM_CASE(OP_SUB_VAR):
+        accumulateProduct(&regs[ip->a], regs[ip->b], 1, ip->nat, false);
+        ++ip;
+        VM_DISPATCH();
+    
+    VM_CASE(OP_ZERO):
+        valueRelease(regs[ip->a]);
+        regs[ip->a] = 0;
+        ++ip;
+        VM_DISPATCH();
+    
+    VM_CASE(OP_MUL_ADD):
+        accumulateProduct(&regs[ip->a], regs[ip->b], regs[ip[1].a], ip->nat, true);
+        ip += 2;
+        VM_DISPATCH();
+    
+    VM_CASE(OP_AFFINE):
+        if (isAffineWorthwhile(code->affine[ip->nat], regs[ip->a])) {
+            executeAffineLoop(code->affine[ip->nat], regs[ip->a], regs);
+            ip = code->code + ip->b;
+        } else {
+            ++ip;
+        }
+        VM_DISPATCH();
+    
+    VM_CASE(OP_LOOP):
+        // the limit is read once, skip the body entirely if it is zero
+        if (regs[ip->a] == 0) {
+            ip = code->code + ip->b;
+        } else {
+            *++top = valueToCount(regs[ip->a]);
+            if (slice-- == 0 && !refuelBudget(budget, &slice))
+                goto exceeded;
+            ++ip;
+        }
+        VM_DISPATCH();
+    
+    VM_CASE(OP_END):
+        if (--*top > 0) {
+            if (slice-- == 0 && !refuelBudget(budget, &slice))
+                goto exceeded;
+            ip = code->code + ip->b;
+        } else {
+            --top;
+            ++ip;
+        }
+        VM_DISPATCH();
+    
+    VM_CASE(OP_CALL):
+        *++top = (uint64_t)(ip + 1 - code->code);
+        ip = code->code + ip->b;
+        VM_DISPATCH();
+    
+    VM_CASE(OP_RET):
+        ip = code->code + *top--;
+        VM_DISPATCH();
+    
+    VM_CASE(OP_HALT):
+        free(counters);
+        settleBudget(budget, slice, 0, 0);
+        return true;
+
+#if !defined(__GNUC__)
+    }
+#endif
+
+exceeded:
+    // instructions carry no source lines, only the depth is known
+    settleBudget(budget, slice, (long)(top - counters), 0);
+    free(counters);
+    return false;
+}